@@ -0,0 +1,780 @@
+/********************************************************************
+ *                                                                  *
+ * THIS FILE IS PART OF THE OggTheora SOFTWARE CODEC SOURCE CODE.   *
+ * USE, DISTRIBUTION AND REPRODUCTION OF THIS LIBRARY SOURCE IS     *
+ * GOVERNED BY A BSD-STYLE SOURCE LICENSE INCLUDED WITH THIS SOURCE *
+ * IN 'COPYING'. PLEASE READ THESE TERMS BEFORE DISTRIBUTING.       *
+ *                                                                  *
+ * THE Theora SOURCE CODE IS COPYRIGHT (C) 2002-2009                *
+ * by the Xiph.Org Foundation and contributors http://www.xiph.org/ *
+ *                                                                  *
+ ********************************************************************
+
+  function: encoder benchmark; reports rate, distortion and speed for a
+   synthetic test corpus at each speed level and rate setting
+  last mod: $Id$
+
+ ********************************************************************/
+
+#if !defined(_GNU_SOURCE)
+#define _GNU_SOURCE
+#endif
+#if !defined(_LARGEFILE_SOURCE)
+#define _LARGEFILE_SOURCE
+#endif
+#if !defined(_LARGEFILE64_SOURCE)
+#define _LARGEFILE64_SOURCE
+#endif
+#if !defined(_FILE_OFFSET_BITS)
+#define _FILE_OFFSET_BITS 64
+#endif
+
+#include <stdio.h>
+#if !defined(_WIN32)
+#include <getopt.h>
+#include <unistd.h>
+#else
+#include "getopt.h"
+#endif
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/timeb.h>
+#include <math.h>
+#include "theora/theoraenc.h"
+#include "theora/theoradec.h"
+
+const char *optstring = "n:s:l:q:b:c:d:o:";
+struct option options [] = {
+  {"frames",required_argument,NULL,'n'},
+  {"size",required_argument,NULL,'s'},
+  {"speed-levels",required_argument,NULL,'l'},
+  {"quality",required_argument,NULL,'q'},
+  {"bitrate",required_argument,NULL,'b'},
+  {"clips",required_argument,NULL,'c'},
+  {"dump",required_argument,NULL,'d'},
+  {"output",required_argument,NULL,'o'},
+  {NULL,0,NULL,0}
+};
+
+#define BENCH_MAX_SETTINGS (16)
+
+/*The frame rate of the synthetic corpus.*/
+#define BENCH_FPS (30)
+
+
+
+/*A synthetic 4:2:0 clip, held entirely in memory.*/
+typedef struct bench_clip bench_clip;
+
+/*Generates frame _fi of a clip.*/
+typedef void (*bench_gen_func)(bench_clip *_clip,int _fi,
+ unsigned char *_y,unsigned char *_cb,unsigned char *_cr);
+
+struct bench_clip{
+  const char     *name;
+  bench_gen_func  gen;
+  int             w;
+  int             h;
+  int             nframes;
+  /*The frames, each stored as a full Y' plane followed by Cb and Cr.*/
+  unsigned char  *data;
+};
+
+
+
+/*The content generators.
+  Everything is computed in integer arithmetic, so the corpus is bit-exact on
+   every platform and results can be compared between machines.*/
+
+static unsigned bench_hash(unsigned _x,unsigned _y,unsigned _seed){
+  unsigned h;
+  h=_x*0x8DA6B343U^_y*0xD8163841U^_seed*0xCB1AB31FU;
+  h^=h>>13;
+  h*=0x5BD1E995U;
+  h^=h>>15;
+  return h;
+}
+
+/*Smoothly interpolated value noise in [0,255].
+  _x, _y: The coordinates in 1/256ths of a pixel.
+  _shift: The log2 of the lattice spacing in pixels.*/
+static int bench_noise(int _x,int _y,int _shift,unsigned _seed){
+  unsigned gx;
+  unsigned gy;
+  int      fx;
+  int      fy;
+  int      a;
+  int      b;
+  int      c;
+  int      d;
+  /*Bias the coordinates so they stay positive.*/
+  _x+=1<<28;
+  _y+=1<<28;
+  gx=(unsigned)_x>>8+_shift;
+  gy=(unsigned)_y>>8+_shift;
+  fx=(int)((unsigned)_x>>_shift&255);
+  fy=(int)((unsigned)_y>>_shift&255);
+  a=bench_hash(gx,gy,_seed)&255;
+  b=bench_hash(gx+1,gy,_seed)&255;
+  c=bench_hash(gx,gy+1,_seed)&255;
+  d=bench_hash(gx+1,gy+1,_seed)&255;
+  a=(a<<8)+(b-a)*fx;
+  c=(c<<8)+(d-c)*fx;
+  return ((a<<8)+(c-a)*fy)>>16;
+}
+
+/*A natural-looking texture with detail at several scales.*/
+static int bench_texture(int _x,int _y,unsigned _seed){
+  return 4*bench_noise(_x,_y,5,_seed)+2*bench_noise(_x,_y,3,_seed+1)
+   +bench_noise(_x,_y,1,_seed+2)+3>>3;
+}
+
+static unsigned char bench_clamp255(int _x){
+  return (unsigned char)(_x<0?0:_x>255?255:_x);
+}
+
+/*Fills a frame with the texture, sampled through the affine map
+   (x,y)->((x*_scale>>16)+_dx,(y*_scale>>16)+_dy) about the frame center,
+   with all offsets in 1/256ths of a pixel.*/
+static void bench_gen_textured(bench_clip *_clip,
+ unsigned char *_y,unsigned char *_cb,unsigned char *_cr,
+ int _dx,int _dy,int _scale,unsigned _seed){
+  int cx;
+  int cy;
+  int x;
+  int y;
+  cx=_clip->w<<7;
+  cy=_clip->h<<7;
+  for(y=0;y<_clip->h;y++){
+    for(x=0;x<_clip->w;x++){
+      int tx;
+      int ty;
+      tx=(int)(((ogg_int64_t)(x<<8)-cx)*_scale>>16)+cx+_dx;
+      ty=(int)(((ogg_int64_t)(y<<8)-cy)*_scale>>16)+cy+_dy;
+      _y[y*_clip->w+x]=(unsigned char)(16+bench_texture(tx,ty,_seed)*219/255);
+    }
+  }
+  for(y=0;y<_clip->h+1>>1;y++){
+    for(x=0;x<_clip->w+1>>1;x++){
+      int tx;
+      int ty;
+      tx=(int)(((ogg_int64_t)(x<<9)-cx)*_scale>>16)+cx+_dx;
+      ty=(int)(((ogg_int64_t)(y<<9)-cy)*_scale>>16)+cy+_dy;
+      _cb[y*(_clip->w+1>>1)+x]=
+       (unsigned char)(96+(bench_noise(tx,ty,6,_seed+3)>>2));
+      _cr[y*(_clip->w+1>>1)+x]=
+       (unsigned char)(96+(bench_noise(tx,ty,6,_seed+4)>>2));
+    }
+  }
+}
+
+/*A steady diagonal camera pan with a sub-pixel component.*/
+static void bench_gen_pan(bench_clip *_clip,int _fi,
+ unsigned char *_y,unsigned char *_cb,unsigned char *_cr){
+  bench_gen_textured(_clip,_y,_cb,_cr,_fi*832,_fi*352,65536,1);
+}
+
+/*A slow zoom out about the frame center.*/
+static void bench_gen_zoom(bench_clip *_clip,int _fi,
+ unsigned char *_y,unsigned char *_cb,unsigned char *_cr){
+  bench_gen_textured(_clip,_y,_cb,_cr,0,0,65536+_fi*655,11);
+}
+
+/*A static scene covered in independent per-frame noise, like film grain.*/
+static void bench_gen_noise(bench_clip *_clip,int _fi,
+ unsigned char *_y,unsigned char *_cb,unsigned char *_cr){
+  int npixels;
+  int i;
+  bench_gen_textured(_clip,_y,_cb,_cr,0,0,65536,21);
+  npixels=_clip->w*_clip->h;
+  for(i=0;i<npixels;i++){
+    _y[i]=bench_clamp255(_y[i]+(int)(bench_hash(i,_fi,29)%25)-12);
+  }
+}
+
+/*Screen content: flat windows, text, and a moving cursor.
+  Only a few blocks change from one frame to the next.*/
+static void bench_gen_screen(bench_clip *_clip,int _fi,
+ unsigned char *_y,unsigned char *_cb,unsigned char *_cr){
+  int w;
+  int h;
+  int cw;
+  int ch;
+  int ntyped;
+  int x;
+  int y;
+  w=_clip->w;
+  h=_clip->h;
+  cw=w+1>>1;
+  ch=h+1>>1;
+  /*Desktop background and a window with a title bar.*/
+  memset(_y,60,w*h);
+  memset(_cb,140,cw*ch);
+  memset(_cr,110,cw*ch);
+  for(y=h/8;y<h*7/8;y++){
+    memset(_y+y*w+w/8,y<h/8+12?90:235,w*3/4);
+  }
+  for(y=h/16;y<h*7/16;y++)memset(_cb+y*cw+cw/8,y<h/16+6?170:128,cw*3/4);
+  for(y=h/16;y<h*7/16;y++)memset(_cr+y*cw+cw/8,128,cw*3/4);
+  /*Text: 6x8 pseudo-random glyphs, with one more typed every frame.*/
+  ntyped=200+_fi;
+  for(y=0;h/8+16+y*10+8<=h*7/8;y++){
+    for(x=0;w/8+4+x*7+6<=w*7/8;x++){
+      unsigned glyph;
+      int      gx;
+      int      gy;
+      int      ci;
+      ci=y*(w*3/4-8)/7+x;
+      if(ci>=ntyped)break;
+      glyph=bench_hash(ci,0,41);
+      /*Leave some spaces between words.*/
+      if((glyph&7)==0)continue;
+      for(gy=0;gy<8;gy++)for(gx=0;gx<6;gx++){
+        if(bench_hash(glyph,gy*6+gx,43)&1){
+          _y[(h/8+16+y*10+gy)*w+w/8+4+x*7+gx]=16;
+        }
+      }
+    }
+  }
+  /*A cursor sweeping across the screen.*/
+  for(y=0;y<12;y++){
+    int cx;
+    int cy;
+    cy=(h/4+_fi*3)%(h-12)+y;
+    cx=(w/4+_fi*5)%(w-12);
+    for(x=0;x<=y&&x<8;x++)_y[cy*w+cx+x]=255;
+  }
+}
+
+/*Hard scene cuts every 15 frames, alternating between panning and zooming
+   over unrelated scenes.*/
+static void bench_gen_cuts(bench_clip *_clip,int _fi,
+ unsigned char *_y,unsigned char *_cb,unsigned char *_cr){
+  int scene;
+  int sfi;
+  scene=_fi/15;
+  sfi=_fi%15;
+  if(scene&1){
+    bench_gen_textured(_clip,_y,_cb,_cr,0,0,65536+sfi*1311,101+scene*7);
+  }
+  else{
+    bench_gen_textured(_clip,_y,_cb,_cr,-sfi*640,sfi*256,65536,101+scene*7);
+  }
+}
+
+static const struct{
+  const char     *name;
+  bench_gen_func  gen;
+}BENCH_CLIPS[]={
+  {"pan",bench_gen_pan},
+  {"zoom",bench_gen_zoom},
+  {"noise",bench_gen_noise},
+  {"screen",bench_gen_screen},
+  {"cuts",bench_gen_cuts}
+};
+
+#define BENCH_NCLIPS ((int)(sizeof(BENCH_CLIPS)/sizeof(*BENCH_CLIPS)))
+
+static size_t bench_frame_sz(const bench_clip *_clip){
+  return _clip->w*(size_t)_clip->h+2*(size_t)(_clip->w+1>>1)*(_clip->h+1>>1);
+}
+
+static unsigned char *bench_clip_frame(const bench_clip *_clip,int _fi){
+  return _clip->data+_fi*bench_frame_sz(_clip);
+}
+
+static int bench_clip_init(bench_clip *_clip,int _ci,int _w,int _h,
+ int _nframes){
+  size_t frame_sz;
+  int    fi;
+  _clip->name=BENCH_CLIPS[_ci].name;
+  _clip->gen=BENCH_CLIPS[_ci].gen;
+  _clip->w=_w;
+  _clip->h=_h;
+  _clip->nframes=_nframes;
+  frame_sz=bench_frame_sz(_clip);
+  _clip->data=(unsigned char *)malloc(frame_sz*_nframes);
+  if(_clip->data==NULL)return -1;
+  for(fi=0;fi<_nframes;fi++){
+    unsigned char *y;
+    y=bench_clip_frame(_clip,fi);
+    (*_clip->gen)(_clip,fi,y,y+_w*_h,y+_w*_h+(_w+1>>1)*(_h+1>>1));
+  }
+  return 0;
+}
+
+/*Writes a clip as YUV4MPEG2, so other encoders can be run on the same
+   corpus.*/
+static int bench_clip_dump(const bench_clip *_clip,const char *_dir){
+  char  path[1024];
+  FILE *fout;
+  int   fi;
+  sprintf(path,"%.1000s/%s.y4m",_dir,_clip->name);
+  fout=fopen(path,"wb");
+  if(fout==NULL){
+    fprintf(stderr,"Unable to open '%s' for writing.\n",path);
+    return -1;
+  }
+  fprintf(fout,"YUV4MPEG2 W%i H%i F%i:1 Ip A1:1 C420jpeg\n",
+   _clip->w,_clip->h,BENCH_FPS);
+  for(fi=0;fi<_clip->nframes;fi++){
+    fprintf(fout,"FRAME\n");
+    fwrite(bench_clip_frame(_clip,fi),1,bench_frame_sz(_clip),fout);
+  }
+  fclose(fout);
+  fprintf(stderr,"Wrote %s.\n",path);
+  return 0;
+}
+
+
+
+/*Returns the current time in seconds, for measuring throughput.*/
+static double bench_time(void){
+#if defined(CLOCK_MONOTONIC)
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC,&ts);
+  return ts.tv_sec+ts.tv_nsec*1E-9;
+#else
+  struct timeb tb;
+  ftime(&tb);
+  return tb.time+tb.millitm*1E-3;
+#endif
+}
+
+static double bench_psnr(ogg_int64_t _sqerr,ogg_int64_t _npixels){
+  /*Report lossless coding as 100 dB rather than infinity.*/
+  if(_sqerr<=0)return 100;
+  return 10*(log10(255*255)+log10((double)_npixels)-log10((double)_sqerr));
+}
+
+/*Accumulates the squared error of each plane over the picture region, as
+   in dump_psnr.*/
+static void bench_sqerr(const th_info *_ti,th_ycbcr_buffer _dec,
+ const bench_clip *_clip,int _fi,ogg_int64_t _plsqerr[3]){
+  const unsigned char *src;
+  int                  pli;
+  src=bench_clip_frame(_clip,_fi);
+  for(pli=0;pli<3;pli++){
+    int w;
+    int h;
+    int x;
+    int y;
+    w=pli?_clip->w+1>>1:_clip->w;
+    h=pli?_clip->h+1>>1:_clip->h;
+    for(y=0;y<h;y++){
+      const unsigned char *d;
+      d=_dec[pli].data+((pli?_ti->pic_y>>1:_ti->pic_y)+y)*_dec[pli].stride
+       +(pli?_ti->pic_x>>1:_ti->pic_x);
+      for(x=0;x<w;x++){
+        int e;
+        e=d[x]-src[y*w+x];
+        _plsqerr[pli]+=e*e;
+      }
+    }
+    src+=w*h;
+  }
+}
+
+/*Computes the mean luma SSIM over 8x8 windows spaced 4 pixels apart.*/
+static double bench_ssim(const th_info *_ti,th_ycbcr_buffer _dec,
+ const bench_clip *_clip,int _fi){
+  static const double C1=255*255*0.01*0.01;
+  static const double C2=255*255*0.03*0.03;
+  const unsigned char *src;
+  const unsigned char *dec;
+  double               ssim;
+  int                  nwindows;
+  int                  x;
+  int                  y;
+  src=bench_clip_frame(_clip,_fi);
+  dec=_dec[0].data+_ti->pic_y*_dec[0].stride+_ti->pic_x;
+  ssim=0;
+  nwindows=0;
+  for(y=0;y+8<=_clip->h;y+=4){
+    for(x=0;x+8<=_clip->w;x+=4){
+      double mu1;
+      double mu2;
+      double s11;
+      double s22;
+      double s12;
+      int    sum1;
+      int    sum2;
+      int    sum11;
+      int    sum22;
+      int    sum12;
+      int    i;
+      int    j;
+      sum1=sum2=sum11=sum22=sum12=0;
+      for(j=0;j<8;j++){
+        for(i=0;i<8;i++){
+          int a;
+          int b;
+          a=src[(y+j)*_clip->w+x+i];
+          b=dec[(y+j)*_dec[0].stride+x+i];
+          sum1+=a;
+          sum2+=b;
+          sum11+=a*a;
+          sum22+=b*b;
+          sum12+=a*b;
+        }
+      }
+      mu1=sum1/64.0;
+      mu2=sum2/64.0;
+      s11=sum11/64.0-mu1*mu1;
+      s22=sum22/64.0-mu2*mu2;
+      s12=sum12/64.0-mu1*mu2;
+      ssim+=(2*mu1*mu2+C1)*(2*s12+C2)/((mu1*mu1+mu2*mu2+C1)*(s11+s22+C2));
+      nwindows++;
+    }
+  }
+  return nwindows>0?ssim/nwindows:1;
+}
+
+
+
+/*The results of a single encode.*/
+typedef struct{
+  double      secs;
+  ogg_int64_t bytes;
+  ogg_int64_t plsqerr[3];
+  double      ssim;
+}bench_result;
+
+/*Encodes a clip with the given settings, then decodes it and measures the
+   distortion.
+  Only the encoder is timed: its packets are buffered and decoded
+   afterwards.*/
+static int bench_run(const bench_clip *_clip,int _splevel,int _quality,
+ int _bitrate,bench_result *_res){
+  th_info          ti;
+  th_enc_ctx      *te;
+  th_comment       tc;
+  th_setup_info   *ts;
+  th_dec_ctx      *td;
+  ogg_packet       op;
+  ogg_packet      *packets;
+  unsigned char   *packet_data;
+  size_t           npackets;
+  size_t           cpackets;
+  size_t           data_sz;
+  size_t           cdata_sz;
+  size_t           pi;
+  double           start;
+  int              fi;
+  th_info_init(&ti);
+  ti.frame_width=_clip->w+15&~15;
+  ti.frame_height=_clip->h+15&~15;
+  ti.pic_width=_clip->w;
+  ti.pic_height=_clip->h;
+  ti.pic_x=0;
+  ti.pic_y=0;
+  ti.fps_numerator=BENCH_FPS;
+  ti.fps_denominator=1;
+  ti.aspect_numerator=1;
+  ti.aspect_denominator=1;
+  ti.colorspace=TH_CS_UNSPECIFIED;
+  ti.pixel_fmt=TH_PF_420;
+  ti.target_bitrate=_bitrate;
+  ti.quality=_quality;
+  te=th_encode_alloc(&ti);
+  if(te==NULL){
+    fprintf(stderr,"Could not initialize the encoder.\n");
+    return -1;
+  }
+  if(th_encode_ctl(te,TH_ENCCTL_SET_SPLEVEL,&_splevel,sizeof(_splevel))<0){
+    fprintf(stderr,"Could not set speed level %i.\n",_splevel);
+    th_encode_free(te);
+    return -1;
+  }
+  /*Collect all the packets, headers included, in one buffer.*/
+  npackets=cpackets=0;
+  data_sz=cdata_sz=0;
+  packets=NULL;
+  packet_data=NULL;
+  th_comment_init(&tc);
+  start=bench_time();
+  for(fi=-1;fi<_clip->nframes;fi++){
+    int ret;
+    if(fi>=0){
+      th_ycbcr_buffer ycbcr;
+      unsigned char  *y;
+      y=bench_clip_frame(_clip,fi);
+      ycbcr[0].width=_clip->w;
+      ycbcr[0].height=_clip->h;
+      ycbcr[0].stride=_clip->w;
+      ycbcr[0].data=y;
+      ycbcr[1].width=ycbcr[2].width=_clip->w+1>>1;
+      ycbcr[1].height=ycbcr[2].height=_clip->h+1>>1;
+      ycbcr[1].stride=ycbcr[2].stride=_clip->w+1>>1;
+      ycbcr[1].data=y+_clip->w*_clip->h;
+      ycbcr[2].data=ycbcr[1].data+ycbcr[1].stride*ycbcr[1].height;
+      if(th_encode_ycbcr_in(te,ycbcr)<0){
+        fprintf(stderr,"Error encoding frame %i.\n",fi);
+        break;
+      }
+    }
+    for(;;){
+      ret=fi<0?th_encode_flushheader(te,&tc,&op):
+       th_encode_packetout(te,fi+1>=_clip->nframes,&op);
+      if(ret<=0)break;
+      if(npackets>=cpackets){
+        cpackets=cpackets<<1|16;
+        packets=(ogg_packet *)realloc(packets,cpackets*sizeof(*packets));
+      }
+      if(data_sz+op.bytes>cdata_sz){
+        cdata_sz=(data_sz+op.bytes)*2;
+        packet_data=(unsigned char *)realloc(packet_data,cdata_sz);
+      }
+      if(packets==NULL||packet_data==NULL&&cdata_sz>0){
+        fprintf(stderr,"Out of memory.\n");
+        exit(1);
+      }
+      memcpy(packet_data+data_sz,op.packet,op.bytes);
+      packets[npackets]=op;
+      /*Store the offset until the buffer stops moving.*/
+      packets[npackets].packet=NULL;
+      packets[npackets++].bytes=op.bytes;
+      data_sz+=op.bytes;
+    }
+  }
+  _res->secs=bench_time()-start;
+  th_encode_free(te);
+  /*Now decode everything and compare against the source.*/
+  _res->bytes=0;
+  _res->plsqerr[0]=_res->plsqerr[1]=_res->plsqerr[2]=0;
+  _res->ssim=0;
+  ts=NULL;
+  td=NULL;
+  th_info_clear(&ti);
+  th_info_init(&ti);
+  data_sz=0;
+  fi=0;
+  for(pi=0;pi<npackets;pi++){
+    packets[pi].packet=packet_data+data_sz;
+    data_sz+=packets[pi].bytes;
+    if(td==NULL){
+      int ret;
+      ret=th_decode_headerin(&ti,&tc,&ts,packets+pi);
+      if(ret<0){
+        fprintf(stderr,"Error decoding headers.\n");
+        break;
+      }
+      /*Keep going until we see the first data packet.*/
+      if(ret>0)continue;
+      td=th_decode_alloc(&ti,ts);
+      if(td==NULL)break;
+    }
+    {
+      th_ycbcr_buffer ycbcr;
+      if(th_decode_packetin(td,packets+pi,NULL)<0){
+        fprintf(stderr,"Error decoding frame %i.\n",fi);
+        break;
+      }
+      th_decode_ycbcr_out(td,ycbcr);
+      bench_sqerr(&ti,ycbcr,_clip,fi,_res->plsqerr);
+      _res->ssim+=bench_ssim(&ti,ycbcr,_clip,fi);
+      _res->bytes+=packets[pi].bytes;
+      fi++;
+    }
+  }
+  if(fi>0)_res->ssim/=fi;
+  if(td!=NULL)th_decode_free(td);
+  th_setup_free(ts);
+  th_comment_clear(&tc);
+  th_info_clear(&ti);
+  free(packets);
+  free(packet_data);
+  if(fi!=_clip->nframes){
+    fprintf(stderr,"Decoded %i of %i frames.\n",fi,_clip->nframes);
+    return -1;
+  }
+  return 0;
+}
+
+static void bench_report(FILE *_out,const bench_clip *_clip,int _splevel,
+ const char *_mode,int _target,const bench_result *_res){
+  ogg_int64_t ypixels;
+  ogg_int64_t cpixels;
+  ypixels=_clip->w*(ogg_int64_t)_clip->h*_clip->nframes;
+  cpixels=(_clip->w+1>>1)*(ogg_int64_t)(_clip->h+1>>1)*_clip->nframes;
+  fprintf(_out,"%s,%i,%i,%i,%i,%s,%i,%.2f,%.1f,%.4f,%.4f,%.4f,%.4f,%.5f\n",
+   _clip->name,_clip->w,_clip->h,_clip->nframes,_splevel,_mode,_target,
+   _res->secs>0?_clip->nframes/_res->secs:0,
+   _res->bytes*8.0*BENCH_FPS/_clip->nframes/1000,
+   bench_psnr(_res->plsqerr[0]+_res->plsqerr[1]+_res->plsqerr[2],
+   ypixels+2*cpixels),bench_psnr(_res->plsqerr[0],ypixels),
+   bench_psnr(_res->plsqerr[1],cpixels),bench_psnr(_res->plsqerr[2],cpixels),
+   _res->ssim);
+  fflush(_out);
+}
+
+/*Parses a comma-separated list of non-negative integers.
+  Return: The number of values, or -1 on error.*/
+static int bench_parse_list(const char *_s,int _vals[BENCH_MAX_SETTINGS]){
+  int n;
+  if(*_s=='\0')return 0;
+  for(n=0;n<BENCH_MAX_SETTINGS;n++){
+    char *end;
+    long  v;
+    v=strtol(_s,&end,10);
+    if(end==_s||v<0||v>0x7FFFFFFF)return -1;
+    _vals[n]=(int)v;
+    if(*end=='\0')return n+1;
+    if(*end!=',')return -1;
+    _s=end+1;
+  }
+  return -1;
+}
+
+static void usage(char *_argv[]){
+  fprintf(stderr,"Usage: %s [options]\n"
+   "    Encodes a synthetic test corpus at each speed level and rate\n"
+   "     setting, and writes one CSV line per encode to stdout.\n\n"
+   "    Options:\n\n"
+   "      -n --frames <n>         Frames per clip (default: 60).\n"
+   "      -s --size <w>x<h>       Picture size (default: 352x288).\n"
+   "      -l --speed-levels <l,...>\n"
+   "                              Speed levels to test (default: all).\n"
+   "      -q --quality <q,...>    Quality settings to test, 0...63\n"
+   "                               (default: 16,32,48).\n"
+   "      -b --bitrate <kbps,...> Target bitrates to test, in kbps\n"
+   "                               (default: 256,1024).\n"
+   "      -c --clips <name,...>   Clips to encode (default: all of\n"
+   "                               pan,zoom,noise,screen,cuts).\n"
+   "      -d --dump <dir>         Write the corpus to <dir> as .y4m files\n"
+   "                               and exit.\n"
+   "      -o --output <file>      Write the results to <file> instead.\n",
+   _argv[0]);
+}
+
+int main(int _argc,char *_argv[]){
+  bench_clip  clip;
+  FILE       *out;
+  const char *clip_names;
+  const char *dump_dir;
+  int         splevels[BENCH_MAX_SETTINGS];
+  int         qualities[BENCH_MAX_SETTINGS];
+  int         bitrates[BENCH_MAX_SETTINGS];
+  int         nsplevels;
+  int         nqualities;
+  int         nbitrates;
+  int         nframes;
+  int         w;
+  int         h;
+  int         ci;
+  int         long_option_index;
+  int         ret;
+  int         c;
+  out=stdout;
+  clip_names=NULL;
+  dump_dir=NULL;
+  nsplevels=-1;
+  nqualities=bench_parse_list("16,32,48",qualities);
+  nbitrates=bench_parse_list("256,1024",bitrates);
+  nframes=60;
+  w=352;
+  h=288;
+  while((c=getopt_long(_argc,_argv,optstring,options,&long_option_index))!=EOF){
+    switch(c){
+      case 'n':{
+        nframes=atoi(optarg);
+        if(nframes<1){
+          fprintf(stderr,"Illegal number of frames.\n");
+          exit(1);
+        }
+      }break;
+      case 's':{
+        if(sscanf(optarg,"%ix%i",&w,&h)!=2||w<16||h<16
+         ||w>16384||h>16384){
+          fprintf(stderr,"Illegal picture size.\n");
+          exit(1);
+        }
+      }break;
+      case 'l':nsplevels=bench_parse_list(optarg,splevels);break;
+      case 'q':nqualities=bench_parse_list(optarg,qualities);break;
+      case 'b':nbitrates=bench_parse_list(optarg,bitrates);break;
+      case 'c':clip_names=optarg;break;
+      case 'd':dump_dir=optarg;break;
+      case 'o':{
+        out=fopen(optarg,"w");
+        if(out==NULL){
+          fprintf(stderr,"Unable to open '%s' for writing.\n",optarg);
+          exit(1);
+        }
+      }break;
+      default:{
+        usage(_argv);
+        exit(1);
+      }break;
+    }
+  }
+  if(nsplevels==0||nsplevels<-1||nqualities<0||nbitrates<0){
+    fprintf(stderr,"Illegal setting list.\n");
+    exit(1);
+  }
+  if(nsplevels<0){
+    th_info     ti;
+    th_enc_ctx *te;
+    int         splevel_max;
+    /*Ask the library how many speed levels it has.*/
+    th_info_init(&ti);
+    ti.frame_width=ti.frame_height=16;
+    ti.pic_width=ti.pic_height=16;
+    ti.fps_numerator=ti.fps_denominator=1;
+    te=th_encode_alloc(&ti);
+    if(te==NULL||th_encode_ctl(te,TH_ENCCTL_GET_SPLEVEL_MAX,
+     &splevel_max,sizeof(splevel_max))<0){
+      splevel_max=0;
+    }
+    th_encode_free(te);
+    th_info_clear(&ti);
+    for(nsplevels=0;nsplevels<=splevel_max&&nsplevels<BENCH_MAX_SETTINGS;
+     nsplevels++){
+      splevels[nsplevels]=nsplevels;
+    }
+  }
+  if(dump_dir==NULL){
+    fprintf(out,"clip,width,height,frames,splevel,mode,target,fps,kbps,"
+     "psnr,psnr_y,psnr_cb,psnr_cr,ssim_y\n");
+  }
+  ret=0;
+  for(ci=0;ci<BENCH_NCLIPS;ci++){
+    int si;
+    int ri;
+    if(clip_names!=NULL){
+      const char *p;
+      size_t      len;
+      /*Only run the clips named in the list.*/
+      len=strlen(BENCH_CLIPS[ci].name);
+      for(p=clip_names;(p=strstr(p,BENCH_CLIPS[ci].name))!=NULL;p+=len){
+        if((p==clip_names||p[-1]==',')&&(p[len]==','||p[len]=='\0'))break;
+      }
+      if(p==NULL)continue;
+    }
+    fprintf(stderr,"Generating %s...\n",BENCH_CLIPS[ci].name);
+    if(bench_clip_init(&clip,ci,w,h,nframes)<0){
+      fprintf(stderr,"Out of memory.\n");
+      exit(1);
+    }
+    if(dump_dir!=NULL){
+      if(bench_clip_dump(&clip,dump_dir)<0)ret=1;
+      free(clip.data);
+      continue;
+    }
+    for(si=0;si<nsplevels;si++){
+      bench_result res;
+      for(ri=0;ri<nqualities;ri++){
+        if(bench_run(&clip,splevels[si],qualities[ri],0,&res)<0)ret=1;
+        else bench_report(out,&clip,splevels[si],"quality",qualities[ri],&res);
+      }
+      for(ri=0;ri<nbitrates;ri++){
+        if(bench_run(&clip,splevels[si],0,bitrates[ri]*1000,&res)<0)ret=1;
+        else bench_report(out,&clip,splevels[si],"bitrate",bitrates[ri],&res);
+      }
+    }
+    free(clip.data);
+  }
+  if(out!=stdout)fclose(out);
+  return ret;
+}
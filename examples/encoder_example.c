@@ -44,6 +44,9 @@
 #include <string.h>
 #include <time.h>
 #include <math.h>
+#if defined(OC_HAVE_PTHREAD)
+# include <pthread.h>
+#endif
 #include "theora/theoraenc.h"
 #include "vorbis/codec.h"
 #include "vorbis/vorbisenc.h"
@@ -66,7 +69,7 @@ static double rint(double x)
 # define TH_ENCCTL_SET_METRICS_FILE (0x8000)
 #endif
 
-const char *optstring = "b:e:o:a:A:v:V:s:S:f:F:qck:d:z:\1\2\3\4"
+const char *optstring = "b:e:o:a:A:v:V:s:S:f:F:qck:d:z:\1\2\3\4\5"
 #if defined(OC_COLLECT_METRICS)
  "m:"
 #endif
@@ -92,6 +95,7 @@ struct option options [] = {
   {"two-pass",no_argument,NULL,'\2'},
   {"first-pass",required_argument,NULL,'\3'},
   {"second-pass",required_argument,NULL,'\4'},
+  {"threads",required_argument,NULL,'\5'},
 #if defined(OC_COLLECT_METRICS)
   {"metrics-file",required_argument,NULL,'m'},
 #endif
@@ -223,6 +227,16 @@ static void usage(void){
           "                                  one-pass encoding (or somewhat larger if\n"
           "                                  --soft-target is used) and infinite for\n"
           "                                  two-pass encoding.\n"
+          "      --threads <n>               Split the video into chunks of one\n"
+          "                                  keyframe interval each and compress up\n"
+          "                                  to <n> of them at once. Every chunk\n"
+          "                                  starts with a keyframe, and with a\n"
+          "                                  bitrate target each chunk's budget is\n"
+          "                                  adjusted to make up for the bits used\n"
+          "                                  by earlier ones. The output does not\n"
+          "                                  depend on thread scheduling. With\n"
+          "                                  two-pass encoding, only the first pass\n"
+          "                                  is split up.\n"
           "   -b --begin-time <h:m:s.d>      Begin encoding at offset into input\n"
           "   -e --end-time <h:m:s.d>        End encoding at offset into input\n\n"
           "   -q --quiet                     Don't print progress information.\n\n"
@@ -1050,6 +1064,42 @@ static ogg_int64_t         frames=0;
 static unsigned char      *yuvframe[3];
 static th_ycbcr_buffer     ycbcr;
 
+/*Reads the next frame of YUV4MPEG2 video into _dst, converting its chroma
+   planes with the help of the auxilliary buffer _aux.
+  Return: 1 if a frame was read, or 0 at the end of the input.*/
+static int y4m_read_frame(FILE *_video,unsigned char *_dst,unsigned char *_aux){
+  char c,frame[6];
+  int ret=fread(frame,1,6,_video);
+  /* match and skip the frame header */
+  if(ret<6)return 0;
+  if(memcmp(frame,"FRAME",5)){
+    fprintf(stderr,"Loss of framing in YUV input data\n");
+    exit(1);
+  }
+  if(frame[5]!='\n'){
+    int j;
+    for(j=0;j<79;j++)
+      if(fread(&c,1,1,_video)&&c=='\n')break;
+    if(j==79){
+      fprintf(stderr,"Error parsing YUV frame header\n");
+      exit(1);
+    }
+  }
+  /*Read the frame data that needs no conversion.*/
+  if(fread(_dst,1,y4m_dst_buf_read_sz,_video)!=y4m_dst_buf_read_sz){
+    fprintf(stderr,"Error reading YUV frame data.\n");
+    exit(1);
+  }
+  /*Read the frame data that does need conversion.*/
+  if(fread(_aux,1,y4m_aux_buf_read_sz,_video)!=y4m_aux_buf_read_sz){
+    fprintf(stderr,"Error reading YUV frame data.\n");
+    exit(1);
+  }
+  /*Now convert the just read frame.*/
+  (*y4m_convert)(_dst,_aux);
+  return 1;
+}
+
 int fetch_and_process_video_packet(FILE *video,FILE *twopass_file,int passno,
  th_enc_ctx *td,ogg_packet *op){
   int                        ret;
@@ -1083,36 +1133,7 @@ int fetch_and_process_video_packet(FILE *video,FILE *twopass_file,int passno,
      proceeding.  after first pass and until eos, one will
      always be full when we get here */
   for(;frame_state<2 && (frames<endframe || endframe<0);){
-    char c,frame[6];
-    int ret=fread(frame,1,6,video);
-    /* match and skip the frame header */
-    if(ret<6)break;
-    if(memcmp(frame,"FRAME",5)){
-      fprintf(stderr,"Loss of framing in YUV input data\n");
-      exit(1);
-    }
-    if(frame[5]!='\n'){
-      int j;
-      for(j=0;j<79;j++)
-        if(fread(&c,1,1,video)&&c=='\n')break;
-      if(j==79){
-        fprintf(stderr,"Error parsing YUV frame header\n");
-        exit(1);
-      }
-    }
-    /*Read the frame data that needs no conversion.*/
-    if(fread(yuvframe[frame_state],1,y4m_dst_buf_read_sz,video)!=
-     y4m_dst_buf_read_sz){
-      fprintf(stderr,"Error reading YUV frame data.\n");
-      exit(1);
-    }
-    /*Read the frame data that does need conversion.*/
-    if(fread(yuvframe[2],1,y4m_aux_buf_read_sz,video)!=y4m_aux_buf_read_sz){
-      fprintf(stderr,"Error reading YUV frame data.\n");
-      exit(1);
-    }
-    /*Now convert the just read frame.*/
-    (*y4m_convert)(yuvframe[frame_state],yuvframe[2]);
+    if(!y4m_read_frame(video,yuvframe[frame_state],yuvframe[2]))break;
     frames++;
     if(frames>=beginframe)
     frame_state++;
@@ -1218,6 +1239,531 @@ int fetch_and_process_video_packet(FILE *video,FILE *twopass_file,int passno,
 }
 
 
+/*GOP-chunked encoding (--threads).
+  The input is split into chunks of keyframe_frequency frames, each of which
+   starts with a keyframe and is compressed by its own encoder instance.
+  Up to threads chunks are compressed at once.
+  TH_ENCCTL_SET_FRAME_OFFSET makes each encoder emit the granule positions and
+   packet numbers its packets will have in the complete stream, so stitching
+   the chunks back together only requires concatenating their packets in
+   order behind the headers of the main encoder.
+  When rate controlled, each chunk gets the bit budget that brings the total
+   back on target, assuming the chunks still in flight miss their own budgets
+   by the same ratio as the finished ones did.
+  Only chunks that are guaranteed to have finished are used for this, which
+   keeps the output independent of thread scheduling.
+  The first pass of two-pass encoding is split the same way, and the
+   statistics of the chunks are combined with th_encode_2pass_merge().*/
+
+#define CHUNK_FREE    (0)
+#define CHUNK_PENDING (1)
+#define CHUNK_DONE    (2)
+
+typedef struct video_chunk video_chunk;
+
+struct video_chunk{
+  /*The index of the first frame of this chunk in the complete stream.*/
+  ogg_int64_t    frame_offset;
+  /*The number of frames in this chunk.*/
+  int            nframes;
+  /*The converted input frames, y4m_dst_buf_sz bytes apiece.*/
+  unsigned char *frames;
+  int            cframes;
+  /*The number of bits this chunk may use, or 0 when not rate controlled.*/
+  ogg_int64_t    target_bits;
+  /*The number of bits actually used.*/
+  ogg_int64_t    bits;
+  /*The compressed packets.*/
+  ogg_packet    *packets;
+  int            npackets;
+  int            cpackets;
+  /*The next packet to hand to the Ogg stream.*/
+  int            packeti;
+  /*The per-frame first-pass data, in first-pass mode.*/
+  unsigned char *pass_data;
+  long           npass_data;
+  long           cpass_data;
+  /*The first-pass summary of this chunk.*/
+  unsigned char *pass_summary;
+  int            pass_summary_sz;
+  /*One of the CHUNK_* states.*/
+  int            state;
+};
+
+/*The number of chunks to compress at once, or 0 to encode serially.*/
+static int            threads;
+/*The chunks being compressed or waiting to be written out.
+  Chunk i lives in slot i%nchunk_slots.*/
+static video_chunk   *chunks;
+static int            nchunk_slots;
+/*The number of chunks read so far.*/
+static ogg_int64_t    chunk_next_in;
+/*The next chunk to write out.*/
+static ogg_int64_t    chunk_next_out;
+/*The number of frames read into chunks so far.*/
+static ogg_int64_t    chunk_frames_in;
+/*Whether the end of the input has been reached.*/
+static int            chunk_eof;
+/*The sum of the budgets of all chunks read so far.*/
+static ogg_int64_t    chunk_target_sum;
+/*The budgets of and bits used by the chunks that have been retired from their
+   slots.*/
+static ogg_int64_t    chunk_known_target;
+static ogg_int64_t    chunk_known_bits;
+/*Scratch space for chroma conversion.*/
+static unsigned char *chunk_aux;
+/*The parameters every chunk encoder is created with.*/
+static th_info        chunk_info;
+static int            chunk_passno;
+static int            chunk_soft_target;
+static int            chunk_speed;
+
+#if defined(OC_HAVE_PTHREAD)
+/*The next chunk to hand to a worker.*/
+static ogg_int64_t      chunk_next_run;
+static pthread_mutex_t  chunk_mutex=PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t   chunk_cond=PTHREAD_COND_INITIALIZER;
+static pthread_t       *chunk_workers;
+static int              chunk_quit;
+#endif
+
+/*Creates an encoder for a chunk, configured like the main encoder.*/
+static th_enc_ctx *chunk_encoder_alloc(const video_chunk *_chunk){
+  th_info      ti;
+  th_enc_ctx  *enc;
+  ogg_int64_t  frame_offset;
+  int          arg;
+  ti=chunk_info;
+  if(_chunk->target_bits>0){
+    ogg_int64_t bitrate;
+    bitrate=_chunk->target_bits*video_fps_n
+     /(_chunk->nframes*(ogg_int64_t)video_fps_d);
+    ti.target_bitrate=(int)OC_MAXI(bitrate,1);
+  }
+  enc=th_encode_alloc(&ti);
+  if(enc==NULL)return NULL;
+  th_encode_ctl(enc,TH_ENCCTL_SET_KEYFRAME_FREQUENCY_FORCE,
+   &keyframe_frequency,sizeof(keyframe_frequency));
+  if(vp3_compatible){
+    arg=vp3_compatible;
+    th_encode_ctl(enc,TH_ENCCTL_SET_VP3_COMPATIBLE,&arg,sizeof(arg));
+  }
+  if(chunk_soft_target){
+    arg=TH_RATECTL_CAP_UNDERFLOW;
+    th_encode_ctl(enc,TH_ENCCTL_SET_RATE_FLAGS,&arg,sizeof(arg));
+    if(chunk_passno==0&&buf_delay<0){
+      if((keyframe_frequency*7>>1) > 5*video_fps_n/video_fps_d)
+        arg=keyframe_frequency*7>>1;
+      else
+        arg=5*video_fps_n/video_fps_d;
+      th_encode_ctl(enc,TH_ENCCTL_SET_RATE_BUFFER,&arg,sizeof(arg));
+    }
+  }
+  if(chunk_passno==1){
+    unsigned char *buffer;
+    /*This returns a placeholder summary; the real one comes at the end.*/
+    if(th_encode_ctl(enc,TH_ENCCTL_2PASS_OUT,&buffer,sizeof(buffer))<0){
+      th_encode_free(enc);
+      return NULL;
+    }
+  }
+  else if(buf_delay>=0){
+    th_encode_ctl(enc,TH_ENCCTL_SET_RATE_BUFFER,&buf_delay,sizeof(buf_delay));
+  }
+  if(chunk_speed>=0){
+    arg=chunk_speed;
+    if(th_encode_ctl(enc,TH_ENCCTL_SET_SPLEVEL,&arg,sizeof(arg))<0&&
+     th_encode_ctl(enc,TH_ENCCTL_GET_SPLEVEL_MAX,&arg,sizeof(arg))>=0){
+      th_encode_ctl(enc,TH_ENCCTL_SET_SPLEVEL,&arg,sizeof(arg));
+    }
+  }
+  frame_offset=_chunk->frame_offset;
+  if(th_encode_ctl(enc,TH_ENCCTL_SET_FRAME_OFFSET,
+   &frame_offset,sizeof(frame_offset))<0){
+    th_encode_free(enc);
+    return NULL;
+  }
+  return enc;
+}
+
+static void chunk_packet_add(video_chunk *_chunk,const ogg_packet *_op){
+  ogg_packet *op;
+  if(_chunk->npackets>=_chunk->cpackets){
+    _chunk->cpackets=_chunk->cpackets<<1|16;
+    _chunk->packets=(ogg_packet *)realloc(_chunk->packets,
+     _chunk->cpackets*sizeof(*_chunk->packets));
+    if(_chunk->packets==NULL){
+      fprintf(stderr,"Out of memory.\n");
+      exit(1);
+    }
+  }
+  op=_chunk->packets+_chunk->npackets++;
+  *op=*_op;
+  if(_op->bytes>0){
+    op->packet=(unsigned char *)malloc(_op->bytes);
+    if(op->packet==NULL){
+      fprintf(stderr,"Out of memory.\n");
+      exit(1);
+    }
+    memcpy(op->packet,_op->packet,_op->bytes);
+  }
+  else op->packet=NULL;
+  _chunk->bits+=_op->bytes<<3;
+}
+
+static void chunk_pass_data_add(video_chunk *_chunk,
+ const unsigned char *_buf,int _bytes){
+  if(_chunk->npass_data+_bytes>_chunk->cpass_data){
+    _chunk->cpass_data=OC_MAXI(_chunk->cpass_data<<1,_chunk->npass_data+_bytes);
+    _chunk->pass_data=(unsigned char *)realloc(_chunk->pass_data,
+     _chunk->cpass_data);
+    if(_chunk->pass_data==NULL){
+      fprintf(stderr,"Out of memory.\n");
+      exit(1);
+    }
+  }
+  memcpy(_chunk->pass_data+_chunk->npass_data,_buf,_bytes);
+  _chunk->npass_data+=_bytes;
+}
+
+static void chunk_encode(video_chunk *_chunk){
+  th_ycbcr_buffer  ycbcr;
+  th_enc_ctx      *enc;
+  ogg_packet       op;
+  int              pic_sz;
+  int              c_w;
+  int              c_h;
+  int              c_sz;
+  int              fi;
+  enc=chunk_encoder_alloc(_chunk);
+  if(enc==NULL){
+    fprintf(stderr,"Error: Could not create an encoder instance.\n");
+    exit(1);
+  }
+  pic_sz=pic_w*pic_h;
+  c_w=(pic_w+dst_c_dec_h-1)/dst_c_dec_h;
+  c_h=(pic_h+dst_c_dec_v-1)/dst_c_dec_v;
+  c_sz=c_w*c_h;
+  for(fi=0;fi<_chunk->nframes;fi++){
+    unsigned char *frame;
+    frame=_chunk->frames+fi*y4m_dst_buf_sz;
+    ycbcr[0].width=pic_w;
+    ycbcr[0].height=pic_h;
+    ycbcr[0].stride=pic_w;
+    ycbcr[0].data=frame;
+    ycbcr[1].width=c_w;
+    ycbcr[1].height=c_h;
+    ycbcr[1].stride=c_w;
+    ycbcr[1].data=frame+pic_sz;
+    ycbcr[2].width=c_w;
+    ycbcr[2].height=c_h;
+    ycbcr[2].stride=c_w;
+    ycbcr[2].data=frame+pic_sz+c_sz;
+    if(th_encode_ycbcr_in(enc,ycbcr)<0){
+      fprintf(stderr,"Error submitting frame to the encoder.\n");
+      exit(1);
+    }
+    if(chunk_passno==1){
+      unsigned char *buffer;
+      int            bytes;
+      bytes=th_encode_ctl(enc,TH_ENCCTL_2PASS_OUT,&buffer,sizeof(buffer));
+      if(bytes<0){
+        fprintf(stderr,"Could not read two-pass data from encoder.\n");
+        exit(1);
+      }
+      chunk_pass_data_add(_chunk,buffer,bytes);
+      /*Finishing the chunk's stream makes the encoder produce its summary.*/
+      th_encode_packetout(enc,fi+1>=_chunk->nframes,&op);
+    }
+    /*The end of the stream is marked when the chunks are stitched together,
+       since only then do we know which chunk is the last one.*/
+    else while(th_encode_packetout(enc,0,&op)>0)chunk_packet_add(_chunk,&op);
+  }
+  if(chunk_passno==1){
+    unsigned char *buffer;
+    int            bytes;
+    bytes=th_encode_ctl(enc,TH_ENCCTL_2PASS_OUT,&buffer,sizeof(buffer));
+    if(bytes<0){
+      fprintf(stderr,"Could not read two-pass summary data from encoder.\n");
+      exit(1);
+    }
+    _chunk->pass_summary=(unsigned char *)malloc(bytes);
+    if(_chunk->pass_summary==NULL){
+      fprintf(stderr,"Out of memory.\n");
+      exit(1);
+    }
+    memcpy(_chunk->pass_summary,buffer,bytes);
+    _chunk->pass_summary_sz=bytes;
+  }
+  th_encode_free(enc);
+  free(_chunk->frames);
+  _chunk->frames=NULL;
+  _chunk->cframes=0;
+}
+
+#if defined(OC_HAVE_PTHREAD)
+static void *chunk_worker(void *_arg){
+  pthread_mutex_lock(&chunk_mutex);
+  for(;;){
+    video_chunk *chunk;
+    while(!chunk_quit&&chunk_next_run>=chunk_next_in){
+      pthread_cond_wait(&chunk_cond,&chunk_mutex);
+    }
+    if(chunk_next_run>=chunk_next_in)break;
+    chunk=chunks+chunk_next_run++%nchunk_slots;
+    pthread_mutex_unlock(&chunk_mutex);
+    chunk_encode(chunk);
+    pthread_mutex_lock(&chunk_mutex);
+    chunk->state=CHUNK_DONE;
+    pthread_cond_broadcast(&chunk_cond);
+  }
+  pthread_mutex_unlock(&chunk_mutex);
+  return NULL;
+}
+#endif
+
+static void chunks_init(const th_info *_ti,int _soft_target,int _speed,
+ int _passno){
+  /*One more slot than there are threads lets the next chunk be read while
+     the oldest one is being written out.*/
+  nchunk_slots=threads+1;
+  chunks=(video_chunk *)calloc(nchunk_slots,sizeof(*chunks));
+  chunk_aux=(unsigned char *)malloc(y4m_aux_buf_sz);
+  if(chunks==NULL||chunk_aux==NULL){
+    fprintf(stderr,"Out of memory.\n");
+    exit(1);
+  }
+  chunk_next_in=chunk_next_out=0;
+  chunk_frames_in=0;
+  chunk_eof=0;
+  chunk_target_sum=chunk_known_target=chunk_known_bits=0;
+  chunk_info=*_ti;
+  chunk_soft_target=_soft_target;
+  chunk_speed=_speed;
+  chunk_passno=_passno;
+#if defined(OC_HAVE_PTHREAD)
+  chunk_next_run=0;
+  chunk_quit=0;
+  chunk_workers=(pthread_t *)malloc(threads*sizeof(*chunk_workers));
+  if(chunk_workers==NULL){
+    fprintf(stderr,"Out of memory.\n");
+    exit(1);
+  }
+  {
+    int ti;
+    for(ti=0;ti<threads;ti++){
+      if(pthread_create(chunk_workers+ti,NULL,chunk_worker,NULL)){
+        fprintf(stderr,"Unable to start encoding thread.\n");
+        exit(1);
+      }
+    }
+  }
+#endif
+}
+
+static void chunks_clear(void){
+  int ci;
+#if defined(OC_HAVE_PTHREAD)
+  int ti;
+  pthread_mutex_lock(&chunk_mutex);
+  chunk_quit=1;
+  pthread_cond_broadcast(&chunk_cond);
+  pthread_mutex_unlock(&chunk_mutex);
+  for(ti=0;ti<threads;ti++)pthread_join(chunk_workers[ti],NULL);
+  free(chunk_workers);
+#endif
+  for(ci=0;ci<nchunk_slots;ci++){
+    int pi;
+    for(pi=0;pi<chunks[ci].npackets;pi++)free(chunks[ci].packets[pi].packet);
+    free(chunks[ci].packets);
+    free(chunks[ci].frames);
+    free(chunks[ci].pass_data);
+    free(chunks[ci].pass_summary);
+  }
+  free(chunk_aux);
+  free(chunks);
+  chunks=NULL;
+}
+
+/*Reads the next chunk of input and queues it for compression.*/
+static void chunk_read(FILE *video){
+  video_chunk *chunk;
+  ogg_int64_t  beginframe;
+  ogg_int64_t  endframe;
+  int          nframes;
+  beginframe=video_fps_n*(begin_sec+begin_usec*.000001)/video_fps_d;
+  endframe=video_fps_n*(end_sec+end_usec*.000001)/video_fps_d;
+  chunk=chunks+chunk_next_in%nchunk_slots;
+  for(nframes=0;nframes<keyframe_frequency&&(frames<endframe||endframe<0);){
+    if(nframes>=chunk->cframes){
+      chunk->cframes=chunk->cframes<<1|1;
+      if(chunk->cframes>keyframe_frequency)chunk->cframes=keyframe_frequency;
+      chunk->frames=(unsigned char *)realloc(chunk->frames,
+       chunk->cframes*y4m_dst_buf_sz);
+      if(chunk->frames==NULL){
+        fprintf(stderr,"Out of memory.\n");
+        exit(1);
+      }
+    }
+    if(!y4m_read_frame(video,chunk->frames+nframes*y4m_dst_buf_sz,chunk_aux)){
+      break;
+    }
+    frames++;
+    if(frames>=beginframe)nframes++;
+  }
+  if(nframes<keyframe_frequency)chunk_eof=1;
+  if(nframes<=0){
+    free(chunk->frames);
+    chunk->frames=NULL;
+    chunk->cframes=0;
+    return;
+  }
+  /*The slot's previous chunk is now known to be done.*/
+  if(chunk_next_in>=nchunk_slots){
+    chunk_known_target+=chunk->target_bits;
+    chunk_known_bits+=chunk->bits;
+  }
+  chunk->frame_offset=chunk_frames_in;
+  chunk->nframes=nframes;
+  chunk->target_bits=0;
+  if(chunk_passno==0&&chunk_info.target_bitrate>0){
+    double frame_bits;
+    double spent;
+    double target;
+    frame_bits=chunk_info.target_bitrate*(double)video_fps_d/video_fps_n;
+    /*Estimate what the preceding chunks will have used, and make up whatever
+       they are expected to be off by.*/
+    spent=(double)(chunk_target_sum-chunk_known_target);
+    if(chunk_known_target>0){
+      spent*=chunk_known_bits/(double)chunk_known_target;
+    }
+    spent+=chunk_known_bits;
+    target=frame_bits*(chunk_frames_in+nframes)-spent;
+    if(target<frame_bits*nframes*0.5)target=frame_bits*nframes*0.5;
+    if(target>frame_bits*nframes*2)target=frame_bits*nframes*2;
+    chunk->target_bits=(ogg_int64_t)target;
+    chunk_target_sum+=chunk->target_bits;
+  }
+  chunk->bits=0;
+  chunk->npackets=0;
+  chunk->packeti=0;
+  chunk->npass_data=0;
+  chunk->state=CHUNK_PENDING;
+  chunk_frames_in+=nframes;
+#if defined(OC_HAVE_PTHREAD)
+  pthread_mutex_lock(&chunk_mutex);
+  chunk_next_in++;
+  pthread_cond_broadcast(&chunk_cond);
+  pthread_mutex_unlock(&chunk_mutex);
+#else
+  chunk_next_in++;
+  chunk_encode(chunk);
+  chunk->state=CHUNK_DONE;
+#endif
+}
+
+/*Waits for the oldest chunk to be compressed.*/
+static video_chunk *chunk_wait(void){
+  video_chunk *chunk;
+  chunk=chunks+chunk_next_out%nchunk_slots;
+#if defined(OC_HAVE_PTHREAD)
+  pthread_mutex_lock(&chunk_mutex);
+  while(chunk->state!=CHUNK_DONE)pthread_cond_wait(&chunk_cond,&chunk_mutex);
+  pthread_mutex_unlock(&chunk_mutex);
+#endif
+  return chunk;
+}
+
+/*Frees the oldest chunk's slot once its output has been written.*/
+static void chunk_retire(video_chunk *_chunk){
+  int pi;
+  for(pi=0;pi<_chunk->npackets;pi++)free(_chunk->packets[pi].packet);
+  _chunk->npackets=0;
+  free(_chunk->pass_summary);
+  _chunk->pass_summary=NULL;
+  _chunk->state=CHUNK_FREE;
+  chunk_next_out++;
+}
+
+/*Performs the whole first pass of two-pass encoding on chunks of the input,
+   writing the merged statistics to _twopass_file.
+  The placeholder summary of the main encoder must already have been written
+   to the start of the file.*/
+static void chunked_first_pass(FILE *_video,FILE *_twopass_file){
+  unsigned char *summary;
+  int            summary_sz;
+  summary=NULL;
+  summary_sz=0;
+  for(;;){
+    video_chunk *chunk;
+    while(!chunk_eof&&chunk_next_in-chunk_next_out<nchunk_slots){
+      chunk_read(_video);
+    }
+    if(chunk_next_out>=chunk_next_in)break;
+    spinnit();
+    chunk=chunk_wait();
+    if(summary==NULL){
+      summary_sz=chunk->pass_summary_sz;
+      summary=(unsigned char *)calloc(summary_sz,1);
+      if(summary==NULL){
+        fprintf(stderr,"Out of memory.\n");
+        exit(1);
+      }
+    }
+    if(th_encode_2pass_merge(summary,summary_sz,
+     chunk->pass_summary,chunk->pass_summary_sz,keyframe_frequency)<0){
+      fprintf(stderr,"Could not merge two-pass summary data.\n");
+      exit(1);
+    }
+    if(fwrite(chunk->pass_data,1,chunk->npass_data,_twopass_file)<
+     (size_t)chunk->npass_data){
+      fprintf(stderr,"Unable to write to two-pass data file.\n");
+      exit(1);
+    }
+    chunk_retire(chunk);
+  }
+  if(summary==NULL){
+    fprintf(stderr,"Video input contains no frames.\n");
+    exit(1);
+  }
+  if(fseek(_twopass_file,0,SEEK_SET)<0){
+    fprintf(stderr,"Unable to seek in two-pass data file.\n");
+    exit(1);
+  }
+  if(fwrite(summary,1,summary_sz,_twopass_file)<(size_t)summary_sz){
+    fprintf(stderr,"Unable to write to two-pass data file.\n");
+    exit(1);
+  }
+  fflush(_twopass_file);
+  free(summary);
+}
+
+int fetch_chunked_video_packet(FILE *video,ogg_packet *op){
+  video_chunk *chunk;
+  spinnit();
+  for(;;){
+    /*Keep all of the threads busy.*/
+    while(!chunk_eof&&chunk_next_in-chunk_next_out<nchunk_slots){
+      chunk_read(video);
+    }
+    if(chunk_next_out>=chunk_next_in){
+      if(chunk_frames_in<=0){
+        fprintf(stderr,"Video input contains no frames.\n");
+        exit(1);
+      }
+      return 0;
+    }
+    chunk=chunk_wait();
+    if(chunk->packeti<chunk->npackets)break;
+    chunk_retire(chunk);
+  }
+  *op=chunk->packets[chunk->packeti++];
+  op->b_o_s=0;
+  op->e_o_s=chunk_eof&&chunk_next_out+1>=chunk_next_in
+   &&chunk->packeti>=chunk->npackets;
+  return 1;
+}
+
 int fetch_and_process_video(FILE *video,ogg_page *videopage,
  ogg_stream_state *to,th_enc_ctx *td,FILE *twopass_file,int passno,
  int videoflag){
@@ -1227,7 +1773,8 @@ int fetch_and_process_video(FILE *video,ogg_page *videopage,
   while(!videoflag){
     if(ogg_stream_pageout(to,videopage)>0) return 1;
     if(ogg_stream_eos(to)) return 0;
-    ret=fetch_and_process_video_packet(video,twopass_file,passno,td,&op);
+    if(chunks!=NULL)ret=fetch_chunked_video_packet(video,&op);
+    else ret=fetch_and_process_video_packet(video,twopass_file,passno,td,&op);
     if(ret<=0)return 0;
     ogg_stream_packetin(to,&op);
   }
@@ -1456,6 +2003,13 @@ int main(int argc,char *argv[]){
         exit(1);
       }
       break;
+    case '\5':
+      threads=atoi(optarg);
+      if(threads<1){
+        fprintf(stderr,"Illegal number of threads\n");
+        exit(1);
+      }
+      break;
 #if defined(OC_COLLECT_METRICS)
     case 'm':
       if(th_encode_ctl(NULL,TH_ENCCTL_SET_METRICS_FILE,
@@ -1580,6 +2134,11 @@ int main(int argc,char *argv[]){
     }
     else ti.pixel_fmt=TH_PF_444;
     td=th_encode_alloc(&ti);
+    /*The chunk encoders must produce the same headers as this one.
+      The second pass needs a single encoder to follow the whole input.*/
+    if(td!=NULL&&threads>0&&passno!=2){
+      chunks_init(&ti,soft_target,speed,passno);
+    }
     th_info_clear(&ti);
     if(td==NULL){
       fprintf(stderr,"Error: Could not create an encoder instance.\n");
@@ -1666,7 +2225,9 @@ int main(int argc,char *argv[]){
           fprintf(stderr,"Unable to seek in two-pass data file.\n");
           exit(1);
         }
-        frame_state=0;
+        /*The frame buffers are not allocated yet if the first pass was split
+           into chunks.*/
+        if(frame_state>0)frame_state=0;
         frames=0;
       }
     }
@@ -1792,7 +2353,12 @@ int main(int argc,char *argv[]){
       int audio_or_video=-1;
       if(passno==1){
         ogg_packet op;
-        int ret=fetch_and_process_video_packet(video,twopass_file,passno,td,&op);
+        int ret;
+        if(chunks!=NULL){
+          chunked_first_pass(video,twopass_file);
+          break;
+        }
+        ret=fetch_and_process_video_packet(video,twopass_file,passno,td,&op);
         if(ret<0)break;
         if(op.e_o_s)break; /* end of stream */
         timebase=th_granule_time(td,op.granulepos);
@@ -1851,6 +2417,7 @@ int main(int argc,char *argv[]){
       }
     }
     if(video)th_encode_free(td);
+    if(chunks!=NULL)chunks_clear();
   }
 
   /* clear out state */
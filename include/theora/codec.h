@@ -447,6 +447,110 @@ typedef struct{
   int          nbits;
 }th_huff_code;
 
+/**\name Allocator usage tags
+ * These tell a #th_allocator what each block of memory it is asked for will be
+ *  used for.*/
+/*@{*/
+/**The encoder or decoder context structure itself.*/
+#define TH_ALLOC_CONTEXT (0)
+/**Reference and post-processing frame buffers.
+ * These are by far the largest blocks, several megabytes each for HD
+ *  content.*/
+#define TH_ALLOC_FRAME   (1)
+/**Per-fragment, per-super block, and per-macro block tables.*/
+#define TH_ALLOC_TABLES  (2)
+/**Working buffers, such as DCT token storage and image conversion space.*/
+#define TH_ALLOC_SCRATCH (3)
+/**A single block holding everything a context allocates when it is created.
+ * This is only used when #TH_ALLOCF_ARENA is set.*/
+#define TH_ALLOC_ARENA   (4)
+/*@}*/
+
+/**\name Allocator flags*/
+/*@{*/
+/**Make a single allocation for each context, with tag #TH_ALLOC_ARENA, and
+ *  carve everything the context needs when it is created out of it.
+ * The size is found by initializing the context once with ordinary
+ *  allocations first, so creation takes about twice as long, but the amount
+ *  of memory used depends only on the stream parameters.
+ * Buffers that are only allocated later, such as those for post-processing,
+ *  still use separate allocations.*/
+#define TH_ALLOCF_ARENA     (1)
+/**Place frame buffers (or the arena, if there is one) in transparent huge
+ *  pages.
+ * They are aligned and padded to 2 MB boundaries and passed to
+ *  <tt>madvise(MADV_HUGEPAGE)</tt>.
+ * This is ignored on systems that do not support it.*/
+#define TH_ALLOCF_HUGEPAGES (2)
+/*@}*/
+
+/**Memory allocation hooks for an encoder or decoder context.
+ * These let an application control where a context's large buffers are
+ *  placed and account for them.
+ * Small allocations that are not tied to a single context, such as decoder
+ *  setup tables shared between streams, still use the <tt>libogg</tt>
+ *  allocator.*/
+typedef struct{
+  /**Allocates a block of memory.
+   * This may be <tt>NULL</tt>, in which case the <tt>libogg</tt> allocator is
+   *  used for both allocating and freeing.
+   * \param _ctx   The #ctx pointer from this structure.
+   * \param _sz    The number of bytes to allocate.
+   * \param _align The required alignment of the block.
+   *               This is always a power of two.
+   * \param _tag   One of the \ref TH_ALLOC_CONTEXT "TH_ALLOC_*" usage tags.
+   * \return The allocated block, or <tt>NULL</tt> on failure.*/
+  void *(*alloc)(void *_ctx,size_t _sz,size_t _align,int _tag);
+  /**Frees a block returned by #alloc.
+   * This must be set if #alloc is.
+   * \param _ctx The #ctx pointer from this structure.
+   * \param _ptr The block to free.
+   * \param _tag The usage tag the block was allocated with.*/
+  void  (*free)(void *_ctx,void *_ptr,int _tag);
+  /**An opaque pointer passed to #alloc and #free.*/
+  void   *ctx;
+  /**A combination of the \ref TH_ALLOCF_ARENA "TH_ALLOCF_*" flags.*/
+  int     flags;
+}th_allocator;
+
+/**A unit of work handed to a #th_executor.
+ * \param _arg The argument given to th_executor::submit.*/
+typedef void (*th_task_func)(void *_arg);
+
+/**Hooks for running an encoder or decoder's parallel work on the
+ *  application's own threads.
+ * Attach one with #TH_ENCCTL_SET_EXECUTOR or #TH_DECCTL_SET_EXECUTOR.
+ * The same executor may be shared by any number of contexts, so that they
+ *  all draw from one set of threads instead of each starting their own.
+ * A context never starts threads of its own while it has an executor.
+ * See th_executor_pthread_create() for a ready-made implementation.*/
+typedef struct{
+  /**Queues a task to be run.
+   * The task may run on any thread, including inside this call.
+   * \param _ctx   The #ctx pointer from this structure.
+   * \param _group Identifies the batch the task belongs to, for #wait.
+   *               A context only ever has one batch outstanding per group
+   *                pointer, and never reuses a pointer while a batch is
+   *                running.
+   * \param _func  The task to run.
+   * \param _arg   The argument to pass to \a _func.
+   * \retval 0 The task was queued or run.
+   * \retval <0 The task could not be queued.
+   *            The library will run it on the calling thread instead.*/
+  int  (*submit)(void *_ctx,void *_group,th_task_func _func,void *_arg);
+  /**Waits for every task submitted with a given group to finish.
+   * The calling thread may run queued tasks while it waits.
+   * \param _ctx   The #ctx pointer from this structure.
+   * \param _group The group passed to #submit.*/
+  void (*wait)(void *_ctx,void *_group);
+  /**An opaque pointer passed to #submit and #wait.*/
+  void  *ctx;
+  /**The number of tasks the executor can usefully run at once, counting the
+   *  thread that calls #wait.
+   * The library only splits work up when this is more than <tt>1</tt>.*/
+  int    concurrency;
+}th_executor;
+
 
 
 /**\defgroup basefuncs Functions Shared by Encode and Decode*/
@@ -516,6 +620,25 @@ extern int th_packet_isheader(ogg_packet *_op);
  * \retval 0  The packet contains a delta frame.
  * \retval -1 The packet is not a video data packet.*/
 extern int th_packet_iskeyframe(ogg_packet *_op);
+/**Creates a #th_executor backed by a pool of POSIX threads.
+ * Each worker keeps its own queue and takes work from the others when it runs
+ *  out, and threads waiting on a group run that group's queued tasks
+ *  themselves, so a pool with one fewer thread than there are cores can be
+ *  shared by every context in a process without oversubscribing them.
+ * The pool must outlive every context it is attached to.
+ * \param _nthreads The number of worker threads to start.
+ *                  If this is less than 1, one fewer than the number of
+ *                   online processors is used.
+ * \return The executor, to be freed with th_executor_pthread_free().
+ * \retval NULL The library was built without thread support, or there was
+ *               not enough memory or threads could not be started.*/
+extern th_executor *th_executor_pthread_create(int _nthreads);
+/**Stops the threads of an executor created by th_executor_pthread_create()
+ *  and frees it.
+ * Any tasks still queued are run first.
+ * \param _exec The executor to free.
+ *              This can safely be <tt>NULL</tt>.*/
+extern void th_executor_pthread_free(th_executor *_exec);
 /*@}*/
 
 
@@ -100,6 +100,23 @@ extern "C" {
 #define TH_DECCTL_SET_TELEMETRY_QI (13)
 /**Enables telemetry and sets the bitstream breakdown visualization mode */
 #define TH_DECCTL_SET_TELEMETRY_BITS (15)
+/**Sets the executor used to decode the planes of each stripe in parallel.
+ * The luma plane is decoded on the calling thread while the chroma planes
+ *  are handed to the executor, so this only helps if
+ *  th_executor#concurrency is more than 1.
+ * The output is identical with or without an executor.
+ * The executor is copied, but the threads behind it must stay available
+ *  until the decoder is freed or the executor is cleared.
+ *
+ * \param[in] _buf #th_executor: The executor to use, or <tt>NULL</tt> to go
+ *                  back to decoding on the calling thread only.
+ * \retval 0         Success.
+ * \retval TH_EFAULT \a _dec_ctx is <tt>NULL</tt>, or either the
+ *                    th_executor#submit or th_executor#wait hook is
+ *                    <tt>NULL</tt>.
+ * \retval TH_EINVAL \a _buf is not <tt>NULL</tt> and \a _buf_sz is not
+ *                     <tt>sizeof(th_executor)</tt>.*/
+#define TH_DECCTL_SET_EXECUTOR (17)
 /*@}*/
 
 
@@ -247,6 +264,9 @@ extern int th_decode_headerin(th_info *_info,th_comment *_tc,
  *  is larger than some reasonable maximum.
  * libtheora will not check this for you, because there may be machines that
  *  can handle such streams and applications that wish to.
+ * When libtheora is built with thread support, decoders allocated from
+ *  byte-identical setup headers share a single read-only copy of the Huffman
+ *  and dequantization tables, which is freed with the last such decoder.
  * \param _info  A #th_info struct filled via th_decode_headerin().
  * \param _setup A #th_setup_info handle returned via
  *                th_decode_headerin().
@@ -254,6 +274,22 @@ extern int th_decode_headerin(th_info *_info,th_comment *_tc,
  * \retval NULL If the decoding parameters were invalid.*/
 extern th_dec_ctx *th_decode_alloc(const th_info *_info,
  const th_setup_info *_setup);
+/**Allocates a decoder instance using custom memory allocation hooks.
+ * This behaves like th_decode_alloc(), except that the decoder context and all
+ *  of its frame buffers and per-frame tables are allocated through \a _alloc.
+ * The hooks are copied, and are used again by th_decode_free() and whenever
+ *  the decoder needs more memory, e.g., when post-processing is enabled.
+ * \param _info  A #th_info struct filled via th_decode_headerin().
+ * \param _setup A #th_setup_info handle returned via
+ *                th_decode_headerin().
+ * \param _alloc The allocation hooks and flags to use.
+ *               This may be <tt>NULL</tt> to get the same behavior as
+ *                th_decode_alloc().
+ * \return The initialized #th_dec_ctx handle.
+ * \retval NULL If the decoding parameters were invalid, only one of the
+ *                hooks was set, or there was not enough memory.*/
+extern th_dec_ctx *th_decode_alloc_with(const th_info *_info,
+ const th_setup_info *_setup,const th_allocator *_alloc);
 /**Releases all storage used for the decoder setup information.
  * This should be called after you no longer want to create any decoders for
  *  a stream whose headers you have parsed with th_decode_headerin().
@@ -317,6 +353,26 @@ extern int th_decode_ycbcr_out(th_dec_ctx *_dec,
 /**Frees an allocated decoder instance.
  * \param _dec A #th_dec_ctx handle.*/
 extern void th_decode_free(th_dec_ctx *_dec);
+/**Prepares a decoder instance to start decoding from a new position.
+ * This can be used to begin a new stream with the same frame size and pixel
+ *  format without reallocating the decoder, or to discard the reference
+ *  frames after seeking within the current stream.
+ * Settings made with th_decode_ctl(), such as the post-processing level and
+ *  the striped decoding callback, are kept.
+ * As after th_decode_alloc(), decoding should resume with a keyframe.
+ * \param _dec   A #th_dec_ctx handle.
+ * \param _info  A #th_info struct filled via th_decode_headerin().
+ * \param _setup A #th_setup_info handle returned via th_decode_headerin(),
+ *                or <tt>NULL</tt> to keep using the current stream's
+ *                Huffman tables and quantization parameters.
+ * \retval 0         Success.
+ * \retval TH_EFAULT \a _dec or \a _info is <tt>NULL</tt>, or memory could
+ *                    not be allocated.
+ * \retval TH_EINVAL The decoding parameters were invalid, or the frame size
+ *                    or pixel format differs from the current stream.
+ *                   The decoder is left unchanged.*/
+extern int th_decode_reset(th_dec_ctx *_dec,const th_info *_info,
+ const th_setup_info *_setup);
 /*@}*/
 /*@}*/
 
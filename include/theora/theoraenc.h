@@ -376,10 +376,291 @@ extern "C" {
  * \retval TH_ENOTFORMAT \a _buf did not contain a Theora header at all.
  * \retval TH_EIMPL   Not supported by this implementation.*/
 #define TH_ENCCTL_SET_COMPAT_CONFIG (32)
+/**Sets a per-frame encoding time budget for real-time encoding.
+ * When a deadline is set, the encoder measures the wall-clock time spent in
+ *  each call to th_encode_ycbcr_in() and adjusts its speed level from frame
+ *  to frame to stay within the budget.
+ * In addition to the levels exposed by #TH_ENCCTL_SET_SPLEVEL, it uses finer
+ *  intermediate steps, such as disabling the 4MV or golden-frame motion
+ *  searches, before moving to the next coarser level.
+ * The speed level currently in use may be retrieved using
+ *  #TH_ENCCTL_GET_SPLEVEL.
+ * Setting the speed level explicitly with #TH_ENCCTL_SET_SPLEVEL while a
+ *  deadline is active only changes the level adaptation starts from.
+ * Keyframes are not used to adapt the speed, since their cost is dominated by
+ *  intra analysis which the speed levels barely affect.
+ *
+ * \param[in] _buf <tt>int</tt>: The time budget per frame, in microseconds.
+ *                 A value of 0 disables adaptation and leaves the current
+ *                  speed level in place, but turns the 4MV and golden-frame
+ *                  searches back on if adaptation had disabled them.
+ * \retval TH_EFAULT \a _enc or \a _buf is <tt>NULL</tt>.
+ * \retval TH_EINVAL \a _buf_sz is not <tt>sizeof(int)</tt>, or the deadline
+ *                    is negative.
+ * \retval TH_EIMPL   Not supported by this implementation.*/
+#define TH_ENCCTL_SET_DEADLINE (34)
+/**Gets statistics about the most recently encoded frame.
+ * This reports where the encoder spent its time and its bits, for tuning
+ *  speed levels and diagnosing throughput regressions in release builds.
+ * Measuring the time spent in each stage has a small cost, so stage timings
+ *  are only collected for frames submitted after the first call to this
+ *  function; they read as zero before then.
+ * The bit counts and macro block statistics are always available.
+ *
+ * \param[out] _buf #th_enc_frame_stats: Filled in with the statistics for
+ *                   the last frame passed to th_encode_ycbcr_in().
+ * \retval TH_EFAULT \a _enc or \a _buf is <tt>NULL</tt>.
+ * \retval TH_EINVAL \a _buf_sz is not <tt>sizeof(th_enc_frame_stats)</tt>,
+ *                    or no frame has been encoded yet.
+ * \retval TH_EIMPL   Not supported by this implementation.*/
+#define TH_ENCCTL_GET_FRAME_STATS (36)
+/**Sets the number of frames that precede the first frame passed to this
+ *  encoder in the output stream.
+ * This allows a long input to be split into segments at keyframes and each
+ *  segment encoded independently, e.g., by several encoder instances running
+ *  in parallel.
+ * Every segment always starts with a keyframe, so with the offset set to the
+ *  index of its first frame, each encoder emits the granule positions and
+ *  packet numbers its packets have in the complete stream, and the packets
+ *  of consecutive segments may simply be concatenated after the headers of
+ *  any one of the encoders.
+ * All of the encoders must be created from the same #th_info and configured
+ *  identically, so that their headers are interchangeable.
+ * Only the last packet of the final segment should be marked as the end of
+ *  the stream; the others should be retrieved with  _last_p set to 0 in
+ *  th_encode_packetout().
+ *
+ * \param[in] _buf <tt>ogg_int64_t</tt>: The index of the first frame of this
+ *                  segment in the complete stream.
+ * \retval 0          Success.
+ * \retval TH_EFAULT  \a _enc or \a _buf is <tt>NULL</tt>.
+ * \retval TH_EINVAL  \a _buf_sz is not <tt>sizeof(ogg_int64_t)</tt>, the
+ *                     offset is negative, or a frame has already been
+ *                     submitted to the encoder.
+ * \retval TH_EIMPL   Not supported by this implementation.*/
+#define TH_ENCCTL_SET_FRAME_OFFSET (38)
+/**Enables automatic detection of repeated input frames.
+ * When a frame passed to th_encode_ycbcr_in() matches the previous input
+ *  frame, it is not analyzed or coded at all.
+ * Instead, the previous frame gets one more duplicate, exactly as if
+ *  #TH_ENCCTL_SET_DUP_COUNT had been used (any duplicates already requested
+ *  for the repeated frame are carried over as well).
+ * This is useful for content such as screen captures, slide shows, or
+ *  telecined material, where many frames are identical.
+ * As with #TH_ENCCTL_SET_DUP_COUNT, th_encode_packetout() must be called
+ *  repeatedly until it returns 0, or the duplicate frames will be lost.
+ * Detection is never performed in two-pass mode, after a frame dropped by
+ *  the rate controller, or when the duplicates would extend past the maximum
+ *  keyframe interval.
+ *
+ * \param[in] _buf <tt>int</tt>: The largest absolute difference allowed in
+ *                  any sample of the picture region for a frame to still be
+ *                  considered a repeat.
+ *                 A value of 0 detects only exact repeats, which is cheap.
+ *                 A small positive value tolerates noise in captured
+ *                  sources.
+ *                 A negative value disables detection (the default).
+ * \retval 0          Success.
+ * \retval TH_EFAULT  \a _enc or \a _buf is <tt>NULL</tt>.
+ * \retval TH_EINVAL  \a _buf_sz is not <tt>sizeof(int)</tt>, or the
+ *                     threshold is greater than 255.
+ * \retval TH_EIMPL   Not supported by this implementation.*/
+#define TH_ENCCTL_SET_DUP_DETECT (40)
+/**Enables periodic intra refresh.
+ * Each inter frame codes a fixed number of macro blocks in INTRA mode,
+ *  sweeping through the frame column by column from left to right, so that
+ *  the whole picture is refreshed once every period.
+ * Macro blocks the sweep has already passed only predict from the part of
+ *  the previous frame that was refreshed before them, so a decoder that joins
+ *  the stream or loses a packet recovers within about one period, without
+ *  waiting for a keyframe.
+ * This spreads the cost of a keyframe over many frames, giving nearly
+ *  constant packet sizes for low-latency streaming with a small
+ *  #TH_ENCCTL_SET_RATE_BUFFER.
+ * While it is enabled, frames are never promoted to keyframes on scene
+ *  changes.
+ * Keyframes are still forced at the maximum keyframe interval, since the
+ *  granule position cannot describe a longer one.
+ * Use a large th_info#keyframe_granule_shift and
+ *  #TH_ENCCTL_SET_KEYFRAME_FREQUENCY_FORCE to make them rare.
+ * Small deblocking artifacts can still leak across the edge of the band, and
+ *  are cleaned up by the following sweep.
+ *
+ * \param[in] _buf <tt>int</tt>: The refresh period, in inter frames, or 0 to
+ *                  disable intra refresh (the default).
+ *                 If this is larger than the number of macro blocks in the
+ *                  frame, some frames refresh none.
+ * \retval 0          Success.
+ * \retval TH_EFAULT  \a _enc or \a _buf is <tt>NULL</tt>.
+ * \retval TH_EINVAL  \a _buf_sz is not <tt>sizeof(int)</tt>, or the period
+ *                     is negative.
+ * \retval TH_EIMPL   Not supported by this implementation.*/
+#define TH_ENCCTL_SET_INTRA_REFRESH (42)
+/**Makes this encoder a rung of a bitrate ladder, reusing the analysis of
+ *  another encoder of the same source.
+ * When several encoders code the same frames at different rates, only one of
+ *  them, the master, needs to perform motion estimation and measure the
+ *  source statistics used for activity masking.
+ * The rungs take these from the master, and only repeat the half-pel motion
+ *  refinement, mode decision, quantization, tokenization, and reconstruction
+ *  against their own reference frames.
+ * Each frame must be submitted to the master first, and then to every rung,
+ *  before the master receives the next one.
+ * The rungs may then encode that frame concurrently, since they only read
+ *  from the master.
+ * All the encoders must be given identical input frames and the same speed
+ *  level, keyframe placement and intra refresh settings.
+ * When a frame cannot share the master's analysis (for example, because the
+ *  master coded a keyframe, or either encoder dropped the previous frame), the
+ *  rung simply performs its own.
+ * The master must remain allocated while it is in use by any rung.
+ *
+ * \param[in] _buf <tt>th_enc_ctx *</tt>: The master encoder, or
+ *                  <tt>NULL</tt> to stop reusing its analysis.
+ * \retval 0          Success.
+ * \retval TH_EFAULT  \a _enc or \a _buf is <tt>NULL</tt>.
+ * \retval TH_EINVAL  \a _buf_sz is not <tt>sizeof(th_enc_ctx *)</tt>, the
+ *                     master is \a _enc itself, or its frame size or pixel
+ *                     format differs.
+ * \retval TH_EIMPL   Not supported by this implementation.*/
+#define TH_ENCCTL_SET_LADDER_MASTER (44)
+
+/**Supplies motion hints for the next frame passed to th_encode_ycbcr_in().
+ * When the input was itself decoded from a compressed stream, or motion
+ *  data is otherwise available, the encoder can start its motion search for
+ *  each macro block from the given vectors and refine them over a short
+ *  distance, instead of performing its full predictor search.
+ * Macro blocks whose hint has no flags set are searched normally.
+ * The hints are copied, and apply only to the next frame submitted (which
+ *  may be coded as a keyframe or detected as a duplicate, in which case they
+ *  go unused).
+ *
+ * \param[in] _buf <tt>#th_enc_motion_hint[]</tt>: One hint for each macro
+ *                  block of the frame, in raster order starting from the top
+ *                  left, or <tt>NULL</tt> to discard any pending hints.
+ * \param[in] _buf_sz The size of the array in bytes, which must be
+ *                     <tt>(frame_width>>4)*(frame_height>>4)</tt> hints,
+ *                     or 0 if \a _buf is <tt>NULL</tt>.
+ * \retval 0          Success.
+ * \retval TH_EFAULT  \a _enc is <tt>NULL</tt>, or memory for the hints could
+ *                     not be allocated.
+ * \retval TH_EINVAL  \a _buf_sz is not the size of the hint array, or a
+ *                     vector is out of range.
+ * \retval TH_EIMPL   Not supported by this implementation.*/
+#define TH_ENCCTL_SET_MOTION_HINTS (46)
+
+/**Sets a buffer for the encoder to assemble frame packets in.
+ * Each frame submitted afterwards is written directly into this buffer, so
+ *  that the packet returned by th_encode_packetout() points into it and need
+ *  not be copied.
+ * If a packet does not fit, the encoder moves it into its own storage and
+ *  continues, and the returned packet then points there instead.
+ * The buffer must remain valid until the last packet written into it has been
+ *  retrieved.
+ * Packets can also be placed in a specific buffer with
+ *  th_encode_packetout_buffer(), which copies them only if they were not
+ *  already assembled there.
+ *
+ * \param[in] _buf <tt>#th_enc_packet_buffer</tt>: The buffer to use, or
+ *                  <tt>NULL</tt> (or a buffer with no data) to use the
+ *                  encoder's own storage.
+ * \retval 0          Success.
+ * \retval TH_EFAULT  \a _enc is <tt>NULL</tt>.
+ * \retval TH_EINVAL  \a _buf_sz is not
+ *                     <tt>sizeof(th_enc_packet_buffer)</tt>.
+ * \retval TH_EIMPL   Not supported by this implementation.*/
+#define TH_ENCCTL_SET_PACKET_BUFFER (48)
+
+/**Gets Huffman tables fitted to the frames coded so far.
+ * The encoder counts the tokens coded with each of its Huffman tables.
+ * This builds a new code for each table from those counts, and keeps the
+ *  current code for tables that were never chosen.
+ * Since the setup header must be written before any frame, the tables are
+ *  meant for another encoder: run a first pass (or encode a representative
+ *  window of the input) with the same settings, retrieve the tables, and
+ *  pass them to the encoder producing the final stream with
+ *  #TH_ENCCTL_SET_HUFFMAN_CODES before calling th_encode_flushheader().
+ * Each table is fitted to the tokens coded with it, and the current code is
+ *  kept for any table where the new one would not code those same tokens in
+ *  fewer bits.
+ * Token selection depends on the code lengths, and the encoder remains free
+ *  to pick a different table for each frame, so the stream produced with the
+ *  new tables is usually, but not always, smaller.
+ * The process can be repeated with the new tables to refine them further.
+ *
+ * \param[out] _buf <tt>#th_huff_code[#TH_NHUFFMAN_TABLES][#TH_NDCT_TOKENS]</tt>
+ * \retval 0         Success.
+ * \retval TH_EFAULT \a _enc or \a _buf is <tt>NULL</tt>.
+ * \retval TH_EINVAL \a _buf_sz is not
+ *                    <tt>sizeof(#th_huff_code)*#TH_NHUFFMAN_TABLES*#TH_NDCT_TOKENS</tt>.
+ * \retval TH_EIMPL   Not supported by this implementation.*/
+#define TH_ENCCTL_GET_OPTIMAL_HUFFMAN_CODES (50)
+
+/**Sets how many frames th_encode_submit() can queue ahead of the encoder.
+ * This also bounds the number of packets the encoder will leave waiting for
+ *  th_encode_receive() before it stops to let them be collected.
+ * It must be set before the first call to th_encode_submit().
+ * The default is 2.
+ *
+ * \param[in] _buf <tt>int</tt>: The queue depth, from 1 to 64.
+ * \retval 0          Success.
+ * \retval TH_EFAULT  \a _enc or \a _buf is <tt>NULL</tt>.
+ * \retval TH_EINVAL  \a _buf_sz is not <tt>sizeof(int)</tt>, the depth is
+ *                     out of range, or frames have already been submitted.
+ * \retval TH_EIMPL   Not supported by this implementation.*/
+#define TH_ENCCTL_SET_ASYNC_DEPTH (52)
+/**Sets the executor that th_encode_submit() uses to encode queued frames.
+ * With an executor attached, the encoder does not start a thread of its own
+ *  for asynchronous encoding.
+ * Instead it submits a task whenever frames are queued and none is running,
+ *  and that task returns as soon as it runs out of frames or the packet queue
+ *  fills up, so it never holds one of the executor's threads while waiting
+ *  for the caller.
+ * It must be set before the first call to th_encode_submit().
+ * Like every other setting, it is cleared by th_encode_reset(), after which
+ *  the encoder no longer uses the executor and it may be freed.
+ * The output is identical with or without an executor.
+ *
+ * \param[in] _buf #th_executor: The executor to use, or <tt>NULL</tt> to go
+ *                  back to using a thread owned by the encoder.
+ * \retval 0          Success.
+ * \retval TH_EFAULT  \a _enc is <tt>NULL</tt>, or either the
+ *                     th_executor#submit or th_executor#wait hook is
+ *                     <tt>NULL</tt>.
+ * \retval TH_EINVAL  \a _buf is not <tt>NULL</tt> and \a _buf_sz is not
+ *                     <tt>sizeof(th_executor)</tt>, or frames have already
+ *                     been submitted.
+ * \retval TH_EIMPL   Not supported by this implementation.*/
+#define TH_ENCCTL_SET_EXECUTOR (54)
 
 /*@}*/
 
 
+/**\name Motion hint flags
+ * These say which reference frames the vector in a #th_enc_motion_hint is a
+ *  candidate for.*/
+/*@{*/
+/**The vector is a candidate against the previous frame.*/
+#define TH_ENC_HINT_PREV (0x1)
+/**The vector is a candidate against the golden frame (the most recent
+ *  keyframe).*/
+#define TH_ENC_HINT_GOLD (0x2)
+/*@}*/
+
+
+/**\name th_encode_submit() and th_encode_receive() flags*/
+/*@{*/
+/**This is the last frame of the stream.
+ * Its final packet will have the end-of-stream flag set.*/
+#define TH_ENCASYNC_LAST (0x1)
+/**Wait for room in the queue (th_encode_submit()) or for a packet
+ *  (th_encode_receive()) instead of returning 0 immediately.
+ * th_encode_submit() still returns 0 if the encoder has stopped because too
+ *  many packets are waiting to be received.*/
+#define TH_ENCASYNC_WAIT (0x2)
+/*@}*/
+
+
 /**\name TH_ENCCTL_SET_RATE_FLAGS flags
  * \anchor ratectlflags
  * These are the flags available for use with #TH_ENCCTL_SET_RATE_FLAGS.*/
@@ -417,6 +698,164 @@ extern const th_huff_code
 
 
 
+/**\name Input images
+ * The formats accepted by th_encode_image_in(), which converts them to the
+ *  encoder's #th_pixel_fmt while copying the frame into its internal buffer.*/
+/*@{*/
+/**The layout of a #th_input_image.*/
+typedef enum{
+  /**Planar 4:2:0 Y'CbCr: a full-resolution Y' plane in <tt>data[0]</tt>,
+      followed by half-resolution Cb and Cr planes in <tt>data[1]</tt> and
+      <tt>data[2]</tt>.*/
+  TH_INFMT_I420,
+  /**Semi-planar 4:2:0 Y'CbCr: a full-resolution Y' plane in
+      <tt>data[0]</tt>, followed by a half-resolution plane of interleaved
+      Cb, Cr pairs in <tt>data[1]</tt>.*/
+  TH_INFMT_NV12,
+  /**Packed 4:2:2 Y'CbCr in <tt>data[0]</tt>, with the byte order
+      Y'0 Cb Y'1 Cr.*/
+  TH_INFMT_YUYV,
+  /**Packed 4:2:2 Y'CbCr in <tt>data[0]</tt>, with the byte order
+      Cb Y'0 Cr Y'1.*/
+  TH_INFMT_UYVY,
+  /**Packed 8-bit R'G'B' in <tt>data[0]</tt>, with the byte order B G R X.
+     The fourth byte is ignored.*/
+  TH_INFMT_BGRA,
+  /**Packed 8-bit R'G'B' in <tt>data[0]</tt>, with the byte order R G B X.
+     The fourth byte is ignored.*/
+  TH_INFMT_RGBA,
+  /**The total number of currently defined input formats.*/
+  TH_INFMT_NFORMATS
+}th_input_fmt;
+
+/**An uncompressed image in one of the #th_input_fmt layouts.
+ * The image must be exactly the size of the picture region the encoder was
+ *  initialized with (th_info#pic_width by th_info#pic_height).
+ * Half-resolution planes are rounded up in size when the picture dimensions
+ *  are odd.
+ * R'G'B' input is converted with the ITU-R BT.601 matrix to studio-swing
+ *  Y'CbCr; it is up to the application to set th_info#colorspace
+ *  accordingly.*/
+typedef struct{
+  /**The layout of the image.*/
+  th_input_fmt         fmt;
+  /**A pointer to the first (top) row of each plane.
+     Planes not used by #fmt are ignored.*/
+  const unsigned char *data[3];
+  /**The offset in bytes between successive rows of each plane.
+     This may be negative for images stored bottom-up.*/
+  int                  stride[3];
+}th_input_image;
+/*@}*/
+
+
+
+/**A rectangular region of the picture passed to th_encode_ycbcr_in_rects().
+ * It is measured in luma samples, relative to the top-left corner of the
+ *  picture region, with rows counted from the top.
+ * Parts of it that fall outside the picture region are ignored.*/
+typedef struct{
+  /**The column of the left edge.*/
+  int x;
+  /**The row of the top edge.*/
+  int y;
+  /**The width, in samples.*/
+  int width;
+  /**The height, in samples.*/
+  int height;
+}th_enc_rect;
+
+
+
+/**A motion hint for one macro block, passed with
+ *  #TH_ENCCTL_SET_MOTION_HINTS.
+ * The vector uses the same units and orientation as the motion vectors in a
+ *  Theora stream: half-pixel luma units, with positive values pointing right
+ *  and up.
+ * A Theora decoder's macro block modes map onto it directly: the GOLDEN modes
+ *  give #TH_ENC_HINT_GOLD, the other inter modes give #TH_ENC_HINT_PREV (with
+ *  the zero vector for INTER_NOMV, and any one of the four vectors for
+ *  INTER_MV_FOUR), and intra macro blocks give no flags.*/
+typedef struct{
+  /**The horizontal and vertical components, each from -31 to 31.*/
+  signed char   mv[2];
+  /**A combination of the TH_ENC_HINT_* flags, or 0 for no hint.*/
+  unsigned char flags;
+}th_enc_motion_hint;
+
+/**A caller-provided buffer for frame packets, passed with
+ *  #TH_ENCCTL_SET_PACKET_BUFFER.*/
+typedef struct{
+  /**The start of the buffer.*/
+  unsigned char *data;
+  /**The size of the buffer, in bytes.*/
+  size_t         size;
+}th_enc_packet_buffer;
+
+/**Per-frame encoder statistics, as returned by #TH_ENCCTL_GET_FRAME_STATS.
+ * Times are wall-clock nanoseconds.
+ * Stages that are interleaved at the block level (motion search, mode
+ *  analysis, transform and quantization, and tokenization) are charged
+ *  separately as the encoder switches between them.
+ * Time spent in none of the listed stages, such as copying the input frame,
+ *  is only included in #total_ns.*/
+typedef struct{
+  /**The total time spent in th_encode_ycbcr_in().*/
+  ogg_int64_t total_ns;
+  /**The time spent in motion search and refinement.*/
+  ogg_int64_t motion_ns;
+  /**The time spent in intra and inter mode analysis.*/
+  ogg_int64_t analysis_ns;
+  /**The time spent in the final transform, quantization and reconstruction
+      of coded blocks.*/
+  ogg_int64_t transform_ns;
+  /**The time spent in AC and DC tokenization.*/
+  ogg_int64_t tokenize_ns;
+  /**The time spent selecting Huffman tables and packing the frame.*/
+  ogg_int64_t pack_ns;
+  /**The time spent in the loop filter and filling reference frame
+      borders.*/
+  ogg_int64_t filter_ns;
+  /**The time spent in rate control.*/
+  ogg_int64_t rc_ns;
+  /**The size of the frame header, including the frame qi list.*/
+  long        header_bits;
+  /**The size of the coded block flags.*/
+  long        flag_bits;
+  /**The size of the macro block modes.*/
+  long        mode_bits;
+  /**The size of the motion vectors.*/
+  long        mv_bits;
+  /**The size of the per-block qi indices.*/
+  long        qi_bits;
+  /**The size of the DC coefficient tokens.*/
+  long        dc_bits;
+  /**The size of the AC coefficient tokens.*/
+  long        ac_bits;
+  /**The frame type: 0 for a keyframe, 1 for a delta frame.*/
+  int         frame_type;
+  /**Non-zero if the frame was dropped by rate control.
+     The bit counts are then all zero, except in VP3-compatibility mode.*/
+  int         dropped;
+  /**The number of qi values used by the frame.*/
+  int         nqis;
+  /**The qi values used by the frame, of which the first is the base.*/
+  int         qis[3];
+  /**The rate-distortion trade-off used for mode and token decisions.*/
+  int         lambda;
+  /**The number of macro blocks not coded.*/
+  int         nskipped_mbs;
+  /**The number of macro blocks coded in intra mode.*/
+  int         nintra_mbs;
+  /**The number of macro blocks coded with a single reference (with or
+      without a motion vector).*/
+  int         ninter_mbs;
+  /**The number of macro blocks coded with four motion vectors.*/
+  int         n4mv_mbs;
+}th_enc_frame_stats;
+
+
+
 /**\name Encoder state
    The following data structure is opaque, and its contents are not publicly
     defined by this API.
@@ -445,7 +884,10 @@ typedef struct th_enc_ctx    th_enc_ctx;
  * - Repeatedly call th_encode_flushheader() to retrieve all the header
  *    packets.
  * - For each uncompressed frame:
- *   - Submit the uncompressed frame via th_encode_ycbcr_in()
+ *   - Submit the uncompressed frame via th_encode_ycbcr_in(), or write it
+ *      into the buffer returned by th_encode_ycbcr_borrow() and submit it with
+ *      th_encode_ycbcr_commit(), or submit packed or R'G'B' data via
+ *      th_encode_image_in()
  *   - Repeatedly call th_encode_packetout() to retrieve any video
  *      data packets that are ready.
  * - Call th_encode_free() to release all encoder memory.*/
@@ -455,6 +897,22 @@ typedef struct th_enc_ctx    th_enc_ctx;
  * \return The initialized #th_enc_ctx handle.
  * \retval NULL If the encoding parameters were invalid.*/
 extern th_enc_ctx *th_encode_alloc(const th_info *_info);
+/**Allocates an encoder instance using custom memory allocation hooks.
+ * This behaves like th_encode_alloc(), except that the encoder context and
+ *  all of its frame buffers, per-frame tables, and working buffers are
+ *  allocated through \a _alloc.
+ * The hooks are copied, and are used again by th_encode_free() and whenever
+ *  the encoder needs more of these buffers later.
+ * \param _info  A #th_info struct filled with the desired encoding
+ *                parameters.
+ * \param _alloc The allocation hooks and flags to use.
+ *               This may be <tt>NULL</tt> to get the same behavior as
+ *                th_encode_alloc().
+ * \return The initialized #th_enc_ctx handle.
+ * \retval NULL If the encoding parameters were invalid, only one of the
+ *                hooks was set, or there was not enough memory.*/
+extern th_enc_ctx *th_encode_alloc_with(const th_info *_info,
+ const th_allocator *_alloc);
 /**Encoder control function.
  * This is used to provide advanced control the encoding process.
  * \param _enc    A #th_enc_ctx handle.
@@ -509,6 +967,78 @@ extern int th_encode_flushheader(th_enc_ctx *_enc,
  *                    picture size the encoder was initialized with, or
  *                    encoding has already completed.*/
 extern int th_encode_ycbcr_in(th_enc_ctx *_enc,th_ycbcr_buffer _ycbcr);
+/**Borrows the encoder's internal buffer for the next uncompressed frame.
+ * This allows a capture or conversion stage to write the next frame directly
+ *  into the encoder's memory, avoiding the copy made by th_encode_ycbcr_in().
+ * The returned buffer always covers the full frame size, in the same layout
+ *  th_encode_ycbcr_in() accepts, and the caller must fill in the entire
+ *  picture region of all three planes.
+ * Its previous contents are undefined.
+ * The encoder itself extends the picture into the rest of the frame, so any
+ *  data written outside the picture region will be overwritten.
+ * Once filled in, submit the frame with th_encode_ycbcr_commit().
+ * The buffer remains valid until the next call to th_encode_ycbcr_commit()
+ *  or th_encode_ycbcr_in(), or until the encoder is freed.
+ * Calling th_encode_ycbcr_in() instead discards the borrowed frame.
+ * \param _enc   A #th_enc_ctx handle.
+ * \param[out] _ycbcr Returns the planes to write the next frame into.
+ *                    The memory is owned by <tt>libtheoraenc</tt>.
+ * \retval 0         Success.
+ * \retval TH_EFAULT \a _enc or \a _ycbcr is <tt>NULL</tt>.
+ * \retval TH_EINVAL Encoding has already completed.*/
+extern int th_encode_ycbcr_borrow(th_enc_ctx *_enc,th_ycbcr_buffer _ycbcr);
+/**Submits the frame written into the buffer returned by
+ *  th_encode_ycbcr_borrow().
+ * This behaves exactly like th_encode_ycbcr_in(), except that the picture data
+ *  is not copied.
+ * \param _enc A #th_enc_ctx handle.
+ * \retval 0         Success.
+ * \retval TH_EFAULT \a _enc is <tt>NULL</tt>.
+ * \retval TH_EINVAL No buffer is currently borrowed, or encoding has already
+ *                    completed.*/
+extern int th_encode_ycbcr_commit(th_enc_ctx *_enc);
+/**Submits an uncompressed frame in one of the #th_input_fmt layouts.
+ * The frame is converted and chroma-subsampled to the encoder's pixel format
+ *  directly into its internal buffer, so no separate conversion pass is
+ *  needed.
+ * Otherwise this behaves exactly like th_encode_ycbcr_in().
+ * \param _enc A #th_enc_ctx handle.
+ * \param _img The image to encode.
+ * \retval 0         Success.
+ * \retval TH_EFAULT \a _enc or \a _img is <tt>NULL</tt>, one of the planes
+ *                    required by its format is <tt>NULL</tt>, or memory for
+ *                    the conversion could not be allocated.
+ * \retval TH_EINVAL The image format is unknown, or encoding has already
+ *                    completed.*/
+extern int th_encode_image_in(th_enc_ctx *_enc,const th_input_image *_img);
+/**Submits an uncompressed frame, along with the regions that changed since
+ *  the last one.
+ * This is intended for screen content, where most of each frame is usually
+ *  static.
+ * Only the samples inside the given rectangles are copied, and macro blocks
+ *  outside them that were not coded in the last frame are skipped without any
+ *  analysis.
+ * Samples outside the rectangles <em>must</em> be identical to those of the
+ *  previous frame submitted; any differences there are not guaranteed to be
+ *  encoded.
+ * Chroma planes are updated over the rectangles scaled to their resolution,
+ *  rounded outwards.
+ * The first frame is always copied in full, whatever rectangles are given.
+ * Otherwise this behaves exactly like th_encode_ycbcr_in().
+ * \param _enc    A #th_enc_ctx handle.
+ * \param _ycbcr  A buffer of Y'CbCr data to encode, as for
+ *                  th_encode_ycbcr_in().
+ * \param _rects  The regions of \a _ycbcr that changed.
+ *                They may overlap.
+ * \param _nrects The number of entries in \a _rects.
+ *                This may be zero if nothing changed.
+ * \retval 0         Success.
+ * \retval TH_EFAULT \a _enc or \a _ycbcr is <tt>NULL</tt>, or \a _rects is
+ *                    <tt>NULL</tt> and \a _nrects is positive.
+ * \retval TH_EINVAL \a _nrects is negative, the buffer size is not
+ *                    supported, or encoding has already completed.*/
+extern int th_encode_ycbcr_in_rects(th_enc_ctx *_enc,th_ycbcr_buffer _ycbcr,
+ const th_enc_rect *_rects,int _nrects);
 /**Retrieves encoded video data packets.
  * This should be called repeatedly after each frame is submitted to flush any
  *  encoded packets, until it returns 0.
@@ -533,9 +1063,137 @@ extern int th_encode_ycbcr_in(th_enc_ctx *_enc,th_ycbcr_buffer _ycbcr);
  *                    remains.
  * \retval TH_EFAULT \a _enc or \a _op was <tt>NULL</tt>.*/
 extern int th_encode_packetout(th_enc_ctx *_enc,int _last,ogg_packet *_op);
+/**Retrieves encoded video data packets into a caller-provided buffer.
+ * This behaves like th_encode_packetout(), except that the video data is
+ *  placed in \a _buf.
+ * No copy is made if the packet was already assembled there, i.e., if \a _buf
+ *  was set with #TH_ENCCTL_SET_PACKET_BUFFER before the frame was submitted
+ *  and the packet fit.
+ * Duplicate frames are written into \a _buf directly.
+ * If the packet does not fit, it is not consumed: the required size is
+ *  returned in the <tt>bytes</tt> field of \a _op, and the call may be
+ *  repeated with a larger buffer.
+ * Passing a <tt>NULL</tt> buffer with a size of 0 just queries the size of a
+ *  pending non-empty packet.
+ * \param _enc    A #th_enc_ctx handle.
+ * \param _last   Set this flag to a non-zero value if no more uncompressed
+ *                 frames will be submitted.
+ * \param _buf    The buffer to store the video data in.
+ * \param _buf_sz The size of \a _buf, in bytes.
+ * \param _op     An <tt>ogg_packet</tt> structure to fill.
+ *                All of the elements of this structure will be set, and the
+ *                 pointer to the video data will point to \a _buf, unless the
+ *                 packet is empty, in which case it is <tt>NULL</tt>.
+ * \return A positive value indicates that a video data packet was successfully
+ *          produced.
+ * \retval 0         No packet was produced, and no more encoded video data
+ *                    remains.
+ * \retval TH_EFAULT \a _enc or \a _op was <tt>NULL</tt>, or \a _buf was
+ *                    <tt>NULL</tt> and \a _buf_sz was positive.
+ * \retval TH_EINVAL \a _buf_sz is too small for the packet.
+ *                   The required size is stored in <tt>_op->bytes</tt>.*/
+extern int th_encode_packetout_buffer(th_enc_ctx *_enc,int _last,
+ unsigned char *_buf,size_t _buf_sz,ogg_packet *_op);
+/**Queues a frame to be encoded in the background.
+ * The frame is copied, so the buffer can be reused as soon as this returns.
+ * Encoding happens on a worker thread owned by the encoder, and the packets
+ *  are collected with th_encode_receive().
+ * The headers must be flushed with th_encode_flushheader() before the first
+ *  frame is submitted.
+ * Once this has been called, no other encoder functions may be used except
+ *  th_encode_receive() and th_encode_free().
+ * If the library was built without thread support, the frame is encoded
+ *  before this returns, and its packets are queued for th_encode_receive().
+ * \param _enc   A #th_enc_ctx handle.
+ * \param _ycbcr A color buffer, with the same layouts
+ *                th_encode_ycbcr_in() accepts.
+ *               This may be <tt>NULL</tt> when \a _flags contains
+ *                #TH_ENCASYNC_LAST, to end a stream whose last frame was
+ *                submitted without it; in that case no packet will carry the
+ *                end-of-stream flag unless it has not yet been received.
+ * \param _flags A combination of #TH_ENCASYNC_LAST and #TH_ENCASYNC_WAIT.
+ * \return 1 if the frame was queued.
+ * \retval 0         The queue was full, and either #TH_ENCASYNC_WAIT was not
+ *                    given or the encoder is waiting for packets to be
+ *                    received.
+ *                   Receive some packets and try again.
+ * \retval TH_EFAULT \a _enc was <tt>NULL</tt>, or memory could not be
+ *                    allocated.
+ * \retval TH_EINVAL The buffer size does not match the frame size the encoder
+ *                    was initialized with, or the last frame has already been
+ *                    submitted.*/
+extern int th_encode_submit(th_enc_ctx *_enc,th_ycbcr_buffer _ycbcr,
+ int _flags);
+/**Retrieves a packet encoded from frames queued with th_encode_submit().
+ * \param _enc   A #th_enc_ctx handle.
+ * \param _op    An <tt>ogg_packet</tt> structure to fill.
+ *               The memory for the video data is owned by
+ *                <tt>libtheoraenc</tt>, and remains valid until the next call
+ *                to this function or th_encode_free().
+ * \param _flags #TH_ENCASYNC_WAIT to wait until a packet is ready, or 0.
+ * \return 1 if a packet was produced.
+ * \retval 0         No packet is ready.
+ *                   When waiting, this means every submitted frame has been
+ *                    encoded and all of its packets received.
+ * \retval TH_EFAULT \a _enc or \a _op was <tt>NULL</tt>, or encoding a frame
+ *                    failed (its packets are lost).*/
+extern int th_encode_receive(th_enc_ctx *_enc,ogg_packet *_op,int _flags);
+/**Merges the first-pass summary of one segment of the input into the
+ *  summary of the whole input.
+ * This allows the first pass of two-pass encoding to be split into segments
+ *  that are scanned at the same time, each by its own encoder instance.
+ * Each segment must start where the second pass will place a keyframe, i.e.,
+ *  at a multiple of the keyframe interval, since the first frame of each
+ *  segment is always scanned as a keyframe.
+ * Segments must therefore be merged in order, and every segment but the last
+ *  must contain a multiple of the keyframe interval frames (counting
+ *  duplicates).
+ * The data to submit to the second pass with #TH_ENCCTL_2PASS_IN is the
+ *  merged summary followed by the per-frame data of each segment in order,
+ *  that is, everything each encoder returned from #TH_ENCCTL_2PASS_OUT
+ *  except its summaries.
+ * \param[in,out] _summary The summary of the segments merged so far.
+ *                          This must be filled with zeros before the first
+ *                           segment is merged.
+ * \param _summary_sz       The size of \a _summary, in bytes.
+ * \param _seg              The summary of the next segment, as returned by
+ *                           the last call to #TH_ENCCTL_2PASS_OUT on its
+ *                           encoder.
+ * \param _seg_sz           The size of \a _seg, in bytes.
+ * \param _keyframe_frequency The keyframe interval, as returned by
+ *                              #TH_ENCCTL_SET_KEYFRAME_FREQUENCY_FORCE.
+ * \return The size of the summary, in bytes.
+ * \retval TH_EFAULT     \a _summary or \a _seg is <tt>NULL</tt>.
+ * \retval TH_EINVAL     One of the buffers is too small to hold a summary,
+ *                        \a _keyframe_frequency is zero, \a _seg does not
+ *                        start on a multiple of \a _keyframe_frequency
+ *                        frames, the segments were scanned by encoders with
+ *                        different settings, or the merged input would be
+ *                        too long.
+ * \retval TH_ENOTFORMAT One of the buffers does not contain first-pass data
+ *                        in a format supported by this implementation.
+ * \retval TH_EBADHEADER \a _seg is the placeholder data from an unfinished
+ *                        first pass.*/
+extern int th_encode_2pass_merge(unsigned char *_summary,size_t _summary_sz,
+ const unsigned char *_seg,size_t _seg_sz,ogg_uint32_t _keyframe_frequency);
 /**Frees an allocated encoder instance.
  * \param _enc A #th_enc_ctx handle.*/
 extern void th_encode_free(th_enc_ctx *_enc);
+/**Prepares an encoder instance to start a new stream.
+ * This behaves like th_encode_free() followed by th_encode_alloc(), except
+ *  that the buffers sized by the frame dimensions are kept and reused, so the
+ *  new stream must have the same frame size and pixel format.
+ * All settings made with th_encode_ctl() return to their defaults, and the
+ *  headers must be flushed again before encoding the first frame.
+ * \param _enc  A #th_enc_ctx handle.
+ * \param _info A #th_info struct filled with the desired encoding parameters.
+ * \retval 0         Success.
+ * \retval TH_EFAULT \a _enc or \a _info is <tt>NULL</tt>.
+ * \retval TH_EINVAL The encoding parameters were invalid, or the frame size or
+ *                    pixel format differs from the current stream.
+ *                   Any frames queued with th_encode_submit() are discarded,
+ *                    but the encoder is otherwise left unchanged.*/
+extern int th_encode_reset(th_enc_ctx *_enc,const th_info *_info);
 /*@}*/
 /*@}*/
 
@@ -25,6 +25,7 @@
 
 
 typedef struct oc_rd_metric          oc_rd_metric;
+typedef struct oc_block_state        oc_block_state;
 typedef struct oc_mode_choice        oc_mode_choice;
 
 
@@ -546,6 +547,9 @@ static void oc_enc_pipeline_init(oc_enc_ctx *_enc,oc_enc_pipeline_state *_pipe){
   /*Set up condensed quantizer tables.*/
   qi0=_enc->state.qis[0];
   nqis=_enc->state.nqis;
+  for(qii=0;qii<nqis;qii++){
+    oc_enc_enquant_tables_get(_enc,qii,_enc->state.qis[qii]);
+  }
   for(pli=0;pli<3;pli++){
     for(qii=0;qii<nqis;qii++){
       int qi;
@@ -555,9 +559,6 @@ static void oc_enc_pipeline_init(oc_enc_ctx *_enc,oc_enc_pipeline_state *_pipe){
         _enc->state.dequant_tables[qi][pli][qti][0]=
          _enc->dequant_dc[qi0][pli][qti];
         _enc->dequant[pli][qii][qti]=_enc->state.dequant_tables[qi][pli][qti];
-        /*Copy over the quantization table.*/
-        memcpy(_enc->enquant[pli][qii][qti],_enc->enquant_tables[qi][pli][qti],
-         _enc->opt_data.enquant_table_size);
       }
     }
   }
@@ -612,6 +613,8 @@ static int oc_enc_pipeline_set_stripe(oc_enc_ctx *_enc,
 
 static void oc_enc_pipeline_finish_mcu_plane(oc_enc_ctx *_enc,
  oc_enc_pipeline_state *_pipe,int _pli,int _sdelay,int _edelay){
+  int stage;
+  stage=oc_enc_stage_switch(_enc,OC_ENC_STAGE_FILTER);
   /*Copy over all the uncoded fragments from this plane and advance the uncoded
      fragment list.*/
   if(_pipe->nuncoded_fragis[_pli]>0){
@@ -624,6 +627,7 @@ static void oc_enc_pipeline_finish_mcu_plane(oc_enc_ctx *_enc,
     _pipe->nuncoded_fragis[_pli]=0;
   }
   /*Perform DC prediction.*/
+  oc_enc_stage_switch(_enc,OC_ENC_STAGE_TOKENIZE);
   oc_enc_pred_dc_frag_rows(_enc,_pli,
    _pipe->fragy0[_pli],_pipe->fragy_end[_pli]);
   /*Finish DC tokenization.*/
@@ -637,6 +641,7 @@ static void oc_enc_pipeline_finish_mcu_plane(oc_enc_ctx *_enc,
   _pipe->coded_fragis[_pli]+=_pipe->ncoded_fragis[_pli];
   _pipe->ncoded_fragis[_pli]=0;
   /*Apply the loop filter if necessary.*/
+  oc_enc_stage_switch(_enc,OC_ENC_STAGE_FILTER);
   if(_pipe->loop_filter){
     oc_state_loop_filter_frag_rows(&_enc->state,
      _pipe->bounding_values,OC_FRAME_SELF,_pli,
@@ -651,6 +656,7 @@ static void oc_enc_pipeline_finish_mcu_plane(oc_enc_ctx *_enc,
    _enc->state.ref_frame_idx[OC_FRAME_SELF],_pli,
    (_pipe->fragy0[_pli]-_sdelay<<3)-(_sdelay<<1),
    (_pipe->fragy_end[_pli]-_edelay<<3)-(_edelay<<1));
+  oc_enc_stage_switch(_enc,stage);
 }
 
 
@@ -665,53 +671,50 @@ struct oc_rd_metric{
 
 
 
-static int oc_enc_block_transform_quantize(oc_enc_ctx *_enc,
- oc_enc_pipeline_state *_pipe,int _pli,ptrdiff_t _fragi,
- unsigned _rd_scale,unsigned _rd_iscale,oc_rd_metric *_mo,
- oc_fr_state *_fr,oc_token_checkpoint **_stack){
-  ogg_int16_t            *data;
-  ogg_int16_t            *dct;
-  ogg_int16_t            *idct;
-  oc_qii_state            qs;
-  const ogg_uint16_t     *dequant;
-  ogg_uint16_t            dequant_dc;
+/*The state of a block between motion compensation and coding.*/
+struct oc_block_state{
+  const unsigned char *src;
+  /*The prediction to add the reconstructed residual to (INTER modes only).*/
+  const unsigned char *pred;
+  unsigned char       *dst;
+  const ogg_uint16_t  *dequant;
+  const void          *enquant;
+  int                  nonzero;
+  int                  qii;
+  int                  qti;
+};
+
+
+
+/*Computes the motion-compensated residual of a block in _data.
+  Return: 0 if early skip detection decided the block should not be coded (in
+   which case the caller must still update the fragment run state), or 1
+   otherwise.*/
+static int oc_enc_block_predict(oc_enc_ctx *_enc,int _pli,ptrdiff_t _fragi,
+ oc_block_state *_bs,ogg_int16_t _data[64]){
   ptrdiff_t               frag_offs;
   int                     ystride;
   const unsigned char    *src;
   const unsigned char    *ref;
   unsigned char          *dst;
-  int                     nonzero;
-  unsigned                uncoded_ssd;
-  unsigned                coded_ssd;
-  oc_token_checkpoint    *checkpoint;
   oc_fragment            *frags;
   int                     mb_mode;
   int                     refi;
   int                     mv_offs[2];
   int                     nmv_offs;
-  int                     ac_bits;
-  int                     borderi;
-  int                     nqis;
   int                     qti;
   int                     qii;
-  int                     dc;
-  nqis=_enc->state.nqis;
   frags=_enc->state.frags;
   frag_offs=_enc->state.frag_buf_offs[_fragi];
   ystride=_enc->state.ref_ystride[_pli];
   src=_enc->state.ref_frame_data[OC_FRAME_IO]+frag_offs;
-  borderi=frags[_fragi].borderi;
   qii=frags[_fragi].qii;
-  data=_enc->pipe.dct_data;
-  dct=data+64;
-  idct=data+128;
   if(qii&~3){
 #if !defined(OC_COLLECT_METRICS)
     if(_enc->sp_level>=OC_SP_LEVEL_EARLY_SKIP){
       /*Enable early skip detection.*/
       frags[_fragi].coded=0;
       frags[_fragi].refi=OC_FRAME_NONE;
-      oc_fr_skip_block(_fr);
       return 0;
     }
 #endif
@@ -726,13 +729,13 @@ static int oc_enc_block_transform_quantize(oc_enc_ctx *_enc,
   switch(mb_mode){
     case OC_MODE_INTRA:{
       nmv_offs=0;
-      oc_enc_frag_sub_128(_enc,data,src,ystride);
+      oc_enc_frag_sub_128(_enc,_data,src,ystride);
     }break;
     case OC_MODE_GOLDEN_NOMV:
     case OC_MODE_INTER_NOMV:{
       nmv_offs=1;
       mv_offs[0]=0;
-      oc_enc_frag_sub(_enc,data,src,ref,ystride);
+      oc_enc_frag_sub(_enc,_data,src,ref,ystride);
     }break;
     default:{
       const oc_mv *frag_mvs;
@@ -742,15 +745,16 @@ static int oc_enc_block_transform_quantize(oc_enc_ctx *_enc,
       if(nmv_offs>1){
         oc_enc_frag_copy2(_enc,dst,
          ref+mv_offs[0],ref+mv_offs[1],ystride);
-        oc_enc_frag_sub(_enc,data,src,dst,ystride);
+        oc_enc_frag_sub(_enc,_data,src,dst,ystride);
       }
-      else oc_enc_frag_sub(_enc,data,src,ref+mv_offs[0],ystride);
+      else oc_enc_frag_sub(_enc,_data,src,ref+mv_offs[0],ystride);
     }break;
   }
 #if defined(OC_COLLECT_METRICS)
   {
     unsigned sad;
     unsigned satd;
+    int      dc;
     switch(nmv_offs){
       case 0:{
         sad=oc_enc_frag_intra_sad(_enc,src,ystride);
@@ -771,23 +775,66 @@ static int oc_enc_block_transform_quantize(oc_enc_ctx *_enc,
     _enc->frag_satd[_fragi]=satd;
   }
 #endif
-  /*Transform:*/
-  oc_enc_fdct8x8(_enc,dct,data);
-  /*Quantize:*/
   qti=mb_mode!=OC_MODE_INTRA;
-  dequant=_enc->dequant[_pli][qii][qti];
-  nonzero=oc_enc_quantize(_enc,data,dct,dequant,_enc->enquant[_pli][qii][qti]);
-  dc=data[0];
+  _bs->src=src;
+  _bs->pred=nmv_offs==1?ref+mv_offs[0]:dst;
+  _bs->dst=dst;
+  _bs->dequant=_enc->dequant[_pli][qii][qti];
+  _bs->enquant=_enc->enquant[_pli][qii][qti];
+  _bs->qii=qii;
+  _bs->qti=qti;
+  return 1;
+}
+
+/*Tokenizes and reconstructs a block whose quantized coefficients are in _data
+   and whose unquantized DCT coefficients are in _dct, and decides whether it
+   was worth coding.
+  Return: 1 if the block was coded, or 0 if it was skipped.*/
+static int oc_enc_block_code(oc_enc_ctx *_enc,oc_enc_pipeline_state *_pipe,
+ int _pli,ptrdiff_t _fragi,const oc_block_state *_bs,ogg_int16_t _data[64],
+ ogg_int16_t _dct[64],unsigned _rd_scale,unsigned _rd_iscale,
+ oc_rd_metric *_mo,oc_fr_state *_fr,oc_token_checkpoint **_stack){
+  ogg_int16_t            *idct;
+  oc_qii_state            qs;
+  const ogg_uint16_t     *dequant;
+  ogg_uint16_t            dequant_dc;
+  int                     ystride;
+  unsigned char          *dst;
+  int                     nonzero;
+  unsigned                uncoded_ssd;
+  unsigned                coded_ssd;
+  oc_token_checkpoint    *checkpoint;
+  oc_fragment            *frags;
+  int                     ac_bits;
+  int                     borderi;
+  int                     nqis;
+  int                     qti;
+  int                     qii;
+  int                     dc;
+  int                     stage;
+  nqis=_enc->state.nqis;
+  frags=_enc->state.frags;
+  ystride=_enc->state.ref_ystride[_pli];
+  borderi=frags[_fragi].borderi;
+  idct=_enc->pipe.dct_data+256;
+  dst=_bs->dst;
+  dequant=_bs->dequant;
+  nonzero=_bs->nonzero;
+  qii=_bs->qii;
+  qti=_bs->qti;
+  dc=_data[0];
   /*Tokenize.*/
   checkpoint=*_stack;
+  stage=oc_enc_stage_switch(_enc,OC_ENC_STAGE_TOKENIZE);
   if(_enc->sp_level<OC_SP_LEVEL_FAST_ANALYSIS){
-    ac_bits=oc_enc_tokenize_ac(_enc,_pli,_fragi,idct,data,dequant,dct,
+    ac_bits=oc_enc_tokenize_ac(_enc,_pli,_fragi,idct,_data,dequant,_dct,
      nonzero+1,_stack,OC_RD_ISCALE(_enc->lambda,_rd_iscale),qti?0:3);
   }
   else{
-    ac_bits=oc_enc_tokenize_ac_fast(_enc,_pli,_fragi,idct,data,dequant,dct,
+    ac_bits=oc_enc_tokenize_ac_fast(_enc,_pli,_fragi,idct,_data,dequant,_dct,
      nonzero+1,_stack,OC_RD_ISCALE(_enc->lambda,_rd_iscale),qti?0:3);
   }
+  oc_enc_stage_switch(_enc,stage);
   /*Reconstruct.
     TODO: nonzero may need to be adjusted after tokenization.*/
   dequant_dc=dequant[0];
@@ -800,7 +847,7 @@ static int oc_enc_block_transform_quantize(oc_enc_ctx *_enc,
        no iDCT rounding.*/
     p=(ogg_int16_t)(dc*(ogg_int32_t)dequant_dc+15>>5);
     /*LOOP VECTORIZES.*/
-    for(ci=0;ci<64;ci++)data[ci]=p;
+    for(ci=0;ci<64;ci++)_data[ci]=p;
     /*We didn't code any AC coefficients, so don't change the quantizer.*/
     qi01=_pipe->qs[_pli].qi01;
     qi12=_pipe->qs[_pli].qi12;
@@ -810,18 +857,15 @@ static int oc_enc_block_transform_quantize(oc_enc_ctx *_enc,
   else{
     idct[0]=dc*dequant_dc;
     /*Note: This clears idct[] back to zero for the next block.*/
-    oc_idct8x8(&_enc->state,data,idct,nonzero+1);
+    oc_idct8x8(&_enc->state,_data,idct,nonzero+1);
   }
   frags[_fragi].qii=qii;
   if(nqis>1){
     oc_qii_state_advance(&qs,_pipe->qs+_pli,qii);
     ac_bits+=qs.bits-_pipe->qs[_pli].bits;
   }
-  if(!qti)oc_enc_frag_recon_intra(_enc,dst,ystride,data);
-  else{
-    oc_enc_frag_recon_inter(_enc,dst,
-     nmv_offs==1?ref+mv_offs[0]:dst,ystride,data);
-  }
+  if(!qti)oc_enc_frag_recon_intra(_enc,dst,ystride,_data);
+  else oc_enc_frag_recon_inter(_enc,dst,_bs->pred,ystride,_data);
   /*If _fr is NULL, then this is an INTRA frame, and we can't skip blocks.*/
 #if !defined(OC_COLLECT_METRICS)
   if(_fr!=NULL)
@@ -829,10 +873,10 @@ static int oc_enc_block_transform_quantize(oc_enc_ctx *_enc,
   {
     /*In retrospect, should we have skipped this block?*/
     if(borderi<0){
-      coded_ssd=oc_enc_frag_ssd(_enc,src,dst,ystride);
+      coded_ssd=oc_enc_frag_ssd(_enc,_bs->src,dst,ystride);
     }
     else{
-      coded_ssd=oc_enc_frag_border_ssd(_enc,src,dst,ystride,
+      coded_ssd=oc_enc_frag_border_ssd(_enc,_bs->src,dst,ystride,
        _enc->state.borders[borderi].mask);
     }
     /*Scale to match DCT domain.*/
@@ -847,7 +891,8 @@ static int oc_enc_block_transform_quantize(oc_enc_ctx *_enc,
     if(uncoded_ssd<UINT_MAX&&
      /*Don't allow luma blocks to be skipped in 4MV mode when VP3 compatibility
         is enabled.*/
-     (!_enc->vp3_compatible||mb_mode!=OC_MODE_INTER_MV_FOUR||_pli)){
+     (!_enc->vp3_compatible||frags[_fragi].mb_mode!=OC_MODE_INTER_MV_FOUR
+     ||_pli)){
       int overhead_bits;
       overhead_bits=oc_fr_cost1(_fr);
       /*Although the fragment coding overhead determination is accurate, it is
@@ -882,6 +927,78 @@ static int oc_enc_block_transform_quantize(oc_enc_ctx *_enc,
   return 1;
 }
 
+static int oc_enc_block_transform_quantize(oc_enc_ctx *_enc,
+ oc_enc_pipeline_state *_pipe,int _pli,ptrdiff_t _fragi,
+ unsigned _rd_scale,unsigned _rd_iscale,oc_rd_metric *_mo,
+ oc_fr_state *_fr,oc_token_checkpoint **_stack){
+  oc_block_state  bs;
+  ogg_int16_t    *data;
+  ogg_int16_t    *dct;
+  data=_enc->pipe.dct_data;
+  dct=data+128;
+  if(!oc_enc_block_predict(_enc,_pli,_fragi,&bs,data)){
+    oc_fr_skip_block(_fr);
+    return 0;
+  }
+  /*Transform:*/
+  oc_enc_fdct8x8(_enc,dct,data);
+  /*Quantize:*/
+  bs.nonzero=oc_enc_quantize(_enc,data,dct,bs.dequant,bs.enquant);
+  return oc_enc_block_code(_enc,_pipe,_pli,_fragi,&bs,data,dct,
+   _rd_scale,_rd_iscale,_mo,_fr,_stack);
+}
+
+/*Like oc_enc_block_transform_quantize(), but for two blocks of the same MB.
+  The motion compensation, tokenization, and skip decisions are still done one
+   block at a time, but when both blocks need it the fDCT and quantization are
+   done for both at once.
+  Return: A bit mask with bit i set if block i was coded.*/
+static int oc_enc_block_pair_transform_quantize(oc_enc_ctx *_enc,
+ oc_enc_pipeline_state *_pipe,int _pli,const ptrdiff_t _fragis[2],
+ const unsigned _rd_scale[2],const unsigned _rd_iscale[2],oc_rd_metric *_mo,
+ oc_fr_state *_fr,oc_token_checkpoint **_stack){
+  oc_block_state  bs[2];
+  int             predicted[2];
+  ogg_int16_t    *data;
+  ogg_int16_t    *dct;
+  int             coded;
+  int             bi;
+  data=_enc->pipe.dct_data;
+  dct=data+128;
+  for(bi=0;bi<2;bi++){
+    predicted[bi]=oc_enc_block_predict(_enc,_pli,_fragis[bi],bs+bi,data+64*bi);
+  }
+  if(predicted[0]&&predicted[1]){
+    const ogg_uint16_t *dequant[2];
+    const void         *enquant[2];
+    int                 nonzero[2];
+    oc_enc_fdct8x8_x2(_enc,dct,data);
+    dequant[0]=bs[0].dequant;
+    dequant[1]=bs[1].dequant;
+    enquant[0]=bs[0].enquant;
+    enquant[1]=bs[1].enquant;
+    oc_enc_quantize_x2(_enc,nonzero,data,dct,dequant,enquant);
+    bs[0].nonzero=nonzero[0];
+    bs[1].nonzero=nonzero[1];
+  }
+  else{
+    for(bi=0;bi<2;bi++)if(predicted[bi]){
+      oc_enc_fdct8x8(_enc,dct+64*bi,data+64*bi);
+      bs[bi].nonzero=oc_enc_quantize(_enc,data+64*bi,dct+64*bi,
+       bs[bi].dequant,bs[bi].enquant);
+    }
+  }
+  coded=0;
+  for(bi=0;bi<2;bi++){
+    if(!predicted[bi])oc_fr_skip_block(_fr);
+    else if(oc_enc_block_code(_enc,_pipe,_pli,_fragis[bi],bs+bi,
+     data+64*bi,dct+64*bi,_rd_scale[bi],_rd_iscale[bi],_mo,_fr,_stack)){
+      coded|=1<<bi;
+    }
+  }
+  return coded;
+}
+
 static int oc_enc_mb_transform_quantize_inter_luma(oc_enc_ctx *_enc,
  oc_enc_pipeline_state *_pipe,unsigned _mbi,int _mode_overhead,
  const unsigned _rd_scale[4],const unsigned _rd_iscale[4]){
@@ -917,16 +1034,25 @@ static int oc_enc_mb_transform_quantize_inter_luma(oc_enc_ctx *_enc,
   ncoded=0;
   stackptr=stack;
   memset(&mo,0,sizeof(mo));
-  for(bi=0;bi<4;bi++){
-    fragi=sb_maps[_mbi>>2][_mbi&3][bi];
-    frags[fragi].refi=refi;
-    frags[fragi].mb_mode=mb_mode;
-    if(oc_enc_block_transform_quantize(_enc,_pipe,0,fragi,
-     _rd_scale[bi],_rd_iscale[bi],&mo,_pipe->fr+0,&stackptr)){
-      coded_fragis[ncoded_fragis++]=fragi;
-      ncoded++;
+  for(bi=0;bi<4;bi+=2){
+    ptrdiff_t fragis[2];
+    int       coded;
+    int       bj;
+    for(bj=0;bj<2;bj++){
+      fragi=sb_maps[_mbi>>2][_mbi&3][bi+bj];
+      frags[fragi].refi=refi;
+      frags[fragi].mb_mode=mb_mode;
+      fragis[bj]=fragi;
+    }
+    coded=oc_enc_block_pair_transform_quantize(_enc,_pipe,0,fragis,
+     _rd_scale+bi,_rd_iscale+bi,&mo,_pipe->fr+0,&stackptr);
+    for(bj=0;bj<2;bj++){
+      if(coded>>bj&1){
+        coded_fragis[ncoded_fragis++]=fragis[bj];
+        ncoded++;
+      }
+      else *(uncoded_fragis-++nuncoded_fragis)=fragis[bj];
     }
-    else *(uncoded_fragis-++nuncoded_fragis)=fragi;
   }
   if(ncoded>0&&!mo.dc_flag){
     int cost;
@@ -967,6 +1093,73 @@ static int oc_enc_mb_transform_quantize_inter_luma(oc_enc_ctx *_enc,
   return ncoded;
 }
 
+/*Returns whether all the blocks of a macro block are identical to those of
+   the previous input frame and none of them were coded in the previous frame.
+  At the same quantizer, mode decision for such a macro block will almost
+   always reach the same conclusion again, so it can go straight to the skip
+   path.*/
+static int oc_mb_unchanged(oc_enc_ctx *_enc,unsigned _mbi){
+  const unsigned char   *src;
+  const unsigned char   *ref;
+  const oc_mb_map_plane *mb_map;
+  const oc_fragment     *frags;
+  const ptrdiff_t       *frag_buf_offs;
+  const unsigned char   *map_idxs;
+  int                    nmap_idxs;
+  int                    mapii;
+  mb_map=(const oc_mb_map_plane *)_enc->state.mb_maps[_mbi];
+  map_idxs=OC_MB_MAP_IDXS[_enc->state.info.pixel_fmt];
+  nmap_idxs=OC_MB_MAP_NIDXS[_enc->state.info.pixel_fmt];
+  frags=_enc->state.frags;
+  for(mapii=0;mapii<nmap_idxs;mapii++){
+    int mapi;
+    mapi=map_idxs[mapii];
+    if(frags[mb_map[mapi>>2][mapi&3]].coded)return 0;
+  }
+  /*If the application told us which regions changed, take its word for it.*/
+  if(_enc->dirty_rects)return !_enc->mb_info[_mbi].dirty;
+  src=_enc->state.ref_frame_data[OC_FRAME_IO];
+  ref=_enc->state.ref_frame_data[OC_FRAME_PREV_ORIG];
+  frag_buf_offs=_enc->state.frag_buf_offs;
+  for(mapii=0;mapii<nmap_idxs;mapii++){
+    ptrdiff_t frag_offs;
+    int       mapi;
+    mapi=map_idxs[mapii];
+    frag_offs=frag_buf_offs[mb_map[mapi>>2][mapi&3]];
+    if(oc_enc_frag_sad(_enc,src+frag_offs,ref+frag_offs,
+     _enc->state.ref_ystride[mapi>>2])>0){
+      return 0;
+    }
+  }
+  return 1;
+}
+
+/*Marks the luma blocks of an unchanged macro block as not coded, without
+   transforming or tokenizing them.*/
+static void oc_enc_mb_skip_inter_luma(oc_enc_ctx *_enc,
+ oc_enc_pipeline_state *_pipe,unsigned _mbi){
+  const ptrdiff_t *sb_map;
+  oc_fragment     *frags;
+  ptrdiff_t       *uncoded_fragis;
+  ptrdiff_t        nuncoded_fragis;
+  int              bi;
+  sb_map=_enc->state.sb_maps[_mbi>>2][_mbi&3];
+  frags=_enc->state.frags;
+  uncoded_fragis=_pipe->uncoded_fragis[0];
+  nuncoded_fragis=_pipe->nuncoded_fragis[0];
+  for(bi=0;bi<4;bi++){
+    ptrdiff_t fragi;
+    fragi=sb_map[bi];
+    frags[fragi].coded=0;
+    frags[fragi].refi=OC_FRAME_NONE;
+    frags[fragi].mb_mode=OC_MODE_INTER_NOMV;
+    *(uncoded_fragis-++nuncoded_fragis)=fragi;
+    oc_fr_skip_block(_pipe->fr+0);
+  }
+  _pipe->nuncoded_fragis[0]=nuncoded_fragis;
+  _enc->state.mb_modes[_mbi]=OC_MODE_INTER_NOMV;
+}
+
 static void oc_enc_sb_transform_quantize_inter_chroma(oc_enc_ctx *_enc,
  oc_enc_pipeline_state *_pipe,int _pli,int _sbi_start,int _sbi_end){
   const ogg_uint16_t *mcu_rd_scale;
@@ -1373,8 +1566,9 @@ static int oc_mb_intra_satd(oc_enc_ctx *_enc,unsigned _mbi,
   int                    bi;
   ptrdiff_t              fragi;
   ptrdiff_t              frag_offs;
+  const unsigned char   *srcs[12];
   unsigned               luma;
-  int                    dc;
+  int                    dc[2];
   frag_buf_offs=_enc->state.frag_buf_offs;
   sb_map=_enc->state.sb_maps[_mbi>>2][_mbi&3];
   src=_enc->state.ref_frame_data[OC_FRAME_IO];
@@ -1383,8 +1577,11 @@ static int oc_mb_intra_satd(oc_enc_ctx *_enc,unsigned _mbi,
   for(bi=0;bi<4;bi++){
     fragi=sb_map[bi];
     frag_offs=frag_buf_offs[fragi];
-    _frag_satd[bi]=oc_enc_frag_intra_satd(_enc,&dc,src+frag_offs,ystride);
-    luma+=dc;
+    srcs[bi]=src+frag_offs;
+  }
+  for(bi=0;bi<4;bi+=2){
+    oc_enc_frag_intra_satd_x2(_enc,_frag_satd+bi,dc,srcs+bi,ystride);
+    luma+=dc[0]+dc[1];
   }
   mb_map=(const oc_mb_map_plane *)_enc->state.mb_maps[_mbi];
   map_idxs=OC_MB_MAP_IDXS[_enc->state.info.pixel_fmt];
@@ -1397,7 +1594,11 @@ static int oc_mb_intra_satd(oc_enc_ctx *_enc,unsigned _mbi,
     bi=mapi&3;
     fragi=mb_map[pli][bi];
     frag_offs=frag_buf_offs[fragi];
-    _frag_satd[mapii]=oc_enc_frag_intra_satd(_enc,&dc,src+frag_offs,ystride);
+    srcs[mapii]=src+frag_offs;
+  }
+  /*There is always an even number of chroma blocks in a MB.*/
+  for(mapii=4;mapii<map_nidxs;mapii+=2){
+    oc_enc_frag_intra_satd_x2(_enc,_frag_satd+mapii,dc,srcs+mapii,ystride);
   }
   return luma;
 }
@@ -1586,13 +1787,19 @@ static void oc_enc_mb_transform_quantize_intra_luma(oc_enc_ctx *_enc,
   coded_fragis=_pipe->coded_fragis[0];
   ncoded_fragis=_pipe->ncoded_fragis[0];
   stackptr=stack;
-  for(bi=0;bi<4;bi++){
-    fragi=sb_maps[_mbi>>2][_mbi&3][bi];
-    frags[fragi].refi=OC_FRAME_SELF;
-    frags[fragi].mb_mode=OC_MODE_INTRA;
-    oc_enc_block_transform_quantize(_enc,_pipe,0,fragi,
-     _rd_scale[bi],_rd_iscale[bi],NULL,NULL,&stackptr);
-    coded_fragis[ncoded_fragis++]=fragi;
+  for(bi=0;bi<4;bi+=2){
+    ptrdiff_t fragis[2];
+    int       bj;
+    for(bj=0;bj<2;bj++){
+      fragi=sb_maps[_mbi>>2][_mbi&3][bi+bj];
+      frags[fragi].refi=OC_FRAME_SELF;
+      frags[fragi].mb_mode=OC_MODE_INTRA;
+      fragis[bj]=fragi;
+    }
+    oc_enc_block_pair_transform_quantize(_enc,_pipe,0,fragis,
+     _rd_scale+bi,_rd_iscale+bi,NULL,NULL,&stackptr);
+    coded_fragis[ncoded_fragis++]=fragis[0];
+    coded_fragis[ncoded_fragis++]=fragis[1];
   }
   _pipe->ncoded_fragis[0]=ncoded_fragis;
 }
@@ -1653,6 +1860,7 @@ void oc_enc_analyze_intra(oc_enc_ctx *_enc,int _recode){
   const oc_mb_map        *mb_maps;
   const oc_sb_map        *sb_maps;
   oc_fragment            *frags;
+  oc_mb_enc_info         *embs;
   unsigned                stripe_sby;
   unsigned                mcu_nvsbs;
   int                     notstart;
@@ -1660,6 +1868,8 @@ void oc_enc_analyze_intra(oc_enc_ctx *_enc,int _recode){
   int                     refi;
   int                     pli;
   _enc->state.frame_type=OC_INTRA_FRAME;
+  /*The motion search done here is not published for a bitrate ladder.*/
+  if(!_recode)_enc->ladder_frame=-1;
   oc_enc_tokenize_start(_enc);
   oc_enc_pipeline_init(_enc,&_enc->pipe);
   oc_enc_mode_rd_init(_enc);
@@ -1681,6 +1891,7 @@ void oc_enc_analyze_intra(oc_enc_ctx *_enc,int _recode){
   mb_maps=(const oc_mb_map *)_enc->state.mb_maps;
   sb_maps=(const oc_sb_map *)_enc->state.sb_maps;
   frags=_enc->state.frags;
+  embs=_enc->mb_info;
   notstart=0;
   notdone=1;
   mcu_nvsbs=_enc->mcu_nvsbs;
@@ -1705,14 +1916,25 @@ void oc_enc_analyze_intra(oc_enc_ctx *_enc,int _recode){
         int       bi;
         ptrdiff_t fragi;
         mbi=sbi<<2|quadi;
-        /*Activity masking.*/
-        if(_enc->sp_level<OC_SP_LEVEL_FAST_ANALYSIS){
+        /*Activity masking.
+          When recoding, the first analysis of this frame (intra or inter)
+           already measured the source.*/
+        if(_recode){
+          luma=embs[mbi].luma;
+          memcpy(activity,embs[mbi].activity,sizeof(activity));
+        }
+        else if(_enc->sp_level<OC_SP_LEVEL_FAST_ANALYSIS){
           luma=oc_mb_activity(_enc,mbi,activity);
         }
         else{
-          unsigned intra_satd[12];
-          luma=oc_mb_intra_satd(_enc,mbi,intra_satd);
-          oc_mb_activity_fast(_enc,mbi,activity,intra_satd);
+          luma=oc_mb_intra_satd(_enc,mbi,embs[mbi].intra_satd);
+          oc_mb_activity_fast(_enc,mbi,activity,embs[mbi].intra_satd);
+        }
+        if(!_recode){
+          embs[mbi].luma=luma;
+          memcpy(embs[mbi].activity,activity,sizeof(activity));
+        }
+        if(_enc->sp_level>=OC_SP_LEVEL_FAST_ANALYSIS){
           for(bi=0;bi<4;bi++)frags[sb_maps[mbi>>2][mbi&3][bi]].qii=0;
         }
         activity_sum+=oc_mb_masking(rd_scale,rd_iscale,
@@ -1723,14 +1945,18 @@ void oc_enc_analyze_intra(oc_enc_ctx *_enc,int _recode){
            keyframe or not, unless we aren't using motion estimation at all.*/
         if(!_recode&&_enc->state.curframe_num>0&&
          _enc->sp_level<OC_SP_LEVEL_NOMC&&_enc->keyframe_frequency_force>1){
+          oc_enc_stage_switch(_enc,OC_ENC_STAGE_MOTION);
           oc_mcenc_search(_enc,mbi);
+          oc_enc_stage_switch(_enc,OC_ENC_STAGE_ANALYSIS);
         }
         if(_enc->sp_level<OC_SP_LEVEL_FAST_ANALYSIS){
           oc_analyze_intra_mb_luma(_enc,_enc->pipe.qs+0,mbi,rd_scale);
         }
         mb_modes[mbi]=OC_MODE_INTRA;
+        oc_enc_stage_switch(_enc,OC_ENC_STAGE_TRANSFORM);
         oc_enc_mb_transform_quantize_intra_luma(_enc,&_enc->pipe,
          mbi,rd_scale,rd_iscale);
+        oc_enc_stage_switch(_enc,OC_ENC_STAGE_ANALYSIS);
         /*Propagate final MB mode and MVs to the chroma blocks.*/
         for(mapii=4;mapii<nmap_idxs;mapii++){
           mapi=map_idxs[mapii];
@@ -1753,8 +1979,10 @@ void oc_enc_analyze_intra(oc_enc_ctx *_enc,int _recode){
     oc_enc_pipeline_finish_mcu_plane(_enc,&_enc->pipe,0,notstart,notdone);
     /*Code chroma planes.*/
     for(pli=1;pli<3;pli++){
+      oc_enc_stage_switch(_enc,OC_ENC_STAGE_TRANSFORM);
       oc_enc_sb_transform_quantize_intra_chroma(_enc,&_enc->pipe,
        pli,_enc->pipe.sbi0[pli],_enc->pipe.sbi_end[pli]);
+      oc_enc_stage_switch(_enc,OC_ENC_STAGE_ANALYSIS);
       oc_enc_pipeline_finish_mcu_plane(_enc,&_enc->pipe,pli,notstart,notdone);
     }
     notstart=1;
@@ -1765,8 +1993,10 @@ void oc_enc_analyze_intra(oc_enc_ctx *_enc,int _recode){
    _enc->state.fplanes[0].nfrags));
   _enc->luma_avg=(unsigned)((luma_sum+(_enc->state.nmbs>>1))/_enc->state.nmbs);
   /*Finish filling in the reference frame borders.*/
+  oc_enc_stage_switch(_enc,OC_ENC_STAGE_FILTER);
   refi=_enc->state.ref_frame_idx[OC_FRAME_SELF];
   for(pli=0;pli<3;pli++)oc_state_borders_fill_caps(&_enc->state,refi,pli);
+  oc_enc_stage_switch(_enc,OC_ENC_STAGE_ANALYSIS);
   _enc->state.ntotal_coded_fragis=_enc->state.nfrags;
 }
 
@@ -1986,6 +2216,7 @@ static void oc_skip_cost(oc_enc_ctx *_enc,oc_enc_pipeline_state *_pipe,
   ptrdiff_t              fragi;
   ptrdiff_t              frag_offs;
   int                    borderi;
+  unsigned               luma_ssd[4];
   src=_enc->state.ref_frame_data[OC_FRAME_IO];
   ref=_enc->state.ref_frame_data[OC_FRAME_PREV];
   ystride=_enc->state.ref_ystride[0];
@@ -1993,19 +2224,36 @@ static void oc_skip_cost(oc_enc_ctx *_enc,oc_enc_pipeline_state *_pipe,
   frag_buf_offs=_enc->state.frag_buf_offs;
   sb_map=_enc->state.sb_maps[_mbi>>2][_mbi&3];
   mvs=_enc->mb_info[_mbi].block_mv;
-  for(bi=0;bi<4;bi++){
-    fragi=sb_map[bi];
-    borderi=frags[fragi].borderi;
-    frag_offs=frag_buf_offs[fragi];
-    if(borderi<0){
-      uncoded_ssd=oc_enc_frag_ssd(_enc,src+frag_offs,ref+frag_offs,ystride);
+  for(bi=0;bi<4;bi+=2){
+    const unsigned char *srcs[2];
+    const unsigned char *refs[2];
+    ogg_int64_t          masks[2];
+    int                  nborders;
+    int                  bj;
+    nborders=0;
+    for(bj=0;bj<2;bj++){
+      fragi=sb_map[bi+bj];
+      borderi=frags[fragi].borderi;
+      frag_offs=frag_buf_offs[fragi];
+      srcs[bj]=src+frag_offs;
+      refs[bj]=ref+frag_offs;
+      if(borderi<0)masks[bj]=-1;
+      else{
+        masks[bj]=_enc->state.borders[borderi].mask;
+        nborders++;
+      }
     }
-    else{
-      uncoded_ssd=oc_enc_frag_border_ssd(_enc,
-       src+frag_offs,ref+frag_offs,ystride,_enc->state.borders[borderi].mask);
+    /*A full mask gives the same result as the plain SSD, so if either block
+       is on the border, we can still do both at once.*/
+    if(nborders>0){
+      oc_enc_frag_border_ssd_x2(_enc,luma_ssd+bi,srcs,refs,ystride,masks);
     }
+    else oc_enc_frag_ssd_x2(_enc,luma_ssd+bi,srcs,refs,ystride);
+  }
+  for(bi=0;bi<4;bi++){
+    fragi=sb_map[bi];
     /*Scale to match DCT domain and RD.*/
-    uncoded_ssd=OC_RD_SKIP_SCALE(uncoded_ssd,_rd_scale[bi]);
+    uncoded_ssd=OC_RD_SKIP_SCALE(luma_ssd[bi],_rd_scale[bi]);
     /*Motion is a special case; if there is more than a full-pixel motion
        against the prior frame, penalize skipping.
       TODO: The factor of two here is a kludge, but it tested out better than a
@@ -2060,11 +2308,46 @@ static void oc_cost_intra(oc_enc_ctx *_enc,oc_mode_choice *_modec,
   oc_mode_set_cost(_modec,_enc->lambda);
 }
 
+/*Computes the SATD of the prediction error of _nfrags fragments, plus the
+   magnitude of their DC coefficients.
+  _ref2[i] is NULL if fragment i does not need half-pel interpolation.
+  Neighboring fragments that use the same kind of prediction are done two at
+   a time.*/
+static void oc_enc_frag_satd_list(oc_enc_ctx *_enc,unsigned *_satd,
+ const unsigned char *const *_src,const unsigned char *const *_ref1,
+ const unsigned char *const *_ref2,int _ystride,int _nfrags){
+  int dc[2];
+  int fi;
+  int fj;
+  for(fi=0;fi<_nfrags;fi+=2){
+    if(fi+1<_nfrags&&(_ref2[fi]!=NULL)==(_ref2[fi+1]!=NULL)){
+      if(_ref2[fi]!=NULL){
+        oc_enc_frag_satd2_x2(_enc,_satd+fi,dc,
+         _src+fi,_ref1+fi,_ref2+fi,_ystride);
+      }
+      else oc_enc_frag_satd_x2(_enc,_satd+fi,dc,_src+fi,_ref1+fi,_ystride);
+      _satd[fi]+=abs(dc[0]);
+      _satd[fi+1]+=abs(dc[1]);
+    }
+    else for(fj=fi;fj<fi+2&&fj<_nfrags;fj++){
+      if(_ref2[fj]!=NULL){
+        _satd[fj]=oc_enc_frag_satd2(_enc,dc,
+         _src[fj],_ref1[fj],_ref2[fj],_ystride);
+      }
+      else _satd[fj]=oc_enc_frag_satd(_enc,dc,_src[fj],_ref1[fj],_ystride);
+      _satd[fj]+=abs(dc[0]);
+    }
+  }
+}
+
 static void oc_cost_inter(oc_enc_ctx *_enc,oc_mode_choice *_modec,
  unsigned _mbi,int _mb_mode,oc_mv _mv,
  const oc_fr_state *_fr,const oc_qii_state *_qs,
  const unsigned _skip_ssd[12],const unsigned _rd_scale[5]){
   unsigned               frag_satd[12];
+  const unsigned char   *srcs[12];
+  const unsigned char   *refs1[12];
+  const unsigned char   *refs2[12];
   const unsigned char   *src;
   const unsigned char   *ref;
   int                    ystride;
@@ -2076,45 +2359,35 @@ static void oc_cost_inter(oc_enc_ctx *_enc,oc_mode_choice *_modec,
   int                    mapii;
   int                    mapi;
   int                    mv_offs[2];
+  int                    nmv_offs;
   int                    pli;
   int                    bi;
   ptrdiff_t              fragi;
   ptrdiff_t              frag_offs;
-  int                    dc;
   src=_enc->state.ref_frame_data[OC_FRAME_IO];
   ref=_enc->state.ref_frame_data[OC_FRAME_FOR_MODE(_mb_mode)];
   ystride=_enc->state.ref_ystride[0];
   frag_buf_offs=_enc->state.frag_buf_offs;
   sb_map=_enc->state.sb_maps[_mbi>>2][_mbi&3];
   _modec->rate=_modec->ssd=0;
-  if(oc_state_get_mv_offsets(&_enc->state,mv_offs,0,_mv)>1){
-    for(bi=0;bi<4;bi++){
-      fragi=sb_map[bi];
-      frag_offs=frag_buf_offs[fragi];
-      if(_enc->sp_level<OC_SP_LEVEL_NOSATD){
-        frag_satd[bi]=oc_enc_frag_satd2(_enc,&dc,src+frag_offs,
-         ref+frag_offs+mv_offs[0],ref+frag_offs+mv_offs[1],ystride);
-        frag_satd[bi]+=abs(dc);
-      }
-      else{
-        frag_satd[bi]=oc_enc_frag_sad2_thresh(_enc,src+frag_offs,
-         ref+frag_offs+mv_offs[0],ref+frag_offs+mv_offs[1],ystride,UINT_MAX);
-      }
-    }
+  nmv_offs=oc_state_get_mv_offsets(&_enc->state,mv_offs,0,_mv);
+  for(bi=0;bi<4;bi++){
+    fragi=sb_map[bi];
+    frag_offs=frag_buf_offs[fragi];
+    srcs[bi]=src+frag_offs;
+    refs1[bi]=ref+frag_offs+mv_offs[0];
+    refs2[bi]=nmv_offs>1?ref+frag_offs+mv_offs[1]:NULL;
+  }
+  if(_enc->sp_level<OC_SP_LEVEL_NOSATD){
+    oc_enc_frag_satd_list(_enc,frag_satd,srcs,refs1,refs2,ystride,4);
   }
   else{
     for(bi=0;bi<4;bi++){
-      fragi=sb_map[bi];
-      frag_offs=frag_buf_offs[fragi];
-      if(_enc->sp_level<OC_SP_LEVEL_NOSATD){
-        frag_satd[bi]=oc_enc_frag_satd(_enc,&dc,src+frag_offs,
-         ref+frag_offs+mv_offs[0],ystride);
-        frag_satd[bi]+=abs(dc);
-      }
-      else{
-        frag_satd[bi]=oc_enc_frag_sad(_enc,src+frag_offs,
-         ref+frag_offs+mv_offs[0],ystride);
+      if(nmv_offs>1){
+        frag_satd[bi]=oc_enc_frag_sad2_thresh(_enc,srcs[bi],
+         refs1[bi],refs2[bi],ystride,UINT_MAX);
       }
+      else frag_satd[bi]=oc_enc_frag_sad(_enc,srcs[bi],refs1[bi],ystride);
     }
   }
   mb_map=(const oc_mb_map_plane *)_enc->state.mb_maps[_mbi];
@@ -2122,39 +2395,30 @@ static void oc_cost_inter(oc_enc_ctx *_enc,oc_mode_choice *_modec,
   map_nidxs=OC_MB_MAP_NIDXS[_enc->state.info.pixel_fmt];
   /*Note: This assumes ref_ystride[1]==ref_ystride[2].*/
   ystride=_enc->state.ref_ystride[1];
-  if(oc_state_get_mv_offsets(&_enc->state,mv_offs,1,_mv)>1){
-    for(mapii=4;mapii<map_nidxs;mapii++){
-      mapi=map_idxs[mapii];
-      pli=mapi>>2;
-      bi=mapi&3;
-      fragi=mb_map[pli][bi];
-      frag_offs=frag_buf_offs[fragi];
-      if(_enc->sp_level<OC_SP_LEVEL_NOSATD){
-        frag_satd[mapii]=oc_enc_frag_satd2(_enc,&dc,src+frag_offs,
-         ref+frag_offs+mv_offs[0],ref+frag_offs+mv_offs[1],ystride);
-        frag_satd[mapii]+=abs(dc);
-      }
-      else{
-        frag_satd[mapii]=oc_enc_frag_sad2_thresh(_enc,src+frag_offs,
-         ref+frag_offs+mv_offs[0],ref+frag_offs+mv_offs[1],ystride,UINT_MAX);
-      }
-    }
+  nmv_offs=oc_state_get_mv_offsets(&_enc->state,mv_offs,1,_mv);
+  for(mapii=4;mapii<map_nidxs;mapii++){
+    mapi=map_idxs[mapii];
+    pli=mapi>>2;
+    bi=mapi&3;
+    fragi=mb_map[pli][bi];
+    frag_offs=frag_buf_offs[fragi];
+    srcs[mapii]=src+frag_offs;
+    refs1[mapii]=ref+frag_offs+mv_offs[0];
+    refs2[mapii]=nmv_offs>1?ref+frag_offs+mv_offs[1]:NULL;
+  }
+  if(_enc->sp_level<OC_SP_LEVEL_NOSATD){
+    oc_enc_frag_satd_list(_enc,frag_satd+4,srcs+4,refs1+4,refs2+4,
+     ystride,map_nidxs-4);
   }
   else{
     for(mapii=4;mapii<map_nidxs;mapii++){
-      mapi=map_idxs[mapii];
-      pli=mapi>>2;
-      bi=mapi&3;
-      fragi=mb_map[pli][bi];
-      frag_offs=frag_buf_offs[fragi];
-      if(_enc->sp_level<OC_SP_LEVEL_NOSATD){
-        frag_satd[mapii]=oc_enc_frag_satd(_enc,&dc,src+frag_offs,
-         ref+frag_offs+mv_offs[0],ystride);
-        frag_satd[mapii]+=abs(dc);
+      if(nmv_offs>1){
+        frag_satd[mapii]=oc_enc_frag_sad2_thresh(_enc,srcs[mapii],
+         refs1[mapii],refs2[mapii],ystride,UINT_MAX);
       }
       else{
-        frag_satd[mapii]=oc_enc_frag_sad(_enc,src+frag_offs,
-         ref+frag_offs+mv_offs[0],ystride);
+        frag_satd[mapii]=oc_enc_frag_sad(_enc,srcs[mapii],
+         refs1[mapii],ystride);
       }
     }
   }
@@ -2214,8 +2478,10 @@ static void oc_cost_inter4mv(oc_enc_ctx *_enc,oc_mode_choice *_modec,
   ptrdiff_t              frag_offs;
   int                    bits0;
   int                    bits1;
-  unsigned               satd;
-  int                    dc;
+  unsigned               satd[12];
+  const unsigned char   *srcs[12];
+  const unsigned char   *refs1[12];
+  const unsigned char   *refs2[12];
   src=_enc->state.ref_frame_data[OC_FRAME_IO];
   ref=_enc->state.ref_frame_data[OC_FRAME_PREV];
   ystride=_enc->state.ref_ystride[0];
@@ -2229,16 +2495,15 @@ static void oc_cost_inter4mv(oc_enc_ctx *_enc,oc_mode_choice *_modec,
        them if we don't ultimately choose 4MV mode.*/
     frag_mvs[fragi]=_mv[bi];
     frag_offs=frag_buf_offs[fragi];
+    srcs[bi]=src+frag_offs;
     if(oc_state_get_mv_offsets(&_enc->state,mv_offs,0,_mv[bi])>1){
-      satd=oc_enc_frag_satd2(_enc,&dc,src+frag_offs,
-       ref+frag_offs+mv_offs[0],ref+frag_offs+mv_offs[1],ystride);
+      refs2[bi]=ref+frag_offs+mv_offs[1];
     }
-    else{
-      satd=oc_enc_frag_satd(_enc,&dc,src+frag_offs,
-       ref+frag_offs+mv_offs[0],ystride);
-    }
-    frag_satd[OC_MB_PHASE[_mbi&3][bi]]=satd+abs(dc);
+    else refs2[bi]=NULL;
+    refs1[bi]=ref+frag_offs+mv_offs[0];
   }
+  oc_enc_frag_satd_list(_enc,satd,srcs,refs1,refs2,ystride,4);
+  for(bi=0;bi<4;bi++)frag_satd[OC_MB_PHASE[_mbi&3][bi]]=satd[bi];
   oc_analyze_mb_mode_luma(_enc,_modec,_fr,_qs,frag_satd,
    _enc->vp3_compatible?OC_NOSKIP:_skip_ssd,_rd_scale,1);
   /*Figure out which blocks are being skipped and give them (0,0) MVs.*/
@@ -2267,16 +2532,15 @@ static void oc_cost_inter4mv(oc_enc_ctx *_enc,oc_mode_choice *_modec,
     frag_offs=frag_buf_offs[fragi];
     /*TODO: We could save half these calls by re-using the results for the Cb
        and Cr planes; is it worth it?*/
+    srcs[mapii]=src+frag_offs;
     if(oc_state_get_mv_offsets(&_enc->state,mv_offs,pli,cbmvs[bi])>1){
-      satd=oc_enc_frag_satd2(_enc,&dc,src+frag_offs,
-       ref+frag_offs+mv_offs[0],ref+frag_offs+mv_offs[1],ystride);
-    }
-    else{
-      satd=oc_enc_frag_satd(_enc,&dc,src+frag_offs,
-       ref+frag_offs+mv_offs[0],ystride);
+      refs2[mapii]=ref+frag_offs+mv_offs[1];
     }
-    frag_satd[mapii]=satd+abs(dc);
+    else refs2[mapii]=NULL;
+    refs1[mapii]=ref+frag_offs+mv_offs[0];
   }
+  oc_enc_frag_satd_list(_enc,frag_satd+4,srcs+4,refs1+4,refs2+4,
+   ystride,map_nidxs-4);
   oc_analyze_mb_mode_chroma(_enc,_modec,_fr,_qs,
    frag_satd,_skip_ssd,_rd_scale[4],1);
   _modec->overhead=
@@ -2286,6 +2550,95 @@ static void oc_cost_inter4mv(oc_enc_ctx *_enc,oc_mode_choice *_modec,
   oc_mode_set_cost(_modec,_enc->lambda);
 }
 
+/*Prevents all the blocks of a macro block from being skipped, so that an
+   intra refresh codes every one of them.*/
+static void oc_mb_noskip(oc_enc_ctx *_enc,oc_enc_pipeline_state *_pipe,
+ unsigned _mbi){
+  const oc_mb_map_plane *mb_map;
+  const unsigned char   *map_idxs;
+  int                    nmap_idxs;
+  int                    mapii;
+  mb_map=(const oc_mb_map_plane *)_enc->state.mb_maps[_mbi];
+  map_idxs=OC_MB_MAP_IDXS[_enc->state.info.pixel_fmt];
+  nmap_idxs=OC_MB_MAP_NIDXS[_enc->state.info.pixel_fmt];
+  for(mapii=0;mapii<nmap_idxs;mapii++){
+    ptrdiff_t fragi;
+    int       mapi;
+    int       pli;
+    mapi=map_idxs[mapii];
+    pli=mapi>>2;
+    fragi=mb_map[pli][mapi&3];
+    _pipe->skip_ssd[pli][fragi-_pipe->froffset[pli]]=UINT_MAX;
+  }
+}
+
+/*Returns the mode to use for a macro block already refreshed in the current
+   intra refresh sweep.
+  Refreshed macro blocks may only predict from the region of the previous
+   frame that was refreshed before it: the first _clean_mbi macro blocks in
+   column-major order.
+  If _mb_mode would read from outside that region, or from the golden frame,
+   the cheaper of OC_MODE_INTRA and OC_MODE_INTER_NOMV is used instead.*/
+static int oc_mb_refresh_mode(oc_enc_ctx *_enc,const oc_mode_choice _modes[8],
+ unsigned _mbi,int _mb_mode,oc_mv _last_mv,oc_mv _prior_mv,
+ unsigned _clean_mbi){
+  const oc_mb_map_plane *mb_map;
+  ptrdiff_t              nhfrags;
+  unsigned               nvmbs;
+  int                    clean_x;
+  int                    clean_y;
+  int                    x1;
+  int                    y1;
+  oc_mv                  mv;
+  int                    dx;
+  int                    dy;
+  int                    bi;
+  mb_map=(const oc_mb_map_plane *)_enc->state.mb_maps[_mbi];
+  switch(_mb_mode){
+    case OC_MODE_INTRA:
+    case OC_MODE_INTER_NOMV:return _mb_mode;
+    case OC_MODE_INTER_MV:{
+      mv=_enc->mb_info[_mbi].analysis_mv[0][OC_FRAME_PREV];
+      dx=OC_MV_X(mv);
+      dy=OC_MV_Y(mv);
+    }break;
+    case OC_MODE_INTER_MV_LAST:dx=OC_MV_X(_last_mv);dy=OC_MV_Y(_last_mv);break;
+    case OC_MODE_INTER_MV_LAST2:{
+      dx=OC_MV_X(_prior_mv);
+      dy=OC_MV_Y(_prior_mv);
+    }break;
+    case OC_MODE_INTER_MV_FOUR:{
+      /*The chroma MVs are averages of these, so the largest components bound
+         them.*/
+      dx=dy=-32;
+      for(bi=0;bi<4;bi++){
+        mv=_enc->state.frag_mvs[mb_map[0][bi]];
+        dx=OC_MAXI(dx,OC_MV_X(mv));
+        dy=OC_MAXI(dy,OC_MV_Y(mv));
+      }
+    }break;
+    /*The golden frame is only refreshed by keyframes.*/
+    default:return _modes[OC_MODE_INTRA].cost<_modes[OC_MODE_INTER_NOMV].cost?
+     OC_MODE_INTRA:OC_MODE_INTER_NOMV;
+  }
+  /*Find the far edges of the region the prediction reads from, which
+     includes one more sample in each direction for a half-pel MV.
+    Subsampled chroma reads the same region at half resolution, and since the
+     edges of the clean region are multiples of 16, its extra rounding stays
+     inside it, too.*/
+  nhfrags=_enc->state.fplanes[0].nhfrags;
+  nvmbs=(unsigned)(_enc->state.fplanes[0].nvfrags>>1);
+  x1=(int)(mb_map[0][0]%nhfrags<<3)+16+(dx>>1)+(dx&1);
+  y1=(int)(mb_map[0][0]/nhfrags<<3)+16+(dy>>1)+(dy&1);
+  clean_x=(int)(_clean_mbi/nvmbs)<<4;
+  clean_y=(int)(_clean_mbi%nvmbs)<<4;
+  /*The clean region is every column to the left of clean_x, plus the bottom
+     of the next one.*/
+  if(x1<=clean_x||x1<=clean_x+16&&y1<=clean_y)return _mb_mode;
+  return _modes[OC_MODE_INTRA].cost<_modes[OC_MODE_INTER_NOMV].cost?
+   OC_MODE_INTRA:OC_MODE_INTER_NOMV;
+}
+
 int oc_enc_analyze_inter(oc_enc_ctx *_enc,int _allow_keyframe,int _recode){
   oc_set_chroma_mvs_func  set_chroma_mvs;
   oc_qii_state            intra_luma_qs;
@@ -2319,10 +2672,47 @@ int oc_enc_analyze_inter(oc_enc_ctx *_enc,int _allow_keyframe,int _recode){
   int                     notdone;
   unsigned                sbi;
   unsigned                sbi_end;
+  unsigned                refresh_mbi0;
+  unsigned                refresh_mbi1;
+  unsigned                refresh_nvmbs;
+  const oc_enc_ctx       *master;
   int                     refi;
   int                     pli;
+  int                     static_skip;
   int                     sp_level;
+  unsigned                sp_flags;
   sp_level=_enc->sp_level;
+  sp_flags=_enc->sp_flags;
+  /*Unchanged macro blocks only skip mode decision at a fixed quality.
+    Rate control predicts the size of each frame from the analysis, and
+     macro blocks that never reach the cost model starve it, which drives it
+     into wild quantizer swings and frame drops on mostly static input.*/
+  static_skip=sp_level>=OC_SP_LEVEL_EARLY_SKIP
+   &&_enc->state.info.target_bitrate<=0;
+  /*In a bitrate ladder, take the motion search and source statistics from the
+     master encoder if it just analyzed this same frame from the same original
+     reference frames in the same way.*/
+  master=_enc->ladder_master;
+  if(master!=NULL&&(master->ladder_frame!=_enc->state.curframe_num
+   ||master->state.keyframe_num!=_enc->state.keyframe_num
+   ||master->ladder_sp_level!=sp_level||master->ladder_sp_flags!=sp_flags
+   ||_enc->prevframe_dropped)){
+    master=NULL;
+  }
+  if(!_recode)_enc->ladder_frame=-1;
+  /*Find the macro blocks to refresh in this frame.
+    The sweep runs through the frame in column-major order, refreshing the
+     same number of macro blocks in every frame, so that each packet carries
+     the same share of the cost.
+    Everything before this band was refreshed earlier in the sweep.*/
+  refresh_nvmbs=(unsigned)(_enc->state.fplanes[0].nvfrags>>1);
+  refresh_mbi0=refresh_mbi1=0;
+  if(_enc->refresh_period>0){
+    ogg_int64_t nmbs;
+    nmbs=(_enc->state.fplanes[0].nhfrags>>1)*(ogg_int64_t)refresh_nvmbs;
+    refresh_mbi0=(unsigned)(_enc->refresh_pos*nmbs/_enc->refresh_period);
+    refresh_mbi1=(unsigned)((_enc->refresh_pos+1)*nmbs/_enc->refresh_period);
+  }
   set_chroma_mvs=OC_SET_CHROMA_MVS_TABLE[_enc->state.info.pixel_fmt];
   _enc->state.frame_type=OC_INTER_FRAME;
   oc_mode_scheme_chooser_reset(&_enc->chooser);
@@ -2380,27 +2770,77 @@ int oc_enc_analyze_inter(oc_enc_ctx *_enc,int _allow_keyframe,int _recode){
         int            mb_gmv_bits_0;
         int            inter_mv_pref;
         int            mb_mode;
+        int            coded;
+        int            skip;
+        int            refresh;
         int            refi;
         int            mv;
         unsigned       mbi;
+        unsigned       refresh_mbi;
         int            mapii;
         int            mapi;
         int            bi;
         ptrdiff_t      fragi;
         mbi=sbi<<2|quadi;
-        luma=oc_mb_intra_satd(_enc,mbi,intra_satd);
-        /*Activity masking.*/
-        if(sp_level<OC_SP_LEVEL_FAST_ANALYSIS){
-          oc_mb_activity(_enc,mbi,activity);
+        fragi=mb_maps[mbi][0][0];
+        refresh_mbi=(unsigned)(fragi%_enc->state.fplanes[0].nhfrags>>1)
+         *refresh_nvmbs+(unsigned)(fragi/_enc->state.fplanes[0].nhfrags>>1);
+        refresh=refresh_mbi>=refresh_mbi0&&refresh_mbi<refresh_mbi1;
+        /*Static macro blocks skip motion estimation and mode decision.
+          Whether this one is unchanged is decided on the first analysis of a
+           frame, since by the time we recode, the coded flags refer to it.*/
+        if(!_recode){
+          embs[mbi].unchanged=sp_level>=OC_SP_LEVEL_EARLY_SKIP
+           &&!_enc->prevframe_dropped&&oc_mb_unchanged(_enc,mbi);
+        }
+        skip=static_skip&&!refresh&&embs[mbi].unchanged
+         &&_enc->state.qis[0]==embs[mbi].skip_qi;
+        /*If the source did not change, neither did its statistics, and a
+           recode analyzes the same source again.*/
+        if(embs[mbi].unchanged||_recode){
+          luma=embs[mbi].luma;
+          memcpy(activity,embs[mbi].activity,sizeof(activity));
+          memcpy(intra_satd,embs[mbi].intra_satd,sizeof(intra_satd));
+        }
+        else{
+          if(master!=NULL){
+            const oc_mb_enc_info *memb;
+            memb=master->mb_info+mbi;
+            luma=memb->luma;
+            memcpy(activity,memb->activity,sizeof(activity));
+            memcpy(intra_satd,memb->intra_satd,sizeof(intra_satd));
+          }
+          else{
+            luma=oc_mb_intra_satd(_enc,mbi,intra_satd);
+            /*Activity masking.*/
+            if(sp_level<OC_SP_LEVEL_FAST_ANALYSIS){
+              oc_mb_activity(_enc,mbi,activity);
+            }
+            else oc_mb_activity_fast(_enc,mbi,activity,intra_satd);
+          }
+          embs[mbi].luma=luma;
+          memcpy(embs[mbi].activity,activity,sizeof(activity));
+          memcpy(embs[mbi].intra_satd,intra_satd,sizeof(intra_satd));
         }
-        else oc_mb_activity_fast(_enc,mbi,activity,intra_satd);
         luma_sum+=luma;
         activity_sum+=oc_mb_masking(rd_scale,rd_iscale,
          chroma_rd_scale,activity,activity_avg,luma,luma_avg);
         /*Motion estimation:
           We always do a basic 1MV search for all macroblocks, coded or not,
-           keyframe or not.*/
-        if(!_recode&&sp_level<OC_SP_LEVEL_NOMC)oc_mcenc_search(_enc,mbi);
+           keyframe or not, except static ones.
+          Those still age their MV predictors, so that the search in the next
+           frame predicts from the right frames.*/
+        if(!_recode&&sp_level<OC_SP_LEVEL_NOMC){
+          if(skip)oc_mcenc_search_static(_enc,mbi);
+          else{
+            oc_enc_stage_switch(_enc,OC_ENC_STAGE_MOTION);
+            if(master!=NULL){
+              oc_mcenc_search_reuse(_enc,mbi,master->mb_info+mbi);
+            }
+            else oc_mcenc_search(_enc,mbi);
+            oc_enc_stage_switch(_enc,OC_ENC_STAGE_ANALYSIS);
+          }
+        }
         mv=0;
         /*Find the block choice with the lowest estimated coding cost.
           If a Cb or Cr block is coded but no Y' block from a macro block then
@@ -2427,8 +2867,22 @@ int oc_enc_analyze_inter(oc_enc_ctx *_enc,int _allow_keyframe,int _recode){
           }
         }
         /*Estimate the cost in a delta frame for various modes.*/
-        oc_skip_cost(_enc,&_enc->pipe,mbi,rd_scale,skip_ssd);
-        if(sp_level<OC_SP_LEVEL_NOMC){
+        if(refresh)oc_mb_noskip(_enc,&_enc->pipe,mbi);
+        else if(!skip)oc_skip_cost(_enc,&_enc->pipe,mbi,rd_scale,skip_ssd);
+        if(skip){
+          /*Flag the chroma blocks for early skip, too.*/
+          memset(modes[OC_MODE_INTER_NOMV].qii,4,
+           sizeof(modes[OC_MODE_INTER_NOMV].qii));
+          mb_mode=OC_MODE_INTER_NOMV;
+          mb_mv_bits_0=mb_gmv_bits_0=0;
+        }
+        else if(refresh){
+          oc_cost_intra(_enc,modes+OC_MODE_INTRA,mbi,
+           _enc->pipe.fr+0,_enc->pipe.qs+0,intra_satd,OC_NOSKIP,rd_scale);
+          mb_mode=OC_MODE_INTRA;
+          mb_mv_bits_0=mb_gmv_bits_0=0;
+        }
+        else if(sp_level<OC_SP_LEVEL_NOMC){
           oc_cost_inter_nomv(_enc,modes+OC_MODE_INTER_NOMV,mbi,
            OC_MODE_INTER_NOMV,_enc->pipe.fr+0,_enc->pipe.qs+0,
            skip_ssd,rd_scale);
@@ -2446,9 +2900,15 @@ int oc_enc_analyze_inter(oc_enc_ctx *_enc,int _allow_keyframe,int _recode){
           oc_cost_inter_nomv(_enc,modes+OC_MODE_GOLDEN_NOMV,mbi,
            OC_MODE_GOLDEN_NOMV,_enc->pipe.fr+0,_enc->pipe.qs+0,
            skip_ssd,rd_scale);
-          mb_gmv_bits_0=oc_cost_inter1mv(_enc,modes+OC_MODE_GOLDEN_MV,mbi,
-           OC_MODE_GOLDEN_MV,embs[mbi].unref_mv[OC_FRAME_GOLD],
-           _enc->pipe.fr+0,_enc->pipe.qs+0,skip_ssd,rd_scale);
+          if(!(sp_flags&OC_SP_FLAG_NOGOLDEN)){
+            mb_gmv_bits_0=oc_cost_inter1mv(_enc,modes+OC_MODE_GOLDEN_MV,mbi,
+             OC_MODE_GOLDEN_MV,embs[mbi].unref_mv[OC_FRAME_GOLD],
+             _enc->pipe.fr+0,_enc->pipe.qs+0,skip_ssd,rd_scale);
+          }
+          else{
+            modes[OC_MODE_GOLDEN_MV].cost=UINT_MAX;
+            mb_gmv_bits_0=0;
+          }
           /*The explicit MV modes (2,6,7) have not yet gone through halfpel
              refinement.
             We choose the explicit MV mode that's already furthest ahead on
@@ -2456,7 +2916,8 @@ int oc_enc_analyze_inter(oc_enc_ctx *_enc,int _allow_keyframe,int _recode){
             We have to be careful to remember which ones we've refined so that
              we don't refine it again if we re-encode this frame.*/
           inter_mv_pref=_enc->lambda*3;
-          if(sp_level<OC_SP_LEVEL_FAST_ANALYSIS){
+          if(sp_level<OC_SP_LEVEL_FAST_ANALYSIS&&
+           !(sp_flags&OC_SP_FLAG_NO4MV)){
             oc_cost_inter4mv(_enc,modes+OC_MODE_INTER_MV_FOUR,mbi,
              embs[mbi].block_mv,_enc->pipe.fr+0,_enc->pipe.qs+0,
              skip_ssd,rd_scale);
@@ -2467,17 +2928,22 @@ int oc_enc_analyze_inter(oc_enc_ctx *_enc,int _allow_keyframe,int _recode){
           if(modes[OC_MODE_INTER_MV_FOUR].cost<modes[OC_MODE_INTER_MV].cost&&
            modes[OC_MODE_INTER_MV_FOUR].cost<modes[OC_MODE_GOLDEN_MV].cost){
             if(!(embs[mbi].refined&0x80)){
+              oc_enc_stage_switch(_enc,OC_ENC_STAGE_MOTION);
               oc_mcenc_refine4mv(_enc,mbi);
+              oc_enc_stage_switch(_enc,OC_ENC_STAGE_ANALYSIS);
               embs[mbi].refined|=0x80;
             }
             oc_cost_inter4mv(_enc,modes+OC_MODE_INTER_MV_FOUR,mbi,
              embs[mbi].ref_mv,_enc->pipe.fr+0,_enc->pipe.qs+0,
              skip_ssd,rd_scale);
           }
-          else if(modes[OC_MODE_GOLDEN_MV].cost+inter_mv_pref<
+          else if(!(sp_flags&OC_SP_FLAG_NOGOLDEN)&&
+           modes[OC_MODE_GOLDEN_MV].cost+inter_mv_pref<
            modes[OC_MODE_INTER_MV].cost){
             if(!(embs[mbi].refined&0x40)){
+              oc_enc_stage_switch(_enc,OC_ENC_STAGE_MOTION);
               oc_mcenc_refine1mv(_enc,mbi,OC_FRAME_GOLD);
+              oc_enc_stage_switch(_enc,OC_ENC_STAGE_ANALYSIS);
               embs[mbi].refined|=0x40;
             }
             mb_gmv_bits_0=oc_cost_inter1mv(_enc,modes+OC_MODE_GOLDEN_MV,mbi,
@@ -2485,7 +2951,9 @@ int oc_enc_analyze_inter(oc_enc_ctx *_enc,int _allow_keyframe,int _recode){
              _enc->pipe.fr+0,_enc->pipe.qs+0,skip_ssd,rd_scale);
           }
           if(!(embs[mbi].refined&0x04)){
+            oc_enc_stage_switch(_enc,OC_ENC_STAGE_MOTION);
             oc_mcenc_refine1mv(_enc,mbi,OC_FRAME_PREV);
+            oc_enc_stage_switch(_enc,OC_ENC_STAGE_ANALYSIS);
             embs[mbi].refined|=0x04;
           }
           mb_mv_bits_0=oc_cost_inter1mv(_enc,modes+OC_MODE_INTER_MV,mbi,
@@ -2537,6 +3005,10 @@ int oc_enc_analyze_inter(oc_enc_ctx *_enc,int _allow_keyframe,int _recode){
           }
           mb_mv_bits_0=mb_gmv_bits_0=0;
         }
+        if(refresh_mbi<refresh_mbi0){
+          mb_mode=oc_mb_refresh_mode(_enc,modes,mbi,mb_mode,last_mv,prior_mv,
+           refresh_mbi0);
+        }
         mb_modes[mbi]=mb_mode;
         /*Propagate the MVs to the luma blocks.*/
         if(mb_mode!=OC_MODE_INTER_MV_FOUR){
@@ -2559,8 +3031,18 @@ int oc_enc_analyze_inter(oc_enc_ctx *_enc,int _allow_keyframe,int _recode){
           fragi=sb_maps[mbi>>2][mbi&3][bi];
           frags[fragi].qii=modes[mb_mode].qii[bi];
         }
-        if(oc_enc_mb_transform_quantize_inter_luma(_enc,&_enc->pipe,mbi,
-         modes[mb_mode].overhead>>OC_BIT_SCALE,rd_scale,rd_iscale)>0){
+        if(skip){
+          oc_enc_mb_skip_inter_luma(_enc,&_enc->pipe,mbi);
+          coded=0;
+        }
+        else{
+          oc_enc_stage_switch(_enc,OC_ENC_STAGE_TRANSFORM);
+          coded=oc_enc_mb_transform_quantize_inter_luma(_enc,&_enc->pipe,mbi,
+           modes[mb_mode].overhead>>OC_BIT_SCALE,rd_scale,rd_iscale);
+          oc_enc_stage_switch(_enc,OC_ENC_STAGE_ANALYSIS);
+          if(coded<=0)embs[mbi].skip_qi=(unsigned char)_enc->state.qis[0];
+        }
+        if(coded>0){
           int orig_mb_mode;
           orig_mb_mode=mb_mode;
           mb_mode=mb_modes[mbi];
@@ -2668,8 +3150,10 @@ int oc_enc_analyze_inter(oc_enc_ctx *_enc,int _allow_keyframe,int _recode){
     oc_enc_pipeline_finish_mcu_plane(_enc,&_enc->pipe,0,notstart,notdone);
     /*Code chroma planes.*/
     for(pli=1;pli<3;pli++){
+      oc_enc_stage_switch(_enc,OC_ENC_STAGE_TRANSFORM);
       oc_enc_sb_transform_quantize_inter_chroma(_enc,&_enc->pipe,
        pli,_enc->pipe.sbi0[pli],_enc->pipe.sbi_end[pli]);
+      oc_enc_stage_switch(_enc,OC_ENC_STAGE_ANALYSIS);
       oc_enc_pipeline_finish_mcu_plane(_enc,&_enc->pipe,pli,notstart,notdone);
     }
     notstart=1;
@@ -2682,8 +3166,18 @@ int oc_enc_analyze_inter(oc_enc_ctx *_enc,int _allow_keyframe,int _recode){
    _enc->state.fplanes[0].nfrags));
   _enc->luma_avg=(unsigned)((luma_sum+(_enc->state.nmbs>>1))/_enc->state.nmbs);
   /*Finish filling in the reference frame borders.*/
+  oc_enc_stage_switch(_enc,OC_ENC_STAGE_FILTER);
   refi=_enc->state.ref_frame_idx[OC_FRAME_SELF];
   for(pli=0;pli<3;pli++)oc_state_borders_fill_caps(&_enc->state,refi,pli);
+  oc_enc_stage_switch(_enc,OC_ENC_STAGE_ANALYSIS);
+  /*Publish the analysis of this frame for any rungs of a bitrate ladder.
+    After a drop, the search used an older original reference frame than the
+     rungs will have.*/
+  if(!_recode&&!_enc->prevframe_dropped){
+    _enc->ladder_frame=_enc->state.curframe_num;
+    _enc->ladder_sp_level=sp_level;
+    _enc->ladder_sp_flags=sp_flags;
+  }
   /*Finish adding flagging overhead costs to inter bit counts to determine if
      we should have coded a key frame instead.*/
   if(_allow_keyframe){
@@ -162,6 +162,7 @@ static int oc_setup_unpack(oc_pack_buf *_opb,th_setup_info *_setup){
 static void oc_setup_clear(th_setup_info *_setup){
   oc_quant_params_clear(&_setup->qinfo);
   oc_huff_trees_clear(_setup->huff_tables);
+  _ogg_free(_setup->header);
 }
 
 static int oc_dec_headerin(oc_pack_buf *_opb,th_info *_info,
@@ -231,6 +232,14 @@ static int oc_dec_headerin(oc_pack_buf *_opb,th_info *_info,
         _ogg_free(setup);
       }
       else{
+        /*Keep a copy of the packet so decoders can recognize identical setup
+           headers.
+          This is only an optimization, so failing to allocate it is fine.*/
+        setup->header=(unsigned char *)_ogg_malloc(_op->bytes);
+        if(setup->header!=NULL){
+          memcpy(setup->header,_op->packet,_op->bytes);
+          setup->header_bytes=_op->bytes;
+        }
         *_setup=setup;
         ret=1;
       }
@@ -25,8 +25,10 @@
 # include "dequant.h"
 
 typedef struct th_setup_info         oc_setup_info;
+typedef struct oc_dec_setup          oc_dec_setup;
 typedef struct oc_dec_opt_vtable     oc_dec_opt_vtable;
 typedef struct oc_dec_pipeline_state oc_dec_pipeline_state;
+typedef struct oc_dec_plane_task     oc_dec_plane_task;
 typedef struct th_dec_ctx            oc_dec_ctx;
 
 
@@ -64,6 +66,53 @@ struct th_setup_info{
   ogg_int16_t   *huff_tables[TH_NHUFFMAN_TABLES];
   /*The quantization parameters.*/
   th_quant_info  qinfo;
+  /*A copy of the setup header packet, or NULL if there was not enough memory
+     to keep one.
+    Decoders use this to find others created from an identical header.*/
+  unsigned char *header;
+  long           header_bytes;
+};
+
+
+
+/*The tables built from a setup header.
+  Decoders created from identical setup headers share a single
+   reference-counted copy.
+  The dequantization tables for each qi are only built the first time a frame
+   uses that qi, and are never modified after that.*/
+struct oc_dec_setup{
+  /*The quantization parameters the dequantization tables are built from.*/
+  th_quant_info   qinfo;
+  /*Storage for the dequantization tables, indexed by qi, or NULL if they
+     have not been built yet.*/
+  oc_quant_table *dequant_table_data[64];
+  /*The dequantization tables, indexed by qi, pli, and qti.
+    Identical tables point to the same storage.*/
+  ogg_uint16_t   *dequant_tables[64][3][2];
+  /*Huffman decode trees.*/
+  ogg_int16_t    *huff_tables[TH_NHUFFMAN_TABLES];
+  /*The DC scale used for out-of-loop deblocking.*/
+  int             pp_dc_scale[64];
+  /*The sharpen modifier used for out-of-loop deringing.*/
+  int             pp_sharp_mod[64];
+  /*Loop filter strength parameters.*/
+  unsigned char   loop_filter_limits[64];
+  /*The setup header these were built from, or NULL if they are not shared.*/
+  unsigned char  *header;
+  long            header_bytes;
+  ogg_uint32_t    hash;
+  /*The number of decoders using these tables.*/
+  int             nrefs;
+  /*The next entry in the list of shared setups.*/
+  oc_dec_setup   *next;
+};
+
+
+
+/*The arguments for decoding one plane of an MCU as an executor task.*/
+struct oc_dec_plane_task{
+  oc_dec_ctx *dec;
+  int         pli;
 };
 
 
@@ -88,12 +137,14 @@ struct oc_dec_pipeline_state{
      reconstruction buffer, which saves passing another parameter to all the
      acceleration functios.
     It also solves problems with 16-byte alignment for NEON on ARM.
+    There is one buffer per plane, so that the planes of an MCU can be
+     decoded in parallel.
     gcc (as of 4.2.1) only seems to be able to give stack variables 8-byte
      alignment, and silently produces incorrect results if you ask for 16.
     Finally, keeping it off the stack means there's less likely to be a data
      hazard beween the NEON co-processor and the regular ARM core, which avoids
      unnecessary stalls.*/
-  OC_ALIGN16(ogg_int16_t dct_coeffs[128]);
+  OC_ALIGN16(ogg_int16_t dct_coeffs[3][128]);
   OC_ALIGN16(signed char bounding_values[256]);
   ptrdiff_t           ti[3][64];
   ptrdiff_t           ebi[3][64];
@@ -106,6 +157,18 @@ struct oc_dec_pipeline_state{
   int                 fragy0[3];
   int                 fragy_end[3];
   int                 pred_last[3][4];
+  /*The number of rows at the start and end of the current MCU in each plane
+     that cannot be output yet because the filters still need to see the
+     neighboring MCUs.*/
+  int                 sdelay[3];
+  int                 edelay[3];
+  /*The first luma fragment row of the current MCU.*/
+  int                 stripe_fragy;
+  /*Whether the current MCU is not the first, and not the last.*/
+  int                 notstart;
+  int                 notdone;
+  /*The index of the reference frame being decoded into.*/
+  int                 refi;
   int                 mcu_nvfrags;
   int                 loop_filter;
   int                 pp_level;
@@ -122,8 +185,8 @@ struct th_dec_ctx{
   int                    packet_state;
   /*Buffer in which to assemble packets.*/
   oc_pack_buf            opb;
-  /*Huffman decode trees.*/
-  ogg_int16_t           *huff_tables[TH_NHUFFMAN_TABLES];
+  /*The Huffman trees and dequantization tables for this stream.*/
+  oc_dec_setup          *setup;
   /*The index of the first token in each plane for each coefficient.*/
   ptrdiff_t              ti0[3][64];
   /*The number of outstanding EOB runs at the start of each coefficient in each
@@ -137,10 +200,6 @@ struct th_dec_ctx{
   int                    dct_tokens_count;
   /*The out-of-loop post-processing level.*/
   int                    pp_level;
-  /*The DC scale used for out-of-loop deblocking.*/
-  int                    pp_dc_scale[64];
-  /*The sharpen modifier used for out-of-loop deringing.*/
-  int                    pp_sharp_mod[64];
   /*The DC quantization index of each block.*/
   unsigned char         *dc_qis;
   /*The variance of each block.*/
@@ -155,6 +214,11 @@ struct th_dec_ctx{
   th_ycbcr_buffer        pp_frame_buf;
   /*The striped decode callback function.*/
   th_stripe_callback     stripe_cb;
+  /*The executor used to decode planes in parallel.
+    submit is NULL if there is none.*/
+  th_executor            executor;
+  /*The tasks handed to the executor.*/
+  oc_dec_plane_task      plane_tasks[3];
   oc_dec_pipeline_state  pipe;
 # if defined(OC_DEC_USE_VTABLE)
   /*Table for decoder acceleration functions.*/
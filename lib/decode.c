@@ -19,6 +19,9 @@
 #include <string.h>
 #include <ogg/ogg.h>
 #include "decint.h"
+#if defined(OC_HAVE_PTHREAD)
+# include <pthread.h>
+#endif
 #if defined(OC_DUMP_IMAGES)
 # include <stdio.h>
 # include "png.h"
@@ -365,50 +368,200 @@ void oc_dec_accel_init_c(oc_dec_ctx *_dec){
 # endif
 }
 
-static int oc_dec_init(oc_dec_ctx *_dec,const th_info *_info,
- const th_setup_info *_setup){
-  int qti;
-  int pli;
+#if defined(OC_HAVE_PTHREAD)
+/*The list of setup tables currently in use, shared by every decoder in the
+   process.*/
+static oc_dec_setup    *oc_dec_setups;
+static pthread_mutex_t  oc_dec_setups_lock=PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+/*A 32-bit FNV-1a hash of the setup header packet.*/
+static ogg_uint32_t oc_dec_setup_hash(const unsigned char *_buf,long _nbytes){
+  ogg_uint32_t h;
+  long         i;
+  h=0x811C9DC5;
+  for(i=0;i<_nbytes;i++)h=(h^_buf[i])*0x01000193;
+  return h;
+}
+
+static void oc_dec_setup_free(oc_dec_setup *_setup){
   int qi;
-  int ret;
-  ret=oc_state_init(&_dec->state,_info,3);
+  for(qi=0;qi<64;qi++)oc_aligned_free(_setup->dequant_table_data[qi]);
+  oc_quant_params_clear(&_setup->qinfo);
+  oc_huff_trees_clear(_setup->huff_tables);
+  _ogg_free(_setup->header);
+  _ogg_free(_setup);
+}
+
+/*Builds the decoder tables for the given setup information.
+  Return: The new tables with a single reference, or NULL on failure.*/
+static oc_dec_setup *oc_dec_setup_build(const th_setup_info *_setup){
+  oc_dec_setup *setup;
+  setup=(oc_dec_setup *)_ogg_calloc(1,sizeof(*setup));
+  if(setup==NULL)return NULL;
+  if(oc_quant_params_copy(&setup->qinfo,&_setup->qinfo)<0){
+    oc_quant_params_clear(&setup->qinfo);
+    _ogg_free(setup);
+    return NULL;
+  }
+  if(oc_huff_trees_copy(setup->huff_tables,
+   (const ogg_int16_t *const *)_setup->huff_tables)<0){
+    oc_quant_params_clear(&setup->qinfo);
+    _ogg_free(setup);
+    return NULL;
+  }
+  memcpy(setup->loop_filter_limits,_setup->qinfo.loop_filter_limits,
+   sizeof(setup->loop_filter_limits));
+  setup->nrefs=1;
+  return setup;
+}
+
+/*Builds the dequantization tables and the values derived from them for a
+   single qi, if they have not been built already.
+  If the tables are shared, the caller must hold the lock.*/
+static int oc_dec_setup_qi_init(oc_dec_setup *_setup,int _qi){
+  oc_quant_table *data;
+  int             qsum;
+  int             qti;
+  int             pli;
+  if(_setup->dequant_table_data[_qi]!=NULL)return 0;
+  data=(oc_quant_table *)oc_aligned_malloc(6*sizeof(*data),16);
+  if(data==NULL)return TH_EFAULT;
+  for(pli=0;pli<3;pli++)for(qti=0;qti<2;qti++){
+    _setup->dequant_tables[_qi][pli][qti]=data[pli*2+qti];
+  }
+  oc_dequant_tables_init_qi(_setup->dequant_tables[_qi],
+   _setup->pp_dc_scale+_qi,&_setup->qinfo,_qi);
+  qsum=0;
+  for(qti=0;qti<2;qti++)for(pli=0;pli<3;pli++){
+    qsum+=_setup->dequant_tables[_qi][pli][qti][12]+
+     _setup->dequant_tables[_qi][pli][qti][17]+
+     _setup->dequant_tables[_qi][pli][qti][18]+
+     _setup->dequant_tables[_qi][pli][qti][24]<<(pli==0);
+  }
+  _setup->pp_sharp_mod[_qi]=-(qsum>>11);
+  _setup->dequant_table_data[_qi]=data;
+  return 0;
+}
+
+/*Acquires a reference to the decoder tables for the given setup information.
+  If another decoder was created from an identical setup header, its tables
+   are shared instead of building a new copy.
+  Return: The tables, or NULL on failure.*/
+static oc_dec_setup *oc_dec_setup_get(const th_setup_info *_setup){
+#if defined(OC_HAVE_PTHREAD)
+  oc_dec_setup *setup;
+  ogg_uint32_t  hash;
+  /*Without a copy of the header we can't tell whether two setups match.*/
+  if(_setup->header==NULL)return oc_dec_setup_build(_setup);
+  hash=oc_dec_setup_hash(_setup->header,_setup->header_bytes);
+  pthread_mutex_lock(&oc_dec_setups_lock);
+  for(setup=oc_dec_setups;setup!=NULL;setup=setup->next){
+    if(setup->hash==hash&&setup->header_bytes==_setup->header_bytes
+     &&memcmp(setup->header,_setup->header,_setup->header_bytes)==0){
+      setup->nrefs++;
+      break;
+    }
+  }
+  if(setup==NULL){
+    setup=oc_dec_setup_build(_setup);
+    if(setup!=NULL){
+      setup->header=(unsigned char *)_ogg_malloc(_setup->header_bytes);
+      /*If we can't keep a copy of the header, just don't share these.*/
+      if(setup->header!=NULL){
+        memcpy(setup->header,_setup->header,_setup->header_bytes);
+        setup->header_bytes=_setup->header_bytes;
+        setup->hash=hash;
+        setup->next=oc_dec_setups;
+        oc_dec_setups=setup;
+      }
+    }
+  }
+  pthread_mutex_unlock(&oc_dec_setups_lock);
+  return setup;
+#else
+  /*Without a lock to protect the list of shared tables, each decoder gets
+     its own copy.*/
+  return oc_dec_setup_build(_setup);
+#endif
+}
+
+/*Releases a reference to the decoder tables, freeing them if it was the last
+   one.*/
+static void oc_dec_setup_release(oc_dec_setup *_setup){
+#if defined(OC_HAVE_PTHREAD)
+  if(_setup->header!=NULL){
+    int nrefs;
+    pthread_mutex_lock(&oc_dec_setups_lock);
+    nrefs=--_setup->nrefs;
+    if(nrefs<=0){
+      oc_dec_setup **pnext;
+      for(pnext=&oc_dec_setups;*pnext!=_setup;pnext=&(*pnext)->next);
+      *pnext=_setup->next;
+    }
+    pthread_mutex_unlock(&oc_dec_setups_lock);
+    if(nrefs>0)return;
+  }
+#endif
+  oc_dec_setup_free(_setup);
+}
+
+/*Points the decoder at a new set of tables.
+  The dequantization tables are fetched as frames need them.*/
+static void oc_dec_setup_attach(oc_dec_ctx *_dec,oc_dec_setup *_setup){
+  _dec->setup=_setup;
+  memset(_dec->state.dequant_tables,0,sizeof(_dec->state.dequant_tables));
+  memcpy(_dec->state.loop_filter_limits,_setup->loop_filter_limits,
+   sizeof(_dec->state.loop_filter_limits));
+}
+
+/*Makes sure the dequantization tables for the given qi are available.*/
+static int oc_dec_dequant_tables_get(oc_dec_ctx *_dec,int _qi){
+  oc_dec_setup *setup;
+  int           ret;
+  if(_dec->state.dequant_tables[_qi][0][0]!=NULL)return 0;
+  setup=_dec->setup;
+#if defined(OC_HAVE_PTHREAD)
+  /*Shared tables may be built by another decoder at the same time.*/
+  if(setup->header!=NULL){
+    pthread_mutex_lock(&oc_dec_setups_lock);
+    ret=oc_dec_setup_qi_init(setup,_qi);
+    pthread_mutex_unlock(&oc_dec_setups_lock);
+  }
+  else ret=oc_dec_setup_qi_init(setup,_qi);
+#else
+  ret=oc_dec_setup_qi_init(setup,_qi);
+#endif
   if(ret<0)return ret;
-  ret=oc_huff_trees_copy(_dec->huff_tables,
-   (const ogg_int16_t *const *)_setup->huff_tables);
-  if(ret<0){
+  memcpy(_dec->state.dequant_tables[_qi],setup->dequant_tables[_qi],
+   sizeof(_dec->state.dequant_tables[_qi]));
+  return 0;
+}
+
+static int oc_dec_init(oc_dec_ctx *_dec,const th_info *_info,
+ const th_setup_info *_setup,const oc_mem *_mem){
+  oc_dec_setup *setup;
+  int           ret;
+  ret=oc_state_init(&_dec->state,_info,3,_mem);
+  if(ret<0)return ret;
+  setup=oc_dec_setup_get(_setup);
+  if(setup==NULL){
     oc_state_clear(&_dec->state);
-    return ret;
+    return TH_EFAULT;
   }
   /*For each fragment, allocate one byte for every DCT coefficient token, plus
      one byte for extra-bits for each token, plus one more byte for the long
      EOB run, just in case it's the very last token and has a run length of
      one.*/
-  _dec->dct_tokens=(unsigned char *)_ogg_malloc((64+64+1)*
-   _dec->state.nfrags*sizeof(_dec->dct_tokens[0]));
+  _dec->dct_tokens=(unsigned char *)oc_mem_alloc(&_dec->state.mem,
+   (64+64+1)*_dec->state.nfrags*sizeof(_dec->dct_tokens[0]),16,
+   TH_ALLOC_SCRATCH);
   if(_dec->dct_tokens==NULL){
-    oc_huff_trees_clear(_dec->huff_tables);
+    oc_dec_setup_release(setup);
     oc_state_clear(&_dec->state);
     return TH_EFAULT;
   }
-  for(qi=0;qi<64;qi++)for(pli=0;pli<3;pli++)for(qti=0;qti<2;qti++){
-    _dec->state.dequant_tables[qi][pli][qti]=
-     _dec->state.dequant_table_data[qi][pli][qti];
-  }
-  oc_dequant_tables_init(_dec->state.dequant_tables,_dec->pp_dc_scale,
-   &_setup->qinfo);
-  for(qi=0;qi<64;qi++){
-    int qsum;
-    qsum=0;
-    for(qti=0;qti<2;qti++)for(pli=0;pli<3;pli++){
-      qsum+=_dec->state.dequant_tables[qi][pli][qti][12]+
-       _dec->state.dequant_tables[qi][pli][qti][17]+
-       _dec->state.dequant_tables[qi][pli][qti][18]+
-       _dec->state.dequant_tables[qi][pli][qti][24]<<(pli==0);
-    }
-    _dec->pp_sharp_mod[qi]=-(qsum>>11);
-  }
-  memcpy(_dec->state.loop_filter_limits,_setup->qinfo.loop_filter_limits,
-   sizeof(_dec->state.loop_filter_limits));
+  oc_dec_setup_attach(_dec,setup);
   oc_dec_accel_init(_dec);
   _dec->pp_level=OC_PP_LEVEL_DISABLED;
   _dec->dc_qis=NULL;
@@ -416,6 +569,7 @@ static int oc_dec_init(oc_dec_ctx *_dec,const th_info *_info,
   _dec->pp_frame_data=NULL;
   _dec->stripe_cb.ctx=NULL;
   _dec->stripe_cb.stripe_decoded=NULL;
+  memset(&_dec->executor,0,sizeof(_dec->executor));
 #if defined(HAVE_CAIRO)
   _dec->telemetry=0;
   _dec->telemetry_bits=0;
@@ -431,17 +585,18 @@ static void oc_dec_clear(oc_dec_ctx *_dec){
 #if defined(HAVE_CAIRO)
   _ogg_free(_dec->telemetry_frame_data);
 #endif
-  _ogg_free(_dec->pp_frame_data);
-  _ogg_free(_dec->variances);
-  _ogg_free(_dec->dc_qis);
-  _ogg_free(_dec->dct_tokens);
-  oc_huff_trees_clear(_dec->huff_tables);
+  oc_mem_free(&_dec->state.mem,_dec->pp_frame_data,TH_ALLOC_FRAME);
+  oc_mem_free(&_dec->state.mem,_dec->variances,TH_ALLOC_SCRATCH);
+  oc_mem_free(&_dec->state.mem,_dec->dc_qis,TH_ALLOC_SCRATCH);
+  oc_mem_free(&_dec->state.mem,_dec->dct_tokens,TH_ALLOC_SCRATCH);
+  oc_dec_setup_release(_dec->setup);
   oc_state_clear(&_dec->state);
 }
 
 
 static int oc_dec_frame_header_unpack(oc_dec_ctx *_dec){
   long val;
+  int  qii;
   /*Check to make sure this is a data packet.*/
   val=oc_pack_read1(&_dec->opb);
   if(val!=0)return TH_EBADPACKET;
@@ -473,6 +628,12 @@ static int oc_dec_frame_header_unpack(oc_dec_ctx *_dec){
     val=oc_pack_read(&_dec->opb,3);
     if(val!=0)return TH_EIMPL;
   }
+  /*Build any dequantization tables we have not needed before.*/
+  for(qii=0;qii<_dec->state.nqis;qii++){
+    int ret;
+    ret=oc_dec_dequant_tables_get(_dec,_dec->state.qis[qii]);
+    if(ret<0)return ret;
+  }
   return 0;
 }
 
@@ -1026,7 +1187,7 @@ static ptrdiff_t oc_dec_dc_coeff_unpack(oc_dec_ctx *_dec,int _huff_idxs[2],
       int eb;
       int skip;
       token=oc_huff_token_decode(&_dec->opb,
-       _dec->huff_tables[_huff_idxs[pli+1>>1]]);
+       _dec->setup->huff_tables[_huff_idxs[pli+1>>1]]);
       dct_tokens[ti++]=(unsigned char)token;
       if(OC_DCT_TOKEN_NEEDS_MORE(token)){
         eb=(int)oc_pack_read(&_dec->opb,
@@ -1104,7 +1265,7 @@ static int oc_dec_ac_coeff_unpack(oc_dec_ctx *_dec,int _zzi,int _huff_idxs[2],
       ntoks+=_eobs;
       eob_count+=_eobs;
       token=oc_huff_token_decode(&_dec->opb,
-       _dec->huff_tables[_huff_idxs[pli+1>>1]]);
+       _dec->setup->huff_tables[_huff_idxs[pli+1>>1]]);
       dct_tokens[ti++]=(unsigned char)token;
       if(OC_DCT_TOKEN_NEEDS_MORE(token)){
         eb=(int)oc_pack_read(&_dec->opb,
@@ -1209,11 +1370,11 @@ static int oc_dec_postprocess_init(oc_dec_ctx *_dec){
   /*pp_level 0: disabled; free any memory used and return*/
   if(_dec->pp_level<=OC_PP_LEVEL_DISABLED){
     if(_dec->dc_qis!=NULL){
-      _ogg_free(_dec->dc_qis);
+      oc_mem_free(&_dec->state.mem,_dec->dc_qis,TH_ALLOC_SCRATCH);
       _dec->dc_qis=NULL;
-      _ogg_free(_dec->variances);
+      oc_mem_free(&_dec->state.mem,_dec->variances,TH_ALLOC_SCRATCH);
       _dec->variances=NULL;
-      _ogg_free(_dec->pp_frame_data);
+      oc_mem_free(&_dec->state.mem,_dec->pp_frame_data,TH_ALLOC_FRAME);
       _dec->pp_frame_data=NULL;
     }
     return 1;
@@ -1222,8 +1383,8 @@ static int oc_dec_postprocess_init(oc_dec_ctx *_dec){
     /*If we haven't been tracking DC quantization indices, there's no point in
        starting now.*/
     if(_dec->state.frame_type!=OC_INTRA_FRAME)return 1;
-    _dec->dc_qis=(unsigned char *)_ogg_malloc(
-     _dec->state.nfrags*sizeof(_dec->dc_qis[0]));
+    _dec->dc_qis=(unsigned char *)oc_mem_alloc(&_dec->state.mem,
+     _dec->state.nfrags*sizeof(_dec->dc_qis[0]),16,TH_ALLOC_SCRATCH);
     if(_dec->dc_qis==NULL)return 1;
     memset(_dec->dc_qis,_dec->state.qis[0],_dec->state.nfrags);
   }
@@ -1246,9 +1407,9 @@ static int oc_dec_postprocess_init(oc_dec_ctx *_dec){
   /*pp_level 1: Stop after updating DC quantization indices.*/
   if(_dec->pp_level<=OC_PP_LEVEL_TRACKDCQI){
     if(_dec->variances!=NULL){
-      _ogg_free(_dec->variances);
+      oc_mem_free(&_dec->state.mem,_dec->variances,TH_ALLOC_SCRATCH);
       _dec->variances=NULL;
-      _ogg_free(_dec->pp_frame_data);
+      oc_mem_free(&_dec->state.mem,_dec->pp_frame_data,TH_ALLOC_FRAME);
       _dec->pp_frame_data=NULL;
     }
     return 1;
@@ -1266,14 +1427,14 @@ static int oc_dec_postprocess_init(oc_dec_ctx *_dec){
        them; this simplifies allocation state management, though it may waste
        memory on the few systems that don't overcommit pages.*/
     frame_sz+=c_sz<<1;
-    _dec->pp_frame_data=(unsigned char *)_ogg_malloc(
-     frame_sz*sizeof(_dec->pp_frame_data[0]));
-    _dec->variances=(int *)_ogg_malloc(
-     _dec->state.nfrags*sizeof(_dec->variances[0]));
+    _dec->pp_frame_data=(unsigned char *)oc_mem_alloc(&_dec->state.mem,
+     frame_sz*sizeof(_dec->pp_frame_data[0]),16,TH_ALLOC_FRAME);
+    _dec->variances=(int *)oc_mem_alloc(&_dec->state.mem,
+     _dec->state.nfrags*sizeof(_dec->variances[0]),16,TH_ALLOC_SCRATCH);
     if(_dec->variances==NULL||_dec->pp_frame_data==NULL){
-      _ogg_free(_dec->pp_frame_data);
+      oc_mem_free(&_dec->state.mem,_dec->pp_frame_data,TH_ALLOC_FRAME);
       _dec->pp_frame_data=NULL;
-      _ogg_free(_dec->variances);
+      oc_mem_free(&_dec->state.mem,_dec->variances,TH_ALLOC_SCRATCH);
       _dec->variances=NULL;
       return 1;
     }
@@ -1382,8 +1543,10 @@ static void oc_dec_pipeline_init(oc_dec_ctx *_dec,
      _dec->state.ref_frame_bufs[_dec->state.ref_frame_idx[OC_FRAME_SELF]],
      sizeof(_dec->pp_frame_buf[0])*3);
   }
-  /*Clear down the DCT coefficient buffer for the first block.*/
-  for(zzi=0;zzi<64;zzi++)_pipe->dct_coeffs[zzi]=0;
+  /*Clear down the DCT coefficient buffers for the first block.*/
+  for(pli=0;pli<3;pli++){
+    for(zzi=0;zzi<64;zzi++)_pipe->dct_coeffs[pli][zzi]=0;
+  }
 }
 
 /*Undo the DC prediction in a single plane of an MCU (one or two super block
@@ -1513,6 +1676,7 @@ static void oc_dec_frags_recon_mcu_plane(oc_dec_ctx *_dec,
  oc_dec_pipeline_state *_pipe,int _pli){
   unsigned char       *dct_tokens;
   const unsigned char *dct_fzig_zag;
+  ogg_int16_t         *dct_coeffs;
   ogg_uint16_t         dc_quant[2];
   const oc_fragment   *frags;
   const ptrdiff_t     *coded_fragis;
@@ -1523,6 +1687,7 @@ static void oc_dec_frags_recon_mcu_plane(oc_dec_ctx *_dec,
   int                  qti;
   dct_tokens=_dec->dct_tokens;
   dct_fzig_zag=_dec->state.opt_data.dct_fzig_zag;
+  dct_coeffs=_pipe->dct_coeffs[_pli];
   frags=_dec->state.frags;
   coded_fragis=_pipe->coded_fragis[_pli];
   ncoded_fragis=_pipe->ncoded_fragis[_pli];
@@ -1571,19 +1736,18 @@ static void oc_dec_frags_recon_mcu_plane(oc_dec_ctx *_dec,
         eob_runs[zzi]=eob;
         ti[zzi]=lti;
         zzi+=rlen;
-        _pipe->dct_coeffs[dct_fzig_zag[zzi]]=
-         (ogg_int16_t)(coeff*(int)ac_quant[zzi]);
+        dct_coeffs[dct_fzig_zag[zzi]]=(ogg_int16_t)(coeff*(int)ac_quant[zzi]);
         zzi+=!eob;
       }
     }
     /*TODO: zzi should be exactly 64 here.
       If it's not, we should report some kind of warning.*/
     zzi=OC_MINI(zzi,64);
-    _pipe->dct_coeffs[0]=(ogg_int16_t)frags[fragi].dc;
+    dct_coeffs[0]=(ogg_int16_t)frags[fragi].dc;
     /*last_zzi is always initialized.
       If your compiler thinks otherwise, it is dumb.*/
     oc_state_frag_recon(&_dec->state,fragi,_pli,
-     _pipe->dct_coeffs,last_zzi,dc_quant[qti]);
+     dct_coeffs,last_zzi,dc_quant[qti]);
   }
   _pipe->coded_fragis[_pli]+=ncoded_fragis;
   /*Right now the reconstructed MCU has only the coded blocks in it.*/
@@ -1745,14 +1909,14 @@ static void oc_dec_deblock_frag_rows(oc_dec_ctx *_dec,
   /*We also want to skip the last row in the frame for this loop.*/
   y_end=_fragy_end-!notdone<<3;
   for(;y<y_end;y+=8){
-    qstep=_dec->pp_dc_scale[*dc_qi];
+    qstep=_dec->setup->pp_dc_scale[*dc_qi];
     flimit=(qstep*3)>>2;
     oc_filter_hedge(dst,dst_ystride,src-src_ystride,src_ystride,
      qstep,flimit,variance,variance+nhfrags);
     variance++;
     dc_qi++;
     for(x=8;x<width;x+=8){
-      qstep=_dec->pp_dc_scale[*dc_qi];
+      qstep=_dec->setup->pp_dc_scale[*dc_qi];
       flimit=(qstep*3)>>2;
       oc_filter_hedge(dst+x,dst_ystride,src+x-src_ystride,src_ystride,
        qstep,flimit,variance,variance+nhfrags);
@@ -1776,7 +1940,7 @@ static void oc_dec_deblock_frag_rows(oc_dec_ctx *_dec,
     /*Filter the last row of vertical block edges.*/
     dc_qi++;
     for(x=8;x<width;x+=8){
-      qstep=_dec->pp_dc_scale[*dc_qi++];
+      qstep=_dec->setup->pp_dc_scale[*dc_qi++];
       flimit=(qstep*3)>>2;
       oc_filter_vedge(dst+x-(dst_ystride<<3)-4,dst_ystride,
        qstep,flimit,variance++);
@@ -1931,24 +2095,24 @@ static void oc_dec_dering_frag_rows(oc_dec_ctx *_dec,th_img_plane *_img,
       b=(x<=0)|(x+8>=width)<<1|(y<=0)<<2|(y+8>=height)<<3;
       if(strong&&var>sthresh){
         oc_dering_block(idata+x,ystride,b,
-         _dec->pp_dc_scale[qi],_dec->pp_sharp_mod[qi],1);
+         _dec->setup->pp_dc_scale[qi],_dec->setup->pp_sharp_mod[qi],1);
         if(_pli||!(b&1)&&*(variance-1)>OC_DERING_THRESH4||
          !(b&2)&&variance[1]>OC_DERING_THRESH4||
          !(b&4)&&*(variance-nhfrags)>OC_DERING_THRESH4||
          !(b&8)&&variance[nhfrags]>OC_DERING_THRESH4){
           oc_dering_block(idata+x,ystride,b,
-           _dec->pp_dc_scale[qi],_dec->pp_sharp_mod[qi],1);
+           _dec->setup->pp_dc_scale[qi],_dec->setup->pp_sharp_mod[qi],1);
           oc_dering_block(idata+x,ystride,b,
-           _dec->pp_dc_scale[qi],_dec->pp_sharp_mod[qi],1);
+           _dec->setup->pp_dc_scale[qi],_dec->setup->pp_sharp_mod[qi],1);
         }
       }
       else if(var>OC_DERING_THRESH2){
         oc_dering_block(idata+x,ystride,b,
-         _dec->pp_dc_scale[qi],_dec->pp_sharp_mod[qi],1);
+         _dec->setup->pp_dc_scale[qi],_dec->setup->pp_sharp_mod[qi],1);
       }
       else if(var>OC_DERING_THRESH1){
         oc_dering_block(idata+x,ystride,b,
-         _dec->pp_dc_scale[qi],_dec->pp_sharp_mod[qi],0);
+         _dec->setup->pp_dc_scale[qi],_dec->setup->pp_sharp_mod[qi],0);
       }
       frag++;
       variance++;
@@ -1959,25 +2123,160 @@ static void oc_dec_dering_frag_rows(oc_dec_ctx *_dec,th_img_plane *_img,
 
 
 
-th_dec_ctx *th_decode_alloc(const th_info *_info,const th_setup_info *_setup){
+/*Runs every stage of the pipeline over one plane of the current MCU.
+  The planes only share read-only state, so this can be run for all three at
+   once.*/
+static void oc_dec_mcu_plane_decode(oc_dec_ctx *_dec,
+ oc_dec_pipeline_state *_pipe,int _pli){
+  oc_fragment_plane *fplane;
+  int                frag_shift;
+  int                pp_offset;
+  int                sdelay;
+  int                edelay;
+  fplane=_dec->state.fplanes+_pli;
+  /*Compute the first and last fragment row of the current MCU for this
+     plane.*/
+  frag_shift=_pli!=0&&!(_dec->state.info.pixel_fmt&2);
+  _pipe->fragy0[_pli]=_pipe->stripe_fragy>>frag_shift;
+  _pipe->fragy_end[_pli]=OC_MINI(fplane->nvfrags,
+   _pipe->fragy0[_pli]+(_pipe->mcu_nvfrags>>frag_shift));
+  oc_dec_dc_unpredict_mcu_plane(_dec,_pipe,_pli);
+  oc_dec_frags_recon_mcu_plane(_dec,_pipe,_pli);
+  sdelay=edelay=0;
+  if(_pipe->loop_filter){
+    sdelay+=_pipe->notstart;
+    edelay+=_pipe->notdone;
+    oc_state_loop_filter_frag_rows(&_dec->state,
+     _pipe->bounding_values,OC_FRAME_SELF,_pli,
+     _pipe->fragy0[_pli]-sdelay,_pipe->fragy_end[_pli]-edelay);
+  }
+  /*To fill the borders, we have an additional two pixel delay, since a
+     fragment in the next row could filter its top edge, using two pixels
+     from a fragment in this row.
+    But there's no reason to delay a full fragment between the two.*/
+  oc_state_borders_fill_rows(&_dec->state,_pipe->refi,_pli,
+   (_pipe->fragy0[_pli]-sdelay<<3)-(sdelay<<1),
+   (_pipe->fragy_end[_pli]-edelay<<3)-(edelay<<1));
+  /*Out-of-loop post-processing.*/
+  pp_offset=3*(_pli!=0);
+  if(_pipe->pp_level>=OC_PP_LEVEL_DEBLOCKY+pp_offset){
+    /*Perform de-blocking in one plane.*/
+    sdelay+=_pipe->notstart;
+    edelay+=_pipe->notdone;
+    oc_dec_deblock_frag_rows(_dec,_dec->pp_frame_buf,
+     _dec->state.ref_frame_bufs[_pipe->refi],_pli,
+     _pipe->fragy0[_pli]-sdelay,_pipe->fragy_end[_pli]-edelay);
+    if(_pipe->pp_level>=OC_PP_LEVEL_DERINGY+pp_offset){
+      /*Perform de-ringing in one plane.*/
+      sdelay+=_pipe->notstart;
+      edelay+=_pipe->notdone;
+      oc_dec_dering_frag_rows(_dec,_dec->pp_frame_buf,_pli,
+       _pipe->fragy0[_pli]-sdelay,_pipe->fragy_end[_pli]-edelay);
+    }
+  }
+  /*If no post-processing is done, we still need to delay a row for the
+     loop filter, thanks to the strange filtering order VP3 chose.*/
+  else if(_pipe->loop_filter){
+    sdelay+=_pipe->notstart;
+    edelay+=_pipe->notdone;
+  }
+  _pipe->sdelay[_pli]=sdelay;
+  _pipe->edelay[_pli]=edelay;
+}
+
+/*Decodes one plane of the current MCU on an executor thread.*/
+static void oc_dec_mcu_plane_task(void *_task){
+  oc_dec_plane_task *task;
+  oc_dec_ctx        *dec;
+  task=(oc_dec_plane_task *)_task;
+  dec=task->dec;
+  oc_dec_mcu_plane_decode(dec,&dec->pipe,task->pli);
+  /*Leave the thread's FPU state the way we found it.*/
+  oc_restore_fpu(&dec->state);
+}
+
+
+
+/*Allocates and initializes a decoder using the given allocator.*/
+static oc_dec_ctx *oc_dec_create(const oc_mem *_mem,const th_info *_info,
+ const th_setup_info *_setup){
+  oc_mem      mem;
   oc_dec_ctx *dec;
-  if(_info==NULL||_setup==NULL)return NULL;
-  dec=oc_aligned_malloc(sizeof(*dec),16);
-  if(dec==NULL||oc_dec_init(dec,_info,_setup)<0){
-    oc_aligned_free(dec);
+  mem=*_mem;
+  dec=(oc_dec_ctx *)oc_mem_alloc(&mem,sizeof(*dec),16,TH_ALLOC_CONTEXT);
+  if(dec==NULL)return NULL;
+  if(oc_dec_init(dec,_info,_setup,&mem)<0){
+    oc_mem_free(&mem,dec,TH_ALLOC_CONTEXT);
     return NULL;
   }
   dec->state.curframe_num=0;
   return dec;
 }
 
+th_dec_ctx *th_decode_alloc(const th_info *_info,const th_setup_info *_setup){
+  return th_decode_alloc_with(_info,_setup,NULL);
+}
+
+th_dec_ctx *th_decode_alloc_with(const th_info *_info,
+ const th_setup_info *_setup,const th_allocator *_alloc){
+  oc_mem      mem;
+  oc_dec_ctx *dec;
+  if(_info==NULL||_setup==NULL)return NULL;
+  if(_alloc!=NULL&&(_alloc->alloc==NULL)!=(_alloc->free==NULL))return NULL;
+  oc_mem_init(&mem,_alloc);
+  if(mem.hooks.flags&TH_ALLOCF_ARENA){
+    size_t arena_sz;
+    /*Create the decoder once with separate allocations to find out how much
+       space it needs.*/
+    dec=oc_dec_create(&mem,_info,_setup);
+    if(dec==NULL)return NULL;
+    arena_sz=dec->state.mem.nbytes;
+    th_decode_free(dec);
+    if(oc_mem_arena_init(&mem,arena_sz)<0)return NULL;
+  }
+  dec=oc_dec_create(&mem,_info,_setup);
+  if(dec==NULL)oc_mem_clear(&mem);
+  return dec;
+}
+
 void th_decode_free(th_dec_ctx *_dec){
   if(_dec!=NULL){
+    oc_mem mem;
     oc_dec_clear(_dec);
-    oc_aligned_free(_dec);
+    mem=_dec->state.mem;
+    oc_mem_free(&mem,_dec,TH_ALLOC_CONTEXT);
+    oc_mem_clear(&mem);
   }
 }
 
+int th_decode_reset(th_dec_ctx *_dec,const th_info *_info,
+ const th_setup_info *_setup){
+  oc_dec_setup *setup;
+  int           ret;
+  if(_dec==NULL||_info==NULL)return TH_EFAULT;
+  /*Acquire the new tables first, so we can fail without changing anything.*/
+  setup=NULL;
+  if(_setup!=NULL){
+    setup=oc_dec_setup_get(_setup);
+    if(setup==NULL)return TH_EFAULT;
+  }
+  ret=oc_state_reset(&_dec->state,_info);
+  if(ret<0){
+    if(setup!=NULL)oc_dec_setup_release(setup);
+    return ret;
+  }
+  if(setup!=NULL){
+    oc_dec_setup_release(_dec->setup);
+    oc_dec_setup_attach(_dec,setup);
+  }
+  /*The post-processing buffers are kept, but DC quantization indices have to
+     be tracked again starting from the next keyframe.*/
+  oc_mem_free(&_dec->state.mem,_dec->dc_qis,TH_ALLOC_SCRATCH);
+  _dec->dc_qis=NULL;
+  _dec->state.curframe_num=0;
+  return 0;
+}
+
 int th_decode_ctl(th_dec_ctx *_dec,int _req,void *_buf,
  size_t _buf_sz){
   switch(_req){
@@ -2018,6 +2317,19 @@ int th_decode_ctl(th_dec_ctx *_dec,int _req,void *_buf,
     _dec->stripe_cb.stripe_decoded=cb->stripe_decoded;
     return 0;
   }break;
+  case TH_DECCTL_SET_EXECUTOR:{
+    th_executor *executor;
+    if(_dec==NULL)return TH_EFAULT;
+    if(_buf==NULL){
+      memset(&_dec->executor,0,sizeof(_dec->executor));
+      return 0;
+    }
+    if(_buf_sz!=sizeof(th_executor))return TH_EINVAL;
+    executor=(th_executor *)_buf;
+    if(executor->submit==NULL||executor->wait==NULL)return TH_EFAULT;
+    _dec->executor=*executor;
+    return 0;
+  }break;
 #ifdef HAVE_CAIRO
   case TH_DECCTL_SET_TELEMETRY_MBMODE:{
     if(_dec==NULL||_buf==NULL)return TH_EFAULT;
@@ -2782,6 +3094,7 @@ int th_decode_packetin(th_dec_ctx *_dec,const ogg_packet *_op,
     int             pli;
     int             notstart;
     int             notdone;
+    int             parallel;
 #ifdef HAVE_CAIRO
     int             telemetry;
     /*Save the current telemetry state.
@@ -2845,6 +3158,8 @@ int th_decode_packetin(th_dec_ctx *_dec,const ogg_packet *_op,
       Otherwise, an MCU consists of one super block row from each plane.
       Inside each MCU, we perform all of the steps on one color plane before
        moving on to the next.
+      No stage looks at more than one plane, so with an executor the planes of
+       an MCU are decoded at the same time.
       After reconstruction, the additional filtering stages introduce a delay
        since they need some pixels from the next fragment row.
       Thus the actual number of decoded rows available is slightly smaller for
@@ -2857,6 +3172,10 @@ int th_decode_packetin(th_dec_ctx *_dec,const ogg_packet *_op,
        in cache.*/
     oc_dec_pipeline_init(_dec,&_dec->pipe);
     oc_ycbcr_buffer_flip(stripe_buf,_dec->pp_frame_buf);
+    _dec->pipe.refi=refi;
+    /*The chroma planes are handed to the executor while we decode the luma
+       plane ourselves.*/
+    parallel=_dec->executor.submit!=NULL&&_dec->executor.concurrency>1;
     notstart=0;
     notdone=1;
     for(stripe_fragy=0;notdone;stripe_fragy+=_dec->pipe.mcu_nvfrags){
@@ -2864,68 +3183,38 @@ int th_decode_packetin(th_dec_ctx *_dec,const ogg_packet *_op,
       int avail_fragy_end;
       avail_fragy0=avail_fragy_end=_dec->state.fplanes[0].nvfrags;
       notdone=stripe_fragy+_dec->pipe.mcu_nvfrags<avail_fragy_end;
-      for(pli=0;pli<3;pli++){
-        oc_fragment_plane *fplane;
-        int                frag_shift;
-        int                pp_offset;
-        int                sdelay;
-        int                edelay;
-        fplane=_dec->state.fplanes+pli;
-        /*Compute the first and last fragment row of the current MCU for this
-           plane.*/
-        frag_shift=pli!=0&&!(_dec->state.info.pixel_fmt&2);
-        _dec->pipe.fragy0[pli]=stripe_fragy>>frag_shift;
-        _dec->pipe.fragy_end[pli]=OC_MINI(fplane->nvfrags,
-         _dec->pipe.fragy0[pli]+(_dec->pipe.mcu_nvfrags>>frag_shift));
-        oc_dec_dc_unpredict_mcu_plane(_dec,&_dec->pipe,pli);
-        oc_dec_frags_recon_mcu_plane(_dec,&_dec->pipe,pli);
-        sdelay=edelay=0;
-        if(_dec->pipe.loop_filter){
-          sdelay+=notstart;
-          edelay+=notdone;
-          oc_state_loop_filter_frag_rows(&_dec->state,
-           _dec->pipe.bounding_values,OC_FRAME_SELF,pli,
-           _dec->pipe.fragy0[pli]-sdelay,_dec->pipe.fragy_end[pli]-edelay);
-        }
-        /*To fill the borders, we have an additional two pixel delay, since a
-           fragment in the next row could filter its top edge, using two pixels
-           from a fragment in this row.
-          But there's no reason to delay a full fragment between the two.*/
-        oc_state_borders_fill_rows(&_dec->state,refi,pli,
-         (_dec->pipe.fragy0[pli]-sdelay<<3)-(sdelay<<1),
-         (_dec->pipe.fragy_end[pli]-edelay<<3)-(edelay<<1));
-        /*Out-of-loop post-processing.*/
-        pp_offset=3*(pli!=0);
-        if(_dec->pipe.pp_level>=OC_PP_LEVEL_DEBLOCKY+pp_offset){
-          /*Perform de-blocking in one plane.*/
-          sdelay+=notstart;
-          edelay+=notdone;
-          oc_dec_deblock_frag_rows(_dec,_dec->pp_frame_buf,
-           _dec->state.ref_frame_bufs[refi],pli,
-           _dec->pipe.fragy0[pli]-sdelay,_dec->pipe.fragy_end[pli]-edelay);
-          if(_dec->pipe.pp_level>=OC_PP_LEVEL_DERINGY+pp_offset){
-            /*Perform de-ringing in one plane.*/
-            sdelay+=notstart;
-            edelay+=notdone;
-            oc_dec_dering_frag_rows(_dec,_dec->pp_frame_buf,pli,
-             _dec->pipe.fragy0[pli]-sdelay,_dec->pipe.fragy_end[pli]-edelay);
+      _dec->pipe.stripe_fragy=stripe_fragy;
+      _dec->pipe.notstart=notstart;
+      _dec->pipe.notdone=notdone;
+      if(parallel){
+        for(pli=1;pli<3;pli++){
+          oc_dec_plane_task *task;
+          task=_dec->plane_tasks+pli;
+          task->dec=_dec;
+          task->pli=pli;
+          if((*_dec->executor.submit)(_dec->executor.ctx,&_dec->pipe,
+           oc_dec_mcu_plane_task,task)<0){
+            oc_dec_mcu_plane_decode(_dec,&_dec->pipe,pli);
           }
         }
-        /*If no post-processing is done, we still need to delay a row for the
-           loop filter, thanks to the strange filtering order VP3 chose.*/
-        else if(_dec->pipe.loop_filter){
-          sdelay+=notstart;
-          edelay+=notdone;
-        }
+        oc_dec_mcu_plane_decode(_dec,&_dec->pipe,0);
+        (*_dec->executor.wait)(_dec->executor.ctx,&_dec->pipe);
+      }
+      else{
+        for(pli=0;pli<3;pli++)oc_dec_mcu_plane_decode(_dec,&_dec->pipe,pli);
+      }
+      for(pli=0;pli<3;pli++){
+        int frag_shift;
         /*Compute the intersection of the available rows in all planes.
           If chroma is sub-sampled, the effect of each of its delays is
            doubled, but luma might have more post-processing filters enabled
            than chroma, so we don't know up front which one is the limiting
            factor.*/
+        frag_shift=pli!=0&&!(_dec->state.info.pixel_fmt&2);
         avail_fragy0=OC_MINI(avail_fragy0,
-         _dec->pipe.fragy0[pli]-sdelay<<frag_shift);
+         _dec->pipe.fragy0[pli]-_dec->pipe.sdelay[pli]<<frag_shift);
         avail_fragy_end=OC_MINI(avail_fragy_end,
-         _dec->pipe.fragy_end[pli]-edelay<<frag_shift);
+         _dec->pipe.fragy_end[pli]-_dec->pipe.edelay[pli]<<frag_shift);
       }
 #ifdef HAVE_CAIRO
       if(_dec->stripe_cb.stripe_decoded!=NULL&&!telemetry){
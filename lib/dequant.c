@@ -180,3 +180,58 @@ void oc_quant_params_clear(th_quant_info *_qinfo){
     _ogg_free((void *)_qinfo->qi_ranges[qti][pli].base_matrices);
   }
 }
+
+/*Makes a deep copy of a set of quantization parameters returned by
+   oc_quant_params_unpack().
+  Ranges that were shared in the source are shared in the copy, so it can be
+   freed with oc_quant_params_clear().
+  On failure, the caller is responsible for cleaning up the partial copy.*/
+int oc_quant_params_copy(th_quant_info *_dst,const th_quant_info *_src){
+  int i;
+  memcpy(_dst,_src,sizeof(*_dst));
+  for(i=0;i<6;i++){
+    _dst->qi_ranges[i/3][i%3].sizes=NULL;
+    _dst->qi_ranges[i/3][i%3].base_matrices=NULL;
+  }
+  for(i=0;i<6;i++){
+    const th_quant_ranges *sranges;
+    th_quant_ranges       *dranges;
+    int                    qti;
+    int                    pli;
+    qti=i/3;
+    pli=i%3;
+    sranges=_src->qi_ranges[qti]+pli;
+    dranges=_dst->qi_ranges[qti]+pli;
+    if(i>0&&sranges->sizes==_src->qi_ranges[(i-1)/3][(i-1)%3].sizes){
+      dranges->sizes=_dst->qi_ranges[(i-1)/3][(i-1)%3].sizes;
+    }
+    else if(qti>0&&sranges->sizes==_src->qi_ranges[0][pli].sizes){
+      dranges->sizes=_dst->qi_ranges[0][pli].sizes;
+    }
+    else{
+      int *sizes;
+      sizes=(int *)_ogg_malloc(sranges->nranges*sizeof(sizes[0]));
+      if(sizes==NULL)return TH_EFAULT;
+      memcpy(sizes,sranges->sizes,sranges->nranges*sizeof(sizes[0]));
+      dranges->sizes=sizes;
+    }
+    if(i>0&&sranges->base_matrices==
+     _src->qi_ranges[(i-1)/3][(i-1)%3].base_matrices){
+      dranges->base_matrices=_dst->qi_ranges[(i-1)/3][(i-1)%3].base_matrices;
+    }
+    else if(qti>0&&sranges->base_matrices==
+     _src->qi_ranges[0][pli].base_matrices){
+      dranges->base_matrices=_dst->qi_ranges[0][pli].base_matrices;
+    }
+    else{
+      th_quant_base *base_mats;
+      base_mats=(th_quant_base *)_ogg_malloc(
+       (sranges->nranges+1)*sizeof(base_mats[0]));
+      if(base_mats==NULL)return TH_EFAULT;
+      memcpy(base_mats,sranges->base_matrices,
+       (sranges->nranges+1)*sizeof(base_mats[0]));
+      dranges->base_matrices=(const th_quant_base *)base_mats;
+    }
+  }
+  return 0;
+}
@@ -23,5 +23,6 @@
 int oc_quant_params_unpack(oc_pack_buf *_opb,
  th_quant_info *_qinfo);
 void oc_quant_params_clear(th_quant_info *_qinfo);
+int oc_quant_params_copy(th_quant_info *_dst,const th_quant_info *_src);
 
 #endif
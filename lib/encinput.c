@@ -0,0 +1,309 @@
+/********************************************************************
+ *                                                                  *
+ * THIS FILE IS PART OF THE OggTheora SOFTWARE CODEC SOURCE CODE.   *
+ * USE, DISTRIBUTION AND REPRODUCTION OF THIS LIBRARY SOURCE IS     *
+ * GOVERNED BY A BSD-STYLE SOURCE LICENSE INCLUDED WITH THIS SOURCE *
+ * IN 'COPYING'. PLEASE READ THESE TERMS BEFORE DISTRIBUTING.       *
+ *                                                                  *
+ * THE Theora SOURCE CODE IS COPYRIGHT (C) 2002-2009                *
+ * by the Xiph.Org Foundation http://www.xiph.org/                  *
+ *                                                                  *
+ ********************************************************************
+
+  function:
+  last mod: $Id$
+
+ ********************************************************************/
+#include <string.h>
+#include "encint.h"
+
+/*Conversion of the formats accepted by th_encode_image_in() into the
+   encoder's planar input buffer.
+  R'G'B' input uses the ITU-R BT.601 matrix with studio-swing output, in
+   fixed point with 8 fractional bits.
+  Each chroma sample is computed from the sum of the 2x2 block of pixels it
+   covers (with pixels duplicated when the chroma plane is not decimated in a
+   given direction, or along the picture edges), so all of the chroma paths
+   use the same rounding.*/
+
+/*The luma coefficients, in the byte order of each pixel format, repeated for
+   two pixels.*/
+static const ogg_int16_t OC_BGRX_Y_COEFS[8]={25,129,66,0,25,129,66,0};
+static const ogg_int16_t OC_RGBX_Y_COEFS[8]={66,129,25,0,66,129,25,0};
+/*The Cb coefficients followed by the Cr coefficients, in the same layout.*/
+static const ogg_int16_t OC_BGRX_CBCR_COEFS[16]={
+  112,-74,-38,0,112,-74,-38,0,
+  -18,-94,112,0,-18,-94,112,0
+};
+static const ogg_int16_t OC_RGBX_CBCR_COEFS[16]={
+  -38,-74,112,0,-38,-74,112,0,
+  112,-94,-18,0,112,-94,-18,0
+};
+
+/*The offset and rounding bias for luma.*/
+#define OC_Y_BIAS      ((16<<8)+(1<<7))
+/*The offset and rounding bias for chroma computed from a sum of 4 pixels.*/
+#define OC_CBCR4_BIAS  ((128<<10)+(1<<9))
+
+
+
+void oc_enc_input_deinterleave_c(unsigned char *_dst0,unsigned char *_dst1,
+ const unsigned char *_src,int _n){
+  int i;
+  for(i=0;i<_n;i++){
+    _dst0[i]=_src[2*i+0];
+    _dst1[i]=_src[2*i+1];
+  }
+}
+
+void oc_enc_input_avg_c(unsigned char *_dst,const unsigned char *_src0,
+ const unsigned char *_src1,int _n){
+  int i;
+  for(i=0;i<_n;i++)_dst[i]=(unsigned char)(_src0[i]+_src1[i]+1>>1);
+}
+
+void oc_enc_input_rgbx_to_y_c(unsigned char *_dst,const unsigned char *_src,
+ int _n,const ogg_int16_t _coefs[8]){
+  int i;
+  for(i=0;i<_n;i++){
+    _dst[i]=(unsigned char)(_coefs[0]*_src[4*i+0]+_coefs[1]*_src[4*i+1]
+     +_coefs[2]*_src[4*i+2]+OC_Y_BIAS>>8);
+  }
+}
+
+void oc_enc_input_rgbx_to_cbcr420_c(unsigned char *_cb,unsigned char *_cr,
+ const unsigned char *_src0,const unsigned char *_src1,int _n,
+ const ogg_int16_t _coefs[16]){
+  int i;
+  for(i=0;i<_n;i++){
+    int s0;
+    int s1;
+    int s2;
+    s0=_src0[8*i+0]+_src0[8*i+4]+_src1[8*i+0]+_src1[8*i+4];
+    s1=_src0[8*i+1]+_src0[8*i+5]+_src1[8*i+1]+_src1[8*i+5];
+    s2=_src0[8*i+2]+_src0[8*i+6]+_src1[8*i+2]+_src1[8*i+6];
+    _cb[i]=(unsigned char)(_coefs[0]*s0+_coefs[1]*s1+_coefs[2]*s2
+     +OC_CBCR4_BIAS>>10);
+    _cr[i]=(unsigned char)(_coefs[8]*s0+_coefs[9]*s1+_coefs[10]*s2
+     +OC_CBCR4_BIAS>>10);
+  }
+}
+
+
+
+/*Returns a pointer to row _y of plane _pli of the input image, counting from
+   the bottom as the encoder does.*/
+static const unsigned char *oc_input_row(const th_input_image *_img,int _pli,
+ int _height,int _y){
+  return _img->data[_pli]+(_height-1-_y)*(ptrdiff_t)_img->stride[_pli];
+}
+
+/*Converts row _y of the luma plane.
+  For packed Y'CbCr input, the interleaved chroma for the row is stored in
+   _chroma.
+  With an odd picture width, packed Y'CbCr input writes one extra luma value
+   past the end of the picture, which is overwritten by the padding.*/
+static void oc_enc_input_luma_row(oc_enc_ctx *_enc,unsigned char *_dst,
+ unsigned char *_chroma,const th_input_image *_img,
+ int _pic_width,int _pic_height,int _y){
+  const unsigned char *src;
+  src=oc_input_row(_img,0,_pic_height,_y);
+  switch(_img->fmt){
+    case TH_INFMT_I420:
+    case TH_INFMT_NV12:memcpy(_dst,src,_pic_width);break;
+    case TH_INFMT_YUYV:{
+      oc_enc_input_deinterleave(_enc,_dst,_chroma,src,_pic_width+1&~1);
+    }break;
+    case TH_INFMT_UYVY:{
+      oc_enc_input_deinterleave(_enc,_chroma,_dst,src,_pic_width+1&~1);
+    }break;
+    case TH_INFMT_BGRA:{
+      oc_enc_input_rgbx_to_y(_enc,_dst,src,_pic_width,OC_BGRX_Y_COEFS);
+    }break;
+    default:{
+      oc_enc_input_rgbx_to_y(_enc,_dst,src,_pic_width,OC_RGBX_Y_COEFS);
+    }break;
+  }
+}
+
+/*Computes a single chroma sample from the 2x2 block of luma positions given
+   by _lx and _ly (counting rows from the bottom).*/
+static void oc_input_chroma_sample(unsigned char *_cb,unsigned char *_cr,
+ const th_input_image *_img,int _pic_height,const int _lx[2],
+ const int _ly[2]){
+  int                  s0;
+  int                  s1;
+  int                  s2;
+  int                  i;
+  int                  j;
+  s0=s1=s2=0;
+  for(j=0;j<2;j++){
+    int ty;
+    ty=_pic_height-1-_ly[j];
+    for(i=0;i<2;i++){
+      const unsigned char *p;
+      int                  lx;
+      lx=_lx[i];
+      switch(_img->fmt){
+        case TH_INFMT_I420:{
+          s0+=_img->data[1][(ty>>1)*(ptrdiff_t)_img->stride[1]+(lx>>1)];
+          s1+=_img->data[2][(ty>>1)*(ptrdiff_t)_img->stride[2]+(lx>>1)];
+        }break;
+        case TH_INFMT_NV12:{
+          p=_img->data[1]+(ty>>1)*(ptrdiff_t)_img->stride[1]+(lx&~1);
+          s0+=p[0];
+          s1+=p[1];
+        }break;
+        case TH_INFMT_YUYV:
+        case TH_INFMT_UYVY:{
+          p=_img->data[0]+ty*(ptrdiff_t)_img->stride[0]+(lx&~1)*2
+           +(_img->fmt==TH_INFMT_YUYV);
+          s0+=p[0];
+          s1+=p[2];
+        }break;
+        default:{
+          p=_img->data[0]+ty*(ptrdiff_t)_img->stride[0]+lx*4;
+          s0+=p[0];
+          s1+=p[1];
+          s2+=p[2];
+        }break;
+      }
+    }
+  }
+  if(_img->fmt==TH_INFMT_BGRA||_img->fmt==TH_INFMT_RGBA){
+    const ogg_int16_t *coefs;
+    coefs=_img->fmt==TH_INFMT_BGRA?OC_BGRX_CBCR_COEFS:OC_RGBX_CBCR_COEFS;
+    *_cb=(unsigned char)(coefs[0]*s0+coefs[1]*s1+coefs[2]*s2
+     +OC_CBCR4_BIAS>>10);
+    *_cr=(unsigned char)(coefs[8]*s0+coefs[9]*s1+coefs[10]*s2
+     +OC_CBCR4_BIAS>>10);
+  }
+  else{
+    *_cb=(unsigned char)(s0+2>>2);
+    *_cr=(unsigned char)(s1+2>>2);
+  }
+}
+
+/*Converts chroma row _cy of a 4:2:0 frame whose picture region starts on an
+   even row and column and has an even height.
+  _chroma0 and _chroma1 hold the interleaved chroma for packed Y'CbCr input,
+   as returned by oc_enc_input_luma_row() for the two luma rows.*/
+static void oc_enc_input_chroma420_row(oc_enc_ctx *_enc,unsigned char *_cb,
+ unsigned char *_cr,unsigned char *_chroma0,const unsigned char *_chroma1,
+ const th_input_image *_img,int _pic_width,int _pic_height,int _cy){
+  int cwidth;
+  int cheight;
+  cwidth=_pic_width+1>>1;
+  cheight=_pic_height>>1;
+  switch(_img->fmt){
+    case TH_INFMT_I420:{
+      memcpy(_cb,oc_input_row(_img,1,cheight,_cy),cwidth);
+      memcpy(_cr,oc_input_row(_img,2,cheight,_cy),cwidth);
+    }break;
+    case TH_INFMT_NV12:{
+      oc_enc_input_deinterleave(_enc,_cb,_cr,
+       oc_input_row(_img,1,cheight,_cy),cwidth);
+    }break;
+    case TH_INFMT_YUYV:
+    case TH_INFMT_UYVY:{
+      oc_enc_input_avg(_enc,_chroma0,_chroma0,_chroma1,cwidth<<1);
+      oc_enc_input_deinterleave(_enc,_cb,_cr,_chroma0,cwidth);
+    }break;
+    default:{
+      oc_enc_input_rgbx_to_cbcr420(_enc,_cb,_cr,
+       oc_input_row(_img,0,_pic_height,_cy<<1),
+       oc_input_row(_img,0,_pic_height,_cy<<1|1),_pic_width>>1,
+       _img->fmt==TH_INFMT_BGRA?OC_BGRX_CBCR_COEFS:OC_RGBX_CBCR_COEFS);
+      /*Handle the last column of an odd-width picture.*/
+      if(_pic_width&1){
+        int lx[2];
+        int ly[2];
+        lx[0]=lx[1]=_pic_width-1;
+        ly[0]=_cy<<1;
+        ly[1]=_cy<<1|1;
+        oc_input_chroma_sample(_cb+cwidth-1,_cr+cwidth-1,
+         _img,_pic_height,lx,ly);
+      }
+    }break;
+  }
+}
+
+void oc_enc_input_convert(oc_enc_ctx *_enc,th_img_plane _dst[3],
+ const th_input_image *_img){
+  unsigned char *chroma0;
+  unsigned char *chroma1;
+  unsigned char *dst;
+  int            ystride;
+  int            cstride;
+  int            pic_x;
+  int            pic_y;
+  int            pic_width;
+  int            pic_height;
+  int            cpic_x;
+  int            cpic_y;
+  int            cpic_width;
+  int            cpic_height;
+  int            hdec;
+  int            vdec;
+  int            y;
+  hdec=!(_enc->state.info.pixel_fmt&1);
+  vdec=!(_enc->state.info.pixel_fmt&2);
+  pic_x=_enc->state.info.pic_x;
+  pic_y=_enc->state.info.pic_y;
+  pic_width=_enc->state.info.pic_width;
+  pic_height=_enc->state.info.pic_height;
+  cpic_x=pic_x>>hdec;
+  cpic_y=pic_y>>vdec;
+  cpic_width=(pic_x+pic_width+hdec>>hdec)-cpic_x;
+  cpic_height=(pic_y+pic_height+vdec>>vdec)-cpic_y;
+  ystride=_dst[0].stride;
+  cstride=_dst[1].stride;
+  chroma0=_enc->input_scratch;
+  chroma1=chroma0+_enc->state.info.frame_width+16;
+  dst=_dst[0].data+pic_y*(ptrdiff_t)ystride+pic_x;
+  if(hdec&&vdec&&!(pic_x&1)&&!(pic_y&1)&&!(pic_height&1)){
+    unsigned char *cb;
+    unsigned char *cr;
+    int            cy;
+    /*The common case: convert each pair of luma rows together with the
+       chroma row they share, while the source is still in cache.*/
+    cb=_dst[1].data+cpic_y*(ptrdiff_t)cstride+cpic_x;
+    cr=_dst[2].data+cpic_y*(ptrdiff_t)cstride+cpic_x;
+    for(cy=0;cy<cpic_height;cy++){
+      oc_enc_input_luma_row(_enc,dst,chroma0,_img,pic_width,pic_height,cy<<1);
+      dst+=ystride;
+      oc_enc_input_luma_row(_enc,dst,chroma1,_img,
+       pic_width,pic_height,cy<<1|1);
+      dst+=ystride;
+      oc_enc_input_chroma420_row(_enc,cb,cr,chroma0,chroma1,
+       _img,pic_width,pic_height,cy);
+      cb+=cstride;
+      cr+=cstride;
+    }
+  }
+  else{
+    int cy;
+    for(y=0;y<pic_height;y++){
+      oc_enc_input_luma_row(_enc,dst,chroma0,_img,pic_width,pic_height,y);
+      dst+=ystride;
+    }
+    for(cy=0;cy<cpic_height;cy++){
+      unsigned char *cb;
+      unsigned char *cr;
+      int            ly[2];
+      int            cx;
+      cb=_dst[1].data+(cpic_y+cy)*(ptrdiff_t)cstride+cpic_x;
+      cr=_dst[2].data+(cpic_y+cy)*(ptrdiff_t)cstride+cpic_x;
+      ly[0]=(cpic_y+cy<<vdec)-pic_y;
+      ly[1]=OC_CLAMPI(0,ly[0]+vdec,pic_height-1);
+      ly[0]=OC_CLAMPI(0,ly[0],pic_height-1);
+      for(cx=0;cx<cpic_width;cx++){
+        int lx[2];
+        lx[0]=(cpic_x+cx<<hdec)-pic_x;
+        lx[1]=OC_CLAMPI(0,lx[0]+hdec,pic_width-1);
+        lx[0]=OC_CLAMPI(0,lx[0],pic_width-1);
+        oc_input_chroma_sample(cb+cx,cr+cx,_img,pic_height,lx,ly);
+      }
+    }
+  }
+}
@@ -21,6 +21,9 @@
 # include "mathops.h"
 # include "enquant.h"
 # include "huffenc.h"
+# if defined(OC_HAVE_PTHREAD)
+#  include <pthread.h>
+# endif
 /*# define OC_COLLECT_METRICS*/
 
 
@@ -38,6 +41,10 @@ typedef struct oc_mode_rd             oc_mode_rd;
 typedef struct oc_iir_filter          oc_iir_filter;
 typedef struct oc_frame_metrics       oc_frame_metrics;
 typedef struct oc_rc_state            oc_rc_state;
+typedef struct oc_enc_pack_buf        oc_enc_pack_buf;
+typedef struct oc_enc_async_frame     oc_enc_async_frame;
+typedef struct oc_enc_async_packet    oc_enc_async_packet;
+typedef struct oc_enc_async           oc_enc_async;
 typedef struct th_enc_ctx             oc_enc_ctx;
 typedef struct oc_token_checkpoint    oc_token_checkpoint;
 
@@ -131,6 +138,22 @@ typedef struct oc_token_checkpoint    oc_token_checkpoint;
 #   define oc_enc_fdct8x8(_enc,_y,_x) \
   ((*(_enc)->opt_vtable.fdct8x8)(_y,_x))
 #  endif
+#  if !defined(oc_enc_input_deinterleave)
+#   define oc_enc_input_deinterleave(_enc,_dst0,_dst1,_src,_n) \
+  ((*(_enc)->opt_vtable.input_deinterleave)(_dst0,_dst1,_src,_n))
+#  endif
+#  if !defined(oc_enc_input_avg)
+#   define oc_enc_input_avg(_enc,_dst,_src0,_src1,_n) \
+  ((*(_enc)->opt_vtable.input_avg)(_dst,_src0,_src1,_n))
+#  endif
+#  if !defined(oc_enc_input_rgbx_to_y)
+#   define oc_enc_input_rgbx_to_y(_enc,_dst,_src,_n,_coefs) \
+  ((*(_enc)->opt_vtable.input_rgbx_to_y)(_dst,_src,_n,_coefs))
+#  endif
+#  if !defined(oc_enc_input_rgbx_to_cbcr420)
+#   define oc_enc_input_rgbx_to_cbcr420(_enc,_cb,_cr,_src0,_src1,_n,_coefs) \
+  ((*(_enc)->opt_vtable.input_rgbx_to_cbcr420)(_cb,_cr,_src0,_src1,_n,_coefs))
+#  endif
 # else
 #  if !defined(oc_enc_frag_sub)
 #   define oc_enc_frag_sub(_enc,_diff,_src,_ref,_ystride) \
@@ -203,6 +226,96 @@ typedef struct oc_token_checkpoint    oc_token_checkpoint;
 #  if !defined(oc_enc_fdct8x8)
 #   define oc_enc_fdct8x8(_enc,_y,_x) oc_enc_fdct8x8_c(_y,_x)
 #  endif
+#  if !defined(oc_enc_input_deinterleave)
+#   define oc_enc_input_deinterleave(_enc,_dst0,_dst1,_src,_n) \
+  oc_enc_input_deinterleave_c(_dst0,_dst1,_src,_n)
+#  endif
+#  if !defined(oc_enc_input_avg)
+#   define oc_enc_input_avg(_enc,_dst,_src0,_src1,_n) \
+  oc_enc_input_avg_c(_dst,_src0,_src1,_n)
+#  endif
+#  if !defined(oc_enc_input_rgbx_to_y)
+#   define oc_enc_input_rgbx_to_y(_enc,_dst,_src,_n,_coefs) \
+  oc_enc_input_rgbx_to_y_c(_dst,_src,_n,_coefs)
+#  endif
+#  if !defined(oc_enc_input_rgbx_to_cbcr420)
+#   define oc_enc_input_rgbx_to_cbcr420(_enc,_cb,_cr,_src0,_src1,_n,_coefs) \
+  oc_enc_input_rgbx_to_cbcr420_c(_cb,_cr,_src0,_src1,_n,_coefs)
+#  endif
+# endif
+/*The paired routines operate on two blocks at once.
+  Platforms with a dedicated implementation route them through the vtable;
+   everyone else just calls the single-block routine twice.*/
+# if defined(OC_ENC_USE_VTABLE_X2)
+#  if !defined(oc_enc_frag_satd_x2)
+#   define oc_enc_frag_satd_x2(_enc,_satd,_dc,_src,_ref,_ystride) \
+  ((*(_enc)->opt_vtable.frag_satd_x2)(_satd,_dc,_src,_ref,_ystride))
+#  endif
+#  if !defined(oc_enc_frag_satd2_x2)
+#   define oc_enc_frag_satd2_x2(_enc,_satd,_dc,_src,_ref1,_ref2,_ystride) \
+  ((*(_enc)->opt_vtable.frag_satd2_x2)(_satd,_dc,_src,_ref1,_ref2,_ystride))
+#  endif
+#  if !defined(oc_enc_frag_intra_satd_x2)
+#   define oc_enc_frag_intra_satd_x2(_enc,_satd,_dc,_src,_ystride) \
+  ((*(_enc)->opt_vtable.frag_intra_satd_x2)(_satd,_dc,_src,_ystride))
+#  endif
+#  if !defined(oc_enc_frag_ssd_x2)
+#   define oc_enc_frag_ssd_x2(_enc,_ssd,_src,_ref,_ystride) \
+  ((*(_enc)->opt_vtable.frag_ssd_x2)(_ssd,_src,_ref,_ystride))
+#  endif
+#  if !defined(oc_enc_frag_border_ssd_x2)
+#   define oc_enc_frag_border_ssd_x2(_enc,_ssd,_src,_ref,_ystride,_mask) \
+  ((*(_enc)->opt_vtable.frag_border_ssd_x2)(_ssd,_src,_ref,_ystride,_mask))
+#  endif
+#  if !defined(oc_enc_quantize_x2)
+#   define oc_enc_quantize_x2(_enc,_nonzero,_qdct,_dct,_dequant,_enquant) \
+  ((*(_enc)->opt_vtable.quantize_x2)(_nonzero,_qdct,_dct,_dequant,_enquant))
+#  endif
+#  if !defined(oc_enc_fdct8x8_x2)
+#   define oc_enc_fdct8x8_x2(_enc,_y,_x) \
+  ((*(_enc)->opt_vtable.fdct8x8_x2)(_y,_x))
+#  endif
+# else
+#  if !defined(oc_enc_frag_satd_x2)
+#   define oc_enc_frag_satd_x2(_enc,_satd,_dc,_src,_ref,_ystride) \
+  ((_satd)[0]=oc_enc_frag_satd(_enc,(_dc)+0,(_src)[0],(_ref)[0],_ystride), \
+   (_satd)[1]=oc_enc_frag_satd(_enc,(_dc)+1,(_src)[1],(_ref)[1],_ystride))
+#  endif
+#  if !defined(oc_enc_frag_satd2_x2)
+#   define oc_enc_frag_satd2_x2(_enc,_satd,_dc,_src,_ref1,_ref2,_ystride) \
+  ((_satd)[0]=oc_enc_frag_satd2(_enc,(_dc)+0, \
+   (_src)[0],(_ref1)[0],(_ref2)[0],_ystride), \
+   (_satd)[1]=oc_enc_frag_satd2(_enc,(_dc)+1, \
+   (_src)[1],(_ref1)[1],(_ref2)[1],_ystride))
+#  endif
+#  if !defined(oc_enc_frag_intra_satd_x2)
+#   define oc_enc_frag_intra_satd_x2(_enc,_satd,_dc,_src,_ystride) \
+  ((_satd)[0]=oc_enc_frag_intra_satd(_enc,(_dc)+0,(_src)[0],_ystride), \
+   (_satd)[1]=oc_enc_frag_intra_satd(_enc,(_dc)+1,(_src)[1],_ystride))
+#  endif
+#  if !defined(oc_enc_frag_ssd_x2)
+#   define oc_enc_frag_ssd_x2(_enc,_ssd,_src,_ref,_ystride) \
+  ((_ssd)[0]=oc_enc_frag_ssd(_enc,(_src)[0],(_ref)[0],_ystride), \
+   (_ssd)[1]=oc_enc_frag_ssd(_enc,(_src)[1],(_ref)[1],_ystride))
+#  endif
+#  if !defined(oc_enc_frag_border_ssd_x2)
+#   define oc_enc_frag_border_ssd_x2(_enc,_ssd,_src,_ref,_ystride,_mask) \
+  ((_ssd)[0]=oc_enc_frag_border_ssd(_enc, \
+   (_src)[0],(_ref)[0],_ystride,(_mask)[0]), \
+   (_ssd)[1]=oc_enc_frag_border_ssd(_enc, \
+   (_src)[1],(_ref)[1],_ystride,(_mask)[1]))
+#  endif
+#  if !defined(oc_enc_quantize_x2)
+#   define oc_enc_quantize_x2(_enc,_nonzero,_qdct,_dct,_dequant,_enquant) \
+  ((_nonzero)[0]=oc_enc_quantize(_enc,_qdct,_dct, \
+   (_dequant)[0],(_enquant)[0]), \
+   (_nonzero)[1]=oc_enc_quantize(_enc,(_qdct)+64,(_dct)+64, \
+   (_dequant)[1],(_enquant)[1]))
+#  endif
+#  if !defined(oc_enc_fdct8x8_x2)
+#   define oc_enc_fdct8x8_x2(_enc,_y,_x) \
+  (oc_enc_fdct8x8(_enc,_y,_x),oc_enc_fdct8x8(_enc,(_y)+64,(_x)+64))
+#  endif
 # endif
 
 
@@ -227,6 +340,28 @@ typedef struct oc_token_checkpoint    oc_token_checkpoint;
 /*Maximum valid speed level.*/
 #define OC_SP_LEVEL_MAX           (4)
 
+/*Finer speed shortcuts used by the deadline controller between levels.*/
+/*Disable 4MV analysis.*/
+#define OC_SP_FLAG_NO4MV          (0x1)
+/*Disable the golden frame motion search and GOLDEN_MV mode.*/
+#define OC_SP_FLAG_NOGOLDEN       (0x2)
+
+/*The number of consecutive frames that must come in well under the deadline
+   before the controller moves to a slower speed step.*/
+#define OC_DEADLINE_SLACK_FRAMES  (8)
+
+/*The encoder stages timed for TH_ENCCTL_GET_FRAME_STATS.*/
+#define OC_ENC_STAGE_OTHER        (0)
+#define OC_ENC_STAGE_MOTION       (1)
+#define OC_ENC_STAGE_ANALYSIS     (2)
+#define OC_ENC_STAGE_TRANSFORM    (3)
+#define OC_ENC_STAGE_TOKENIZE     (4)
+#define OC_ENC_STAGE_PACK         (5)
+#define OC_ENC_STAGE_FILTER       (6)
+#define OC_ENC_STAGE_RC           (7)
+/*The number of timed stages.*/
+#define OC_ENC_NSTAGES            (8)
+
 
 /*The number of extra bits of precision at which to store rate metrics.*/
 # define OC_BIT_SCALE  (6)
@@ -324,6 +459,35 @@ struct oc_enc_opt_vtable{
   void     (*frag_recon_inter)(unsigned char *_dst,
    const unsigned char *_src,int _ystride,const ogg_int16_t _residue[64]);
   void     (*fdct8x8)(ogg_int16_t _y[64],const ogg_int16_t _x[64]);
+  void     (*input_deinterleave)(unsigned char *_dst0,unsigned char *_dst1,
+   const unsigned char *_src,int _n);
+  void     (*input_avg)(unsigned char *_dst,const unsigned char *_src0,
+   const unsigned char *_src1,int _n);
+  void     (*input_rgbx_to_y)(unsigned char *_dst,const unsigned char *_src,
+   int _n,const ogg_int16_t _coefs[8]);
+  void     (*input_rgbx_to_cbcr420)(unsigned char *_cb,unsigned char *_cr,
+   const unsigned char *_src0,const unsigned char *_src1,int _n,
+   const ogg_int16_t _coefs[16]);
+# if defined(OC_ENC_USE_VTABLE_X2)
+  void     (*frag_satd_x2)(unsigned _satd[2],int _dc[2],
+   const unsigned char *const _src[2],const unsigned char *const _ref[2],
+   int _ystride);
+  void     (*frag_satd2_x2)(unsigned _satd[2],int _dc[2],
+   const unsigned char *const _src[2],const unsigned char *const _ref1[2],
+   const unsigned char *const _ref2[2],int _ystride);
+  void     (*frag_intra_satd_x2)(unsigned _satd[2],int _dc[2],
+   const unsigned char *const _src[2],int _ystride);
+  void     (*frag_ssd_x2)(unsigned _ssd[2],
+   const unsigned char *const _src[2],const unsigned char *const _ref[2],
+   int _ystride);
+  void     (*frag_border_ssd_x2)(unsigned _ssd[2],
+   const unsigned char *const _src[2],const unsigned char *const _ref[2],
+   int _ystride,const ogg_int64_t _mask[2]);
+  void     (*quantize_x2)(int _nonzero[2],ogg_int16_t _qdct[128],
+   const ogg_int16_t _dct[128],const ogg_uint16_t *const _dequant[2],
+   const void *const _enquant[2]);
+  void     (*fdct8x8_x2)(ogg_int16_t _y[128],const ogg_int16_t _x[128]);
+# endif
 };
 
 
@@ -355,6 +519,22 @@ struct oc_mb_enc_info{
   unsigned char npneighbors;
   /*Flags indicating which MB modes have been refined.*/
   unsigned char refined;
+  /*Whether the luma of this MB is unchanged from the previous input frame
+     and was not coded then.*/
+  unsigned char unchanged;
+  /*The quantizer at which mode decision last chose not to code the luma of
+     this MB.
+    If it is unchanged and the quantizer is the same, it can be skipped again
+     without analysis, except under rate control.*/
+  unsigned char skip_qi;
+  /*Whether this MB intersects or borders one of the rectangles passed to
+     th_encode_ycbcr_in_rects() for the current frame.*/
+  unsigned char dirty;
+  /*Source statistics from the last time this MB was analyzed.
+    They are reused for as long as it stays unchanged.*/
+  unsigned      luma;
+  unsigned      activity[4];
+  unsigned      intra_satd[12];
   /*Motion vectors for a macro block for the current frame and the
      previous two frames.
     Each is a set of 2 vectors against OC_FRAME_GOLD and OC_FRAME_PREV, which
@@ -456,8 +636,11 @@ struct oc_enc_pipeline_state{
   /*DCT coefficient storage.
     This is kept off the stack because a) gcc can't align things on the stack
      reliably on ARM, and b) it avoids (unintentional) data hazards between
-     ARM and NEON code.*/
-  OC_ALIGN16(ogg_int16_t dct_data[64*3]);
+     ARM and NEON code.
+    The first 128 coefficients hold the residual and then quantized values of
+     up to two blocks, the next 128 their DCT coefficients, and the last 64
+     the dequantized coefficients of the block currently being coded.*/
+  OC_ALIGN16(ogg_int16_t dct_data[64*5]);
   OC_ALIGN16(signed char bounding_values[256]);
   oc_fr_state         fr[3];
   oc_qii_state        qs[3];
@@ -622,17 +805,131 @@ int oc_enc_select_qi(oc_enc_ctx *_enc,int _qti,int _clamp);
 void oc_enc_calc_lambda(oc_enc_ctx *_enc,int _frame_type);
 int oc_enc_update_rc_state(oc_enc_ctx *_enc,
  long _bits,int _qti,int _qi,int _trial,int _droppable);
+void oc_enc_rc_add_dups(oc_enc_ctx *_enc,int _ndups);
 int oc_enc_rc_2pass_out(oc_enc_ctx *_enc,unsigned char **_buf);
 int oc_enc_rc_2pass_in(oc_enc_ctx *_enc,unsigned char *_buf,size_t _bytes);
 
 
 
+/*The accumulator of the frame packer.*/
+typedef size_t oc_enc_pack_window;
+
+/*A big-endian bit writer for frame packets.
+  Unlike oggpack_buffer, it accumulates bits in a register and only checks for
+   space when it stores a whole word of them.*/
+struct oc_enc_pack_buf{
+  /*The start of the current packet, or NULL if there is no storage yet.
+    This is either buf or user.*/
+  unsigned char      *start;
+  /*The next byte to store to.*/
+  unsigned char      *ptr;
+  /*The end of the available storage.*/
+  unsigned char      *stop;
+  /*Bits written but not yet stored, right-aligned.*/
+  oc_enc_pack_window  window;
+  /*The number of valid bits in the window.*/
+  int                 bits;
+  /*Whether an allocation failed while writing the current packet.*/
+  int                 err;
+  /*Storage owned by the encoder, or NULL if none is allocated yet.*/
+  unsigned char      *buf;
+  /*The number of bytes of storage allocated.*/
+  size_t              storage;
+  /*Storage provided with TH_ENCCTL_SET_PACKET_BUFFER, or NULL.*/
+  unsigned char      *user;
+  /*The number of bytes of caller-provided storage.*/
+  size_t              user_storage;
+  /*Storage used after an allocation failure, so that packing can finish.*/
+  unsigned char       spill[2*sizeof(oc_enc_pack_window)];
+};
+
+
+
+/*A frame queued by th_encode_submit().*/
+struct oc_enc_async_frame{
+  /*A copy of the caller's buffer, pointing into data.*/
+  th_ycbcr_buffer  ycbcr;
+  /*Storage for the planes.*/
+  unsigned char   *data;
+  /*The number of bytes allocated for data.*/
+  size_t           storage;
+  /*The TH_ENCASYNC_* flags the frame was submitted with.*/
+  int              flags;
+};
+
+/*A packet waiting for th_encode_receive().*/
+struct oc_enc_async_packet{
+  /*The packet, whose data points into data.*/
+  ogg_packet       op;
+  /*Storage for the packet data.*/
+  unsigned char   *data;
+  /*The number of bytes allocated for data.*/
+  size_t           storage;
+};
+
+/*The state of the asynchronous encoding API.
+  Everything here is protected by mutex, except the frame slot being filled by
+   th_encode_submit() and the encoder itself, which only the worker uses.
+  With an executor, the worker is a task that is started whenever there is
+   work for it, and returns as soon as there is none.*/
+struct oc_enc_async{
+# if defined(OC_HAVE_PTHREAD)
+  pthread_mutex_t      mutex;
+  /*Signaled whenever any of the queues or flags change.*/
+  pthread_cond_t       cond;
+  pthread_t            worker;
+  /*Whether the worker thread is running, or the mutex is usable with an
+     executor.*/
+  int                  threaded;
+  /*Whether the frames are encoded by executor tasks instead of the worker
+     thread.*/
+  int                  tasks;
+  /*Whether an executor task has been submitted and not yet returned.*/
+  int                  task_running;
+# endif
+  /*The ring buffer of queued frames.
+    The frame at the head stays queued while it is being encoded.*/
+  oc_enc_async_frame  *frames;
+  int                  frame_head;
+  int                  nframes;
+  /*The ring buffer of packets waiting to be received.
+    This grows if one frame produces more packets than fit.*/
+  oc_enc_async_packet *packets;
+  int                  npackets_max;
+  int                  packet_head;
+  int                  npackets;
+  /*The storage for the packet most recently returned to the caller.*/
+  unsigned char       *held;
+  size_t               held_storage;
+  /*The maximum number of queued frames (and, before the worker pauses,
+     packets).*/
+  int                  depth;
+  /*Whether the last frame has been submitted.*/
+  int                  ended;
+  /*Whether the worker should exit.*/
+  int                  shutdown;
+  /*An error from encoding a frame, to report to the caller.*/
+  int                  err;
+};
+
+
+
 /*The internal encoder state.*/
 struct th_enc_ctx{
   /*Shared encoder/decoder state.*/
   oc_theora_state          state;
-  /*Buffer in which to assemble packets.*/
+  /*Buffer in which to assemble header packets.*/
   oggpack_buffer           opb;
+  /*Buffer in which to assemble frame packets.*/
+  oc_enc_pack_buf          pack;
+  /*The asynchronous encoding state, or NULL if th_encode_submit() has not
+     been called.*/
+  oc_enc_async            *async;
+  /*The queue depth to use for asynchronous encoding.*/
+  int                      async_depth;
+  /*The executor to use for asynchronous encoding.
+    submit is NULL if there is none.*/
+  th_executor              executor;
   /*Encoder-specific macroblock information.*/
   oc_mb_enc_info          *mb_info;
   /*DC coefficients after prediction.*/
@@ -654,8 +951,75 @@ struct th_enc_ctx{
   ogg_uint32_t             nqueued_dups;
   /*The number of duplicates emitted for the last frame.*/
   ogg_uint32_t             prev_dup_count;
+  /*The largest per-sample difference from the previous input frame for which
+     a new frame is coded as a duplicate, or -1 to disable detection.*/
+  int                      dup_threshold;
+  /*The number of inter frames over which periodic intra refresh sweeps a band
+     of INTRA macro blocks across the picture, or 0 if it is disabled.*/
+  int                      refresh_period;
+  /*The position of the current inter frame within the refresh period.
+    This restarts from 0 after every keyframe.*/
+  int                      refresh_pos;
+  /*The index of the input buffer lent out by th_encode_ycbcr_borrow(), or -1
+     if none is outstanding.*/
+  int                      borrowed_refi;
+  /*Scratch rows used by th_encode_image_in() for format conversion, or NULL
+     if it has not been used yet.*/
+  unsigned char           *input_scratch;
+  /*Whether the current frame was submitted with th_encode_ycbcr_in_rects(),
+     so that the dirty flags in mb_info say which MBs may have changed.*/
+  int                      dirty_rects;
+  /*The input buffer the last frame submitted with th_encode_ycbcr_in_rects()
+     was copied from, or -1.
+    Until it is overwritten, that buffer differs from the current input
+     buffer only in the MBs flagged dirty in mb_info, so switching back to it
+     only requires copying those.*/
+  int                      io_base_refi;
+  /*The encoder whose motion search and source statistics this one reuses
+     when both analyze the same inter frame, or NULL.*/
+  oc_enc_ctx              *ladder_master;
+  /*The frame whose inter analysis is currently held in mb_info, for other
+     encoders to reuse, or -1 if there is none.*/
+  ogg_int64_t              ladder_frame;
+  /*The speed level and flags that analysis was performed with.*/
+  int                      ladder_sp_level;
+  unsigned                 ladder_sp_flags;
+  /*The motion hints for the next frame, indexed by macro block, or NULL if
+     none have ever been set.*/
+  th_enc_motion_hint      *mv_hints;
+  /*Whether mv_hints applies to the next frame.*/
+  int                      mv_hints_valid;
   /*The current speed level.*/
   int                      sp_level;
+  /*Additional speed shortcuts (OC_SP_FLAG_*) applied on top of sp_level.*/
+  unsigned                 sp_flags;
+  /*The per-frame time budget in microseconds, or 0 if adaptation is off.*/
+  int                      deadline;
+  /*The current step of the deadline controller.
+    Even steps correspond to the plain speed level step>>1, odd steps add all
+     of the OC_SP_FLAG_* shortcuts.*/
+  int                      sp_step;
+  /*The number of consecutive frames that finished well under the deadline.*/
+  int                      deadline_slack;
+  /*The smoothed time spent per inter frame in microseconds, or -1 if the
+     average needs to be re-seeded.*/
+  ogg_int64_t              frame_time_avg;
+  /*Statistics about the last frame for TH_ENCCTL_GET_FRAME_STATS.
+    Only the bit counts are filled in as the frame is coded; the rest is
+     gathered when the statistics are requested.*/
+  th_enc_frame_stats       frame_stats;
+  /*The time spent in each OC_ENC_STAGE_* during the current frame, in
+     nanoseconds.*/
+  ogg_int64_t              stage_ns[OC_ENC_NSTAGES];
+  /*The time at which the current stage was entered.*/
+  ogg_int64_t              stage_start;
+  /*The OC_ENC_STAGE_* currently being timed.*/
+  int                      stage;
+  /*Whether or not stage timing is enabled.*/
+  int                      profiling;
+  /*The number of frames that precede the first frame of this encoder in the
+     output stream (see TH_ENCCTL_SET_FRAME_OFFSET).*/
+  ogg_int64_t              frame_offset;
   /*Whether or not VP3 compatibility mode has been enabled.*/
   unsigned char            vp3_compatible;
   /*Whether or not any INTER frames have been coded.*/
@@ -667,6 +1031,13 @@ struct th_enc_ctx{
     The actual Huffman table used for a given coefficient depends not only on
      the choice made here, but also its index in the zig-zag ordering.*/
   unsigned char            huff_idxs[2][2][2];
+  /*The token counts of the current frame, for the Y' and C planes, in each of
+     the five Huffman table groups (DC and four AC bands).
+    These are kept up to date as tokens are logged.*/
+  ptrdiff_t                huff_token_counts[2][5][TH_NDCT_TOKENS];
+  /*The token counts coded with each Huffman table, accumulated over all the
+     frames coded so far.*/
+  ogg_int64_t              huff_stats[TH_NHUFFMAN_TABLES][TH_NDCT_TOKENS];
   /*Current count of bits used by each MV coding mode.*/
   size_t                   mv_bits[2];
   /*The mode scheme chooser for estimating mode coding costs.*/
@@ -708,17 +1079,25 @@ struct th_enc_ctx{
   unsigned                 luma_avg;
   /*The huffman tables in use.*/
   th_huff_code             huff_codes[TH_NHUFFMAN_TABLES][TH_NDCT_TOKENS];
+  /*The code lengths of the huffman tables in use, for each group of 16
+     tables, indexed by token first so that the cost of a token under all 16
+     tables can be accumulated at once.*/
+  unsigned char            huff_nbits[5][TH_NDCT_TOKENS][16];
   /*The quantization parameters in use.*/
   th_quant_info            qinfo;
+  /*Storage for the dequantization tables.*/
+  OC_ALIGN16(oc_quant_table dequant_table_data[64][3][2]);
   /*The original DC coefficients saved off from the dequatization tables.*/
   ogg_uint16_t             dequant_dc[64][3][2];
   /*Condensed dequantization tables.*/
   const ogg_uint16_t      *dequant[3][3][2];
   /*Condensed quantization tables.*/
   void                    *enquant[3][3][2];
-  /*The full set of quantization tables.*/
-  void                    *enquant_tables[64][3][2];
-  /*Storage for the quantization tables.*/
+  /*The quantization tables for each qi, stored by pli and then qti, or NULL
+     if that qi has not been used since the quantization parameters were
+     last set.*/
+  unsigned char           *enquant_qi_data[64];
+  /*Storage for the condensed quantization tables.*/
   unsigned char           *enquant_table_data;
   /*An "average" quantizer for each frame type (INTRA or INTER) and qi value.
     This is used to parameterize the rate control decisions.
@@ -750,13 +1129,44 @@ struct th_enc_ctx{
 };
 
 
+/*Fills in the condensed quantization tables for the given qii with the
+   tables for the given qi, building those the first time it is used.*/
+void oc_enc_enquant_tables_get(oc_enc_ctx *_enc,int _qii,int _qi);
+
+
+
 void oc_enc_analyze_intra(oc_enc_ctx *_enc,int _recode);
 int oc_enc_analyze_inter(oc_enc_ctx *_enc,int _allow_keyframe,int _recode);
 
 
 
+/*Returns a monotonic timestamp in nanoseconds.*/
+ogg_int64_t oc_enc_clock_ns(void);
+/*Charges the time since the last switch to the current stage and makes
+   _stage the current one.
+  Return: The previous stage, so the caller can switch back to it.*/
+int oc_enc_stage_time(oc_enc_ctx *_enc,int _stage);
+/*Switches stages if stage timing is enabled.
+  This is called from the per-block loops, so when timing is off it costs only
+   the test of the flag.*/
+#define oc_enc_stage_switch(_enc,_stage) \
+ ((_enc)->profiling?oc_enc_stage_time(_enc,_stage):(_stage))
+
+
+
+/*Converts an input image into the picture region of the given planes.*/
+void oc_enc_input_convert(oc_enc_ctx *_enc,th_img_plane _dst[3],
+ const th_input_image *_img);
+
+
+
 /*Perform fullpel motion search for a single MB against both reference frames.*/
 void oc_mcenc_search(oc_enc_ctx *_enc,int _mbi);
+/*Update the MV predictors of a MB whose input is unchanged, without search.*/
+void oc_mcenc_search_static(oc_enc_ctx *_enc,int _mbi);
+/*Adopt another encoder's fullpel motion search results for a single MB.*/
+void oc_mcenc_search_reuse(oc_enc_ctx *_enc,int _mbi,
+ const oc_mb_enc_info *_src);
 /*Refine a MB MV for one frame.*/
 void oc_mcenc_refine1mv(oc_enc_ctx *_enc,int _mbi,int _frame);
 /*Refine the block MVs.*/
@@ -841,5 +1251,14 @@ void oc_enc_enquant_table_fixup_c(void *_enquant[3][3][2],int _nqis);
 int oc_enc_quantize_c(ogg_int16_t _qdct[64],const ogg_int16_t _dct[64],
  const ogg_uint16_t _dequant[64],const void *_enquant);
 void oc_enc_fdct8x8_c(ogg_int16_t _y[64],const ogg_int16_t _x[64]);
+void oc_enc_input_deinterleave_c(unsigned char *_dst0,unsigned char *_dst1,
+ const unsigned char *_src,int _n);
+void oc_enc_input_avg_c(unsigned char *_dst,const unsigned char *_src0,
+ const unsigned char *_src1,int _n);
+void oc_enc_input_rgbx_to_y_c(unsigned char *_dst,const unsigned char *_src,
+ int _n,const ogg_int16_t _coefs[8]);
+void oc_enc_input_rgbx_to_cbcr420_c(unsigned char *_cb,unsigned char *_cr,
+ const unsigned char *_src0,const unsigned char *_src1,int _n,
+ const ogg_int16_t _coefs[16]);
 
 #endif
@@ -16,6 +16,13 @@
  ********************************************************************/
 #include <stdlib.h>
 #include <string.h>
+#if defined(_WIN32)
+# define WIN32_LEAN_AND_MEAN
+# define WIN32_EXTRA_LEAN
+# include <windows.h>
+#else
+# include <time.h>
+#endif
 #include "encint.h"
 #include "dequant.h"
 
@@ -381,6 +388,160 @@ static const unsigned char OC_MV_CODES[2][64]={
 
 
 
+/*The number of bits the frame packer stores at a time.
+  This is half the size of its accumulator, so that a write of up to this many
+   bits always fits.*/
+#define OC_ENC_PACK_FLUSH_BITS ((int)sizeof(oc_enc_pack_window)*CHAR_BIT>>1)
+/*The minimum number of bytes of packet storage to allocate.*/
+#define OC_ENC_PACK_MIN_STORAGE (4096)
+
+static void oc_enc_pack_init(oc_enc_pack_buf *_pb){
+  _pb->start=NULL;
+  _pb->ptr=_pb->stop=_pb->spill;
+  _pb->window=0;
+  _pb->bits=0;
+  _pb->err=0;
+  _pb->buf=NULL;
+  _pb->storage=0;
+  _pb->user=NULL;
+  _pb->user_storage=0;
+}
+
+static void oc_enc_pack_clear(oc_enc_pack_buf *_pb){
+  _ogg_free(_pb->buf);
+}
+
+static void oc_enc_pack_reset(oc_enc_pack_buf *_pb){
+  if(_pb->user!=NULL){
+    _pb->start=_pb->ptr=_pb->user;
+    _pb->stop=_pb->user+_pb->user_storage;
+  }
+  else if(_pb->buf!=NULL){
+    _pb->start=_pb->ptr=_pb->buf;
+    _pb->stop=_pb->buf+_pb->storage;
+  }
+  else{
+    _pb->start=NULL;
+    _pb->ptr=_pb->stop=_pb->spill;
+  }
+  _pb->window=0;
+  _pb->bits=0;
+  _pb->err=0;
+}
+
+/*Makes room for at least _nbytes more bytes of packet data.
+  If the packet is in caller-provided storage, it is moved into our own.
+  If that fails, the packet is lost, but the remaining writes go to a scratch
+   area so that packing can still run to completion.*/
+static void oc_enc_pack_grow(oc_enc_pack_buf *_pb,size_t _nbytes){
+  if(!_pb->err){
+    unsigned char *buf;
+    size_t         used;
+    size_t         storage;
+    used=_pb->start!=NULL?(size_t)(_pb->ptr-_pb->start):0;
+    storage=used+_nbytes<<1;
+    if(storage<OC_ENC_PACK_MIN_STORAGE)storage=OC_ENC_PACK_MIN_STORAGE;
+    if(_pb->start==NULL||_pb->start!=_pb->user){
+      buf=(unsigned char *)_ogg_realloc(_pb->buf,storage);
+    }
+    else{
+      /*Move the packet out of the caller's storage.
+        Nothing in our own storage is worth keeping.*/
+      if(_pb->storage<storage){
+        _ogg_free(_pb->buf);
+        _pb->buf=NULL;
+        _pb->storage=0;
+        buf=(unsigned char *)_ogg_malloc(storage);
+      }
+      else{
+        buf=_pb->buf;
+        storage=_pb->storage;
+      }
+      if(buf!=NULL)memcpy(buf,_pb->user,used);
+    }
+    if(buf!=NULL){
+      _pb->buf=buf;
+      _pb->storage=storage;
+      _pb->start=buf;
+      _pb->ptr=buf+used;
+      _pb->stop=buf+storage;
+      return;
+    }
+    _pb->err=1;
+  }
+  _pb->ptr=_pb->spill;
+  _pb->stop=_pb->spill+sizeof(_pb->spill);
+}
+
+/*Ensures the next _nbits bits can be written without reallocating.*/
+static void oc_enc_pack_reserve(oc_enc_pack_buf *_pb,size_t _nbits){
+  size_t nbytes;
+  nbytes=(_pb->bits+_nbits+7>>3)+(OC_ENC_PACK_FLUSH_BITS>>3);
+  if((size_t)(_pb->stop-_pb->ptr)<nbytes)oc_enc_pack_grow(_pb,nbytes);
+}
+
+/*Stores the oldest OC_ENC_PACK_FLUSH_BITS bits of the accumulator.*/
+static void oc_enc_pack_flush(oc_enc_pack_buf *_pb){
+  oc_enc_pack_window window;
+  int                i;
+  if(_pb->stop-_pb->ptr<OC_ENC_PACK_FLUSH_BITS>>3){
+    oc_enc_pack_grow(_pb,OC_ENC_PACK_FLUSH_BITS>>3);
+  }
+  _pb->bits-=OC_ENC_PACK_FLUSH_BITS;
+  window=_pb->window>>_pb->bits;
+  for(i=OC_ENC_PACK_FLUSH_BITS>>3;i-->0;){
+    _pb->ptr[i]=(unsigned char)window;
+    window>>=8;
+  }
+  _pb->ptr+=OC_ENC_PACK_FLUSH_BITS>>3;
+}
+
+/*Writes the low _nbits bits of _val, most significant bit first.
+  _val must not have any other bits set, and _nbits must be at most 32.*/
+static void oc_enc_pack_write(oc_enc_pack_buf *_pb,ogg_uint32_t _val,
+ int _nbits){
+  /*This only happens with accumulators narrower than 64 bits.*/
+  if(_nbits>OC_ENC_PACK_FLUSH_BITS){
+    oc_enc_pack_write(_pb,_val>>16,_nbits-16);
+    _val&=0xFFFF;
+    _nbits=16;
+  }
+  _pb->window=_pb->window<<_nbits|_val;
+  _pb->bits+=_nbits;
+  if(_pb->bits>=OC_ENC_PACK_FLUSH_BITS)oc_enc_pack_flush(_pb);
+}
+
+/*Stores any bits left in the accumulator, padding the last byte with
+   zeros.*/
+static void oc_enc_pack_finish(oc_enc_pack_buf *_pb){
+  oc_enc_pack_window window;
+  int                nbytes;
+  int                i;
+  nbytes=_pb->bits+7>>3;
+  if(_pb->stop-_pb->ptr<nbytes)oc_enc_pack_grow(_pb,nbytes);
+  window=_pb->window<<(nbytes<<3)-_pb->bits;
+  for(i=nbytes;i-->0;){
+    _pb->ptr[i]=(unsigned char)window;
+    window>>=8;
+  }
+  _pb->ptr+=nbytes;
+  _pb->window=0;
+  _pb->bits=0;
+}
+
+/*Returns the number of bits written since the last reset.*/
+static long oc_enc_pack_bits(const oc_enc_pack_buf *_pb){
+  if(_pb->start==NULL||_pb->err)return _pb->bits;
+  return (long)(_pb->ptr-_pb->start<<3)+_pb->bits;
+}
+
+/*Returns the number of bytes in the finished packet.*/
+static long oc_enc_pack_bytes(const oc_enc_pack_buf *_pb){
+  return oc_enc_pack_bits(_pb)+7>>3;
+}
+
+
+
 /*Super block run coding scheme:
    Codeword             Run Length
    0                       1
@@ -398,26 +559,27 @@ const unsigned char   OC_SB_RUN_CODE_NBITS[7]={1,3,4,6,8,10,18};
 
 
 /*Writes the bit pattern for the run length of a super block run to the given
-   oggpack_buffer.
-  _opb:       The buffer to write to.
+   frame packer.
+  _pb:        The buffer to write to.
   _run_count: The length of the run, which must be positive.
   _flag:      The current flag.
   _done:      Whether or not more flags are to be encoded.*/
-static void oc_sb_run_pack(oggpack_buffer *_opb,ptrdiff_t _run_count,
+static void oc_sb_run_pack(oc_enc_pack_buf *_pb,ptrdiff_t _run_count,
  int _flag,int _done){
   int i;
   if(_run_count>=4129){
     do{
-      oggpackB_write(_opb,0x3FFFF,18);
+      oc_enc_pack_write(_pb,0x3FFFF,18);
       _run_count-=4129;
-      if(_run_count>0)oggpackB_write(_opb,_flag,1);
-      else if(!_done)oggpackB_write(_opb,!_flag,1);
+      if(_run_count>0)oc_enc_pack_write(_pb,_flag,1);
+      else if(!_done)oc_enc_pack_write(_pb,!_flag,1);
     }
     while(_run_count>=4129);
     if(_run_count<=0)return;
   }
   for(i=0;_run_count>=OC_SB_RUN_VAL_MIN[i+1];i++);
-  oggpackB_write(_opb,OC_SB_RUN_CODE_PREFIX[i]+_run_count-OC_SB_RUN_VAL_MIN[i],
+  oc_enc_pack_write(_pb,
+   OC_SB_RUN_CODE_PREFIX[i]+_run_count-OC_SB_RUN_VAL_MIN[i],
    OC_SB_RUN_CODE_NBITS[i]);
 }
 
@@ -443,12 +605,12 @@ static const ogg_uint16_t  OC_BLOCK_RUN_CODE_PATTERN[30]={
 
 
 /*Writes the bit pattern for the run length of a block run to the given
-   oggpack_buffer.
-  _opb:       The buffer to write to.
+   frame packer.
+  _pb:        The buffer to write to.
   _run_count: The length of the run.
               This must be positive, and no more than 30.*/
-static void oc_block_run_pack(oggpack_buffer *_opb,int _run_count){
-  oggpackB_write(_opb,OC_BLOCK_RUN_CODE_PATTERN[_run_count-1],
+static void oc_block_run_pack(oc_enc_pack_buf *_pb,int _run_count){
+  oc_enc_pack_write(_pb,OC_BLOCK_RUN_CODE_PATTERN[_run_count-1],
    OC_BLOCK_RUN_CODE_NBITS[_run_count-1]);
 }
 
@@ -456,27 +618,27 @@ static void oc_block_run_pack(oggpack_buffer *_opb,int _run_count){
 
 static void oc_enc_frame_header_pack(oc_enc_ctx *_enc){
   /*Mark this as a data packet.*/
-  oggpackB_write(&_enc->opb,0,1);
+  oc_enc_pack_write(&_enc->pack,0,1);
   /*Output the frame type (key frame or delta frame).*/
-  oggpackB_write(&_enc->opb,_enc->state.frame_type,1);
+  oc_enc_pack_write(&_enc->pack,_enc->state.frame_type,1);
   /*Write out the current qi list.*/
-  oggpackB_write(&_enc->opb,_enc->state.qis[0],6);
+  oc_enc_pack_write(&_enc->pack,_enc->state.qis[0],6);
   if(_enc->state.nqis>1){
-    oggpackB_write(&_enc->opb,1,1);
-    oggpackB_write(&_enc->opb,_enc->state.qis[1],6);
+    oc_enc_pack_write(&_enc->pack,1,1);
+    oc_enc_pack_write(&_enc->pack,_enc->state.qis[1],6);
     if(_enc->state.nqis>2){
-      oggpackB_write(&_enc->opb,1,1);
-      oggpackB_write(&_enc->opb,_enc->state.qis[2],6);
+      oc_enc_pack_write(&_enc->pack,1,1);
+      oc_enc_pack_write(&_enc->pack,_enc->state.qis[2],6);
     }
-    else oggpackB_write(&_enc->opb,0,1);
+    else oc_enc_pack_write(&_enc->pack,0,1);
   }
-  else oggpackB_write(&_enc->opb,0,1);
+  else oc_enc_pack_write(&_enc->pack,0,1);
   if(_enc->state.frame_type==OC_INTRA_FRAME){
     /*Key frames have 3 unused configuration bits, holdovers from the VP3 days.
       Most of the other unused bits in the VP3 headers were eliminated.
       Monty kept these to leave us some wiggle room for future expansion,
        though a single bit in all frames would have been far more useful.*/
-    oggpackB_write(&_enc->opb,0,3);
+    oc_enc_pack_write(&_enc->pack,0,3);
   }
 }
 
@@ -494,7 +656,7 @@ static unsigned oc_enc_partial_sb_flags_pack(oc_enc_ctx *_enc){
   sb_flags=_enc->state.sb_flags;
   nsbs=_enc->state.nsbs;
   flag=sb_flags[0].coded_partially;
-  oggpackB_write(&_enc->opb,flag,1);
+  oc_enc_pack_write(&_enc->pack,flag,1);
   sbi=npartial=0;
   do{
     unsigned run_count;
@@ -503,7 +665,7 @@ static unsigned oc_enc_partial_sb_flags_pack(oc_enc_ctx *_enc){
       run_count++;
       npartial+=flag;
     }
-    oc_sb_run_pack(&_enc->opb,run_count,flag,sbi>=nsbs);
+    oc_sb_run_pack(&_enc->pack,run_count,flag,sbi>=nsbs);
     flag=!flag;
   }
   while(sbi<nsbs);
@@ -524,7 +686,7 @@ static void oc_enc_coded_sb_flags_pack(oc_enc_ctx *_enc){
   /*Skip partially coded super blocks; their flags have already been coded.*/
   for(sbi=0;sb_flags[sbi].coded_partially;sbi++);
   flag=sb_flags[sbi].coded_fully;
-  oggpackB_write(&_enc->opb,flag,1);
+  oc_enc_pack_write(&_enc->pack,flag,1);
   do{
     unsigned run_count;
     for(run_count=0;sbi<nsbs;sbi++){
@@ -532,7 +694,7 @@ static void oc_enc_coded_sb_flags_pack(oc_enc_ctx *_enc){
       if(sb_flags[sbi].coded_fully!=flag)break;
       run_count++;
     }
-    oc_sb_run_pack(&_enc->opb,run_count,flag,sbi>=nsbs);
+    oc_sb_run_pack(&_enc->pack,run_count,flag,sbi>=nsbs);
     flag=!flag;
   }
   while(sbi<nsbs);
@@ -558,7 +720,7 @@ static void oc_enc_coded_flags_pack(oc_enc_ctx *_enc){
   /*If there's at least one partial SB, store individual coded block flags.*/
   if(sbi<nsbs){
     flag=frags[sb_maps[sbi][0][0]].coded;
-    oggpackB_write(&_enc->opb,flag,1);
+    oc_enc_pack_write(&_enc->pack,flag,1);
     run_count=0;
     nsbs=sbi=0;
     for(pli=0;pli<3;pli++){
@@ -573,7 +735,7 @@ static void oc_enc_coded_flags_pack(oc_enc_ctx *_enc){
               fragi=sb_maps[sbi][quadi][bi];
               if(fragi>=0){
                 if(frags[fragi].coded!=flag){
-                  oc_block_run_pack(&_enc->opb,run_count);
+                  oc_block_run_pack(&_enc->pack,run_count);
                   flag=!flag;
                   run_count=1;
                 }
@@ -585,7 +747,7 @@ static void oc_enc_coded_flags_pack(oc_enc_ctx *_enc){
       }
     }
     /*Flush any trailing block coded run.*/
-    if(run_count>0)oc_block_run_pack(&_enc->opb,run_count);
+    if(run_count>0)oc_block_run_pack(&_enc->pack,run_count);
   }
 }
 
@@ -601,11 +763,11 @@ static void oc_enc_mb_modes_pack(oc_enc_ctx *_enc){
   int                  mb_mode;
   scheme=_enc->chooser.scheme_list[0];
   /*Encode the best scheme.*/
-  oggpackB_write(&_enc->opb,scheme,3);
+  oc_enc_pack_write(&_enc->pack,scheme,3);
   /*If the chosen scheme is scheme 0, send the mode frequency ordering.*/
   if(scheme==0){
     for(mb_mode=0;mb_mode<OC_NMODES;mb_mode++){
-      oggpackB_write(&_enc->opb,_enc->chooser.scheme0_ranks[mb_mode],3);
+      oc_enc_pack_write(&_enc->pack,_enc->chooser.scheme0_ranks[mb_mode],3);
     }
   }
   mode_ranks=_enc->chooser.mode_ranks[scheme];
@@ -617,7 +779,7 @@ static void oc_enc_mb_modes_pack(oc_enc_ctx *_enc){
   for(mbii=0;mbii<ncoded_mbis;mbii++){
     int rank;
     rank=mode_ranks[mb_modes[coded_mbis[mbii]]];
-    oggpackB_write(&_enc->opb,mode_codes[rank],mode_bits[rank]);
+    oc_enc_pack_write(&_enc->pack,mode_codes[rank],mode_bits[rank]);
   }
 }
 
@@ -626,9 +788,9 @@ static void oc_enc_mv_pack(oc_enc_ctx *_enc,int _mv_scheme,oc_mv _mv){
   int dy;
   dx=OC_MV_X(_mv);
   dy=OC_MV_Y(_mv);
-  oggpackB_write(&_enc->opb,
+  oc_enc_pack_write(&_enc->pack,
    OC_MV_CODES[_mv_scheme][dx+31],OC_MV_BITS[_mv_scheme][dx+31]);
-  oggpackB_write(&_enc->opb,
+  oc_enc_pack_write(&_enc->pack,
    OC_MV_CODES[_mv_scheme][dy+31],OC_MV_BITS[_mv_scheme][dy+31]);
 }
 
@@ -643,7 +805,7 @@ static void oc_enc_mvs_pack(oc_enc_ctx *_enc){
   int                 mv_scheme;
   /*Choose the coding scheme.*/
   mv_scheme=_enc->mv_bits[1]<_enc->mv_bits[0];
-  oggpackB_write(&_enc->opb,mv_scheme,1);
+  oc_enc_pack_write(&_enc->pack,mv_scheme,1);
   /*Encode the motion vectors.
     Macro blocks are iterated in Hilbert scan order, but the MVs within the
      macro block are coded in raster order.*/
@@ -697,7 +859,7 @@ static void oc_enc_block_qis_pack(oc_enc_ctx *_enc){
   coded_fragis=_enc->state.coded_fragis;
   frags=_enc->state.frags;
   flag=!!frags[coded_fragis[0]].qii;
-  oggpackB_write(&_enc->opb,flag,1);
+  oc_enc_pack_write(&_enc->pack,flag,1);
   nqi0=0;
   for(fragii=0;fragii<ncoded_fragis;){
     for(run_count=0;fragii<ncoded_fragis;fragii++){
@@ -705,13 +867,13 @@ static void oc_enc_block_qis_pack(oc_enc_ctx *_enc){
       run_count++;
       nqi0+=!flag;
     }
-    oc_sb_run_pack(&_enc->opb,run_count,flag,fragii>=ncoded_fragis);
+    oc_sb_run_pack(&_enc->pack,run_count,flag,fragii>=ncoded_fragis);
     flag=!flag;
   }
   if(_enc->state.nqis<3||nqi0>=ncoded_fragis)return;
   for(fragii=0;!frags[coded_fragis[fragii]].qii;fragii++);
   flag=frags[coded_fragis[fragii]].qii-1;
-  oggpackB_write(&_enc->opb,flag,1);
+  oc_enc_pack_write(&_enc->pack,flag,1);
   while(fragii<ncoded_fragis){
     for(run_count=0;fragii<ncoded_fragis;fragii++){
       int qii;
@@ -720,58 +882,26 @@ static void oc_enc_block_qis_pack(oc_enc_ctx *_enc){
       if(qii-1!=flag)break;
       run_count++;
     }
-    oc_sb_run_pack(&_enc->opb,run_count,flag,fragii>=ncoded_fragis);
+    oc_sb_run_pack(&_enc->pack,run_count,flag,fragii>=ncoded_fragis);
     flag=!flag;
   }
 }
 
-/*Counts the tokens of each type used for the given range of coefficient
-   indices in zig-zag order.
-  _zzi_start:      The first zig-zag index to include.
-  _zzi_end:        The first zig-zag index to not include.
-  _token_counts_y: Returns the token counts for the Y' plane.
-  _token_counts_c: Returns the token counts for the Cb and Cr planes.*/
-static void oc_enc_count_tokens(oc_enc_ctx *_enc,int _zzi_start,int _zzi_end,
- ptrdiff_t _token_counts_y[32],ptrdiff_t _token_counts_c[32]){
-  const unsigned char *dct_tokens;
-  ptrdiff_t            ndct_tokens;
-  int                  pli;
-  int                  zzi;
-  ptrdiff_t            ti;
-  memset(_token_counts_y,0,32*sizeof(*_token_counts_y));
-  memset(_token_counts_c,0,32*sizeof(*_token_counts_c));
-  for(zzi=_zzi_start;zzi<_zzi_end;zzi++){
-    dct_tokens=_enc->dct_tokens[0][zzi];
-    ndct_tokens=_enc->ndct_tokens[0][zzi];
-    for(ti=_enc->dct_token_offs[0][zzi];ti<ndct_tokens;ti++){
-      _token_counts_y[dct_tokens[ti]]++;
-    }
-  }
-  for(pli=1;pli<3;pli++){
-    for(zzi=_zzi_start;zzi<_zzi_end;zzi++){
-      dct_tokens=_enc->dct_tokens[pli][zzi];
-      ndct_tokens=_enc->ndct_tokens[pli][zzi];
-      for(ti=_enc->dct_token_offs[pli][zzi];ti<ndct_tokens;ti++){
-        _token_counts_c[dct_tokens[ti]]++;
-      }
-    }
-  }
-}
-
 /*Computes the number of bits used for each of the potential Huffman code for
    the given list of token counts.
   The bits are added to whatever the current bit counts are.*/
 static void oc_enc_count_bits(oc_enc_ctx *_enc,int _hgi,
  const ptrdiff_t _token_counts[32],size_t _bit_counts[16]){
-  int huffi;
-  int huff_offs;
   int token;
-  huff_offs=_hgi<<4;
-  for(huffi=0;huffi<16;huffi++){
-    for(token=0;token<32;token++){
-      _bit_counts[huffi]+=
-       _token_counts[token]*_enc->huff_codes[huffi+huff_offs][token].nbits;
-    }
+  int huffi;
+  for(token=0;token<32;token++){
+    const unsigned char *nbits;
+    size_t               count;
+    /*Most tokens do not occur in a given group at all.*/
+    if(_token_counts[token]<=0)continue;
+    count=(size_t)_token_counts[token];
+    nbits=_enc->huff_nbits[_hgi][token];
+    for(huffi=0;huffi<16;huffi++)_bit_counts[huffi]+=count*nbits[huffi];
   }
 }
 
@@ -805,54 +935,80 @@ static void oc_enc_huff_group_pack(oc_enc_ctx *_enc,
         int token;
         int neb;
         token=dct_tokens[ti];
-        oggpackB_write(&_enc->opb,huff_codes[token].pattern,
+        oc_enc_pack_write(&_enc->pack,huff_codes[token].pattern,
          huff_codes[token].nbits);
         neb=OC_DCT_TOKEN_EXTRA_BITS[token];
-        if(neb)oggpackB_write(&_enc->opb,extra_bits[ti],neb);
+        if(neb)oc_enc_pack_write(&_enc->pack,extra_bits[ti],neb);
       }
     }
   }
 }
 
+/*Returns the number of extra bits that follow the given tokens.*/
+static size_t oc_enc_count_extra_bits(const ptrdiff_t _token_counts[32]){
+  size_t neb;
+  int    token;
+  neb=0;
+  for(token=0;token<TH_NDCT_TOKENS;token++){
+    neb+=_token_counts[token]*OC_DCT_TOKEN_EXTRA_BITS[token];
+  }
+  return neb;
+}
+
 static void oc_enc_residual_tokens_pack(oc_enc_ctx *_enc){
   static const unsigned char  OC_HUFF_GROUP_MIN[6]={0,1,6,15,28,64};
   static const unsigned char *OC_HUFF_GROUP_MAX=OC_HUFF_GROUP_MIN+1;
-  ptrdiff_t token_counts_y[32];
-  ptrdiff_t token_counts_c[32];
+  ptrdiff_t (*token_counts_y)[TH_NDCT_TOKENS];
+  ptrdiff_t (*token_counts_c)[TH_NDCT_TOKENS];
   size_t    bits_y[16];
   size_t    bits_c[16];
+  size_t    neb;
   int       huff_idxs[2];
+  long      bits;
   int       frame_type;
   int       hgi;
   frame_type=_enc->state.frame_type;
+  bits=oc_enc_pack_bits(&_enc->pack);
+  /*The tokenizer counted the tokens as it logged them.*/
+  token_counts_y=_enc->huff_token_counts[0];
+  token_counts_c=_enc->huff_token_counts[1];
   /*Choose which Huffman tables to use for the DC token list.*/
-  oc_enc_count_tokens(_enc,0,1,token_counts_y,token_counts_c);
   memset(bits_y,0,sizeof(bits_y));
   memset(bits_c,0,sizeof(bits_c));
-  oc_enc_count_bits(_enc,0,token_counts_y,bits_y);
-  oc_enc_count_bits(_enc,0,token_counts_c,bits_c);
+  oc_enc_count_bits(_enc,0,token_counts_y[0],bits_y);
+  oc_enc_count_bits(_enc,0,token_counts_c[0],bits_c);
+  neb=oc_enc_count_extra_bits(token_counts_y[0])
+   +oc_enc_count_extra_bits(token_counts_c[0]);
   huff_idxs[0]=oc_select_huff_idx(bits_y);
   huff_idxs[1]=oc_select_huff_idx(bits_c);
+  /*The token counts tell us exactly how much space the list needs.*/
+  oc_enc_pack_reserve(&_enc->pack,
+   8+bits_y[huff_idxs[0]]+bits_c[huff_idxs[1]]+neb);
   /*Write the DC token list with the chosen tables.*/
-  oggpackB_write(&_enc->opb,huff_idxs[0],4);
-  oggpackB_write(&_enc->opb,huff_idxs[1],4);
+  oc_enc_pack_write(&_enc->pack,huff_idxs[0],4);
+  oc_enc_pack_write(&_enc->pack,huff_idxs[1],4);
   _enc->huff_idxs[frame_type][0][0]=(unsigned char)huff_idxs[0];
   _enc->huff_idxs[frame_type][0][1]=(unsigned char)huff_idxs[1];
   oc_enc_huff_group_pack(_enc,0,1,huff_idxs);
+  _enc->frame_stats.dc_bits=oc_enc_pack_bits(&_enc->pack)-bits;
+  bits+=_enc->frame_stats.dc_bits;
   /*Choose which Huffman tables to use for the AC token lists.*/
   memset(bits_y,0,sizeof(bits_y));
   memset(bits_c,0,sizeof(bits_c));
+  neb=0;
   for(hgi=1;hgi<5;hgi++){
-    oc_enc_count_tokens(_enc,OC_HUFF_GROUP_MIN[hgi],OC_HUFF_GROUP_MAX[hgi],
-     token_counts_y,token_counts_c);
-    oc_enc_count_bits(_enc,hgi,token_counts_y,bits_y);
-    oc_enc_count_bits(_enc,hgi,token_counts_c,bits_c);
+    oc_enc_count_bits(_enc,hgi,token_counts_y[hgi],bits_y);
+    oc_enc_count_bits(_enc,hgi,token_counts_c[hgi],bits_c);
+    neb+=oc_enc_count_extra_bits(token_counts_y[hgi])
+     +oc_enc_count_extra_bits(token_counts_c[hgi]);
   }
   huff_idxs[0]=oc_select_huff_idx(bits_y);
   huff_idxs[1]=oc_select_huff_idx(bits_c);
+  oc_enc_pack_reserve(&_enc->pack,
+   8+bits_y[huff_idxs[0]]+bits_c[huff_idxs[1]]+neb);
   /*Write the AC token lists using the chosen tables.*/
-  oggpackB_write(&_enc->opb,huff_idxs[0],4);
-  oggpackB_write(&_enc->opb,huff_idxs[1],4);
+  oc_enc_pack_write(&_enc->pack,huff_idxs[0],4);
+  oc_enc_pack_write(&_enc->pack,huff_idxs[1],4);
   _enc->huff_idxs[frame_type][1][0]=(unsigned char)huff_idxs[0];
   _enc->huff_idxs[frame_type][1][1]=(unsigned char)huff_idxs[1];
   for(hgi=1;hgi<5;hgi++){
@@ -861,6 +1017,29 @@ static void oc_enc_residual_tokens_pack(oc_enc_ctx *_enc){
     oc_enc_huff_group_pack(_enc,
      OC_HUFF_GROUP_MIN[hgi],OC_HUFF_GROUP_MAX[hgi],huff_idxs);
   }
+  _enc->frame_stats.ac_bits=oc_enc_pack_bits(&_enc->pack)-bits;
+}
+
+/*The longest code to use in Huffman tables built from the token statistics.
+  The format allows 32 bits, but shorter codes keep decoder lookup tables
+   small, and the limit only affects tokens that almost never occur.*/
+#define OC_HUFF_OPT_MAXBITS (24)
+
+/*Adds the token counts of the frame just coded to the statistics kept for
+   each Huffman table.*/
+static void oc_enc_huff_stats_update(oc_enc_ctx *_enc){
+  int frame_type;
+  int hgi;
+  int ci;
+  int ti;
+  frame_type=_enc->state.frame_type;
+  for(ci=0;ci<2;ci++)for(hgi=0;hgi<5;hgi++){
+    ogg_int64_t     *stats;
+    const ptrdiff_t *counts;
+    stats=_enc->huff_stats[hgi<<4|_enc->huff_idxs[frame_type][hgi>0][ci]];
+    counts=_enc->huff_token_counts[ci][hgi];
+    for(ti=0;ti<TH_NDCT_TOKENS;ti++)stats[ti]+=counts[ti];
+  }
 }
 
 /*Packs an explicit drop frame, instead of using the more efficient 0-byte
@@ -876,58 +1055,88 @@ static void oc_enc_residual_tokens_pack(oc_enc_ctx *_enc){
 static void oc_enc_drop_frame_pack(oc_enc_ctx *_enc){
   unsigned nsbs;
   /*Mark this as a data packet.*/
-  oggpackB_write(&_enc->opb,0,1);
+  oc_enc_pack_write(&_enc->pack,0,1);
   /*Output the frame type (key frame or delta frame).*/
-  oggpackB_write(&_enc->opb,OC_INTER_FRAME,1);
+  oc_enc_pack_write(&_enc->pack,OC_INTER_FRAME,1);
   /*Write out the current qi list.
     We always use just 1 qi, to avoid wasting bits on the others.*/
-  oggpackB_write(&_enc->opb,_enc->state.qis[0],6);
-  oggpackB_write(&_enc->opb,0,1);
+  oc_enc_pack_write(&_enc->pack,_enc->state.qis[0],6);
+  oc_enc_pack_write(&_enc->pack,0,1);
   /*Coded block flags: everything is uncoded.*/
   nsbs=_enc->state.nsbs;
   /*No partially coded SBs.*/
-  oggpackB_write(&_enc->opb,0,1);
-  oc_sb_run_pack(&_enc->opb,nsbs,0,1);
+  oc_enc_pack_write(&_enc->pack,0,1);
+  oc_sb_run_pack(&_enc->pack,nsbs,0,1);
   /*No fully coded SBs.*/
-  oggpackB_write(&_enc->opb,0,1);
-  oc_sb_run_pack(&_enc->opb,nsbs,0,1);
+  oc_enc_pack_write(&_enc->pack,0,1);
+  oc_sb_run_pack(&_enc->pack,nsbs,0,1);
   /*MB modes: just need write which scheme to use.
     Since we have no coded MBs, we can pick any of them except 0, which would
      require writing out an additional mode list.*/
-  oggpackB_write(&_enc->opb,7,3);
+  oc_enc_pack_write(&_enc->pack,7,3);
   /*MVs: just need write which scheme to use.
     We can pick either one, since we have no MVs.*/
-  oggpackB_write(&_enc->opb,1,1);
+  oc_enc_pack_write(&_enc->pack,1,1);
   /*Write the chosen DC token tables.*/
-  oggpackB_write(&_enc->opb,_enc->huff_idxs[OC_INTER_FRAME][0][0],4);
-  oggpackB_write(&_enc->opb,_enc->huff_idxs[OC_INTER_FRAME][0][1],4);
+  oc_enc_pack_write(&_enc->pack,_enc->huff_idxs[OC_INTER_FRAME][0][0],4);
+  oc_enc_pack_write(&_enc->pack,_enc->huff_idxs[OC_INTER_FRAME][0][1],4);
   /*Write the chosen AC token tables.*/
-  oggpackB_write(&_enc->opb,_enc->huff_idxs[OC_INTER_FRAME][1][0],4);
-  oggpackB_write(&_enc->opb,_enc->huff_idxs[OC_INTER_FRAME][1][1],4);
+  oc_enc_pack_write(&_enc->pack,_enc->huff_idxs[OC_INTER_FRAME][1][0],4);
+  oc_enc_pack_write(&_enc->pack,_enc->huff_idxs[OC_INTER_FRAME][1][1],4);
+}
+
+/*Resets the per-section bit counts of the frame statistics.*/
+static void oc_enc_clear_bit_stats(th_enc_frame_stats *_stats){
+  _stats->header_bits=0;
+  _stats->flag_bits=0;
+  _stats->mode_bits=0;
+  _stats->mv_bits=0;
+  _stats->qi_bits=0;
+  _stats->dc_bits=0;
+  _stats->ac_bits=0;
 }
 
 static void oc_enc_frame_pack(oc_enc_ctx *_enc){
+  th_enc_frame_stats *stats;
+  long                bits;
+  int                 stage;
   /*musl libc malloc()/realloc() calls might use floating point, so make sure
      we've cleared the MMX state for them.*/
   oc_restore_fpu(&_enc->state);
-  oggpackB_reset(&_enc->opb);
+  oc_enc_pack_reset(&_enc->pack);
+  stats=&_enc->frame_stats;
+  oc_enc_clear_bit_stats(stats);
   /*Only proceed if we have some coded blocks.*/
   if(_enc->state.ntotal_coded_fragis>0){
     oc_enc_frame_header_pack(_enc);
+    bits=stats->header_bits=oc_enc_pack_bits(&_enc->pack);
     if(_enc->state.frame_type==OC_INTER_FRAME){
       /*Coded block flags, MB modes, and MVs are only needed for delta frames.*/
       oc_enc_coded_flags_pack(_enc);
+      stats->flag_bits=oc_enc_pack_bits(&_enc->pack)-bits;
+      bits+=stats->flag_bits;
       oc_enc_mb_modes_pack(_enc);
+      stats->mode_bits=oc_enc_pack_bits(&_enc->pack)-bits;
+      bits+=stats->mode_bits;
       oc_enc_mvs_pack(_enc);
+      stats->mv_bits=oc_enc_pack_bits(&_enc->pack)-bits;
+      bits+=stats->mv_bits;
     }
     oc_enc_block_qis_pack(_enc);
+    stats->qi_bits=oc_enc_pack_bits(&_enc->pack)-bits;
+    stage=oc_enc_stage_switch(_enc,OC_ENC_STAGE_TOKENIZE);
     oc_enc_tokenize_finish(_enc);
+    oc_enc_stage_switch(_enc,stage);
     oc_enc_residual_tokens_pack(_enc);
   }
   /*If there are no coded blocks, we can drop this frame simply by emitting a
      0 byte packet.
     We emit an inter frame with no coded blocks in VP3-compatibility mode.*/
-  else if(_enc->vp3_compatible)oc_enc_drop_frame_pack(_enc);
+  else if(_enc->vp3_compatible){
+    oc_enc_drop_frame_pack(_enc);
+    stats->header_bits=oc_enc_pack_bits(&_enc->pack);
+  }
+  oc_enc_pack_finish(&_enc->pack);
   /*Success: Mark the packet as ready to be flushed.*/
   _enc->packet_state=OC_PACKET_READY;
 #if defined(OC_COLLECT_METRICS)
@@ -958,6 +1167,10 @@ void oc_enc_accel_init_c(oc_enc_ctx *_enc){
   _enc->opt_vtable.frag_recon_intra=oc_frag_recon_intra_c;
   _enc->opt_vtable.frag_recon_inter=oc_frag_recon_inter_c;
   _enc->opt_vtable.fdct8x8=oc_enc_fdct8x8_c;
+  _enc->opt_vtable.input_deinterleave=oc_enc_input_deinterleave_c;
+  _enc->opt_vtable.input_avg=oc_enc_input_avg_c;
+  _enc->opt_vtable.input_rgbx_to_y=oc_enc_input_rgbx_to_y_c;
+  _enc->opt_vtable.input_rgbx_to_cbcr420=oc_enc_input_rgbx_to_cbcr420_c;
 # endif
   _enc->opt_data.enquant_table_size=64*sizeof(oc_iquant);
   _enc->opt_data.enquant_table_alignment=16;
@@ -1047,9 +1260,34 @@ static void oc_enc_mb_info_init(oc_enc_ctx *_enc){
   }
 }
 
+/*Rebuilds the code length table used to choose Huffman tables after the
+   codes change.
+  The table is transposed in a local array and copied in afterwards.
+  Storing straight into _enc miscompiles with GCC 12.2 at -O2 -funroll-loops
+   (our default flags): induction variable optimization rewrites the stores
+   relative to a null base, after which the function is taken to have no side
+   effects and every call to it is removed.*/
+static void oc_enc_huff_codes_updated(oc_enc_ctx *_enc){
+  unsigned char nbits[5][TH_NDCT_TOKENS][16];
+  int           hgi;
+  int           token;
+  int           huffi;
+  for(hgi=0;hgi<5;hgi++){
+    for(token=0;token<TH_NDCT_TOKENS;token++){
+      for(huffi=0;huffi<16;huffi++){
+        nbits[hgi][token][huffi]=
+         (unsigned char)_enc->huff_codes[hgi<<4|huffi][token].nbits;
+      }
+    }
+  }
+  memcpy(_enc->huff_nbits,nbits,sizeof(_enc->huff_nbits));
+}
+
 static int oc_enc_set_huffman_codes(oc_enc_ctx *_enc,
  const th_huff_code _codes[TH_NHUFFMAN_TABLES][TH_NDCT_TOKENS]){
   int ret;
+  int hi;
+  int ti;
   if(_enc==NULL)return TH_EFAULT;
   if(_enc->packet_state>OC_PACKET_SETUP_HDR)return TH_EINVAL;
   if(_codes==NULL)_codes=TH_VP31_HUFF_CODES;
@@ -1058,9 +1296,26 @@ static int oc_enc_set_huffman_codes(oc_enc_ctx *_enc,
   ret=oc_huff_codes_pack(&_enc->opb,_codes);
   if(ret<0)return ret;
   memcpy(_enc->huff_codes,_codes,sizeof(_enc->huff_codes));
+  /*The validation ignores any bits set above the length of a code, but
+     oc_enc_pack_write() requires them to be clear.*/
+  for(hi=0;hi<TH_NHUFFMAN_TABLES;hi++)for(ti=0;ti<TH_NDCT_TOKENS;ti++){
+    th_huff_code *code;
+    code=_enc->huff_codes[hi]+ti;
+    if(code->nbits<32)code->pattern&=((ogg_uint32_t)1<<code->nbits)-1;
+  }
+  oc_enc_huff_codes_updated(_enc);
   return 0;
 }
 
+/*Frees the quantization tables built for each qi.*/
+static void oc_enc_enquant_tables_clear(oc_enc_ctx *_enc){
+  int qi;
+  for(qi=0;qi<64;qi++){
+    oc_mem_free(&_enc->state.mem,_enc->enquant_qi_data[qi],TH_ALLOC_TABLES);
+    _enc->enquant_qi_data[qi]=NULL;
+  }
+}
+
 static void oc_enc_enquant_tables_init(oc_enc_ctx *_enc,
  const th_quant_info *_qinfo){
   unsigned char *etd;
@@ -1072,33 +1327,59 @@ static void oc_enc_enquant_tables_init(oc_enc_ctx *_enc,
   int            qti;
   for(qi=0;qi<64;qi++)for(pli=0;pli<3;pli++)for(qti=0;qti<2;qti++){
     _enc->state.dequant_tables[qi][pli][qti]=
-     _enc->state.dequant_table_data[qi][pli][qti];
+     _enc->dequant_table_data[qi][pli][qti];
   }
-  /*Initialize the dequantization tables.*/
+  /*Initialize the dequantization tables.
+    Rate control needs all of these up front.*/
   oc_dequant_tables_init(_enc->state.dequant_tables,NULL,_qinfo);
   /*And save off the DC values.*/
   for(qi=0;qi<64;qi++)for(pli=0;pli<3;pli++)for(qti=0;qti<2;qti++){
     _enc->dequant_dc[qi][pli][qti]=_enc->state.dequant_tables[qi][pli][qti][0];
   }
-  /*Set up storage for the quantization tables.*/
+  /*The quantization tables for each qi are only built when a frame first uses
+     it, so just throw away any built from the old parameters.*/
+  oc_enc_enquant_tables_clear(_enc);
+  /*Set up storage for the local copies we modify for each frame.*/
   etd=_enc->enquant_table_data;
   ets=_enc->opt_data.enquant_table_size;
   align=-(etd-(unsigned char *)0)&_enc->opt_data.enquant_table_alignment-1;
   etd+=align;
-  /*Set up the main tables.*/
-  for(qi=0;qi<64;qi++)for(pli=0;pli<3;pli++)for(qti=0;qti<2;qti++){
-    _enc->enquant_tables[qi][pli][qti]=etd;
-    oc_enc_enquant_table_init(_enc,etd,
-     _enc->state.dequant_tables[qi][pli][qti]);
-    etd+=ets;
-  }
-  /*Set up storage for the local copies we modify for each frame.*/
   for(pli=0;pli<3;pli++)for(qii=0;qii<3;qii++)for(qti=0;qti<2;qti++){
     _enc->enquant[pli][qii][qti]=etd;
     etd+=ets;
   }
 }
 
+void oc_enc_enquant_tables_get(oc_enc_ctx *_enc,int _qii,int _qi){
+  unsigned char *etd;
+  size_t         ets;
+  int            pli;
+  int            qti;
+  ets=_enc->opt_data.enquant_table_size;
+  etd=_enc->enquant_qi_data[_qi];
+  if(etd==NULL){
+    /*If there is no memory to keep the tables in, build them in place for
+       this frame only.*/
+    etd=(unsigned char *)oc_mem_alloc(&_enc->state.mem,6*ets,
+     _enc->opt_data.enquant_table_alignment,TH_ALLOC_TABLES);
+    for(pli=0;pli<3;pli++)for(qti=0;qti<2;qti++){
+      oc_quant_table dequant;
+      /*The analysis overwrites the DC coefficient of the dequantization
+         tables in use for each frame, so start from the original.*/
+      memcpy(dequant,_enc->state.dequant_tables[_qi][pli][qti],
+       sizeof(dequant));
+      dequant[0]=_enc->dequant_dc[_qi][pli][qti];
+      oc_enc_enquant_table_init(_enc,etd!=NULL?etd+(pli*2+qti)*ets:
+       _enc->enquant[pli][_qii][qti],dequant);
+    }
+    if(etd==NULL)return;
+    _enc->enquant_qi_data[_qi]=etd;
+  }
+  for(pli=0;pli<3;pli++)for(qti=0;qti<2;qti++){
+    memcpy(_enc->enquant[pli][_qii][qti],etd+(pli*2+qti)*ets,ets);
+  }
+}
+
 /*Updates the encoder state after the quantization parameters have been
    changed.*/
 static void oc_enc_quant_params_updated(oc_enc_ctx *_enc,
@@ -1137,8 +1418,79 @@ static int oc_enc_set_quant_params(oc_enc_ctx *_enc,
 }
 
 static void oc_enc_clear(oc_enc_ctx *_enc);
+static void oc_enc_async_clear(oc_enc_ctx *_enc);
+
+/*Cleans up the requested stream settings.*/
+static void oc_enc_info_init(th_info *_dst,const th_info *_src){
+  memcpy(_dst,_src,sizeof(*_dst));
+  _dst->version_major=TH_VERSION_MAJOR;
+  _dst->version_minor=TH_VERSION_MINOR;
+  _dst->version_subminor=TH_VERSION_SUB;
+  if(_dst->quality>63)_dst->quality=63;
+  if(_dst->quality<0)_dst->quality=32;
+  if(_dst->target_bitrate<0)_dst->target_bitrate=0;
+}
+
+/*Sets all of the per-stream state and settings to their defaults.
+  This is shared by oc_enc_init() and th_encode_reset(), and does not touch any
+   of the buffers, which must already have been set up.*/
+static void oc_enc_stream_init(oc_enc_ctx *_enc){
+  _enc->keyframe_frequency_force=1<<_enc->state.info.keyframe_granule_shift;
+  _enc->state.qis[0]=_enc->state.info.quality;
+  _enc->state.nqis=1;
+  _enc->activity_avg=90<<12;
+  _enc->luma_avg=128<<8;
+  oc_rc_state_init(&_enc->rc,_enc);
+  _enc->async_depth=2;
+  /*Asynchronous encoding uses a thread owned by the encoder by default.*/
+  memset(&_enc->executor,0,sizeof(_enc->executor));
+  memcpy(_enc->huff_codes,TH_VP31_HUFF_CODES,sizeof(_enc->huff_codes));
+  oc_enc_huff_codes_updated(_enc);
+  /*Reset the packet-out state machine.*/
+  _enc->packet_state=OC_PACKET_INFO_HDR;
+  _enc->dup_count=0;
+  _enc->nqueued_dups=0;
+  _enc->prev_dup_count=0;
+  /*Don't look for repeated input frames by default.*/
+  _enc->dup_threshold=-1;
+  _enc->refresh_period=0;
+  _enc->refresh_pos=0;
+  /*Enable speed optimizations up through early skip by default.*/
+  _enc->sp_level=OC_SP_LEVEL_EARLY_SKIP;
+  _enc->sp_flags=0;
+  /*No deadline-driven speed adaptation by default.*/
+  _enc->deadline=0;
+  _enc->sp_step=OC_SP_LEVEL_EARLY_SKIP<<1;
+  _enc->deadline_slack=0;
+  _enc->frame_time_avg=-1;
+  /*No frame has been dropped yet.*/
+  _enc->prevframe_dropped=0;
+  /*No input buffer has been lent out.*/
+  _enc->borrowed_refi=-1;
+  _enc->dirty_rects=0;
+  _enc->io_base_refi=-1;
+  _enc->ladder_master=NULL;
+  _enc->ladder_frame=-1;
+  _enc->mv_hints_valid=0;
+  /*Stage timing is off until someone asks for frame statistics.*/
+  memset(&_enc->frame_stats,0,sizeof(_enc->frame_stats));
+  memset(_enc->stage_ns,0,sizeof(_enc->stage_ns));
+  _enc->stage_start=0;
+  _enc->stage=OC_ENC_STAGE_OTHER;
+  _enc->profiling=0;
+  /*By default this encoder produces the whole stream.*/
+  _enc->frame_offset=0;
+  /*Disable VP3 compatibility by default.*/
+  _enc->vp3_compatible=0;
+  /*No INTER frames coded yet.*/
+  _enc->coded_inter_frame=0;
+  oc_mode_scheme_chooser_init(&_enc->chooser);
+  memset(_enc->huff_idxs,0,sizeof(_enc->huff_idxs));
+  memset(_enc->huff_stats,0,sizeof(_enc->huff_stats));
+}
 
-static int oc_enc_init(oc_enc_ctx *_enc,const th_info *_info){
+static int oc_enc_init(oc_enc_ctx *_enc,const th_info *_info,
+ const oc_mem *_mem){
   th_info   info;
   size_t    mcu_nmbs;
   ptrdiff_t mcu_ncfrags;
@@ -1147,22 +1499,17 @@ static int oc_enc_init(oc_enc_ctx *_enc,const th_info *_info){
   int       vdec;
   int       ret;
   int       pli;
-  /*Clean up the requested settings.*/
-  memcpy(&info,_info,sizeof(info));
-  info.version_major=TH_VERSION_MAJOR;
-  info.version_minor=TH_VERSION_MINOR;
-  info.version_subminor=TH_VERSION_SUB;
-  if(info.quality>63)info.quality=63;
-  if(info.quality<0)info.quality=32;
-  if(info.target_bitrate<0)info.target_bitrate=0;
+  oc_enc_info_init(&info,_info);
   /*Initialize the shared encoder/decoder state.*/
-  ret=oc_state_init(&_enc->state,&info,6);
+  ret=oc_state_init(&_enc->state,&info,6,_mem);
   if(ret<0)return ret;
   oc_enc_accel_init(_enc);
-  _enc->mb_info=_ogg_calloc(_enc->state.nmbs,sizeof(*_enc->mb_info));
-  _enc->frag_dc=_ogg_calloc(_enc->state.nfrags,sizeof(*_enc->frag_dc));
-  _enc->coded_mbis=
-   (unsigned *)_ogg_malloc(_enc->state.nmbs*sizeof(*_enc->coded_mbis));
+  _enc->mb_info=oc_mem_calloc(&_enc->state.mem,_enc->state.nmbs,
+   sizeof(*_enc->mb_info),TH_ALLOC_TABLES);
+  _enc->frag_dc=oc_mem_calloc(&_enc->state.mem,_enc->state.nfrags,
+   sizeof(*_enc->frag_dc),TH_ALLOC_TABLES);
+  _enc->coded_mbis=(unsigned *)oc_mem_alloc(&_enc->state.mem,
+   _enc->state.nmbs*sizeof(*_enc->coded_mbis),16,TH_ALLOC_TABLES);
   hdec=!(_enc->state.info.pixel_fmt&1);
   vdec=!(_enc->state.info.pixel_fmt&2);
   /*If chroma is sub-sampled in the vertical direction, we have to encode two
@@ -1171,46 +1518,40 @@ static int oc_enc_init(oc_enc_ctx *_enc,const th_info *_info){
   mcu_nmbs=_enc->mcu_nvsbs*_enc->state.fplanes[0].nhsbs*(size_t)4;
   mcu_ncfrags=mcu_nmbs<<3-(hdec+vdec);
   mcu_nfrags=4*mcu_nmbs+mcu_ncfrags;
-  _enc->mcu_skip_ssd=(unsigned *)_ogg_malloc(
-   mcu_nfrags*sizeof(*_enc->mcu_skip_ssd));
-  _enc->mcu_rd_scale=(ogg_uint16_t *)_ogg_malloc(
-   (mcu_ncfrags>>1)*sizeof(*_enc->mcu_rd_scale));
-  _enc->mcu_rd_iscale=(ogg_uint16_t *)_ogg_malloc(
-   (mcu_ncfrags>>1)*sizeof(*_enc->mcu_rd_iscale));
+  _enc->mcu_skip_ssd=(unsigned *)oc_mem_alloc(&_enc->state.mem,
+   mcu_nfrags*sizeof(*_enc->mcu_skip_ssd),16,TH_ALLOC_SCRATCH);
+  _enc->mcu_rd_scale=(ogg_uint16_t *)oc_mem_alloc(&_enc->state.mem,
+   (mcu_ncfrags>>1)*sizeof(*_enc->mcu_rd_scale),16,TH_ALLOC_SCRATCH);
+  _enc->mcu_rd_iscale=(ogg_uint16_t *)oc_mem_alloc(&_enc->state.mem,
+   (mcu_ncfrags>>1)*sizeof(*_enc->mcu_rd_iscale),16,TH_ALLOC_SCRATCH);
   for(pli=0;pli<3;pli++){
-    _enc->dct_tokens[pli]=(unsigned char **)oc_malloc_2d(64,
-     _enc->state.fplanes[pli].nfrags,sizeof(**_enc->dct_tokens));
-    _enc->extra_bits[pli]=(ogg_uint16_t **)oc_malloc_2d(64,
-     _enc->state.fplanes[pli].nfrags,sizeof(**_enc->extra_bits));
+    _enc->dct_tokens[pli]=(unsigned char **)oc_mem_malloc_2d(&_enc->state.mem,
+     64,_enc->state.fplanes[pli].nfrags,sizeof(**_enc->dct_tokens),
+     TH_ALLOC_SCRATCH);
+    _enc->extra_bits[pli]=(ogg_uint16_t **)oc_mem_malloc_2d(&_enc->state.mem,
+     64,_enc->state.fplanes[pli].nfrags,sizeof(**_enc->extra_bits),
+     TH_ALLOC_SCRATCH);
   }
 #if defined(OC_COLLECT_METRICS)
-  _enc->frag_sad=_ogg_calloc(_enc->state.nfrags,sizeof(*_enc->frag_sad));
-  _enc->frag_satd=_ogg_calloc(_enc->state.nfrags,sizeof(*_enc->frag_satd));
-  _enc->frag_ssd=_ogg_calloc(_enc->state.nfrags,sizeof(*_enc->frag_ssd));
+  _enc->frag_sad=oc_mem_calloc(&_enc->state.mem,_enc->state.nfrags,
+   sizeof(*_enc->frag_sad),TH_ALLOC_TABLES);
+  _enc->frag_satd=oc_mem_calloc(&_enc->state.mem,_enc->state.nfrags,
+   sizeof(*_enc->frag_satd),TH_ALLOC_TABLES);
+  _enc->frag_ssd=oc_mem_calloc(&_enc->state.mem,_enc->state.nfrags,
+   sizeof(*_enc->frag_ssd),TH_ALLOC_TABLES);
 #endif
-  _enc->enquant_table_data=(unsigned char *)_ogg_malloc(
-   (64+3)*3*2*_enc->opt_data.enquant_table_size
-   +_enc->opt_data.enquant_table_alignment-1);
-  _enc->keyframe_frequency_force=1<<_enc->state.info.keyframe_granule_shift;
-  _enc->state.qis[0]=_enc->state.info.quality;
-  _enc->state.nqis=1;
-  _enc->activity_avg=90<<12;
-  _enc->luma_avg=128<<8;
-  oc_rc_state_init(&_enc->rc,_enc);
+  _enc->enquant_table_data=(unsigned char *)oc_mem_alloc(&_enc->state.mem,
+   3*3*2*_enc->opt_data.enquant_table_size
+   +_enc->opt_data.enquant_table_alignment-1,16,TH_ALLOC_TABLES);
   oggpackB_writeinit(&_enc->opb);
-  memcpy(_enc->huff_codes,TH_VP31_HUFF_CODES,sizeof(_enc->huff_codes));
+  oc_enc_pack_init(&_enc->pack);
+  /*These are only allocated when they are first needed.*/
+  _enc->async=NULL;
+  memset(_enc->enquant_qi_data,0,sizeof(_enc->enquant_qi_data));
+  _enc->input_scratch=NULL;
+  _enc->mv_hints=NULL;
   memset(_enc->qinfo.qi_ranges,0,sizeof(_enc->qinfo.qi_ranges));
-  /*Reset the packet-out state machine.*/
-  _enc->packet_state=OC_PACKET_INFO_HDR;
-  _enc->dup_count=0;
-  _enc->nqueued_dups=0;
-  _enc->prev_dup_count=0;
-  /*Enable speed optimizations up through early skip by default.*/
-  _enc->sp_level=OC_SP_LEVEL_EARLY_SKIP;
-  /*Disable VP3 compatibility by default.*/
-  _enc->vp3_compatible=0;
-  /*No INTER frames coded yet.*/
-  _enc->coded_inter_frame=0;
+  oc_enc_stream_init(_enc);
   if(_enc->mb_info==NULL||_enc->frag_dc==NULL||_enc->coded_mbis==NULL
    ||_enc->mcu_skip_ssd==NULL||_enc->dct_tokens[0]==NULL
    ||_enc->dct_tokens[1]==NULL||_enc->dct_tokens[2]==NULL
@@ -1223,37 +1564,41 @@ static int oc_enc_init(oc_enc_ctx *_enc,const th_info *_info){
     oc_enc_clear(_enc);
     return TH_EFAULT;
   }
-  oc_mode_scheme_chooser_init(&_enc->chooser);
   oc_enc_mb_info_init(_enc);
-  memset(_enc->huff_idxs,0,sizeof(_enc->huff_idxs));
   return 0;
 }
 
 static void oc_enc_clear(oc_enc_ctx *_enc){
   int pli;
+  /*Stop the worker first, since it may still be using everything else.*/
+  oc_enc_async_clear(_enc);
+  oc_mem_free(&_enc->state.mem,_enc->input_scratch,TH_ALLOC_SCRATCH);
+  oc_mem_free(&_enc->state.mem,_enc->mv_hints,TH_ALLOC_TABLES);
   oc_rc_state_clear(&_enc->rc);
   oggpackB_writeclear(&_enc->opb);
+  oc_enc_pack_clear(&_enc->pack);
   oc_quant_params_clear(&_enc->qinfo);
-  _ogg_free(_enc->enquant_table_data);
+  oc_enc_enquant_tables_clear(_enc);
+  oc_mem_free(&_enc->state.mem,_enc->enquant_table_data,TH_ALLOC_TABLES);
 #if defined(OC_COLLECT_METRICS)
   /*Save the collected metrics from this run.
     Use tools/process_modedec_stats to actually generate modedec.h from the
      resulting file.*/
   oc_mode_metrics_dump();
-  _ogg_free(_enc->frag_ssd);
-  _ogg_free(_enc->frag_satd);
-  _ogg_free(_enc->frag_sad);
+  oc_mem_free(&_enc->state.mem,_enc->frag_ssd,TH_ALLOC_TABLES);
+  oc_mem_free(&_enc->state.mem,_enc->frag_satd,TH_ALLOC_TABLES);
+  oc_mem_free(&_enc->state.mem,_enc->frag_sad,TH_ALLOC_TABLES);
 #endif
   for(pli=3;pli-->0;){
-    oc_free_2d(_enc->extra_bits[pli]);
-    oc_free_2d(_enc->dct_tokens[pli]);
-  }
-  _ogg_free(_enc->mcu_rd_iscale);
-  _ogg_free(_enc->mcu_rd_scale);
-  _ogg_free(_enc->mcu_skip_ssd);
-  _ogg_free(_enc->coded_mbis);
-  _ogg_free(_enc->frag_dc);
-  _ogg_free(_enc->mb_info);
+    oc_mem_free(&_enc->state.mem,_enc->extra_bits[pli],TH_ALLOC_SCRATCH);
+    oc_mem_free(&_enc->state.mem,_enc->dct_tokens[pli],TH_ALLOC_SCRATCH);
+  }
+  oc_mem_free(&_enc->state.mem,_enc->mcu_rd_iscale,TH_ALLOC_SCRATCH);
+  oc_mem_free(&_enc->state.mem,_enc->mcu_rd_scale,TH_ALLOC_SCRATCH);
+  oc_mem_free(&_enc->state.mem,_enc->mcu_skip_ssd,TH_ALLOC_SCRATCH);
+  oc_mem_free(&_enc->state.mem,_enc->coded_mbis,TH_ALLOC_TABLES);
+  oc_mem_free(&_enc->state.mem,_enc->frag_dc,TH_ALLOC_TABLES);
+  oc_mem_free(&_enc->state.mem,_enc->mb_info,TH_ALLOC_TABLES);
   oc_state_clear(&_enc->state);
 }
 
@@ -1266,25 +1611,34 @@ static void oc_enc_drop_frame(th_enc_ctx *_enc){
   /*Flag motion vector analysis about the frame drop.*/
   _enc->prevframe_dropped=1;
   /*Zero the packet.*/
-  oggpackB_reset(&_enc->opb);
+  oc_enc_pack_reset(&_enc->pack);
+  oc_enc_clear_bit_stats(&_enc->frame_stats);
   /*Emit an inter frame with no coded blocks in VP3-compatibility mode.*/
-  if(_enc->vp3_compatible)oc_enc_drop_frame_pack(_enc);
+  if(_enc->vp3_compatible){
+    oc_enc_drop_frame_pack(_enc);
+    _enc->frame_stats.header_bits=oc_enc_pack_bits(&_enc->pack);
+    oc_enc_pack_finish(&_enc->pack);
+  }
 }
 
 static void oc_enc_compress_keyframe(oc_enc_ctx *_enc,int _recode){
+  oc_enc_stage_switch(_enc,OC_ENC_STAGE_RC);
   if(_enc->state.info.target_bitrate>0){
     _enc->state.qis[0]=oc_enc_select_qi(_enc,OC_INTRA_FRAME,
      _enc->state.curframe_num>0);
     _enc->state.nqis=1;
   }
   oc_enc_calc_lambda(_enc,OC_INTRA_FRAME);
+  oc_enc_stage_switch(_enc,OC_ENC_STAGE_ANALYSIS);
   oc_enc_analyze_intra(_enc,_recode);
+  oc_enc_stage_switch(_enc,OC_ENC_STAGE_PACK);
   oc_enc_frame_pack(_enc);
   /*On the first frame, the previous call was an initial dry-run to prime
      feed-forward statistics.*/
   if(!_recode&&_enc->state.curframe_num==0){
     if(_enc->state.info.target_bitrate>0){
-      oc_enc_update_rc_state(_enc,oggpackB_bytes(&_enc->opb)<<3,
+      oc_enc_stage_switch(_enc,OC_ENC_STAGE_RC);
+      oc_enc_update_rc_state(_enc,oc_enc_pack_bytes(&_enc->pack)<<3,
                              OC_INTRA_FRAME,_enc->state.qis[0],1,0);
     }
     oc_enc_compress_keyframe(_enc,1);
@@ -1292,16 +1646,22 @@ static void oc_enc_compress_keyframe(oc_enc_ctx *_enc,int _recode){
 }
 
 static void oc_enc_compress_frame(oc_enc_ctx *_enc,int _recode){
+  oc_enc_stage_switch(_enc,OC_ENC_STAGE_RC);
   if(_enc->state.info.target_bitrate>0){
     _enc->state.qis[0]=oc_enc_select_qi(_enc,OC_INTER_FRAME,1);
     _enc->state.nqis=1;
   }
   oc_enc_calc_lambda(_enc,OC_INTER_FRAME);
-  if(oc_enc_analyze_inter(_enc,_enc->rc.twopass!=2,_recode)){
+  oc_enc_stage_switch(_enc,OC_ENC_STAGE_ANALYSIS);
+  /*With intra refresh, a scene change is absorbed over the refresh period
+     instead of by promoting this frame to a keyframe.*/
+  if(oc_enc_analyze_inter(_enc,
+   _enc->rc.twopass!=2&&_enc->refresh_period<=0,_recode)){
     /*Mode analysis thinks this should have been a keyframe; start over.*/
     oc_enc_compress_keyframe(_enc,1);
   }
   else{
+    oc_enc_stage_switch(_enc,OC_ENC_STAGE_PACK);
     oc_enc_frame_pack(_enc);
     if(!_enc->coded_inter_frame){
       /*On the first INTER frame, the previous call was an initial dry-run to
@@ -1309,7 +1669,8 @@ static void oc_enc_compress_frame(oc_enc_ctx *_enc,int _recode){
       _enc->coded_inter_frame=1;
       if(_enc->state.info.target_bitrate>0){
         /*Rate control also needs to prime.*/
-        oc_enc_update_rc_state(_enc,oggpackB_bytes(&_enc->opb)<<3,
+        oc_enc_stage_switch(_enc,OC_ENC_STAGE_RC);
+        oc_enc_update_rc_state(_enc,oc_enc_pack_bytes(&_enc->pack)<<3,
          OC_INTER_FRAME,_enc->state.qis[0],1,0);
       }
       oc_enc_compress_frame(_enc,1);
@@ -1318,45 +1679,165 @@ static void oc_enc_compress_frame(oc_enc_ctx *_enc,int _recode){
 }
 
 /*Set the granule position for the next packet to output based on the current
-   internal state.*/
+   internal state.
+  Frame numbers are shifted by the offset set with TH_ENCCTL_SET_FRAME_OFFSET,
+   so that an encoder producing one segment of a larger stream emits the
+   granule positions that segment will have in the final stream.*/
 static void oc_enc_set_granpos(oc_enc_ctx *_enc){
   unsigned dup_offs;
   /*Add an offset for the number of duplicate frames we've emitted so far.*/
   dup_offs=_enc->prev_dup_count-_enc->nqueued_dups;
   /*If the current frame was a keyframe, use it for the high part.*/
   if(_enc->state.frame_type==OC_INTRA_FRAME){
-    _enc->state.granpos=(_enc->state.curframe_num+_enc->state.granpos_bias<<
-     _enc->state.info.keyframe_granule_shift)+dup_offs;
+    _enc->state.granpos=(_enc->state.curframe_num+_enc->frame_offset
+     +_enc->state.granpos_bias<<_enc->state.info.keyframe_granule_shift)
+     +dup_offs;
   }
   /*Otherwise use the last keyframe in the high part and put the current frame
      in the low part.*/
   else{
     _enc->state.granpos=
-     (_enc->state.keyframe_num+_enc->state.granpos_bias<<
+     (_enc->state.keyframe_num+_enc->frame_offset+_enc->state.granpos_bias<<
      _enc->state.info.keyframe_granule_shift)
      +_enc->state.curframe_num-_enc->state.keyframe_num+dup_offs;
   }
 }
 
+/*Fills in the parts of the frame statistics that are not gathered while the
+   frame is being coded.*/
+static void oc_enc_frame_stats_fill(oc_enc_ctx *_enc){
+  th_enc_frame_stats *stats;
+  const oc_sb_flags  *sb_flags;
+  const signed char  *mb_modes;
+  const unsigned     *coded_mbis;
+  ogg_int64_t         total_ns;
+  unsigned            nsbs;
+  unsigned            sbi;
+  size_t              ncoded_mbis;
+  size_t              mbii;
+  int                 nmbs;
+  int                 quadi;
+  int                 qii;
+  int                 stage;
+  stats=&_enc->frame_stats;
+  total_ns=0;
+  for(stage=0;stage<OC_ENC_NSTAGES;stage++)total_ns+=_enc->stage_ns[stage];
+  stats->total_ns=total_ns;
+  stats->motion_ns=_enc->stage_ns[OC_ENC_STAGE_MOTION];
+  stats->analysis_ns=_enc->stage_ns[OC_ENC_STAGE_ANALYSIS];
+  stats->transform_ns=_enc->stage_ns[OC_ENC_STAGE_TRANSFORM];
+  stats->tokenize_ns=_enc->stage_ns[OC_ENC_STAGE_TOKENIZE];
+  stats->pack_ns=_enc->stage_ns[OC_ENC_STAGE_PACK];
+  stats->filter_ns=_enc->stage_ns[OC_ENC_STAGE_FILTER];
+  stats->rc_ns=_enc->stage_ns[OC_ENC_STAGE_RC];
+  stats->frame_type=_enc->state.frame_type;
+  stats->dropped=_enc->prevframe_dropped;
+  stats->nqis=_enc->state.nqis;
+  for(qii=0;qii<3;qii++){
+    stats->qis[qii]=qii<_enc->state.nqis?_enc->state.qis[qii]:0;
+  }
+  stats->lambda=_enc->lambda;
+  /*Count the MBs actually inside the frame.*/
+  sb_flags=_enc->state.sb_flags;
+  nsbs=_enc->state.fplanes[0].nsbs;
+  nmbs=0;
+  for(sbi=0;sbi<nsbs;sbi++){
+    for(quadi=0;quadi<4;quadi++)nmbs+=sb_flags[sbi].quad_valid>>quadi&1;
+  }
+  stats->nintra_mbs=stats->ninter_mbs=stats->n4mv_mbs=0;
+  if(stats->dropped)stats->nskipped_mbs=nmbs;
+  else if(_enc->state.frame_type==OC_INTRA_FRAME){
+    stats->nskipped_mbs=0;
+    stats->nintra_mbs=nmbs;
+  }
+  else{
+    mb_modes=_enc->state.mb_modes;
+    coded_mbis=_enc->coded_mbis;
+    ncoded_mbis=_enc->ncoded_mbis;
+    for(mbii=0;mbii<ncoded_mbis;mbii++){
+      switch(mb_modes[coded_mbis[mbii]]){
+        case OC_MODE_INTRA:stats->nintra_mbs++;break;
+        case OC_MODE_INTER_MV_FOUR:stats->n4mv_mbs++;break;
+        default:stats->ninter_mbs++;break;
+      }
+    }
+    stats->nskipped_mbs=nmbs-(int)ncoded_mbis;
+  }
+}
+
+
+/*Allocates and initializes an encoder using the given allocator.*/
+static oc_enc_ctx *oc_enc_create(const oc_mem *_mem,const th_info *_info){
+  oc_mem      mem;
+  oc_enc_ctx *enc;
+  mem=*_mem;
+  enc=(oc_enc_ctx *)oc_mem_alloc(&mem,sizeof(*enc),16,TH_ALLOC_CONTEXT);
+  if(enc==NULL)return NULL;
+  if(oc_enc_init(enc,_info,&mem)<0){
+    oc_mem_free(&mem,enc,TH_ALLOC_CONTEXT);
+    return NULL;
+  }
+  return enc;
+}
 
 th_enc_ctx *th_encode_alloc(const th_info *_info){
+  return th_encode_alloc_with(_info,NULL);
+}
+
+th_enc_ctx *th_encode_alloc_with(const th_info *_info,
+ const th_allocator *_alloc){
+  oc_mem      mem;
   oc_enc_ctx *enc;
   if(_info==NULL)return NULL;
-  enc=oc_aligned_malloc(sizeof(*enc),16);
-  if(enc==NULL||oc_enc_init(enc,_info)<0){
-    oc_aligned_free(enc);
-    return NULL;
+  if(_alloc!=NULL&&(_alloc->alloc==NULL)!=(_alloc->free==NULL))return NULL;
+  oc_mem_init(&mem,_alloc);
+  if(mem.hooks.flags&TH_ALLOCF_ARENA){
+    size_t arena_sz;
+    /*Create the encoder once with separate allocations to find out how much
+       space it needs.*/
+    enc=oc_enc_create(&mem,_info);
+    if(enc==NULL)return NULL;
+    arena_sz=enc->state.mem.nbytes;
+    th_encode_free(enc);
+    if(oc_mem_arena_init(&mem,arena_sz)<0)return NULL;
   }
+  enc=oc_enc_create(&mem,_info);
+  if(enc==NULL)oc_mem_clear(&mem);
   return enc;
 }
 
 void th_encode_free(th_enc_ctx *_enc){
   if(_enc!=NULL){
+    oc_mem mem;
     oc_enc_clear(_enc);
-    oc_aligned_free(_enc);
+    mem=_enc->state.mem;
+    oc_mem_free(&mem,_enc,TH_ALLOC_CONTEXT);
+    oc_mem_clear(&mem);
   }
 }
 
+int th_encode_reset(th_enc_ctx *_enc,const th_info *_info){
+  th_info info;
+  int     ret;
+  if(_enc==NULL||_info==NULL)return TH_EFAULT;
+  oc_enc_info_init(&info,_info);
+  /*Stop the worker before we change anything it might be using.*/
+  oc_enc_async_clear(_enc);
+  ret=oc_state_reset(&_enc->state,&info);
+  if(ret<0)return ret;
+  /*Everything sized by the frame geometry is kept, but the settings go back to
+     what a newly allocated encoder would use.*/
+  oc_rc_state_clear(&_enc->rc);
+  oggpackB_reset(&_enc->opb);
+  _enc->pack.user=NULL;
+  _enc->pack.user_storage=0;
+  oc_enc_stream_init(_enc);
+  memset(_enc->mb_info,0,_enc->state.nmbs*sizeof(*_enc->mb_info));
+  memset(_enc->frag_dc,0,_enc->state.nfrags*sizeof(*_enc->frag_dc));
+  oc_enc_mb_info_init(_enc);
+  return oc_enc_set_quant_params(_enc,NULL);
+}
+
 int th_encode_ctl(th_enc_ctx *_enc,int _req,void *_buf,size_t _buf_sz){
   switch(_req){
     case TH_ENCCTL_SET_HUFFMAN_CODES:{
@@ -1366,6 +1847,42 @@ int th_encode_ctl(th_enc_ctx *_enc,int _req,void *_buf,size_t _buf_sz){
       }
       return oc_enc_set_huffman_codes(_enc,(const th_huff_table *)_buf);
     }break;
+    case TH_ENCCTL_GET_OPTIMAL_HUFFMAN_CODES:{
+      th_huff_code (*codes)[TH_NDCT_TOKENS];
+      int            hti;
+      if(_enc==NULL||_buf==NULL)return TH_EFAULT;
+      if(_buf_sz!=sizeof(th_huff_table)*TH_NHUFFMAN_TABLES)return TH_EINVAL;
+      codes=(th_huff_code (*)[TH_NDCT_TOKENS])_buf;
+      for(hti=0;hti<TH_NHUFFMAN_TABLES;hti++){
+        const ogg_int64_t *stats;
+        ogg_int64_t        ntokens;
+        ogg_int64_t        old_bits;
+        ogg_int64_t        new_bits;
+        int                ti;
+        stats=_enc->huff_stats[hti];
+        ntokens=0;
+        for(ti=0;ti<TH_NDCT_TOKENS;ti++)ntokens+=stats[ti];
+        /*Keep the current code for tables that were never chosen.*/
+        if(ntokens<=0){
+          memcpy(codes[hti],_enc->huff_codes[hti],sizeof(codes[hti]));
+          continue;
+        }
+        oc_huff_code_build(codes[hti],stats,OC_HUFF_OPT_MAXBITS);
+        /*The new code gives every token at least one count and limits the
+           code length, so it can lose to the current code on the very counts
+           it was built from.
+          Keep the current code in that case.*/
+        old_bits=new_bits=0;
+        for(ti=0;ti<TH_NDCT_TOKENS;ti++){
+          old_bits+=stats[ti]*_enc->huff_codes[hti][ti].nbits;
+          new_bits+=stats[ti]*codes[hti][ti].nbits;
+        }
+        if(new_bits>=old_bits){
+          memcpy(codes[hti],_enc->huff_codes[hti],sizeof(codes[hti]));
+        }
+      }
+      return 0;
+    }break;
     case TH_ENCCTL_SET_QUANT_PARAMS:{
       if(_buf==NULL&&_buf_sz!=0||
        _buf!=NULL&&_buf_sz!=sizeof(th_quant_info)){
@@ -1432,6 +1949,10 @@ int th_encode_ctl(th_enc_ctx *_enc,int _req,void *_buf,size_t _buf_sz){
       speed=*(int *)_buf;
       if(speed<0||speed>OC_SP_LEVEL_MAX)return TH_EINVAL;
       _enc->sp_level=speed;
+      _enc->sp_flags=0;
+      _enc->sp_step=speed<<1;
+      _enc->deadline_slack=0;
+      _enc->frame_time_avg=-1;
       return 0;
     }break;
     case TH_ENCCTL_GET_SPLEVEL:{
@@ -1449,6 +1970,125 @@ int th_encode_ctl(th_enc_ctx *_enc,int _req,void *_buf,size_t _buf_sz){
       _enc->dup_count=OC_MAXI(dup_count,0);
       return 0;
     }break;
+    case TH_ENCCTL_SET_DUP_DETECT:{
+      int threshold;
+      if(_enc==NULL||_buf==NULL)return TH_EFAULT;
+      if(_buf_sz!=sizeof(threshold))return TH_EINVAL;
+      threshold=*(int *)_buf;
+      if(threshold>255)return TH_EINVAL;
+      _enc->dup_threshold=OC_MAXI(threshold,-1);
+      return 0;
+    }break;
+    case TH_ENCCTL_SET_INTRA_REFRESH:{
+      int period;
+      if(_enc==NULL||_buf==NULL)return TH_EFAULT;
+      if(_buf_sz!=sizeof(period))return TH_EINVAL;
+      period=*(int *)_buf;
+      if(period<0)return TH_EINVAL;
+      _enc->refresh_period=period;
+      _enc->refresh_pos=0;
+      return 0;
+    }break;
+    case TH_ENCCTL_SET_LADDER_MASTER:{
+      th_enc_ctx *master;
+      if(_enc==NULL||_buf==NULL)return TH_EFAULT;
+      if(_buf_sz!=sizeof(master))return TH_EINVAL;
+      master=*(th_enc_ctx **)_buf;
+      if(master!=NULL&&(master==_enc
+       ||master->state.info.frame_width!=_enc->state.info.frame_width
+       ||master->state.info.frame_height!=_enc->state.info.frame_height
+       ||master->state.info.pixel_fmt!=_enc->state.info.pixel_fmt)){
+        return TH_EINVAL;
+      }
+      _enc->ladder_master=master;
+      return 0;
+    }break;
+    case TH_ENCCTL_SET_MOTION_HINTS:{
+      const th_enc_motion_hint *hints;
+      size_t                    nhmbs;
+      size_t                    nvmbs;
+      size_t                    nmbs;
+      size_t                    mbi;
+      if(_enc==NULL)return TH_EFAULT;
+      if(_buf==NULL){
+        if(_buf_sz!=0)return TH_EINVAL;
+        _enc->mv_hints_valid=0;
+        return 0;
+      }
+      nhmbs=_enc->state.fplanes[0].nhfrags>>1;
+      nvmbs=_enc->state.fplanes[0].nvfrags>>1;
+      if(_buf_sz!=nhmbs*nvmbs*sizeof(*hints))return TH_EINVAL;
+      hints=(const th_enc_motion_hint *)_buf;
+      for(mbi=0;mbi<nhmbs*nvmbs;mbi++){
+        if(hints[mbi].mv[0]<-31||hints[mbi].mv[0]>31
+         ||hints[mbi].mv[1]<-31||hints[mbi].mv[1]>31){
+          return TH_EINVAL;
+        }
+      }
+      nmbs=_enc->state.nmbs;
+      if(_enc->mv_hints==NULL){
+        _enc->mv_hints=(th_enc_motion_hint *)oc_mem_alloc(&_enc->state.mem,
+         nmbs*sizeof(*_enc->mv_hints),16,TH_ALLOC_TABLES);
+        if(_enc->mv_hints==NULL)return TH_EFAULT;
+      }
+      /*Reorder the hints from raster order into coded order, flipping them
+         vertically.*/
+      for(mbi=0;mbi<nmbs;mbi++){
+        ptrdiff_t fragi;
+        size_t    mbx;
+        size_t    mby;
+        fragi=_enc->state.mb_maps[mbi][0][0];
+        if(fragi<0)continue;
+        mbx=fragi%_enc->state.fplanes[0].nhfrags>>1;
+        mby=nvmbs-1-(fragi/_enc->state.fplanes[0].nhfrags>>1);
+        _enc->mv_hints[mbi]=hints[mby*nhmbs+mbx];
+      }
+      _enc->mv_hints_valid=1;
+      return 0;
+    }break;
+    case TH_ENCCTL_SET_ASYNC_DEPTH:{
+      int depth;
+      if(_enc==NULL||_buf==NULL)return TH_EFAULT;
+      if(_buf_sz!=sizeof(depth)||_enc->async!=NULL)return TH_EINVAL;
+      depth=*(int *)_buf;
+      if(depth<1||depth>64)return TH_EINVAL;
+      _enc->async_depth=depth;
+      return 0;
+    }break;
+    case TH_ENCCTL_SET_EXECUTOR:{
+      th_executor *executor;
+      if(_enc==NULL)return TH_EFAULT;
+      if(_enc->async!=NULL)return TH_EINVAL;
+      if(_buf==NULL){
+        memset(&_enc->executor,0,sizeof(_enc->executor));
+        return 0;
+      }
+      if(_buf_sz!=sizeof(th_executor))return TH_EINVAL;
+      executor=(th_executor *)_buf;
+      if(executor->submit==NULL||executor->wait==NULL)return TH_EFAULT;
+      _enc->executor=*executor;
+      return 0;
+    }break;
+    case TH_ENCCTL_SET_PACKET_BUFFER:{
+      const th_enc_packet_buffer *pbuf;
+      if(_enc==NULL)return TH_EFAULT;
+      if(_buf==NULL){
+        _enc->pack.user=NULL;
+        _enc->pack.user_storage=0;
+        return 0;
+      }
+      if(_buf_sz!=sizeof(*pbuf))return TH_EINVAL;
+      pbuf=(const th_enc_packet_buffer *)_buf;
+      if(pbuf->data==NULL||pbuf->size<=0){
+        _enc->pack.user=NULL;
+        _enc->pack.user_storage=0;
+      }
+      else{
+        _enc->pack.user=pbuf->data;
+        _enc->pack.user_storage=pbuf->size;
+      }
+      return 0;
+    }break;
     case TH_ENCCTL_SET_QUALITY:{
       int qi;
       if(_enc==NULL||_buf==NULL)return TH_EFAULT;
@@ -1511,6 +2151,21 @@ int th_encode_ctl(th_enc_ctx *_enc,int _req,void *_buf,size_t _buf_sz){
       }
       return oc_enc_rc_2pass_in(_enc,_buf,_buf_sz);
     }break;
+    case TH_ENCCTL_SET_DEADLINE:{
+      int deadline;
+      if(_enc==NULL||_buf==NULL)return TH_EFAULT;
+      if(_buf_sz!=sizeof(deadline))return TH_EINVAL;
+      deadline=*(int *)_buf;
+      if(deadline<0)return TH_EINVAL;
+      _enc->deadline=deadline;
+      /*Without a deadline, only the levels TH_ENCCTL_SET_SPLEVEL exposes are
+         used, so drop any intermediate step the adaptation left behind.*/
+      if(deadline==0)_enc->sp_flags=0;
+      _enc->sp_step=_enc->sp_level<<1|(_enc->sp_flags!=0);
+      _enc->deadline_slack=0;
+      _enc->frame_time_avg=-1;
+      return 0;
+    }break;
     case TH_ENCCTL_SET_COMPAT_CONFIG:{
       unsigned char buf[7];
       oc_pack_buf   opb;
@@ -1541,6 +2196,27 @@ int th_encode_ctl(th_enc_ctx *_enc,int _req,void *_buf,size_t _buf_sz){
       memcpy(&_enc->qinfo,&qinfo,sizeof(qinfo));
       oc_enc_quant_params_updated(_enc,&qinfo);
       memcpy(_enc->huff_codes,huff_codes,sizeof(_enc->huff_codes));
+      oc_enc_huff_codes_updated(_enc);
+      return 0;
+    }
+    case TH_ENCCTL_GET_FRAME_STATS:{
+      if(_enc==NULL||_buf==NULL)return TH_EFAULT;
+      if(_buf_sz!=sizeof(th_enc_frame_stats))return TH_EINVAL;
+      if(_enc->state.curframe_num<0)return TH_EINVAL;
+      oc_enc_frame_stats_fill(_enc);
+      *(th_enc_frame_stats *)_buf=_enc->frame_stats;
+      /*Time the stages of all subsequent frames.*/
+      _enc->profiling=1;
+      return 0;
+    }
+    case TH_ENCCTL_SET_FRAME_OFFSET:{
+      ogg_int64_t frame_offset;
+      if(_enc==NULL||_buf==NULL)return TH_EFAULT;
+      if(_buf_sz!=sizeof(frame_offset))return TH_EINVAL;
+      frame_offset=*(ogg_int64_t *)_buf;
+      /*The offset must be fixed before any granule position is produced.*/
+      if(frame_offset<0||_enc->state.curframe_num>=0)return TH_EINVAL;
+      _enc->frame_offset=frame_offset;
       return 0;
     }
 #if defined(OC_COLLECT_METRICS)
@@ -1586,17 +2262,21 @@ static void oc_img_plane_copy_pad(th_img_plane *_dst,th_img_plane *_src,
     unsigned char *src;
     int            sstride;
     ogg_uint32_t   x;
-    /*Step 1: Copy the data we do have.*/
+    /*Step 1: Copy the data we do have.
+      If the caller wrote directly into our buffer (see
+       th_encode_ycbcr_borrow()), there is nothing to copy.*/
     dstride=_dst->stride;
     sstride=_src->stride;
     dst_data=_dst->data;
     src_data=_src->data;
-    dst=dst_data+_pic_y*(ptrdiff_t)dstride+_pic_x;
-    src=src_data+_pic_y*(ptrdiff_t)sstride+_pic_x;
-    for(y=0;y<_pic_height;y++){
-      memcpy(dst,src,_pic_width);
-      dst+=dstride;
-      src+=sstride;
+    if(src_data!=dst_data){
+      dst=dst_data+_pic_y*(ptrdiff_t)dstride+_pic_x;
+      src=src_data+_pic_y*(ptrdiff_t)sstride+_pic_x;
+      for(y=0;y<_pic_height;y++){
+        memcpy(dst,src,_pic_width);
+        dst+=dstride;
+        src+=sstride;
+      }
     }
     /*Step 2: Perform a low-pass extension into the padding region.*/
     /*Left side.*/
@@ -1638,7 +2318,428 @@ static void oc_img_plane_copy_pad(th_img_plane *_dst,th_img_plane *_src,
   }
 }
 
-int th_encode_ycbcr_in(th_enc_ctx *_enc,th_ycbcr_buffer _img){
+/*Selects the buffer the next input frame will be stored in.
+  This accounts for the original-reference update performed at the start of
+   th_encode_ycbcr_in(), so it returns the same buffer whether it is called
+   before or after that update.*/
+static int oc_enc_select_io_buf(const oc_enc_ctx *_enc){
+  int prev_orig;
+  int gold_orig;
+  int refi;
+  prev_orig=_enc->state.ref_frame_idx[OC_FRAME_PREV_ORIG];
+  gold_orig=_enc->state.ref_frame_idx[OC_FRAME_GOLD_ORIG];
+  if(_enc->state.ref_frame_idx[OC_FRAME_IO]>=0&&_enc->prevframe_dropped==0){
+    prev_orig=_enc->state.ref_frame_idx[OC_FRAME_IO];
+    if(_enc->state.frame_type==OC_INTRA_FRAME)gold_orig=prev_orig;
+  }
+  for(refi=3;refi==gold_orig||refi==prev_orig;refi++);
+  return refi;
+}
+
+ogg_int64_t oc_enc_clock_ns(void){
+#if defined(_WIN32)
+  LARGE_INTEGER freq;
+  LARGE_INTEGER now;
+  QueryPerformanceFrequency(&freq);
+  QueryPerformanceCounter(&now);
+  return (ogg_int64_t)(now.QuadPart/freq.QuadPart*1000000000+
+   now.QuadPart%freq.QuadPart*1000000000/freq.QuadPart);
+#elif defined(CLOCK_MONOTONIC)
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC,&ts);
+  return (ogg_int64_t)ts.tv_sec*1000000000+ts.tv_nsec;
+#else
+  return (ogg_int64_t)clock()*1000000000/CLOCKS_PER_SEC;
+#endif
+}
+
+int oc_enc_stage_time(oc_enc_ctx *_enc,int _stage){
+  ogg_int64_t now;
+  int         stage;
+  now=oc_enc_clock_ns();
+  stage=_enc->stage;
+  _enc->stage_ns[stage]+=now-_enc->stage_start;
+  _enc->stage_start=now;
+  _enc->stage=_stage;
+  return stage;
+}
+
+/*Applies the given deadline controller step to the speed settings.*/
+static void oc_enc_set_sp_step(oc_enc_ctx *_enc,int _step){
+  _enc->sp_step=_step;
+  _enc->sp_level=_step>>1;
+  _enc->sp_flags=_step&1?OC_SP_FLAG_NO4MV|OC_SP_FLAG_NOGOLDEN:0;
+}
+
+/*Updates the deadline controller with the time taken by the last frame.
+  We move to a faster step as soon as the smoothed frame time exceeds the
+   deadline, but only move back to a slower one after several consecutive
+   frames come in under 3/4 of it, to avoid oscillating between two steps.*/
+static void oc_enc_update_deadline(oc_enc_ctx *_enc,ogg_int64_t _elapsed){
+  ogg_int64_t avg;
+  ogg_int64_t deadline;
+  avg=_enc->frame_time_avg;
+  if(avg<0)avg=_elapsed;
+  else avg+=_elapsed-avg>>2;
+  _enc->frame_time_avg=avg;
+  deadline=_enc->deadline;
+  if(avg>deadline){
+    _enc->deadline_slack=0;
+    if(_enc->sp_step<OC_SP_LEVEL_MAX<<1){
+      oc_enc_set_sp_step(_enc,_enc->sp_step+1);
+      _enc->frame_time_avg=-1;
+    }
+  }
+  else if(avg*4<deadline*3){
+    if(++_enc->deadline_slack>=OC_DEADLINE_SLACK_FRAMES&&_enc->sp_step>0){
+      oc_enc_set_sp_step(_enc,_enc->sp_step-1);
+      _enc->deadline_slack=0;
+      _enc->frame_time_avg=-1;
+    }
+  }
+  else _enc->deadline_slack=0;
+}
+
+/*Converts a rectangle passed to th_encode_ycbcr_in_rects() from top-down
+   picture coordinates to the bottom-up luma frame coordinates used
+   internally, clipping it to the picture region.
+  _bounds: Returns the left, bottom, right, and top edges, exclusive of the
+            latter two.
+  Return: 0 if nothing is left of the rectangle after clipping, or 1
+   otherwise.*/
+static int oc_enc_rect_bounds(const oc_enc_ctx *_enc,const th_enc_rect *_rect,
+ int _bounds[4]){
+  ogg_int64_t x0;
+  ogg_int64_t y0;
+  ogg_int64_t x1;
+  ogg_int64_t y1;
+  int         pic_width;
+  int         pic_height;
+  pic_width=_enc->state.info.pic_width;
+  pic_height=_enc->state.info.pic_height;
+  x0=OC_MAXI(_rect->x,0);
+  y0=OC_MAXI(_rect->y,0);
+  x1=OC_MINI(_rect->x+(ogg_int64_t)_rect->width,pic_width);
+  y1=OC_MINI(_rect->y+(ogg_int64_t)_rect->height,pic_height);
+  if(x0>=x1||y0>=y1)return 0;
+  _bounds[0]=_enc->state.info.pic_x+(int)x0;
+  _bounds[1]=_enc->state.info.pic_y+pic_height-(int)y1;
+  _bounds[2]=_enc->state.info.pic_x+(int)x1;
+  _bounds[3]=_enc->state.info.pic_y+pic_height-(int)y0;
+  return 1;
+}
+
+/*Converts bounds in luma frame coordinates to those of the samples of plane
+   _pli that they cover.*/
+static void oc_enc_plane_bounds(const oc_enc_ctx *_enc,int _pli,
+ int _dst[4],const int _src[4]){
+  int hdec;
+  int vdec;
+  hdec=_pli>0&&!(_enc->state.info.pixel_fmt&1);
+  vdec=_pli>0&&!(_enc->state.info.pixel_fmt&2);
+  _dst[0]=_src[0]>>hdec;
+  _dst[1]=_src[1]>>vdec;
+  _dst[2]=_src[2]+hdec>>hdec;
+  _dst[3]=_src[3]+vdec>>vdec;
+}
+
+/*Returns whether the given region of _img differs from the same region of
+   _ref by no more than _threshold in any sample.*/
+static int oc_img_plane_matches(const th_img_plane *_img,
+ const th_img_plane *_ref,const int _bounds[4],int _threshold){
+  const unsigned char *src;
+  const unsigned char *prev;
+  int                  w;
+  int                  y;
+  src=_img->data+_bounds[1]*(ptrdiff_t)_img->stride+_bounds[0];
+  prev=_ref->data+_bounds[1]*(ptrdiff_t)_ref->stride+_bounds[0];
+  w=_bounds[2]-_bounds[0];
+  for(y=_bounds[1];y<_bounds[3];y++){
+    if(_threshold<=0){
+      if(memcmp(src,prev,w))return 0;
+    }
+    else{
+      int over;
+      int x;
+      /*Accumulate without branching so the loop can be vectorized; the row
+         is only checked once it is finished.*/
+      over=0;
+      for(x=0;x<w;x++)over|=abs(src[x]-prev[x])>_threshold;
+      if(over)return 0;
+    }
+    src+=_img->stride;
+    prev+=_ref->stride;
+  }
+  return 1;
+}
+
+/*Returns whether _img differs from the last input frame by no more than
+   _threshold in any sample.
+  Only the given rectangles are compared, or the whole picture region if
+   _nrects is negative.*/
+static int oc_enc_frame_is_dup(oc_enc_ctx *_enc,th_ycbcr_buffer _img,
+ const th_enc_rect *_rects,int _nrects,int _threshold){
+  th_img_plane *ref;
+  int           luma_bounds[4];
+  int           ri;
+  ref=_enc->state.ref_frame_bufs[_enc->state.ref_frame_idx[OC_FRAME_IO]];
+  for(ri=0;ri<OC_MAXI(_nrects,1);ri++){
+    int pli;
+    if(_nrects<0){
+      luma_bounds[0]=_enc->state.info.pic_x;
+      luma_bounds[1]=_enc->state.info.pic_y;
+      luma_bounds[2]=luma_bounds[0]+_enc->state.info.pic_width;
+      luma_bounds[3]=luma_bounds[1]+_enc->state.info.pic_height;
+    }
+    else if(_nrects==0||!oc_enc_rect_bounds(_enc,_rects+ri,luma_bounds)){
+      continue;
+    }
+    for(pli=0;pli<3;pli++){
+      int bounds[4];
+      oc_enc_plane_bounds(_enc,pli,bounds,luma_bounds);
+      if(!oc_img_plane_matches(_img+pli,ref+pli,bounds,_threshold))return 0;
+    }
+  }
+  return 1;
+}
+
+/*Returns the number of duplicates the last coded frame could be extended by
+   (counting the ones already requested with TH_ENCCTL_SET_DUP_COUNT) to
+   absorb the next input frame, or 0 if it must be coded normally.*/
+static int oc_enc_dup_room(oc_enc_ctx *_enc){
+  ogg_int64_t keyframe_num;
+  int         ndups;
+  if(_enc->dup_threshold<0||_enc->state.curframe_num<0
+   ||_enc->state.ref_frame_idx[OC_FRAME_IO]<0||_enc->prevframe_dropped
+   ||_enc->rc.twopass){
+    return 0;
+  }
+  /*The frame we would extend may have been a keyframe which the buffer state
+     update in th_encode_ycbcr_in() has not yet recorded.*/
+  keyframe_num=_enc->state.frame_type==OC_INTRA_FRAME?
+   _enc->state.curframe_num:_enc->state.keyframe_num;
+  ndups=1+_enc->dup_count;
+  /*Don't let the duplicates overflow the keyframe_granule_shift.*/
+  if(_enc->state.curframe_num-keyframe_num+_enc->prev_dup_count+ndups>=
+   _enc->keyframe_frequency_force){
+    return 0;
+  }
+  return ndups;
+}
+
+/*Copies all of one input buffer, including its borders, into another.*/
+static void oc_enc_io_buf_copy(oc_enc_ctx *_enc,int _dst_refi,int _src_refi){
+  int pli;
+  for(pli=0;pli<3;pli++){
+    th_img_plane  *src;
+    unsigned char *dst_row;
+    unsigned char *src_row;
+    int            hpadding;
+    int            vpadding;
+    int            y;
+    hpadding=OC_UMV_PADDING>>(pli!=0&&!(_enc->state.info.pixel_fmt&1));
+    vpadding=OC_UMV_PADDING>>(pli!=0&&!(_enc->state.info.pixel_fmt&2));
+    src=_enc->state.ref_frame_bufs[_src_refi]+pli;
+    src_row=src->data-vpadding*(ptrdiff_t)src->stride-hpadding;
+    dst_row=_enc->state.ref_frame_bufs[_dst_refi][pli].data
+     -vpadding*(ptrdiff_t)src->stride-hpadding;
+    for(y=-vpadding;y<src->height+vpadding;y++){
+      memcpy(dst_row,src_row,src->width+(hpadding<<1));
+      dst_row+=src->stride;
+      src_row+=src->stride;
+    }
+  }
+}
+
+/*The quadrant of its super block occupied by a macro block, indexed by the
+   parity of its Y and X coordinates.
+  This follows the Hilbert curve ordering of oc_sb_create_plane_mapping().*/
+static const unsigned char OC_MB_QUADI[4]={0,3,1,2};
+
+/*Flags all the macro blocks that intersect the given bounds (in luma frame
+   coordinates) as dirty, along with a border of one macro block around them.
+  The cached activity of a macro block depends on the samples just outside it,
+   and whether it can be skipped depends on how its neighbors are coded, so
+   the ones next to a change have to be analyzed again, too.*/
+static void oc_enc_mark_dirty(oc_enc_ctx *_enc,const int _bounds[4]){
+  unsigned nhsbs;
+  unsigned mbx0;
+  unsigned mbx1;
+  unsigned mby;
+  unsigned mby1;
+  nhsbs=_enc->state.fplanes[0].nhsbs;
+  mbx0=OC_MAXI((_bounds[0]>>4)-1,0);
+  mbx1=OC_MINI((_bounds[2]+15>>4)+1,(int)_enc->state.nhmbs);
+  mby1=OC_MINI((_bounds[3]+15>>4)+1,(int)_enc->state.nvmbs);
+  for(mby=OC_MAXI((_bounds[1]>>4)-1,0);mby<mby1;mby++){
+    unsigned mbx;
+    for(mbx=mbx0;mbx<mbx1;mbx++){
+      unsigned sbi;
+      sbi=(mby>>1)*nhsbs+(mbx>>1);
+      _enc->mb_info[sbi<<2|OC_MB_QUADI[(mby&1)<<1|(mbx&1)]].dirty=1;
+    }
+  }
+}
+
+/*Copies the macro blocks flagged dirty in one input buffer into another,
+   along with the borders next to them.
+  When the destination held the input frame the source was built from, this
+   makes it a full copy of the source.*/
+static void oc_enc_io_buf_copy_dirty(oc_enc_ctx *_enc,
+ int _dst_refi,int _src_refi){
+  unsigned nhsbs;
+  int      pli;
+  nhsbs=_enc->state.fplanes[0].nhsbs;
+  for(pli=0;pli<3;pli++){
+    th_img_plane *src;
+    th_img_plane *dst;
+    int           hdec;
+    int           vdec;
+    int           hpadding;
+    int           vpadding;
+    unsigned      mby;
+    hdec=pli!=0&&!(_enc->state.info.pixel_fmt&1);
+    vdec=pli!=0&&!(_enc->state.info.pixel_fmt&2);
+    hpadding=OC_UMV_PADDING>>hdec;
+    vpadding=OC_UMV_PADDING>>vdec;
+    src=_enc->state.ref_frame_bufs[_src_refi]+pli;
+    dst=_enc->state.ref_frame_bufs[_dst_refi]+pli;
+    for(mby=0;mby<_enc->state.nvmbs;mby++){
+      unsigned mbx;
+      int      y0;
+      int      y1;
+      y0=mby<<4>>vdec;
+      y1=mby+1<<4>>vdec;
+      if(y0==0)y0=-vpadding;
+      if(y1==src->height)y1+=vpadding;
+      for(mbx=0;mbx<_enc->state.nhmbs;){
+        unsigned mbx_end;
+        int      x0;
+        int      x1;
+        int      y;
+        /*Copy each horizontal run of dirty macro blocks at once.*/
+        for(mbx_end=mbx;mbx_end<_enc->state.nhmbs;mbx_end++){
+          unsigned sbi;
+          sbi=(mby>>1)*nhsbs+(mbx_end>>1);
+          if(!_enc->mb_info[sbi<<2|OC_MB_QUADI[(mby&1)<<1|(mbx_end&1)]].dirty){
+            break;
+          }
+        }
+        if(mbx_end<=mbx){
+          mbx++;
+          continue;
+        }
+        x0=mbx<<4>>hdec;
+        x1=mbx_end<<4>>hdec;
+        if(x0==0)x0=-hpadding;
+        if(x1==src->width)x1+=hpadding;
+        for(y=y0;y<y1;y++){
+          memcpy(dst->data+y*(ptrdiff_t)dst->stride+x0,
+           src->data+y*(ptrdiff_t)src->stride+x0,x1-x0);
+        }
+        mbx=mbx_end;
+      }
+    }
+  }
+}
+
+/*Copies the rectangles passed to th_encode_ycbcr_in_rects() into input
+   buffer _refi, which must already hold the previous input frame, and flags
+   the macro blocks they touch as dirty.*/
+static void oc_enc_input_rects(oc_enc_ctx *_enc,int _refi,
+ th_ycbcr_buffer _img,const th_enc_rect *_rects,int _nrects){
+  th_img_plane *iplanes;
+  int           pic_bounds[4];
+  int           repad;
+  int           caps;
+  size_t        mbi;
+  int           ri;
+  int           pli;
+  iplanes=_enc->state.ref_frame_bufs[_refi];
+  pic_bounds[0]=_enc->state.info.pic_x;
+  pic_bounds[1]=_enc->state.info.pic_y;
+  pic_bounds[2]=pic_bounds[0]+_enc->state.info.pic_width;
+  pic_bounds[3]=pic_bounds[1]+_enc->state.info.pic_height;
+  for(mbi=0;mbi<_enc->state.nmbs;mbi++)_enc->mb_info[mbi].dirty=0;
+  repad=caps=0;
+  for(ri=0;ri<_nrects;ri++){
+    int luma_bounds[4];
+    if(!oc_enc_rect_bounds(_enc,_rects+ri,luma_bounds))continue;
+    oc_enc_mark_dirty(_enc,luma_bounds);
+    for(pli=0;pli<3;pli++){
+      unsigned char *dst;
+      unsigned char *src;
+      int            ppic_bounds[4];
+      int            bounds[4];
+      int            y;
+      oc_enc_plane_bounds(_enc,pli,bounds,luma_bounds);
+      dst=iplanes[pli].data+bounds[1]*(ptrdiff_t)iplanes[pli].stride+bounds[0];
+      src=_img[pli].data+bounds[1]*(ptrdiff_t)_img[pli].stride+bounds[0];
+      for(y=bounds[1];y<bounds[3];y++){
+        memcpy(dst,src,bounds[2]-bounds[0]);
+        dst+=iplanes[pli].stride;
+        src+=_img[pli].stride;
+      }
+      /*If the picture region is smaller than the frame, the padding between
+         them is extrapolated from the edges of the picture, so it has to be
+         redone if they changed.*/
+      oc_enc_plane_bounds(_enc,pli,ppic_bounds,pic_bounds);
+      if(bounds[0]==ppic_bounds[0]&&ppic_bounds[0]>0
+       ||bounds[1]==ppic_bounds[1]&&ppic_bounds[1]>0
+       ||bounds[2]==ppic_bounds[2]&&ppic_bounds[2]<iplanes[pli].width
+       ||bounds[3]==ppic_bounds[3]&&ppic_bounds[3]<iplanes[pli].height){
+        repad|=1<<pli;
+      }
+      /*Otherwise only the borders next to the changed samples need to be
+         updated.*/
+      else{
+        if(bounds[0]==0||bounds[2]==iplanes[pli].width){
+          oc_state_borders_fill_rows(&_enc->state,_refi,pli,
+           bounds[1],bounds[3]);
+        }
+        if(bounds[1]==0||bounds[3]==iplanes[pli].height)caps|=1<<pli;
+      }
+    }
+  }
+  for(pli=0;pli<3;pli++){
+    if(repad>>pli&1){
+      int ppic_bounds[4];
+      oc_enc_plane_bounds(_enc,pli,ppic_bounds,pic_bounds);
+      /*Passing the buffer as its own source skips the copy.*/
+      oc_img_plane_copy_pad(iplanes+pli,iplanes+pli,
+       ppic_bounds[0],ppic_bounds[1],ppic_bounds[2]-ppic_bounds[0],
+       ppic_bounds[3]-ppic_bounds[1]);
+      oc_state_borders_fill_rows(&_enc->state,_refi,pli,
+       0,iplanes[pli].height);
+      oc_state_borders_fill_caps(&_enc->state,_refi,pli);
+    }
+    else if(caps>>pli&1)oc_state_borders_fill_caps(&_enc->state,_refi,pli);
+  }
+  /*Any macro block containing padding may have changed along with it.*/
+  if(repad){
+    unsigned nhsbs;
+    unsigned mbx;
+    unsigned mby;
+    nhsbs=_enc->state.fplanes[0].nhsbs;
+    for(mby=0;mby<_enc->state.nvmbs;mby++){
+      for(mbx=0;mbx<_enc->state.nhmbs;mbx++){
+        if((int)mbx<<4<pic_bounds[0]||(int)mby<<4<pic_bounds[1]
+         ||(int)mbx+1<<4>pic_bounds[2]||(int)mby+1<<4>pic_bounds[3]){
+          unsigned sbi;
+          sbi=(mby>>1)*nhsbs+(mbx>>1);
+          _enc->mb_info[sbi<<2|OC_MB_QUADI[(mby&1)<<1|(mbx&1)]].dirty=1;
+        }
+      }
+    }
+  }
+}
+
+/*Submits a frame.
+  _rects: The rectangles outside of which _img is identical to the last input
+           frame, or NULL if _nrects is negative, in which case all of it is
+           copied and analyzed.*/
+static int oc_enc_ycbcr_in(oc_enc_ctx *_enc,th_ycbcr_buffer _img,
+ const th_enc_rect *_rects,int _nrects){
   th_ycbcr_buffer img;
   int             frame_width;
   int             frame_height;
@@ -1655,12 +2756,21 @@ int th_encode_ycbcr_in(th_enc_ctx *_enc,th_ycbcr_buffer _img){
   int             hdec;
   int             vdec;
   int             pli;
+  int             prev_refi;
   int             refi;
   int             drop;
+  int             ndups;
+  ogg_int64_t     start_time;
   /*Step 1: validate parameters.*/
   if(_enc==NULL||_img==NULL)return TH_EFAULT;
   if(_enc->packet_state==OC_PACKET_DONE)return TH_EINVAL;
   if(_enc->rc.twopass&&_enc->rc.twopass_buffer_bytes==0)return TH_EINVAL;
+  start_time=_enc->deadline>0||_enc->profiling?oc_enc_clock_ns():0;
+  if(_enc->profiling){
+    memset(_enc->stage_ns,0,sizeof(_enc->stage_ns));
+    _enc->stage_start=start_time;
+    _enc->stage=OC_ENC_STAGE_OTHER;
+  }
   hdec=!(_enc->state.info.pixel_fmt&1);
   vdec=!(_enc->state.info.pixel_fmt&2);
   frame_width=_enc->state.info.frame_width;
@@ -1694,6 +2804,19 @@ int th_encode_ycbcr_in(th_enc_ctx *_enc,th_ycbcr_buffer _img){
     img[1].data-=cpic_y*(ptrdiff_t)img[1].stride+cpic_x;
     img[2].data-=cpic_y*(ptrdiff_t)img[2].stride+cpic_x;
   }
+  /*If this frame repeats the last one, emit it as extra duplicates of that
+     frame instead of analyzing and coding it again.*/
+  ndups=oc_enc_dup_room(_enc);
+  if(ndups>0
+   &&oc_enc_frame_is_dup(_enc,img,_rects,_nrects,_enc->dup_threshold)){
+    _enc->prev_dup_count+=ndups;
+    _enc->nqueued_dups+=ndups;
+    _enc->dup_count=0;
+    _enc->borrowed_refi=-1;
+    if(_enc->state.info.target_bitrate>0)oc_enc_rc_add_dups(_enc,ndups);
+    _enc->mv_hints_valid=0;
+    return 0;
+  }
   /*Step 2: Update the buffer state.*/
   if(_enc->state.ref_frame_idx[OC_FRAME_SELF]>=0){
     _enc->state.ref_frame_idx[OC_FRAME_PREV]=
@@ -1724,24 +2847,44 @@ int th_encode_ycbcr_in(th_enc_ctx *_enc,th_ycbcr_buffer _img){
     }
   }
   /*Select a free buffer to use for the incoming frame*/
-  for(refi=3;refi==_enc->state.ref_frame_idx[OC_FRAME_GOLD_ORIG]||
-   refi==_enc->state.ref_frame_idx[OC_FRAME_PREV_ORIG];refi++);
+  prev_refi=_enc->state.ref_frame_idx[OC_FRAME_IO];
+  refi=oc_enc_select_io_buf(_enc);
+  /*Any buffer lent out by th_encode_ycbcr_borrow() is consumed (or
+     overwritten) by this frame.*/
+  _enc->borrowed_refi=-1;
   _enc->state.ref_frame_idx[OC_FRAME_IO]=refi;
   _enc->state.ref_frame_data[OC_FRAME_IO]=
    _enc->state.ref_frame_bufs[refi][0].data;
   /*Step 3: Copy the input to our internal buffer.
     This lets us add padding, so we don't have to worry about dereferencing
      possibly invalid addresses, and allows us to use the same strides and
-     fragment offsets for both the input frame and the reference frames.*/
-  oc_img_plane_copy_pad(_enc->state.ref_frame_bufs[refi]+0,img+0,
-   pic_x,pic_y,pic_width,pic_height);
-  oc_state_borders_fill_rows(&_enc->state,refi,0,0,frame_height);
-  oc_state_borders_fill_caps(&_enc->state,refi,0);
-  for(pli=1;pli<3;pli++){
-    oc_img_plane_copy_pad(_enc->state.ref_frame_bufs[refi]+pli,img+pli,
-     cpic_x,cpic_y,cpic_width,cpic_height);
-    oc_state_borders_fill_rows(&_enc->state,refi,pli,0,cframe_height);
-    oc_state_borders_fill_caps(&_enc->state,refi,pli);
+     fragment offsets for both the input frame and the reference frames.
+    If we were told which regions changed, start from the last input frame
+     and only copy those.*/
+  _enc->dirty_rects=_nrects>=0&&prev_refi>=0;
+  if(_enc->dirty_rects){
+    /*If this buffer held the frame the last one was built from, only the
+       macro blocks that changed in the last frame differ from it.*/
+    if(refi!=prev_refi){
+      if(refi==_enc->io_base_refi)oc_enc_io_buf_copy_dirty(_enc,refi,prev_refi);
+      else oc_enc_io_buf_copy(_enc,refi,prev_refi);
+      _enc->io_base_refi=prev_refi;
+    }
+    else _enc->io_base_refi=-1;
+    oc_enc_input_rects(_enc,refi,img,_rects,_nrects);
+  }
+  else{
+    _enc->io_base_refi=-1;
+    oc_img_plane_copy_pad(_enc->state.ref_frame_bufs[refi]+0,img+0,
+     pic_x,pic_y,pic_width,pic_height);
+    oc_state_borders_fill_rows(&_enc->state,refi,0,0,frame_height);
+    oc_state_borders_fill_caps(&_enc->state,refi,0);
+    for(pli=1;pli<3;pli++){
+      oc_img_plane_copy_pad(_enc->state.ref_frame_bufs[refi]+pli,img+pli,
+       cpic_x,cpic_y,cpic_width,cpic_height);
+      oc_state_borders_fill_rows(&_enc->state,refi,pli,0,cframe_height);
+      oc_state_borders_fill_caps(&_enc->state,refi,pli);
+    }
   }
   /*Select a free buffer to use for the reconstructed version of this frame.*/
   for(refi=0;refi==_enc->state.ref_frame_idx[OC_FRAME_GOLD]||
@@ -1764,18 +2907,32 @@ int th_encode_ycbcr_in(th_enc_ctx *_enc,th_ycbcr_buffer _img){
     drop=1;
   }
   oc_restore_fpu(&_enc->state);
+  _enc->mv_hints_valid=0;
   /*drop currently indicates if the frame is droppable.*/
   if(_enc->state.info.target_bitrate>0){
-    drop=oc_enc_update_rc_state(_enc,oggpackB_bytes(&_enc->opb)<<3,
+    oc_enc_stage_switch(_enc,OC_ENC_STAGE_RC);
+    drop=oc_enc_update_rc_state(_enc,oc_enc_pack_bytes(&_enc->pack)<<3,
      _enc->state.frame_type,_enc->state.qis[0],0,drop);
   }
   else drop=0;
+  oc_enc_stage_switch(_enc,OC_ENC_STAGE_OTHER);
   /*drop now indicates if the frame was dropped.*/
   if(drop)oc_enc_drop_frame(_enc);
-  else _enc->prevframe_dropped=0;
+  else{
+    _enc->prevframe_dropped=0;
+    oc_enc_huff_stats_update(_enc);
+    /*A keyframe refreshes everything, so the next sweep starts over.*/
+    if(_enc->state.frame_type==OC_INTRA_FRAME)_enc->refresh_pos=0;
+    else if(++_enc->refresh_pos>=_enc->refresh_period)_enc->refresh_pos=0;
+  }
   _enc->packet_state=OC_PACKET_READY;
   _enc->prev_dup_count=_enc->nqueued_dups=_enc->dup_count;
   _enc->dup_count=0;
+  /*Close out the timing of the last stage.*/
+  oc_enc_stage_switch(_enc,OC_ENC_STAGE_OTHER);
+  if(_enc->deadline>0&&_enc->state.frame_type!=OC_INTRA_FRAME){
+    oc_enc_update_deadline(_enc,(oc_enc_clock_ns()-start_time)/1000);
+  }
 #if defined(OC_DUMP_IMAGES)
   oc_enc_set_granpos(_enc);
   oc_state_dump_frame(&_enc->state,OC_FRAME_IO,"src");
@@ -1784,40 +2941,125 @@ int th_encode_ycbcr_in(th_enc_ctx *_enc,th_ycbcr_buffer _img){
   return 0;
 }
 
-int th_encode_packetout(th_enc_ctx *_enc,int _last_p,ogg_packet *_op){
-  unsigned char *packet;
-  if(_enc==NULL||_op==NULL)return TH_EFAULT;
+int th_encode_ycbcr_in(th_enc_ctx *_enc,th_ycbcr_buffer _img){
+  return oc_enc_ycbcr_in(_enc,_img,NULL,-1);
+}
+
+int th_encode_ycbcr_in_rects(th_enc_ctx *_enc,th_ycbcr_buffer _img,
+ const th_enc_rect *_rects,int _nrects){
+  if(_nrects>0&&_rects==NULL)return TH_EFAULT;
+  if(_nrects<0)return TH_EINVAL;
+  return oc_enc_ycbcr_in(_enc,_img,_rects,_nrects);
+}
+
+int th_encode_ycbcr_borrow(th_enc_ctx *_enc,th_ycbcr_buffer _ycbcr){
+  int refi;
+  if(_enc==NULL||_ycbcr==NULL)return TH_EFAULT;
+  if(_enc->packet_state==OC_PACKET_DONE)return TH_EINVAL;
+  refi=oc_enc_select_io_buf(_enc);
+  /*The application may write anything into it.*/
+  if(refi==_enc->io_base_refi)_enc->io_base_refi=-1;
+  /*Hand out a top-down view of the full frame, the same layout
+     th_encode_ycbcr_in() accepts.*/
+  oc_ycbcr_buffer_flip(_ycbcr,_enc->state.ref_frame_bufs[refi]);
+  _enc->borrowed_refi=refi;
+  return 0;
+}
+
+int th_encode_ycbcr_commit(th_enc_ctx *_enc){
+  th_ycbcr_buffer img;
+  if(_enc==NULL)return TH_EFAULT;
+  if(_enc->borrowed_refi<0)return TH_EINVAL;
+  oc_ycbcr_buffer_flip(img,_enc->state.ref_frame_bufs[_enc->borrowed_refi]);
+  return th_encode_ycbcr_in(_enc,img);
+}
+
+int th_encode_image_in(th_enc_ctx *_enc,const th_input_image *_img){
+  th_ycbcr_buffer ycbcr;
+  int             ret;
+  if(_enc==NULL||_img==NULL||_img->data[0]==NULL)return TH_EFAULT;
+  if((unsigned)_img->fmt>=TH_INFMT_NFORMATS)return TH_EINVAL;
+  if((_img->fmt==TH_INFMT_I420||_img->fmt==TH_INFMT_NV12)&&_img->data[1]==NULL
+   ||_img->fmt==TH_INFMT_I420&&_img->data[2]==NULL){
+    return TH_EFAULT;
+  }
+  if(_enc->rc.twopass&&_enc->rc.twopass_buffer_bytes==0)return TH_EINVAL;
+  if(_enc->input_scratch==NULL){
+    _enc->input_scratch=(unsigned char *)oc_mem_alloc(&_enc->state.mem,
+     2*(_enc->state.info.frame_width+16)*sizeof(*_enc->input_scratch),16,
+     TH_ALLOC_SCRATCH);
+    if(_enc->input_scratch==NULL)return TH_EFAULT;
+  }
+  ret=th_encode_ycbcr_borrow(_enc,ycbcr);
+  if(ret<0)return ret;
+  oc_enc_input_convert(_enc,_enc->state.ref_frame_bufs[_enc->borrowed_refi],
+   _img);
+  return th_encode_ycbcr_commit(_enc);
+}
+
+/*Retrieves the next packet.
+  If _copy_p is set, the packet data is placed in _buf, and if it does not
+   fit, the packet is left pending and its size returned in _op->bytes.*/
+static int oc_enc_packetout(th_enc_ctx *_enc,int _last_p,int _copy_p,
+ unsigned char *_buf,size_t _buf_sz,ogg_packet *_op){
   if(_enc->packet_state==OC_PACKET_READY){
-    _enc->packet_state=OC_PACKET_EMPTY;
     if(_enc->rc.twopass!=1){
-      packet=oggpackB_get_buffer(&_enc->opb);
-      /*If there's no packet, malloc failed while writing; it's lost forever.*/
-      if(packet==NULL)return TH_EFAULT;
-      _op->packet=packet;
-      _op->bytes=oggpackB_bytes(&_enc->opb);
+      long bytes;
+      bytes=oc_enc_pack_bytes(&_enc->pack);
+      if(_copy_p&&!_enc->pack.err&&(size_t)bytes>_buf_sz){
+        _op->bytes=bytes;
+        return TH_EINVAL;
+      }
+      _enc->packet_state=OC_PACKET_EMPTY;
+      /*If malloc failed while writing, the packet is lost forever.*/
+      if(_enc->pack.err)return TH_EFAULT;
+      if(_copy_p){
+        if(_enc->pack.start!=_buf)memcpy(_buf,_enc->pack.start,bytes);
+        _op->packet=_buf;
+      }
+      else _op->packet=_enc->pack.start;
+      _op->bytes=bytes;
     }
     /*For the first pass in 2-pass mode, don't emit any packet data.*/
     else{
+      _enc->packet_state=OC_PACKET_EMPTY;
       _op->packet=NULL;
       _op->bytes=0;
     }
   }
   else if(_enc->packet_state==OC_PACKET_EMPTY){
     if(_enc->nqueued_dups>0){
-      _enc->nqueued_dups--;
       /*Emit an inter frame with no coded blocks in VP3-compatibility mode.*/
       if(_enc->vp3_compatible){
-        oggpackB_reset(&_enc->opb);
+        unsigned char *user;
+        size_t         user_storage;
+        long           bytes;
+        /*Write the packet straight into the caller's buffer, if given.*/
+        user=_enc->pack.user;
+        user_storage=_enc->pack.user_storage;
+        if(_copy_p&&_buf!=NULL){
+          _enc->pack.user=_buf;
+          _enc->pack.user_storage=_buf_sz;
+        }
+        oc_enc_pack_reset(&_enc->pack);
         oc_enc_drop_frame_pack(_enc);
-        packet=oggpackB_get_buffer(&_enc->opb);
-        /*If there's no packet, malloc failed while writing; it's lost
-           forever.*/
-        if(packet==NULL)return TH_EFAULT;
-        _op->packet=packet;
-        _op->bytes=oggpackB_bytes(&_enc->opb);
+        oc_enc_pack_finish(&_enc->pack);
+        _enc->pack.user=user;
+        _enc->pack.user_storage=user_storage;
+        bytes=oc_enc_pack_bytes(&_enc->pack);
+        if(_copy_p&&!_enc->pack.err&&(size_t)bytes>_buf_sz){
+          _op->bytes=bytes;
+          return TH_EINVAL;
+        }
+        _enc->nqueued_dups--;
+        /*If malloc failed while writing, the packet is lost forever.*/
+        if(_enc->pack.err)return TH_EFAULT;
+        _op->packet=_enc->pack.start;
+        _op->bytes=bytes;
       }
       /*Otherwise emit a 0-byte packet.*/
       else{
+        _enc->nqueued_dups--;
         _op->packet=NULL;
         _op->bytes=0;
       }
@@ -1837,3 +3079,423 @@ int th_encode_packetout(th_enc_ctx *_enc,int _last_p,ogg_packet *_op){
   if(_last_p)_enc->packet_state=OC_PACKET_DONE;
   return 1+_enc->nqueued_dups;
 }
+
+int th_encode_packetout(th_enc_ctx *_enc,int _last_p,ogg_packet *_op){
+  if(_enc==NULL||_op==NULL)return TH_EFAULT;
+  return oc_enc_packetout(_enc,_last_p,0,NULL,0,_op);
+}
+
+int th_encode_packetout_buffer(th_enc_ctx *_enc,int _last_p,
+ unsigned char *_buf,size_t _buf_sz,ogg_packet *_op){
+  if(_enc==NULL||_op==NULL||_buf==NULL&&_buf_sz>0)return TH_EFAULT;
+  return oc_enc_packetout(_enc,_last_p,1,_buf,_buf_sz,_op);
+}
+
+
+
+/*Asynchronous encoding.
+  th_encode_submit() copies frames into a small ring buffer, and a worker
+   thread drives the usual th_encode_ycbcr_in()/th_encode_packetout() calls on
+   them, copying each packet into a second queue for th_encode_receive().
+  If the application attached an executor, the worker is instead a task
+   submitted to it each time frames are queued and none is running.
+  Without thread support, frames are encoded as they are submitted and only
+   the packet queue is used.*/
+
+static void oc_enc_async_lock(oc_enc_async *_async){
+#if defined(OC_HAVE_PTHREAD)
+  if(_async->threaded)pthread_mutex_lock(&_async->mutex);
+#endif
+}
+
+static void oc_enc_async_unlock(oc_enc_async *_async){
+#if defined(OC_HAVE_PTHREAD)
+  if(_async->threaded){
+    /*Every change made under the lock is something the other side might be
+       waiting for.*/
+    pthread_cond_broadcast(&_async->cond);
+    pthread_mutex_unlock(&_async->mutex);
+  }
+#endif
+}
+
+/*Waits for the other side to change something.
+  This must only be called with the lock held in threaded mode.*/
+static void oc_enc_async_wait(oc_enc_async *_async){
+#if defined(OC_HAVE_PTHREAD)
+  pthread_cond_wait(&_async->cond,&_async->mutex);
+#endif
+}
+
+/*Checks that a buffer is either the size of the frame or the size of the
+   picture region, the two layouts th_encode_ycbcr_in() accepts.*/
+static int oc_enc_ycbcr_size_ok(const oc_enc_ctx *_enc,
+ th_ycbcr_buffer _img){
+  int hdec;
+  int vdec;
+  int pic_x;
+  int pic_y;
+  int cpic_x;
+  int cpic_y;
+  int cwidth;
+  int cheight;
+  hdec=!(_enc->state.info.pixel_fmt&1);
+  vdec=!(_enc->state.info.pixel_fmt&2);
+  if(_img[0].width==(int)_enc->state.info.frame_width
+   &&_img[0].height==(int)_enc->state.info.frame_height){
+    cwidth=_enc->state.info.frame_width>>hdec;
+    cheight=_enc->state.info.frame_height>>vdec;
+  }
+  else if(_img[0].width==(int)_enc->state.info.pic_width
+   &&_img[0].height==(int)_enc->state.info.pic_height){
+    pic_x=_enc->state.info.pic_x;
+    pic_y=_enc->state.info.pic_y;
+    cpic_x=pic_x>>hdec;
+    cpic_y=pic_y>>vdec;
+    cwidth=(pic_x+_enc->state.info.pic_width+hdec>>hdec)-cpic_x;
+    cheight=(pic_y+_enc->state.info.pic_height+vdec>>vdec)-cpic_y;
+  }
+  else return 0;
+  return _img[1].width==cwidth&&_img[2].width==cwidth
+   &&_img[1].height==cheight&&_img[2].height==cheight;
+}
+
+/*Copies a frame into a queue slot, packing the planes tightly.*/
+static int oc_enc_async_frame_copy(oc_enc_async_frame *_frame,
+ th_ycbcr_buffer _ycbcr){
+  unsigned char *dst;
+  size_t         size;
+  int            pli;
+  size=0;
+  for(pli=0;pli<3;pli++)size+=(size_t)_ycbcr[pli].width*_ycbcr[pli].height;
+  if(size>_frame->storage){
+    _ogg_free(_frame->data);
+    _frame->data=(unsigned char *)_ogg_malloc(size);
+    if(_frame->data==NULL){
+      _frame->storage=0;
+      return TH_EFAULT;
+    }
+    _frame->storage=size;
+  }
+  dst=_frame->data;
+  for(pli=0;pli<3;pli++){
+    const unsigned char *src;
+    int                  width;
+    int                  height;
+    int                  y;
+    width=_ycbcr[pli].width;
+    height=_ycbcr[pli].height;
+    src=_ycbcr[pli].data;
+    for(y=0;y<height;y++){
+      memcpy(dst+y*(size_t)width,src,width);
+      src+=_ycbcr[pli].stride;
+    }
+    _frame->ycbcr[pli].width=width;
+    _frame->ycbcr[pli].height=height;
+    _frame->ycbcr[pli].stride=width;
+    _frame->ycbcr[pli].data=dst;
+    dst+=width*(size_t)height;
+  }
+  return 0;
+}
+
+/*Appends a copy of a packet to the queue.
+  This must be called with the lock held.*/
+static int oc_enc_async_push(oc_enc_async *_async,const ogg_packet *_op){
+  oc_enc_async_packet *packet;
+  if(_async->npackets>=_async->npackets_max){
+    oc_enc_async_packet *packets;
+    int                  npackets_max;
+    int                  pi;
+    /*Grow the ring, unwrapping it so the head starts at 0 again.*/
+    npackets_max=_async->npackets_max<<1;
+    packets=(oc_enc_async_packet *)_ogg_calloc(npackets_max,sizeof(*packets));
+    if(packets==NULL)return TH_EFAULT;
+    for(pi=0;pi<_async->npackets;pi++){
+      packets[pi]=_async->packets[
+       (_async->packet_head+pi)%_async->npackets_max];
+    }
+    _ogg_free(_async->packets);
+    _async->packets=packets;
+    _async->npackets_max=npackets_max;
+    _async->packet_head=0;
+  }
+  packet=_async->packets
+   +(_async->packet_head+_async->npackets)%_async->npackets_max;
+  if((size_t)_op->bytes>packet->storage){
+    _ogg_free(packet->data);
+    packet->data=(unsigned char *)_ogg_malloc(_op->bytes);
+    if(packet->data==NULL){
+      packet->storage=0;
+      return TH_EFAULT;
+    }
+    packet->storage=_op->bytes;
+  }
+  if(_op->bytes>0)memcpy(packet->data,_op->packet,_op->bytes);
+  packet->op=*_op;
+  packet->op.packet=packet->data;
+  _async->npackets++;
+  return 0;
+}
+
+/*Encodes one frame (or, if _ycbcr is NULL, just ends the stream) and queues
+   its packets.
+  This is called without the lock held.*/
+static void oc_enc_async_encode(oc_enc_ctx *_enc,th_ycbcr_buffer _ycbcr,
+ int _flags){
+  oc_enc_async *async;
+  ogg_packet    op;
+  int           last;
+  int           ret;
+  async=_enc->async;
+  last=_flags&TH_ENCASYNC_LAST;
+  ret=_ycbcr!=NULL?th_encode_ycbcr_in(_enc,_ycbcr):0;
+  while(ret>=0){
+    ret=th_encode_packetout(_enc,last,&op);
+    if(ret<=0)break;
+    oc_enc_async_lock(async);
+    ret=oc_enc_async_push(async,&op);
+    oc_enc_async_unlock(async);
+  }
+  oc_enc_async_lock(async);
+  if(ret<0)async->err=ret;
+  else if(_ycbcr==NULL&&last&&async->npackets>0){
+    async->packets[(async->packet_head+async->npackets-1)
+     %async->npackets_max].op.e_o_s=1;
+  }
+  oc_enc_async_unlock(async);
+}
+
+#if defined(OC_HAVE_PTHREAD)
+static void *oc_enc_async_worker(void *_enc){
+  oc_enc_ctx   *enc;
+  oc_enc_async *async;
+  enc=(oc_enc_ctx *)_enc;
+  async=enc->async;
+  oc_enc_async_lock(async);
+  for(;;){
+    oc_enc_async_frame *frame;
+    /*Let the caller catch up before producing more packets.*/
+    while(!async->shutdown
+     &&(async->nframes<=0||async->npackets>=async->depth)){
+      oc_enc_async_wait(async);
+    }
+    if(async->shutdown)break;
+    frame=async->frames+async->frame_head;
+    oc_enc_async_unlock(async);
+    oc_enc_async_encode(enc,frame->ycbcr[0].data!=NULL?frame->ycbcr:NULL,
+     frame->flags);
+    oc_enc_async_lock(async);
+    async->frame_head=(async->frame_head+1)%async->depth;
+    async->nframes--;
+    /*We may go straight back to waiting without unlocking, so announce this
+       explicitly: th_encode_receive() may be waiting for the queue to empty.*/
+    pthread_cond_broadcast(&async->cond);
+  }
+  oc_enc_async_unlock(async);
+  return NULL;
+}
+
+/*Encodes queued frames as an executor task.
+  Unlike the worker thread, this returns as soon as it would have to wait,
+   leaving oc_enc_async_kick() to start it again once there is more to do.*/
+static void oc_enc_async_task(void *_enc){
+  oc_enc_ctx   *enc;
+  oc_enc_async *async;
+  enc=(oc_enc_ctx *)_enc;
+  async=enc->async;
+  oc_enc_async_lock(async);
+  while(!async->shutdown&&async->nframes>0&&async->npackets<async->depth){
+    oc_enc_async_frame *frame;
+    frame=async->frames+async->frame_head;
+    oc_enc_async_unlock(async);
+    oc_enc_async_encode(enc,frame->ycbcr[0].data!=NULL?frame->ycbcr:NULL,
+     frame->flags);
+    oc_enc_async_lock(async);
+    async->frame_head=(async->frame_head+1)%async->depth;
+    async->nframes--;
+  }
+  async->task_running=0;
+  oc_enc_async_unlock(async);
+}
+
+/*Submits a task to encode queued frames if there are any the worker could
+   encode right now and no task is already running.
+  This must be called without the lock held, since the executor is allowed to
+   run the task before submit() returns.*/
+static void oc_enc_async_kick(oc_enc_ctx *_enc){
+  oc_enc_async *async;
+  int           start;
+  async=_enc->async;
+  if(!async->tasks)return;
+  pthread_mutex_lock(&async->mutex);
+  start=!async->task_running&&!async->shutdown
+   &&async->nframes>0&&async->npackets<async->depth;
+  if(start)async->task_running=1;
+  pthread_mutex_unlock(&async->mutex);
+  if(start&&(*_enc->executor.submit)(_enc->executor.ctx,async,
+   oc_enc_async_task,_enc)<0){
+    oc_enc_async_task(_enc);
+  }
+}
+#endif
+
+static int oc_enc_async_init(oc_enc_ctx *_enc){
+  oc_enc_async *async;
+  async=(oc_enc_async *)_ogg_calloc(1,sizeof(*async));
+  if(async==NULL)return TH_EFAULT;
+  async->depth=_enc->async_depth;
+  async->frames=(oc_enc_async_frame *)_ogg_calloc(async->depth,
+   sizeof(*async->frames));
+  async->packets=(oc_enc_async_packet *)_ogg_calloc(async->depth,
+   sizeof(*async->packets));
+  if(async->frames==NULL||async->packets==NULL){
+    _ogg_free(async->packets);
+    _ogg_free(async->frames);
+    _ogg_free(async);
+    return TH_EFAULT;
+  }
+  async->npackets_max=async->depth;
+  _enc->async=async;
+#if defined(OC_HAVE_PTHREAD)
+  /*If we can't start a thread, fall back to encoding frames as they are
+     submitted.*/
+  if(pthread_mutex_init(&async->mutex,NULL)==0){
+    if(pthread_cond_init(&async->cond,NULL)==0){
+      /*The worker takes the lock as soon as it starts, so this must be set
+         first.*/
+      async->threaded=1;
+      /*With an executor, tasks are started as frames are submitted.*/
+      if(_enc->executor.submit!=NULL)async->tasks=1;
+      else if(pthread_create(&async->worker,NULL,
+       oc_enc_async_worker,_enc)!=0){
+        async->threaded=0;
+        pthread_cond_destroy(&async->cond);
+        pthread_mutex_destroy(&async->mutex);
+      }
+    }
+    else pthread_mutex_destroy(&async->mutex);
+  }
+#endif
+  return 0;
+}
+
+static void oc_enc_async_clear(oc_enc_ctx *_enc){
+  oc_enc_async *async;
+  int           i;
+  async=_enc->async;
+  if(async==NULL)return;
+#if defined(OC_HAVE_PTHREAD)
+  if(async->threaded){
+    oc_enc_async_lock(async);
+    async->shutdown=1;
+    oc_enc_async_unlock(async);
+    if(async->tasks)(*_enc->executor.wait)(_enc->executor.ctx,async);
+    else pthread_join(async->worker,NULL);
+    pthread_cond_destroy(&async->cond);
+    pthread_mutex_destroy(&async->mutex);
+  }
+#endif
+  for(i=0;i<async->depth;i++)_ogg_free(async->frames[i].data);
+  for(i=0;i<async->npackets_max;i++)_ogg_free(async->packets[i].data);
+  _ogg_free(async->held);
+  _ogg_free(async->packets);
+  _ogg_free(async->frames);
+  _ogg_free(async);
+  _enc->async=NULL;
+}
+
+int th_encode_submit(th_enc_ctx *_enc,th_ycbcr_buffer _ycbcr,int _flags){
+  oc_enc_async       *async;
+  oc_enc_async_frame *frame;
+  int                 ret;
+  if(_enc==NULL||_ycbcr==NULL&&!(_flags&TH_ENCASYNC_LAST))return TH_EFAULT;
+  if(_ycbcr!=NULL&&!oc_enc_ycbcr_size_ok(_enc,_ycbcr))return TH_EINVAL;
+  if(_enc->async==NULL){
+    ret=oc_enc_async_init(_enc);
+    if(ret<0)return ret;
+  }
+  async=_enc->async;
+  /*Only the caller's thread touches this.*/
+  if(async->ended)return TH_EINVAL;
+#if defined(OC_HAVE_PTHREAD)
+  if(async->threaded){
+    oc_enc_async_lock(async);
+    while(async->nframes>=async->depth){
+      /*Don't wait if the worker is itself waiting for packets to be
+         received, or we'd never wake up.*/
+      if(!(_flags&TH_ENCASYNC_WAIT)||async->npackets>=async->depth){
+        oc_enc_async_unlock(async);
+        return 0;
+      }
+      oc_enc_async_wait(async);
+    }
+    frame=async->frames
+     +(async->frame_head+async->nframes)%async->depth;
+    oc_enc_async_unlock(async);
+    /*The worker never looks at a slot past the end of the queue, so we can
+       fill it without the lock.*/
+    if(_ycbcr!=NULL){
+      ret=oc_enc_async_frame_copy(frame,_ycbcr);
+      if(ret<0)return ret;
+    }
+    else frame->ycbcr[0].data=NULL;
+    frame->flags=_flags;
+    if(_flags&TH_ENCASYNC_LAST)async->ended=1;
+    oc_enc_async_lock(async);
+    async->nframes++;
+    oc_enc_async_unlock(async);
+    oc_enc_async_kick(_enc);
+    return 1;
+  }
+#endif
+  (void)frame;
+  if(_flags&TH_ENCASYNC_LAST)async->ended=1;
+  oc_enc_async_encode(_enc,_ycbcr,_flags);
+  return 1;
+}
+
+int th_encode_receive(th_enc_ctx *_enc,ogg_packet *_op,int _flags){
+  oc_enc_async *async;
+  int           ret;
+  if(_enc==NULL||_op==NULL)return TH_EFAULT;
+  async=_enc->async;
+  if(async==NULL)return 0;
+  oc_enc_async_lock(async);
+  for(;;){
+    if(async->npackets>0){
+      oc_enc_async_packet *packet;
+      unsigned char       *data;
+      size_t               storage;
+      packet=async->packets+async->packet_head;
+      /*Hand the packet's storage to the caller, and give the slot the
+         storage the caller was holding from last time.*/
+      data=packet->data;
+      storage=packet->storage;
+      packet->data=async->held;
+      packet->storage=async->held_storage;
+      async->held=data;
+      async->held_storage=storage;
+      *_op=packet->op;
+      _op->packet=data;
+      async->packet_head=(async->packet_head+1)%async->npackets_max;
+      async->npackets--;
+      ret=1;
+      break;
+    }
+    if(async->err<0){
+      ret=async->err;
+      async->err=0;
+      break;
+    }
+    ret=0;
+    if(!(_flags&TH_ENCASYNC_WAIT)||async->nframes<=0)break;
+    oc_enc_async_wait(async);
+  }
+  oc_enc_async_unlock(async);
+#if defined(OC_HAVE_PTHREAD)
+  /*Taking a packet may have made room for a task to encode more frames.*/
+  if(ret>0)oc_enc_async_kick(_enc);
+#endif
+  return ret;
+}
@@ -21,8 +21,17 @@ th_enc_ctx *th_encode_alloc(const th_info *_info){
   return NULL;
 }
 
+th_enc_ctx *th_encode_alloc_with(const th_info *_info,
+ const th_allocator *_alloc){
+  return NULL;
+}
+
 void th_encode_free(th_enc_ctx *_enc){}
 
+int th_encode_reset(th_enc_ctx *_enc,const th_info *_info){
+  return OC_DISABLED;
+}
+
 
 int th_encode_ctl(th_enc_ctx *_enc,int _req,void *_buf,size_t _buf_sz){
   return OC_DISABLED;
@@ -36,10 +45,45 @@ int th_encode_ycbcr_in(th_enc_ctx *_enc,th_ycbcr_buffer _img){
   return OC_DISABLED;
 }
 
+int th_encode_ycbcr_borrow(th_enc_ctx *_enc,th_ycbcr_buffer _ycbcr){
+  return OC_DISABLED;
+}
+
+int th_encode_ycbcr_commit(th_enc_ctx *_enc){
+  return OC_DISABLED;
+}
+
+int th_encode_image_in(th_enc_ctx *_enc,const th_input_image *_img){
+  return OC_DISABLED;
+}
+
+int th_encode_ycbcr_in_rects(th_enc_ctx *_enc,th_ycbcr_buffer _ycbcr,
+ const th_enc_rect *_rects,int _nrects){
+  return OC_DISABLED;
+}
+
 int th_encode_packetout(th_enc_ctx *_enc,int _last_p,ogg_packet *_op){
   return OC_DISABLED;
 }
 
+int th_encode_packetout_buffer(th_enc_ctx *_enc,int _last_p,
+ unsigned char *_buf,size_t _buf_sz,ogg_packet *_op){
+  return OC_DISABLED;
+}
+
+int th_encode_submit(th_enc_ctx *_enc,th_ycbcr_buffer _ycbcr,int _flags){
+  return OC_DISABLED;
+}
+
+int th_encode_receive(th_enc_ctx *_enc,ogg_packet *_op,int _flags){
+  return OC_DISABLED;
+}
+
+int th_encode_2pass_merge(unsigned char *_summary,size_t _summary_sz,
+ const unsigned char *_seg,size_t _seg_sz,ogg_uint32_t _keyframe_frequency){
+  return OC_DISABLED;
+}
+
 
 
 int theora_encode_init(theora_state *_te,theora_info *_ci){
@@ -964,3 +964,80 @@ int oc_huff_codes_unpack(oc_pack_buf *_opb,
   }
   return 0;
 }
+
+/*Computes the lengths of a Huffman code for the given token weights.
+  _nbits:   Returns the code length of each token.
+  _weights: The weight of each token, all of which must be positive.
+  Return: The length of the longest code.*/
+static int oc_huff_code_lengths(int _nbits[TH_NDCT_TOKENS],
+ const ogg_int64_t _weights[TH_NDCT_TOKENS]){
+  ogg_int64_t weights[2*TH_NDCT_TOKENS-1];
+  int         parents[2*TH_NDCT_TOKENS-1];
+  int         active[2*TH_NDCT_TOKENS-1];
+  int         depths[2*TH_NDCT_TOKENS-1];
+  int         nnodes;
+  int         maxbits;
+  int         i;
+  for(i=0;i<TH_NDCT_TOKENS;i++){
+    weights[i]=_weights[i];
+    active[i]=1;
+  }
+  /*There are only 32 tokens, so a simple quadratic search for the two
+     lightest nodes is fast enough.*/
+  for(nnodes=TH_NDCT_TOKENS;nnodes<2*TH_NDCT_TOKENS-1;nnodes++){
+    int min[2];
+    int j;
+    for(j=0;j<2;j++){
+      min[j]=-1;
+      for(i=0;i<nnodes;i++){
+        if(active[i]&&(min[j]<0||weights[i]<weights[min[j]]))min[j]=i;
+      }
+      active[min[j]]=0;
+      parents[min[j]]=nnodes;
+    }
+    weights[nnodes]=weights[min[0]]+weights[min[1]];
+    active[nnodes]=1;
+  }
+  /*Children always come before their parents, so the depths can be filled in
+     from the root down.*/
+  depths[nnodes-1]=0;
+  for(i=nnodes-1;i-->0;)depths[i]=depths[parents[i]]+1;
+  maxbits=0;
+  for(i=0;i<TH_NDCT_TOKENS;i++){
+    _nbits[i]=depths[i];
+    if(_nbits[i]>maxbits)maxbits=_nbits[i];
+  }
+  return maxbits;
+}
+
+/*Builds a Huffman code fitted to the given token counts.
+  Every token is given a code, even ones that were never seen, so that the
+   result is a full code, as required by the bitstream.
+  _codes:   Returns the constructed code.
+  _counts:  The number of times each token was observed.
+  _maxbits: The maximum length of any code, which must be at least 5.*/
+void oc_huff_code_build(th_huff_code _codes[TH_NDCT_TOKENS],
+ const ogg_int64_t _counts[TH_NDCT_TOKENS],int _maxbits){
+  ogg_int64_t  weights[TH_NDCT_TOKENS];
+  int          nbits[TH_NDCT_TOKENS];
+  ogg_uint32_t pattern;
+  int          len;
+  int          i;
+  for(i=0;i<TH_NDCT_TOKENS;i++)weights[i]=_counts[i]+1;
+  /*Flatten the distribution until the longest code fits.
+    This is not optimal, but it only kicks in for tokens so rare that their
+     cost hardly matters.*/
+  while(oc_huff_code_lengths(nbits,weights)>_maxbits){
+    for(i=0;i<TH_NDCT_TOKENS;i++)weights[i]=weights[i]+1>>1;
+  }
+  /*Assign canonical codes in order of increasing length.*/
+  pattern=0;
+  for(len=1;len<=_maxbits;len++){
+    for(i=0;i<TH_NDCT_TOKENS;i++)if(nbits[i]==len){
+      _codes[i].pattern=pattern;
+      _codes[i].nbits=len;
+      pattern++;
+    }
+    pattern<<=1;
+  }
+}
@@ -18,5 +18,7 @@ int oc_huff_codes_pack(oggpack_buffer *_opb,
  const th_huff_code _codes[TH_NHUFFMAN_TABLES][TH_NDCT_TOKENS]);
 int oc_huff_codes_unpack(oc_pack_buf *_opb,
  th_huff_code _codes[TH_NHUFFMAN_TABLES][TH_NDCT_TOKENS]);
+void oc_huff_code_build(th_huff_code _codes[TH_NDCT_TOKENS],
+ const ogg_int64_t _counts[TH_NDCT_TOKENS],int _maxbits);
 
 #endif
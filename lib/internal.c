@@ -19,6 +19,13 @@
 #include <limits.h>
 #include <string.h>
 #include "internal.h"
+#if defined(HAVE_SYS_MMAN_H)
+# include <sys/mman.h>
+#endif
+#if defined(OC_HAVE_PTHREAD)
+# include <pthread.h>
+# include <unistd.h>
+#endif
 
 
 
@@ -169,6 +176,159 @@ void oc_free_2d(void *_ptr){
   _ogg_free(_ptr);
 }
 
+
+
+/*The default alignment for allocations that don't ask for one.*/
+#define OC_MEM_ALIGN (16)
+
+/*Allocates memory with an arbitrary power-of-two alignment using the libogg
+   allocator.
+  Unlike oc_aligned_malloc(), this stores a full pointer to the start of the
+   block, so it can handle alignments larger than 256 bytes.*/
+static void *oc_mem_sys_alloc(size_t _sz,size_t _align){
+  unsigned char *p;
+  unsigned char *ret;
+  if(_align<sizeof(p))_align=sizeof(p);
+  if(_sz>~(size_t)0-_align-sizeof(p))return NULL;
+  p=(unsigned char *)_ogg_malloc(_sz+_align-1+sizeof(p));
+  if(p==NULL)return NULL;
+  ret=p+sizeof(p);
+  ret+=-(ret-(unsigned char *)0)&_align-1;
+  memcpy(ret-sizeof(p),&p,sizeof(p));
+  return ret;
+}
+
+static void oc_mem_sys_free(void *_ptr){
+  unsigned char *p;
+  memcpy(&p,(unsigned char *)_ptr-sizeof(p),sizeof(p));
+  _ogg_free(p);
+}
+
+static void *oc_mem_raw_alloc(oc_mem *_mem,size_t _sz,size_t _align,
+ int _tag){
+  if(_mem->hooks.alloc!=NULL){
+    return (*_mem->hooks.alloc)(_mem->hooks.ctx,_sz,_align,_tag);
+  }
+  return oc_mem_sys_alloc(_sz,_align);
+}
+
+static void oc_mem_raw_free(oc_mem *_mem,void *_ptr,int _tag){
+  if(_mem->hooks.free!=NULL)(*_mem->hooks.free)(_mem->hooks.ctx,_ptr,_tag);
+  else oc_mem_sys_free(_ptr);
+}
+
+/*Initializes a context allocator.
+  _hooks: The application's allocation hooks, or NULL to use the libogg
+           allocator with no special flags.*/
+void oc_mem_init(oc_mem *_mem,const th_allocator *_hooks){
+  memset(_mem,0,sizeof(*_mem));
+  if(_hooks!=NULL)_mem->hooks=*_hooks;
+}
+
+/*Sets up an arena of the given size to satisfy future allocations from.
+  Return: 0 on success, or TH_EFAULT if it could not be allocated.*/
+int oc_mem_arena_init(oc_mem *_mem,size_t _sz){
+  unsigned char *arena;
+  arena=(unsigned char *)oc_mem_alloc(_mem,_sz,64,TH_ALLOC_ARENA);
+  if(arena==NULL)return TH_EFAULT;
+  _mem->arena=arena;
+  _mem->arena_sz=_sz;
+  _mem->arena_used=0;
+  _mem->nbytes=0;
+  return 0;
+}
+
+/*Releases the arena, if any.
+  Everything allocated from it must no longer be in use.*/
+void oc_mem_clear(oc_mem *_mem){
+  if(_mem->arena!=NULL){
+    oc_mem_raw_free(_mem,_mem->arena,TH_ALLOC_ARENA);
+    _mem->arena=NULL;
+  }
+}
+
+/*Allocates a block of memory for a context.
+  Blocks are carved out of the arena while there is room left in it.
+  Otherwise they come from the application's hooks, if any.
+  _sz:    The number of bytes to allocate.
+  _align: The required alignment, which must be a power of two.
+  _tag:   The TH_ALLOC_* usage tag.
+  Return: The allocated block, or NULL on failure.*/
+void *oc_mem_alloc(oc_mem *_mem,size_t _sz,size_t _align,int _tag){
+  unsigned char *ret;
+  /*Never hand out empty blocks, so that oc_mem_free() can always tell which
+     blocks came from the arena.*/
+  if(_sz==0)_sz=1;
+  if(_sz>~(size_t)0-_align)return NULL;
+  _mem->nbytes+=_sz+_align-1;
+  if(_mem->arena!=NULL){
+    size_t offs;
+    offs=_mem->arena_used;
+    offs+=-(_mem->arena+offs-(unsigned char *)0)&_align-1;
+    if(offs<=_mem->arena_sz&&_sz<=_mem->arena_sz-offs){
+      _mem->arena_used=offs+_sz;
+      return _mem->arena+offs;
+    }
+  }
+  if(!(_mem->hooks.flags&TH_ALLOCF_HUGEPAGES)
+   ||_tag!=TH_ALLOC_FRAME&&_tag!=TH_ALLOC_ARENA){
+    return oc_mem_raw_alloc(_mem,_sz,_align,_tag);
+  }
+  /*Round out to whole huge pages, so the kernel can back all of the block
+     with them without it sharing a page with anything else.*/
+  if(_sz>~(size_t)0-(OC_HUGE_PAGE_SZ-1))return NULL;
+  _sz=_sz+OC_HUGE_PAGE_SZ-1&~(OC_HUGE_PAGE_SZ-1);
+  ret=(unsigned char *)oc_mem_raw_alloc(_mem,_sz,OC_HUGE_PAGE_SZ,_tag);
+#if defined(HAVE_MADVISE)&&defined(MADV_HUGEPAGE)
+  /*This is only a hint, so we don't care if it fails.*/
+  if(ret!=NULL)madvise(ret,_sz,MADV_HUGEPAGE);
+#endif
+  return ret;
+}
+
+void *oc_mem_calloc(oc_mem *_mem,size_t _nmemb,size_t _sz,int _tag){
+  void *ret;
+  if(_sz!=0&&_nmemb>~(size_t)0/_sz)return NULL;
+  ret=oc_mem_alloc(_mem,_nmemb*_sz,OC_MEM_ALIGN,_tag);
+  if(ret!=NULL)memset(ret,0,_nmemb*_sz);
+  return ret;
+}
+
+/*The equivalent of oc_malloc_2d() for a context.
+  The result is freed with oc_mem_free().*/
+void **oc_mem_malloc_2d(oc_mem *_mem,size_t _height,size_t _width,
+ size_t _sz,int _tag){
+  size_t  rowsz;
+  size_t  colsz;
+  size_t  datsz;
+  char   *ret;
+  colsz=_height*sizeof(void *);
+  rowsz=_sz*_width;
+  datsz=rowsz*_height;
+  /*Alloc array and row pointers.*/
+  ret=(char *)oc_mem_alloc(_mem,datsz+colsz,OC_MEM_ALIGN,_tag);
+  /*Initialize the array.*/
+  if(ret!=NULL){
+    size_t   i;
+    void   **p;
+    char    *datptr;
+    p=(void **)ret;
+    i=_height;
+    for(datptr=ret+colsz;i-->0;p++,datptr+=rowsz)*p=(void *)datptr;
+  }
+  return (void **)ret;
+}
+
+/*Frees a block returned by one of the oc_mem allocation functions.
+  Blocks in the arena are only released when the arena is.*/
+void oc_mem_free(oc_mem *_mem,void *_ptr,int _tag){
+  unsigned char *p;
+  p=(unsigned char *)_ptr;
+  if(p==NULL)return;
+  if(_mem->arena!=NULL&&p>=_mem->arena&&p<_mem->arena+_mem->arena_sz)return;
+  oc_mem_raw_free(_mem,p,_tag);
+}
+
 /*Fills in a Y'CbCr buffer with a pointer to the image data in the first
    buffer, but with the opposite vertical orientation.
   _dst: The destination buffer.
@@ -208,3 +368,320 @@ int th_packet_isheader(ogg_packet *_op){
 int th_packet_iskeyframe(ogg_packet *_op){
   return _op->bytes<=0?0:_op->packet[0]&0x80?-1:!(_op->packet[0]&0x40);
 }
+
+
+
+/*The built-in thread pool executor.
+  Each worker has its own queue: it runs the newest task in it first and
+   takes the oldest task from another worker's queue when its own is empty.
+  A thread waiting on a group runs queued tasks from that group itself rather
+   than sleeping, so a context that waits never ties up a second thread.
+  All of the queues share a single lock: the tasks the library submits are
+   large enough that it is never contended for long.*/
+
+#if defined(OC_HAVE_PTHREAD)
+typedef struct oc_exec_task    oc_exec_task;
+typedef struct oc_exec_queue   oc_exec_queue;
+typedef struct oc_exec_running oc_exec_running;
+typedef struct oc_exec_pool    oc_exec_pool;
+
+/*A queued task.*/
+struct oc_exec_task{
+  th_task_func  func;
+  void         *arg;
+  void         *group;
+  /*The neighboring tasks in the queue, or in the free list (next only).*/
+  oc_exec_task *prev;
+  oc_exec_task *next;
+};
+
+/*A worker's queue.
+  The worker itself takes tasks from the tail, and other threads from the
+   head.*/
+struct oc_exec_queue{
+  oc_exec_task *head;
+  oc_exec_task *tail;
+};
+
+/*A task that some thread is currently running.
+  These live on the running thread's stack.*/
+struct oc_exec_running{
+  void            *group;
+  oc_exec_running *next;
+};
+
+struct oc_exec_pool{
+  /*The executor handed to the application.
+    This must be the first member.*/
+  th_executor      exec;
+  pthread_mutex_t  mutex;
+  /*Signaled when a task is queued, and on shutdown.*/
+  pthread_cond_t   work_cond;
+  /*Signaled when a task finishes.*/
+  pthread_cond_t   done_cond;
+  pthread_t       *threads;
+  oc_exec_queue   *queues;
+  int              nthreads;
+  /*The queue that the next task submitted from outside the pool goes to.*/
+  int              next_queue;
+  /*The tasks currently being run.*/
+  oc_exec_running *running;
+  /*Task structures that are not in use.*/
+  oc_exec_task    *free_tasks;
+  /*Whether the workers should exit once the queues are empty.*/
+  int              shutdown;
+};
+
+static void oc_exec_queue_remove(oc_exec_queue *_queue,oc_exec_task *_task){
+  if(_task->prev!=NULL)_task->prev->next=_task->next;
+  else _queue->head=_task->next;
+  if(_task->next!=NULL)_task->next->prev=_task->prev;
+  else _queue->tail=_task->prev;
+}
+
+/*Finds the next task for a worker to run, and removes it from its queue.
+  This must be called with the lock held.
+  _qi: The worker's own queue.
+  Return: The task, or NULL if every queue is empty.*/
+static oc_exec_task *oc_exec_pool_take(oc_exec_pool *_pool,int _qi){
+  oc_exec_task *task;
+  int           i;
+  task=_pool->queues[_qi].tail;
+  if(task!=NULL){
+    oc_exec_queue_remove(_pool->queues+_qi,task);
+    return task;
+  }
+  for(i=1;i<_pool->nthreads;i++){
+    oc_exec_queue *queue;
+    queue=_pool->queues+(_qi+i)%_pool->nthreads;
+    task=queue->head;
+    if(task!=NULL){
+      oc_exec_queue_remove(queue,task);
+      return task;
+    }
+  }
+  return NULL;
+}
+
+/*Finds a queued task from the given group, and removes it from its queue.
+  This must be called with the lock held.
+  Return: The task, or NULL if none of the group's tasks are queued.*/
+static oc_exec_task *oc_exec_pool_take_group(oc_exec_pool *_pool,
+ void *_group){
+  int qi;
+  for(qi=0;qi<_pool->nthreads;qi++){
+    oc_exec_task *task;
+    for(task=_pool->queues[qi].head;task!=NULL;task=task->next){
+      if(task->group==_group){
+        oc_exec_queue_remove(_pool->queues+qi,task);
+        return task;
+      }
+    }
+  }
+  return NULL;
+}
+
+/*Runs a task that has been removed from its queue.
+  This must be called with the lock held, which is released while the task
+   runs.*/
+static void oc_exec_pool_run(oc_exec_pool *_pool,oc_exec_task *_task){
+  oc_exec_running   running;
+  oc_exec_running **pnext;
+  th_task_func      func;
+  void             *arg;
+  func=_task->func;
+  arg=_task->arg;
+  running.group=_task->group;
+  running.next=_pool->running;
+  _pool->running=&running;
+  _task->next=_pool->free_tasks;
+  _pool->free_tasks=_task;
+  pthread_mutex_unlock(&_pool->mutex);
+  (*func)(arg);
+  pthread_mutex_lock(&_pool->mutex);
+  for(pnext=&_pool->running;*pnext!=&running;pnext=&(*pnext)->next);
+  *pnext=running.next;
+  pthread_cond_broadcast(&_pool->done_cond);
+}
+
+/*Returns the index of the calling thread if it is one of the workers, or -1
+   otherwise.*/
+static int oc_exec_pool_self(oc_exec_pool *_pool){
+  pthread_t self;
+  int       i;
+  self=pthread_self();
+  for(i=0;i<_pool->nthreads;i++){
+    if(pthread_equal(_pool->threads[i],self))return i;
+  }
+  return -1;
+}
+
+static int oc_exec_pool_submit(void *_ctx,void *_group,
+ th_task_func _func,void *_arg){
+  oc_exec_pool  *pool;
+  oc_exec_queue *queue;
+  oc_exec_task  *task;
+  int            qi;
+  pool=(oc_exec_pool *)_ctx;
+  pthread_mutex_lock(&pool->mutex);
+  task=pool->free_tasks;
+  if(task!=NULL)pool->free_tasks=task->next;
+  else{
+    task=(oc_exec_task *)_ogg_malloc(sizeof(*task));
+    if(task==NULL){
+      pthread_mutex_unlock(&pool->mutex);
+      return TH_EFAULT;
+    }
+  }
+  task->func=_func;
+  task->arg=_arg;
+  task->group=_group;
+  /*Tasks submitted by a worker go on its own queue, where it will most likely
+     run them itself while their data is still in its cache.
+    Everyone else spreads their tasks around.*/
+  qi=oc_exec_pool_self(pool);
+  if(qi<0){
+    qi=pool->next_queue;
+    pool->next_queue=(qi+1)%pool->nthreads;
+  }
+  queue=pool->queues+qi;
+  task->prev=queue->tail;
+  task->next=NULL;
+  if(queue->tail!=NULL)queue->tail->next=task;
+  else queue->head=task;
+  queue->tail=task;
+  pthread_cond_signal(&pool->work_cond);
+  pthread_mutex_unlock(&pool->mutex);
+  return 0;
+}
+
+static void oc_exec_pool_wait(void *_ctx,void *_group){
+  oc_exec_pool *pool;
+  pool=(oc_exec_pool *)_ctx;
+  pthread_mutex_lock(&pool->mutex);
+  for(;;){
+    oc_exec_running *running;
+    oc_exec_task    *task;
+    task=oc_exec_pool_take_group(pool,_group);
+    if(task!=NULL){
+      oc_exec_pool_run(pool,task);
+      continue;
+    }
+    for(running=pool->running;running!=NULL&&running->group!=_group;
+     running=running->next);
+    if(running==NULL)break;
+    pthread_cond_wait(&pool->done_cond,&pool->mutex);
+  }
+  pthread_mutex_unlock(&pool->mutex);
+}
+
+static void *oc_exec_pool_worker(void *_pool){
+  oc_exec_pool *pool;
+  int           qi;
+  pool=(oc_exec_pool *)_pool;
+  pthread_mutex_lock(&pool->mutex);
+  /*The creating thread holds the lock until every thread has started, so
+     this will find us.*/
+  qi=oc_exec_pool_self(pool);
+  for(;;){
+    oc_exec_task *task;
+    task=oc_exec_pool_take(pool,qi);
+    if(task!=NULL){
+      oc_exec_pool_run(pool,task);
+      continue;
+    }
+    if(pool->shutdown)break;
+    pthread_cond_wait(&pool->work_cond,&pool->mutex);
+  }
+  pthread_mutex_unlock(&pool->mutex);
+  return NULL;
+}
+
+/*Stops the first _nthreads workers and frees the pool.*/
+static void oc_exec_pool_free(oc_exec_pool *_pool,int _nthreads){
+  int i;
+  pthread_mutex_lock(&_pool->mutex);
+  _pool->shutdown=1;
+  pthread_cond_broadcast(&_pool->work_cond);
+  pthread_mutex_unlock(&_pool->mutex);
+  for(i=0;i<_nthreads;i++)pthread_join(_pool->threads[i],NULL);
+  while(_pool->free_tasks!=NULL){
+    oc_exec_task *task;
+    task=_pool->free_tasks;
+    _pool->free_tasks=task->next;
+    _ogg_free(task);
+  }
+  pthread_cond_destroy(&_pool->done_cond);
+  pthread_cond_destroy(&_pool->work_cond);
+  pthread_mutex_destroy(&_pool->mutex);
+  _ogg_free(_pool->queues);
+  _ogg_free(_pool->threads);
+  _ogg_free(_pool);
+}
+#endif
+
+th_executor *th_executor_pthread_create(int _nthreads){
+#if defined(OC_HAVE_PTHREAD)
+  oc_exec_pool *pool;
+  int           i;
+  if(_nthreads<1){
+    _nthreads=1;
+# if defined(_SC_NPROCESSORS_ONLN)
+    {
+      long ncpus;
+      ncpus=sysconf(_SC_NPROCESSORS_ONLN);
+      if(ncpus>2)_nthreads=ncpus>INT_MAX?INT_MAX:(int)ncpus-1;
+    }
+# endif
+  }
+  pool=(oc_exec_pool *)_ogg_calloc(1,sizeof(*pool));
+  if(pool==NULL)return NULL;
+  pool->threads=(pthread_t *)_ogg_calloc(_nthreads,sizeof(*pool->threads));
+  pool->queues=(oc_exec_queue *)_ogg_calloc(_nthreads,sizeof(*pool->queues));
+  if(pool->threads==NULL||pool->queues==NULL){
+    _ogg_free(pool->queues);
+    _ogg_free(pool->threads);
+    _ogg_free(pool);
+    return NULL;
+  }
+  if(pthread_mutex_init(&pool->mutex,NULL)!=0){
+    _ogg_free(pool->queues);
+    _ogg_free(pool->threads);
+    _ogg_free(pool);
+    return NULL;
+  }
+  pthread_cond_init(&pool->work_cond,NULL);
+  pthread_cond_init(&pool->done_cond,NULL);
+  pool->nthreads=_nthreads;
+  pthread_mutex_lock(&pool->mutex);
+  for(i=0;i<_nthreads;i++){
+    if(pthread_create(pool->threads+i,NULL,oc_exec_pool_worker,pool)!=0){
+      break;
+    }
+  }
+  pthread_mutex_unlock(&pool->mutex);
+  if(i<_nthreads){
+    oc_exec_pool_free(pool,i);
+    return NULL;
+  }
+  pool->exec.submit=oc_exec_pool_submit;
+  pool->exec.wait=oc_exec_pool_wait;
+  pool->exec.ctx=pool;
+  pool->exec.concurrency=_nthreads+1;
+  return &pool->exec;
+#else
+  (void)_nthreads;
+  return NULL;
+#endif
+}
+
+void th_executor_pthread_free(th_executor *_exec){
+#if defined(OC_HAVE_PTHREAD)
+  oc_exec_pool *pool;
+  if(_exec==NULL)return;
+  pool=(oc_exec_pool *)_exec->ctx;
+  oc_exec_pool_free(pool,pool->nthreads);
+#else
+  (void)_exec;
+#endif
+}
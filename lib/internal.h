@@ -85,6 +85,32 @@
 
 
 
+/*The size of a transparent huge page.*/
+# define OC_HUGE_PAGE_SZ ((size_t)1<<21)
+
+
+
+typedef struct oc_mem oc_mem;
+
+
+
+/*The allocator for a single encoder or decoder context.*/
+struct oc_mem{
+  /*The application's allocation hooks and flags.*/
+  th_allocator   hooks;
+  /*The arena, or NULL if there is none.*/
+  unsigned char *arena;
+  /*The size of the arena.*/
+  size_t         arena_sz;
+  /*The number of bytes of the arena handed out so far.*/
+  size_t         arena_used;
+  /*An upper bound on the arena space needed for everything allocated so far,
+     including alignment padding.*/
+  size_t         nbytes;
+};
+
+
+
 /*A map from the index in the zig zag scan to the coefficient number in a
    block.*/
 extern const unsigned char OC_FZIG_ZAG[128];
@@ -110,6 +136,15 @@ void **oc_malloc_2d(size_t _height,size_t _width,size_t _sz);
 void **oc_calloc_2d(size_t _height,size_t _width,size_t _sz);
 void oc_free_2d(void *_ptr);
 
+void oc_mem_init(oc_mem *_mem,const th_allocator *_hooks);
+int oc_mem_arena_init(oc_mem *_mem,size_t _sz);
+void oc_mem_clear(oc_mem *_mem);
+void *oc_mem_alloc(oc_mem *_mem,size_t _sz,size_t _align,int _tag);
+void *oc_mem_calloc(oc_mem *_mem,size_t _nmemb,size_t _sz,int _tag);
+void **oc_mem_malloc_2d(oc_mem *_mem,size_t _height,size_t _width,
+ size_t _sz,int _tag);
+void oc_mem_free(oc_mem *_mem,void *_ptr,int _tag);
+
 void oc_ycbcr_buffer_flip(th_ycbcr_buffer _dst,
  const th_ycbcr_buffer _src);
 
@@ -254,6 +254,48 @@ static unsigned oc_mcenc_ysatd_check_bcandidate_fullpel(const oc_enc_ctx *_enc,
   return err+abs(dc);
 }
 
+/*Stores the result of a full-pel search for this macro block, along with the
+   errors of the chosen vectors against the reconstructed reference frame.
+  _frame:          Either OC_FRAME_PREV or OC_FRAME_GOLD.
+  _best_err:       The SAD of the chosen vector in the search frame.
+  _best_vec:       The chosen full-pel vector.
+  _best_block_vec: The chosen full-pel vector for each block, used only for
+                    OC_FRAME_PREV.*/
+static void oc_mcenc_store_result(oc_enc_ctx *_enc,int _mbi,int _frame,
+ unsigned _best_err,const int _best_vec[2],int _best_block_vec[4][2]){
+  const ptrdiff_t     *frag_buf_offs;
+  const ptrdiff_t     *fragis;
+  const unsigned char *src;
+  const unsigned char *satd_ref;
+  int                  ystride;
+  oc_mb_enc_info      *embs;
+  int                  candx;
+  int                  candy;
+  int                  bi;
+  embs=_enc->mb_info;
+  frag_buf_offs=_enc->state.frag_buf_offs;
+  fragis=_enc->state.mb_maps[_mbi][0];
+  src=_enc->state.ref_frame_data[OC_FRAME_IO];
+  satd_ref=_enc->state.ref_frame_data[_frame];
+  ystride=_enc->state.ref_ystride[0];
+  embs[_mbi].error[_frame]=(ogg_uint16_t)_best_err;
+  candx=_best_vec[0];
+  candy=_best_vec[1];
+  embs[_mbi].satd[_frame]=oc_mcenc_ysatd_check_mbcandidate_fullpel(_enc,
+   frag_buf_offs,fragis,candx,candy,src,satd_ref,ystride);
+  embs[_mbi].analysis_mv[0][_frame]=OC_MV(candx<<1,candy<<1);
+  if(_frame==OC_FRAME_PREV&&_enc->sp_level<OC_SP_LEVEL_FAST_ANALYSIS&&
+   !(_enc->sp_flags&OC_SP_FLAG_NO4MV)){
+    for(bi=0;bi<4;bi++){
+      candx=_best_block_vec[bi][0];
+      candy=_best_block_vec[bi][1];
+      embs[_mbi].block_satd[bi]=oc_mcenc_ysatd_check_bcandidate_fullpel(_enc,
+       frag_buf_offs[fragis[bi]],candx,candy,src,satd_ref,ystride);
+      embs[_mbi].block_mv[bi]=OC_MV(candx<<1,candy<<1);
+    }
+  }
+}
+
 /*Perform a motion vector search for this macro block against a single
    reference frame.
   As a bonus, individual block motion vectors are computed as well, as much of
@@ -288,7 +330,6 @@ void oc_mcenc_search_frame(oc_enc_ctx *_enc,oc_mv _accum,int _mbi,int _frame,
   const ptrdiff_t     *fragis;
   const unsigned char *src;
   const unsigned char *ref;
-  const unsigned char *satd_ref;
   int                  ystride;
   oc_mb_enc_info      *embs;
   ogg_int32_t          hit_cache[31];
@@ -314,7 +355,6 @@ void oc_mcenc_search_frame(oc_enc_ctx *_enc,oc_mv _accum,int _mbi,int _frame,
   fragis=_enc->state.mb_maps[_mbi][0];
   src=_enc->state.ref_frame_data[OC_FRAME_IO];
   ref=_enc->state.ref_frame_data[_frame_full];
-  satd_ref=_enc->state.ref_frame_data[_frame];
   ystride=_enc->state.ref_ystride[0];
   /*TODO: customize error function for speed/(quality+size) tradeoff.*/
   best_err=oc_mcenc_ysad_check_mbcandidate_fullpel(_enc,
@@ -498,41 +538,190 @@ void oc_mcenc_search_frame(oc_enc_ctx *_enc,oc_mv _accum,int _mbi,int _frame,
       }
     }
   }
-  embs[_mbi].error[_frame]=(ogg_uint16_t)best_err;
-  candx=best_vec[0];
-  candy=best_vec[1];
-  embs[_mbi].satd[_frame]=oc_mcenc_ysatd_check_mbcandidate_fullpel(_enc,
-   frag_buf_offs,fragis,candx,candy,src,satd_ref,ystride);
-  embs[_mbi].analysis_mv[0][_frame]=OC_MV(candx<<1,candy<<1);
-  if(_frame==OC_FRAME_PREV&&_enc->sp_level<OC_SP_LEVEL_FAST_ANALYSIS){
-    for(bi=0;bi<4;bi++){
-      candx=best_block_vec[bi][0];
-      candy=best_block_vec[bi][1];
-      embs[_mbi].block_satd[bi]=oc_mcenc_ysatd_check_bcandidate_fullpel(_enc,
-       frag_buf_offs[fragis[bi]],candx,candy,src,satd_ref,ystride);
-      embs[_mbi].block_mv[bi]=OC_MV(candx<<1,candy<<1);
+  oc_mcenc_store_result(_enc,_mbi,_frame,best_err,best_vec,best_block_vec);
+}
+
+/*The maximum number of square pattern steps taken away from the best
+   starting vector of a guided search.*/
+#define OC_MCENC_HINT_NSTEPS (2)
+
+/*Perform a guided motion vector search for this macro block against a single
+   reference frame, starting from an application-supplied hint.
+  Instead of the predictor sets of oc_mcenc_search_frame(), only the hint, the
+   vector predicted from this macro block's last search, and the zero vector
+   are examined, followed by a short square pattern search around the best
+   of them.
+  _accum:      Drop frame/golden MV accumulators.
+  _mbi:        The macro block index.
+  _frame:      The frame to use for SATD calculations and refinement,
+                either OC_FRAME_PREV or OC_FRAME_GOLD.
+  _frame_full: The frame to perform the 1px search on.
+  _hint:       The hinted vector in half-pel units, or NULL if this frame has
+                no hint.*/
+static void oc_mcenc_search_frame_hint(oc_enc_ctx *_enc,oc_mv _accum,int _mbi,
+ int _frame,int _frame_full,const oc_mv *_hint){
+  const ptrdiff_t     *frag_buf_offs;
+  const ptrdiff_t     *fragis;
+  const unsigned char *src;
+  const unsigned char *ref;
+  int                  ystride;
+  oc_mb_enc_info      *embs;
+  ogg_int32_t          hit_cache[31];
+  ogg_int32_t          hitbit;
+  unsigned             best_block_err[4];
+  unsigned             block_err[4];
+  unsigned             best_err;
+  unsigned             err;
+  unsigned             t2;
+  int                  best_vec[2];
+  int                  best_block_vec[4][2];
+  int                  cands[3][2];
+  int                  ncands;
+  int                  ncs;
+  int                  candx;
+  int                  candy;
+  int                  ci;
+  int                  stepi;
+  int                  bi;
+  embs=_enc->mb_info;
+  ncands=0;
+  if(_hint!=NULL){
+    oc_mv hint;
+    /*A hint against the previous frame is relative to the last input frame,
+       which is not our reference if we dropped it.
+      Golden hints are already absolute offsets.*/
+    hint=*_hint;
+    if(_frame==OC_FRAME_PREV)hint=OC_MV_ADD(hint,_accum);
+    cands[ncands][0]=OC_CLAMPI(-31,OC_MV_X(hint),31);
+    cands[ncands][1]=OC_CLAMPI(-31,OC_MV_Y(hint),31);
+    ncands++;
+  }
+  cands[ncands][0]=OC_CLAMPI(-31,
+   OC_MV_X(embs[_mbi].analysis_mv[1][_frame])+OC_MV_X(_accum),31);
+  cands[ncands][1]=OC_CLAMPI(-31,
+   OC_MV_Y(embs[_mbi].analysis_mv[1][_frame])+OC_MV_Y(_accum),31);
+  ncands++;
+  cands[ncands][0]=cands[ncands][1]=0;
+  ncands++;
+  memset(hit_cache,0,sizeof(hit_cache));
+  frag_buf_offs=_enc->state.frag_buf_offs;
+  fragis=_enc->state.mb_maps[_mbi][0];
+  src=_enc->state.ref_frame_data[OC_FRAME_IO];
+  ref=_enc->state.ref_frame_data[_frame_full];
+  ystride=_enc->state.ref_ystride[0];
+  best_err=UINT_MAX;
+  best_vec[0]=best_vec[1]=0;
+  for(bi=0;bi<4;bi++){
+    best_block_err[bi]=UINT_MAX;
+    best_block_vec[bi][0]=best_block_vec[bi][1]=0;
+  }
+  for(ci=0;ci<ncands;ci++){
+    /*Stop as soon as a vector is good enough, as the full search does with
+       its median predictor.*/
+    if(best_err<=OC_YSAD_THRESH1)break;
+    candx=OC_DIV2(cands[ci][0]);
+    candy=OC_DIV2(cands[ci][1]);
+    hitbit=(ogg_int32_t)1<<candx+15;
+    if(hit_cache[candy+15]&hitbit)continue;
+    hit_cache[candy+15]|=hitbit;
+    err=oc_mcenc_ysad_check_mbcandidate_fullpel(_enc,
+     frag_buf_offs,fragis,candx,candy,src,ref,ystride,block_err);
+    if(err<best_err){
+      best_err=err;
+      best_vec[0]=candx;
+      best_vec[1]=candy;
+    }
+    for(bi=0;bi<4;bi++)if(block_err[bi]<best_block_err[bi]){
+      best_block_err[bi]=block_err[bi];
+      best_block_vec[bi][0]=candx;
+      best_block_vec[bi][1]=candy;
     }
   }
+  /*Use the same early termination threshold as the full search.*/
+  t2=embs[_mbi].error[_frame];
+  ncs=OC_MINI(3,embs[_mbi].ncneighbors);
+  for(ci=0;ci<ncs;ci++){
+    t2=OC_MAXI(t2,embs[embs[_mbi].cneighbors[ci]].error[_frame]);
+  }
+  t2+=(t2>>OC_YSAD_THRESH2_SCALE_BITS)+OC_YSAD_THRESH2_OFFSET;
+  /*Refine the best vector with a bounded square pattern search.*/
+  for(stepi=0;stepi<OC_MCENC_HINT_NSTEPS&&best_err>OC_YSAD_THRESH1
+   &&best_err>t2;stepi++){
+    int best_site;
+    int nsites;
+    int sitei;
+    int site;
+    int b;
+    best_site=4;
+    b=OC_DIV16(-best_vec[0]+1)|OC_DIV16(best_vec[0]+1)<<1|
+     OC_DIV16(-best_vec[1]+1)<<2|OC_DIV16(best_vec[1]+1)<<3;
+    nsites=OC_SQUARE_NSITES[b];
+    for(sitei=0;sitei<nsites;sitei++){
+      site=OC_SQUARE_SITES[b][sitei];
+      candx=best_vec[0]+OC_SQUARE_DX[site];
+      candy=best_vec[1]+OC_SQUARE_DY[site];
+      hitbit=(ogg_int32_t)1<<candx+15;
+      if(hit_cache[candy+15]&hitbit)continue;
+      hit_cache[candy+15]|=hitbit;
+      err=oc_mcenc_ysad_check_mbcandidate_fullpel(_enc,
+       frag_buf_offs,fragis,candx,candy,src,ref,ystride,block_err);
+      if(err<best_err){
+        best_err=err;
+        best_site=site;
+      }
+      for(bi=0;bi<4;bi++)if(block_err[bi]<best_block_err[bi]){
+        best_block_err[bi]=block_err[bi];
+        best_block_vec[bi][0]=candx;
+        best_block_vec[bi][1]=candy;
+      }
+    }
+    if(best_site==4)break;
+    best_vec[0]+=OC_SQUARE_DX[best_site];
+    best_vec[1]+=OC_SQUARE_DY[best_site];
+  }
+  oc_mcenc_store_result(_enc,_mbi,_frame,best_err,best_vec,best_block_vec);
+}
+
+/*Moves the motion vector predictors of a MB back a frame.
+  The newest set is left in place, to be replaced by the caller.*/
+static void oc_mcenc_age_mvs(oc_mv2 _mvs[3]){
+  oc_mv mv2_p;
+  mv2_p=_mvs[2][OC_FRAME_PREV];
+  _mvs[2][OC_FRAME_GOLD]=_mvs[1][OC_FRAME_GOLD];
+  _mvs[2][OC_FRAME_PREV]=_mvs[1][OC_FRAME_PREV];
+  _mvs[1][OC_FRAME_GOLD]=_mvs[0][OC_FRAME_GOLD];
+  _mvs[1][OC_FRAME_PREV]=OC_MV_SUB(_mvs[0][OC_FRAME_PREV],mv2_p);
 }
 
 void oc_mcenc_search(oc_enc_ctx *_enc,int _mbi){
-  oc_mv2 *mvs;
-  oc_mv   accum_p;
-  oc_mv   accum_g;
-  oc_mv   mv2_p;
+  const th_enc_motion_hint *hint;
+  oc_mv2                   *mvs;
+  oc_mv                     accum_p;
+  oc_mv                     accum_g;
+  oc_mv                     hint_mv;
+  hint=NULL;
+  if(_enc->mv_hints_valid&&_enc->mv_hints[_mbi].flags){
+    hint=_enc->mv_hints+_mbi;
+    hint_mv=OC_MV(hint->mv[0],hint->mv[1]);
+  }
   mvs=_enc->mb_info[_mbi].analysis_mv;
   if(_enc->prevframe_dropped)accum_p=mvs[0][OC_FRAME_PREV];
   else accum_p=0;
   accum_g=mvs[2][OC_FRAME_GOLD];
   /*Move the motion vector predictors back a frame.*/
-  mv2_p=mvs[2][OC_FRAME_PREV];
-  mvs[2][OC_FRAME_GOLD]=mvs[1][OC_FRAME_GOLD];
-  mvs[2][OC_FRAME_PREV]=mvs[1][OC_FRAME_PREV];
-  mvs[1][OC_FRAME_GOLD]=mvs[0][OC_FRAME_GOLD];
-  mvs[1][OC_FRAME_PREV]=OC_MV_SUB(mvs[0][OC_FRAME_PREV],mv2_p);
+  oc_mcenc_age_mvs(mvs);
   /*Search the last frame.*/
-  oc_mcenc_search_frame(_enc,accum_p,_mbi,OC_FRAME_PREV,OC_FRAME_PREV_ORIG);
+  if(hint!=NULL){
+    oc_mcenc_search_frame_hint(_enc,accum_p,_mbi,OC_FRAME_PREV,
+     OC_FRAME_PREV_ORIG,hint->flags&TH_ENC_HINT_PREV?&hint_mv:NULL);
+  }
+  else{
+    oc_mcenc_search_frame(_enc,accum_p,_mbi,OC_FRAME_PREV,OC_FRAME_PREV_ORIG);
+  }
   mvs[2][OC_FRAME_PREV]=accum_p;
+  /*When the golden search is disabled, the golden predictors are left in
+     absolute offset form, and GOLDEN_MV is never selected.*/
+  if(_enc->sp_flags&OC_SP_FLAG_NOGOLDEN)return;
   /*GOLDEN MVs are different from PREV MVs in that they're each absolute
      offsets from some frame in the past rather than relative offsets from the
      frame before.
@@ -541,13 +730,98 @@ void oc_mcenc_search(oc_enc_ctx *_enc,int _mbi){
   mvs[1][OC_FRAME_GOLD]=OC_MV_SUB(mvs[1][OC_FRAME_GOLD],mvs[2][OC_FRAME_GOLD]);
   mvs[2][OC_FRAME_GOLD]=OC_MV_SUB(mvs[2][OC_FRAME_GOLD],accum_g);
   /*Search the golden frame.*/
-  oc_mcenc_search_frame(_enc,accum_g,_mbi,OC_FRAME_GOLD,OC_FRAME_GOLD_ORIG);
+  if(hint!=NULL){
+    oc_mcenc_search_frame_hint(_enc,accum_g,_mbi,OC_FRAME_GOLD,
+     OC_FRAME_GOLD_ORIG,hint->flags&TH_ENC_HINT_GOLD?&hint_mv:NULL);
+  }
+  else{
+    oc_mcenc_search_frame(_enc,accum_g,_mbi,OC_FRAME_GOLD,OC_FRAME_GOLD_ORIG);
+  }
   /*Put GOLDEN MVs back into absolute offset form.
     The newest MV is already an absolute offset.*/
   mvs[2][OC_FRAME_GOLD]=OC_MV_ADD(mvs[2][OC_FRAME_GOLD],accum_g);
   mvs[1][OC_FRAME_GOLD]=OC_MV_ADD(mvs[1][OC_FRAME_GOLD],mvs[2][OC_FRAME_GOLD]);
 }
 
+/*Records the motion of a macro block whose input did not change since the
+   previous frame, without searching.
+  The motion vector predictors are moved back a frame just as
+   oc_mcenc_search() would, so that later searches predict from the right
+   frames.
+  There is no motion relative to the previous frame, and the offset into the
+   golden frame stays the same.
+  The error of the zero MV against the previous original frame is zero, too,
+   which is what the searches of the neighboring MBs should see, and what a
+   bitrate ladder rung adopting these results should get.*/
+void oc_mcenc_search_static(oc_enc_ctx *_enc,int _mbi){
+  oc_mb_enc_info *emb;
+  oc_mv2         *mvs;
+  int             bi;
+  emb=_enc->mb_info+_mbi;
+  mvs=emb->analysis_mv;
+  oc_mcenc_age_mvs(mvs);
+  mvs[0][OC_FRAME_PREV]=0;
+  emb->error[OC_FRAME_PREV]=0;
+  /*This is the motion accumulated across dropped frames, and the caller only
+     takes this path when the previous frame was not dropped.*/
+  mvs[2][OC_FRAME_PREV]=0;
+  for(bi=0;bi<4;bi++)emb->block_mv[bi]=0;
+}
+
+/*Adopts the fullpel motion search results of another encoder that analyzed
+   the same input frame against the same original reference frames.
+  Only the errors measured against the reconstructed reference frames, which
+   half-pel refinement starts from, need to be recomputed, since ours differ.
+  Our own MV predictors are moved back a frame just as a search would, and
+   only the newest set is taken from the other encoder.
+  Its unrefined MVs are used, since by now it may have refined them against
+   its own reconstruction.*/
+void oc_mcenc_search_reuse(oc_enc_ctx *_enc,int _mbi,
+ const oc_mb_enc_info *_src){
+  oc_mb_enc_info      *emb;
+  const ptrdiff_t     *frag_buf_offs;
+  const ptrdiff_t     *fragis;
+  const unsigned char *src;
+  const unsigned char *satd_ref;
+  int                  ystride;
+  int                  frame;
+  int                  bi;
+  emb=_enc->mb_info+_mbi;
+  oc_mcenc_age_mvs(emb->analysis_mv);
+  emb->analysis_mv[0][OC_FRAME_PREV]=_src->unref_mv[OC_FRAME_PREV];
+  /*We are never called after a dropped frame, so no motion accumulated.*/
+  emb->analysis_mv[2][OC_FRAME_PREV]=0;
+  /*When the golden search is disabled, oc_mcenc_search() leaves the golden
+     predictors alone after moving them back.*/
+  if(!(_enc->sp_flags&OC_SP_FLAG_NOGOLDEN)){
+    emb->analysis_mv[0][OC_FRAME_GOLD]=_src->unref_mv[OC_FRAME_GOLD];
+  }
+  memcpy(emb->error,_src->error,sizeof(emb->error));
+  frag_buf_offs=_enc->state.frag_buf_offs;
+  fragis=_enc->state.mb_maps[_mbi][0];
+  src=_enc->state.ref_frame_data[OC_FRAME_IO];
+  ystride=_enc->state.ref_ystride[0];
+  for(frame=OC_FRAME_GOLD;frame<=OC_FRAME_PREV;frame++){
+    oc_mv mv;
+    if(frame==OC_FRAME_GOLD&&(_enc->sp_flags&OC_SP_FLAG_NOGOLDEN))continue;
+    satd_ref=_enc->state.ref_frame_data[frame];
+    mv=emb->analysis_mv[0][frame];
+    emb->satd[frame]=oc_mcenc_ysatd_check_mbcandidate_fullpel(_enc,
+     frag_buf_offs,fragis,OC_MV_X(mv)>>1,OC_MV_Y(mv)>>1,src,satd_ref,ystride);
+  }
+  if(_enc->sp_level<OC_SP_LEVEL_FAST_ANALYSIS&&
+   !(_enc->sp_flags&OC_SP_FLAG_NO4MV)){
+    satd_ref=_enc->state.ref_frame_data[OC_FRAME_PREV];
+    for(bi=0;bi<4;bi++){
+      oc_mv mv;
+      mv=emb->block_mv[bi]=_src->block_mv[bi];
+      emb->block_satd[bi]=oc_mcenc_ysatd_check_bcandidate_fullpel(_enc,
+       frag_buf_offs[fragis[bi]],OC_MV_X(mv)>>1,OC_MV_Y(mv)>>1,
+       src,satd_ref,ystride);
+    }
+  }
+}
+
 #if 0
 static int oc_mcenc_ysad_halfpel_mbrefine(const oc_enc_ctx *_enc,int _mbi,
  int _vec[2],int _best_err,int _frame){
@@ -865,6 +865,19 @@ int oc_enc_update_rc_state(oc_enc_ctx *_enc,
   return dropped;
 }
 
+/*Accounts for _ndups extra duplicates of the last coded frame that were
+   detected after it had already been rate controlled.
+  They take the place of frames that would otherwise have been coded, so the
+   buffer receives their share of the bits, and they count as drops when the
+   real frame rate is next estimated.*/
+void oc_enc_rc_add_dups(oc_enc_ctx *_enc,int _ndups){
+  _enc->rc.prev_drop_count+=_ndups;
+  _enc->rc.fullness+=_enc->rc.bits_per_frame*_ndups;
+  if(_enc->rc.cap_overflow&&_enc->rc.fullness>_enc->rc.max){
+    _enc->rc.fullness=_enc->rc.max;
+  }
+}
+
 #define OC_RC_2PASS_VERSION   (2)
 #define OC_RC_2PASS_HDR_SZ    (38)
 #define OC_RC_2PASS_PACKET_SZ (12)
@@ -927,6 +940,71 @@ int oc_enc_rc_2pass_out(oc_enc_ctx *_enc,unsigned char **_buf){
   return _enc->rc.twopass_buffer_bytes;
 }
 
+static ogg_int64_t oc_rc_read_val(const unsigned char *_buf,int _bytes){
+  ogg_int64_t ret;
+  ret=0;
+  while(_bytes-->0)ret=ret<<8|_buf[_bytes];
+  return ret;
+}
+
+static void oc_rc_write_val(unsigned char *_buf,ogg_int64_t _val,int _bytes){
+  while(_bytes-->0){
+    *_buf++=(unsigned char)(_val&0xFF);
+    _val>>=8;
+  }
+}
+
+int th_encode_2pass_merge(unsigned char *_summary,size_t _summary_sz,
+ const unsigned char *_seg,size_t _seg_sz,ogg_uint32_t _keyframe_frequency){
+  ogg_int64_t nframes;
+  int         i;
+  if(_summary==NULL||_seg==NULL)return TH_EFAULT;
+  if(_summary_sz<OC_RC_2PASS_HDR_SZ||_seg_sz<OC_RC_2PASS_HDR_SZ||
+   _keyframe_frequency<=0){
+    return TH_EINVAL;
+  }
+  if(oc_rc_read_val(_seg,4)!=0x5032544F||
+   oc_rc_read_val(_seg+4,4)!=OC_RC_2PASS_VERSION){
+    return TH_ENOTFORMAT;
+  }
+  /*A segment without a keyframe is the placeholder data from an aborted (or
+     not yet finished) first pass.*/
+  if(oc_rc_read_val(_seg+8,4)==0)return TH_EBADHEADER;
+  /*If nothing has been merged yet, just take the segment's summary.*/
+  for(i=0;i<OC_RC_2PASS_HDR_SZ&&_summary[i]==0;i++);
+  if(i>=OC_RC_2PASS_HDR_SZ){
+    memcpy(_summary,_seg,OC_RC_2PASS_HDR_SZ);
+    return OC_RC_2PASS_HDR_SZ;
+  }
+  if(oc_rc_read_val(_summary,4)!=0x5032544F||
+   oc_rc_read_val(_summary+4,4)!=OC_RC_2PASS_VERSION){
+    return TH_ENOTFORMAT;
+  }
+  /*The rate model exponents depend only on the encoder configuration, so if
+     they differ the segments did not come from identically set up encoders.*/
+  if(_summary[20]!=_seg[20]||_summary[21]!=_seg[21])return TH_EINVAL;
+  /*The first frame of the segment was scanned as a keyframe, and the second
+     pass will code it as one.
+    Unless the segment starts where the second pass would have placed a
+     keyframe anyway, that adds a keyframe the rest of the statistics do not
+     account for.*/
+  nframes=0;
+  for(i=0;i<3;i++)nframes+=oc_rc_read_val(_summary+8+4*i,4);
+  if(nframes%_keyframe_frequency!=0)return TH_EINVAL;
+  /*The second pass requires the total frame count to fit in an int.*/
+  for(i=0;i<3;i++)nframes+=oc_rc_read_val(_seg+8+4*i,4);
+  if(nframes>INT_MAX)return TH_EINVAL;
+  for(i=0;i<3;i++){
+    oc_rc_write_val(_summary+8+4*i,
+     oc_rc_read_val(_summary+8+4*i,4)+oc_rc_read_val(_seg+8+4*i,4),4);
+  }
+  for(i=0;i<2;i++){
+    oc_rc_write_val(_summary+22+8*i,
+     oc_rc_read_val(_summary+22+8*i,8)+oc_rc_read_val(_seg+22+8*i,8),8);
+  }
+  return OC_RC_2PASS_HDR_SZ;
+}
+
 static size_t oc_rc_buffer_fill(oc_rc_state *_rc,
  unsigned char *_buf,size_t _bytes,size_t _consumed,size_t _goal){
   while(_rc->twopass_buffer_fill<_goal&&_consumed<_bytes){
@@ -348,7 +348,7 @@ static void oc_state_border_init(oc_theora_state *_state){
   int                x;
   /*The method we use here is slow, but the code is dead simple and handles
      all the special cases easily.
-    We only ever need to do it once.*/
+    We only need to do it once per stream.*/
   /*Loop through the fragments, marking those completely outside the
      displayable region and constructing a border mask for those that straddle
      the border.*/
@@ -493,17 +493,24 @@ static int oc_state_frarray_init(oc_theora_state *_state){
   _state->fplanes[2].sboffset=ysbs+csbs;
   _state->fplanes[1].nsbs=_state->fplanes[2].nsbs=csbs;
   _state->nfrags=nfrags;
-  _state->frags=_ogg_calloc(nfrags,sizeof(*_state->frags));
-  _state->frag_mvs=_ogg_malloc(nfrags*sizeof(*_state->frag_mvs));
+  _state->frags=oc_mem_calloc(&_state->mem,nfrags,sizeof(*_state->frags),
+   TH_ALLOC_TABLES);
+  _state->frag_mvs=oc_mem_alloc(&_state->mem,
+   nfrags*sizeof(*_state->frag_mvs),16,TH_ALLOC_TABLES);
   _state->nsbs=nsbs;
-  _state->sb_maps=_ogg_malloc(nsbs*sizeof(*_state->sb_maps));
-  _state->sb_flags=_ogg_calloc(nsbs,sizeof(*_state->sb_flags));
+  _state->sb_maps=oc_mem_alloc(&_state->mem,nsbs*sizeof(*_state->sb_maps),16,
+   TH_ALLOC_TABLES);
+  _state->sb_flags=oc_mem_calloc(&_state->mem,nsbs,sizeof(*_state->sb_flags),
+   TH_ALLOC_TABLES);
   _state->nhmbs=yhsbs<<1;
   _state->nvmbs=yvsbs<<1;
   _state->nmbs=nmbs;
-  _state->mb_maps=_ogg_calloc(nmbs,sizeof(*_state->mb_maps));
-  _state->mb_modes=_ogg_calloc(nmbs,sizeof(*_state->mb_modes));
-  _state->coded_fragis=_ogg_malloc(nfrags*sizeof(*_state->coded_fragis));
+  _state->mb_maps=oc_mem_calloc(&_state->mem,nmbs,sizeof(*_state->mb_maps),
+   TH_ALLOC_TABLES);
+  _state->mb_modes=oc_mem_calloc(&_state->mem,nmbs,sizeof(*_state->mb_modes),
+   TH_ALLOC_TABLES);
+  _state->coded_fragis=oc_mem_alloc(&_state->mem,
+   nfrags*sizeof(*_state->coded_fragis),16,TH_ALLOC_TABLES);
   if(_state->frags==NULL||_state->frag_mvs==NULL||_state->sb_maps==NULL||
    _state->sb_flags==NULL||_state->mb_maps==NULL||_state->mb_modes==NULL||
    _state->coded_fragis==NULL){
@@ -526,16 +533,32 @@ static int oc_state_frarray_init(oc_theora_state *_state){
 }
 
 static void oc_state_frarray_clear(oc_theora_state *_state){
-  _ogg_free(_state->coded_fragis);
-  _ogg_free(_state->mb_modes);
-  _ogg_free(_state->mb_maps);
-  _ogg_free(_state->sb_flags);
-  _ogg_free(_state->sb_maps);
-  _ogg_free(_state->frag_mvs);
-  _ogg_free(_state->frags);
+  oc_mem_free(&_state->mem,_state->coded_fragis,TH_ALLOC_TABLES);
+  oc_mem_free(&_state->mem,_state->mb_modes,TH_ALLOC_TABLES);
+  oc_mem_free(&_state->mem,_state->mb_maps,TH_ALLOC_TABLES);
+  oc_mem_free(&_state->mem,_state->sb_flags,TH_ALLOC_TABLES);
+  oc_mem_free(&_state->mem,_state->sb_maps,TH_ALLOC_TABLES);
+  oc_mem_free(&_state->mem,_state->frag_mvs,TH_ALLOC_TABLES);
+  oc_mem_free(&_state->mem,_state->frags,TH_ALLOC_TABLES);
 }
 
 
+/*Marks all of the reference frames as unused.*/
+static void oc_state_ref_frames_reset(oc_theora_state *_state){
+  _state->ref_frame_idx[OC_FRAME_GOLD]=
+   _state->ref_frame_idx[OC_FRAME_PREV]=
+   _state->ref_frame_idx[OC_FRAME_GOLD_ORIG]=
+   _state->ref_frame_idx[OC_FRAME_PREV_ORIG]=
+   _state->ref_frame_idx[OC_FRAME_SELF]=
+   _state->ref_frame_idx[OC_FRAME_IO]=-1;
+  _state->ref_frame_data[OC_FRAME_GOLD]=
+   _state->ref_frame_data[OC_FRAME_PREV]=
+   _state->ref_frame_data[OC_FRAME_GOLD_ORIG]=
+   _state->ref_frame_data[OC_FRAME_PREV_ORIG]=
+   _state->ref_frame_data[OC_FRAME_SELF]=
+   _state->ref_frame_data[OC_FRAME_IO]=NULL;
+}
+
 /*Initializes the buffers used for reconstructed frames.
   These buffers are padded with 16 extra pixels on each side, to allow
    unrestricted motion vectors without special casing the boundary.
@@ -588,12 +611,13 @@ static int oc_state_ref_bufs_init(oc_theora_state *_state,int _nrefs){
    ref_frame_sz<yplane_sz||ref_frame_data_sz/_nrefs!=ref_frame_sz){
     return TH_EIMPL;
   }
-  ref_frame_data=oc_aligned_malloc(ref_frame_data_sz,16);
-  frag_buf_offs=_state->frag_buf_offs=
-   _ogg_malloc(_state->nfrags*sizeof(*frag_buf_offs));
+  ref_frame_data=oc_mem_alloc(&_state->mem,ref_frame_data_sz,16,
+   TH_ALLOC_FRAME);
+  frag_buf_offs=_state->frag_buf_offs=oc_mem_alloc(&_state->mem,
+   _state->nfrags*sizeof(*frag_buf_offs),16,TH_ALLOC_TABLES);
   if(ref_frame_data==NULL||frag_buf_offs==NULL){
-    _ogg_free(frag_buf_offs);
-    oc_aligned_free(ref_frame_data);
+    oc_mem_free(&_state->mem,frag_buf_offs,TH_ALLOC_TABLES);
+    oc_mem_free(&_state->mem,ref_frame_data,TH_ALLOC_FRAME);
     return TH_EFAULT;
   }
   /*Set up the width, height and stride for the image buffers.*/
@@ -654,25 +678,13 @@ static int oc_state_ref_bufs_init(oc_theora_state *_state,int _nrefs){
       vpix+=stride<<3;
     }
   }
-  /*Initialize the reference frame pointers and indices.*/
-  _state->ref_frame_idx[OC_FRAME_GOLD]=
-   _state->ref_frame_idx[OC_FRAME_PREV]=
-   _state->ref_frame_idx[OC_FRAME_GOLD_ORIG]=
-   _state->ref_frame_idx[OC_FRAME_PREV_ORIG]=
-   _state->ref_frame_idx[OC_FRAME_SELF]=
-   _state->ref_frame_idx[OC_FRAME_IO]=-1;
-  _state->ref_frame_data[OC_FRAME_GOLD]=
-   _state->ref_frame_data[OC_FRAME_PREV]=
-   _state->ref_frame_data[OC_FRAME_GOLD_ORIG]=
-   _state->ref_frame_data[OC_FRAME_PREV_ORIG]=
-   _state->ref_frame_data[OC_FRAME_SELF]=
-   _state->ref_frame_data[OC_FRAME_IO]=NULL;
+  oc_state_ref_frames_reset(_state);
   return 0;
 }
 
 static void oc_state_ref_bufs_clear(oc_theora_state *_state){
-  _ogg_free(_state->frag_buf_offs);
-  oc_aligned_free(_state->ref_frame_handle);
+  oc_mem_free(&_state->mem,_state->frag_buf_offs,TH_ALLOC_TABLES);
+  oc_mem_free(&_state->mem,_state->ref_frame_handle,TH_ALLOC_FRAME);
 }
 
 
@@ -695,10 +707,26 @@ void oc_state_accel_init_c(oc_theora_state *_state){
 }
 
 
-int oc_state_init(oc_theora_state *_state,const th_info *_info,int _nrefs){
-  int ret;
-  /*First validate the parameters.*/
-  if(_info==NULL)return TH_EFAULT;
+/*Initializes the state that tracks the position in the stream.*/
+static void oc_state_stream_init(oc_theora_state *_state,
+ const th_info *_info){
+  /*If the keyframe_granule_shift is out of range, use the maximum allowable
+     value.*/
+  if(_info->keyframe_granule_shift<0||_info->keyframe_granule_shift>31){
+    _state->info.keyframe_granule_shift=31;
+  }
+  _state->keyframe_num=0;
+  _state->curframe_num=-1;
+  _state->granpos=0;
+  /*3.2.0 streams mark the frame index instead of the frame count.
+    This was changed with stream version 3.2.1 to conform to other Ogg
+     codecs.
+    We add an extra bias when computing granule positions for new streams.*/
+  _state->granpos_bias=TH_VERSION_CHECK(_info,3,2,1);
+}
+
+/*Checks that the stream parameters are ones we can handle.*/
+static int oc_state_info_check(const th_info *_info){
   /*The width and height of the encoded frame must be multiples of 16.
     They must also, when divided by 16, fit into a 16-bit unsigned integer.
     The displayable frame offset coordinates must fit into an 8-bit unsigned
@@ -725,7 +753,18 @@ int oc_state_init(oc_theora_state *_state,const th_info *_info,int _nrefs){
    _info->fps_numerator<1||_info->fps_denominator<1){
     return TH_EINVAL;
   }
+  return 0;
+}
+
+int oc_state_init(oc_theora_state *_state,const th_info *_info,int _nrefs,
+ const oc_mem *_mem){
+  int ret;
+  /*First validate the parameters.*/
+  if(_info==NULL)return TH_EFAULT;
+  ret=oc_state_info_check(_info);
+  if(ret<0)return ret;
   memset(_state,0,sizeof(*_state));
+  _state->mem=*_mem;
   memcpy(&_state->info,_info,sizeof(*_info));
   /*Invert the sense of pic_y to match Theora's right-handed coordinate
      system.*/
@@ -738,18 +777,34 @@ int oc_state_init(oc_theora_state *_state,const th_info *_info,int _nrefs){
     oc_state_frarray_clear(_state);
     return ret;
   }
-  /*If the keyframe_granule_shift is out of range, use the maximum allowable
-     value.*/
-  if(_info->keyframe_granule_shift<0||_info->keyframe_granule_shift>31){
-    _state->info.keyframe_granule_shift=31;
+  oc_state_stream_init(_state,_info);
+  return 0;
+}
+
+/*Prepares an already initialized state for a new stream with the same frame
+   size and pixel format, reusing all of its buffers.
+  The picture region, frame rate, and other parameters may change.
+  Nothing is modified if the new parameters are invalid or incompatible.*/
+int oc_state_reset(oc_theora_state *_state,const th_info *_info){
+  int ret;
+  if(_info==NULL)return TH_EFAULT;
+  ret=oc_state_info_check(_info);
+  if(ret<0)return ret;
+  if(_info->frame_width!=_state->info.frame_width
+   ||_info->frame_height!=_state->info.frame_height
+   ||_info->pixel_fmt!=_state->info.pixel_fmt){
+    return TH_EINVAL;
   }
-  _state->keyframe_num=0;
-  _state->curframe_num=-1;
-  /*3.2.0 streams mark the frame index instead of the frame count.
-    This was changed with stream version 3.2.1 to conform to other Ogg
-     codecs.
-    We add an extra bias when computing granule positions for new streams.*/
-  _state->granpos_bias=TH_VERSION_CHECK(_info,3,2,1);
+  memcpy(&_state->info,_info,sizeof(*_info));
+  _state->info.pic_y=_info->frame_height-_info->pic_height-_info->pic_y;
+  _state->frame_type=OC_UNKWN_FRAME;
+  /*The picture region may have moved, so rebuild the border information.*/
+  memset(_state->frags,0,_state->nfrags*sizeof(*_state->frags));
+  oc_state_border_init(_state);
+  memset(_state->ncoded_fragis,0,sizeof(_state->ncoded_fragis));
+  _state->ntotal_coded_fragis=0;
+  oc_state_ref_frames_reset(_state);
+  oc_state_stream_init(_state,_info);
   return 0;
 }
 
@@ -380,6 +380,8 @@ struct oc_base_opt_data{
 struct oc_theora_state{
   /*The stream information.*/
   th_info             info;
+  /*The allocator for all of the per-context buffers.*/
+  oc_mem              mem;
 # if defined(OC_STATE_USE_VTABLE)
   /*Table for shared accelerated functions.*/
   oc_base_opt_vtable  opt_vtable;
@@ -460,9 +462,9 @@ struct oc_theora_state{
   /*The quality indices of the current frame.*/
   unsigned char       qis[3];
   /*The dequantization tables, stored in zig-zag order, and indexed by
-     qi, pli, qti, and zzi.*/
+     qi, pli, qti, and zzi.
+    The storage for these belongs to the encoder or decoder.*/
   ogg_uint16_t       *dequant_tables[64][3][2];
-  OC_ALIGN16(oc_quant_table      dequant_table_data[64][3][2]);
   /*Loop filter strength parameters.*/
   unsigned char       loop_filter_limits[64];
 };
@@ -487,7 +489,9 @@ extern const oc_set_chroma_mvs_func OC_SET_CHROMA_MVS_TABLE[TH_PF_NFORMATS];
 
 
 
-int oc_state_init(oc_theora_state *_state,const th_info *_info,int _nrefs);
+int oc_state_init(oc_theora_state *_state,const th_info *_info,int _nrefs,
+ const oc_mem *_mem);
+int oc_state_reset(oc_theora_state *_state,const th_info *_info);
 void oc_state_clear(oc_theora_state *_state);
 void oc_state_accel_init_c(oc_theora_state *_state);
 void oc_state_borders_fill_rows(oc_theora_state *_state,int _refi,int _pli,
@@ -387,6 +387,18 @@ static const unsigned char OC_ZZI_HUFF_OFFSET[64]={
   64,64,64,64,64,64,64,64
 };
 
+/*The Huffman table group used to code the tokens of each zig-zag index.*/
+static const unsigned char OC_ZZI_HUFF_GROUP[64]={
+  0,1,1,1,1,1,2,2,
+  2,2,2,2,2,2,2,3,
+  3,3,3,3,3,3,3,3,
+  3,3,3,3,4,4,4,4,
+  4,4,4,4,4,4,4,4,
+  4,4,4,4,4,4,4,4,
+  4,4,4,4,4,4,4,4,
+  4,4,4,4,4,4,4,4
+};
+
 static int oc_token_bits(oc_enc_ctx *_enc,int _huffi,int _zzi,int _token){
   return _enc->huff_codes[_huffi+OC_ZZI_HUFF_OFFSET[_zzi]][_token].nbits
    +OC_DCT_TOKEN_EXTRA_BITS[_token];
@@ -400,6 +412,34 @@ static void oc_enc_tokenlog_checkpoint(oc_enc_ctx *_enc,
   _cp->ndct_tokens=_enc->ndct_tokens[_pli][_zzi];
 }
 
+/*Returns the token counts for the Huffman group that codes the given plane
+   and coefficient index.*/
+static ptrdiff_t *oc_enc_token_counts(oc_enc_ctx *_enc,int _pli,int _zzi){
+  return _enc->huff_token_counts[_pli+1>>1][OC_ZZI_HUFF_GROUP[_zzi]];
+}
+
+/*Removes tokens _ti_start through _ti_end-1 of a list from the counts.*/
+static void oc_enc_token_counts_sub(oc_enc_ctx *_enc,int _pli,int _zzi,
+ ptrdiff_t _ti_start,ptrdiff_t _ti_end){
+  const unsigned char *dct_tokens;
+  ptrdiff_t           *counts;
+  ptrdiff_t            ti;
+  dct_tokens=_enc->dct_tokens[_pli][_zzi];
+  counts=oc_enc_token_counts(_enc,_pli,_zzi);
+  for(ti=_ti_start;ti<_ti_end;ti++)counts[dct_tokens[ti]]--;
+}
+
+/*Adds tokens _ti_start through _ti_end-1 of a list to the counts.*/
+static void oc_enc_token_counts_add(oc_enc_ctx *_enc,int _pli,int _zzi,
+ ptrdiff_t _ti_start,ptrdiff_t _ti_end){
+  const unsigned char *dct_tokens;
+  ptrdiff_t           *counts;
+  ptrdiff_t            ti;
+  dct_tokens=_enc->dct_tokens[_pli][_zzi];
+  counts=oc_enc_token_counts(_enc,_pli,_zzi);
+  for(ti=_ti_start;ti<_ti_end;ti++)counts[dct_tokens[ti]]++;
+}
+
 void oc_enc_tokenlog_rollback(oc_enc_ctx *_enc,
  const oc_token_checkpoint *_stack,int _n){
   int i;
@@ -408,6 +448,8 @@ void oc_enc_tokenlog_rollback(oc_enc_ctx *_enc,
     int zzi;
     pli=_stack[i].pli;
     zzi=_stack[i].zzi;
+    oc_enc_token_counts_sub(_enc,pli,zzi,
+     _stack[i].ndct_tokens,_enc->ndct_tokens[pli][zzi]);
     _enc->eob_run[pli][zzi]=_stack[i].eob_run;
     _enc->ndct_tokens[pli][zzi]=_stack[i].ndct_tokens;
   }
@@ -419,6 +461,7 @@ static void oc_enc_token_log(oc_enc_ctx *_enc,
   ti=_enc->ndct_tokens[_pli][_zzi]++;
   _enc->dct_tokens[_pli][_zzi][ti]=(unsigned char)_token;
   _enc->extra_bits[_pli][_zzi][ti]=(ogg_uint16_t)_eb;
+  oc_enc_token_counts(_enc,_pli,_zzi)[_token]++;
 }
 
 static void oc_enc_eob_log(oc_enc_ctx *_enc,
@@ -435,6 +478,7 @@ void oc_enc_tokenize_start(oc_enc_ctx *_enc){
   memset(_enc->eob_run,0,sizeof(_enc->eob_run));
   memset(_enc->dct_token_offs,0,sizeof(_enc->dct_token_offs));
   memset(_enc->dc_pred_last,0,sizeof(_enc->dc_pred_last));
+  memset(_enc->huff_token_counts,0,sizeof(_enc->huff_token_counts));
 }
 
 typedef struct oc_quant_token oc_quant_token;
@@ -1108,6 +1152,10 @@ void oc_enc_tokenize_dc_frag_list(oc_enc_ctx *_enc,int _pli,
     This is needed to allow us to track tokens to the end of the list.*/
   eob_run1=_enc->eob_run[_pli][1];
   if(eob_run1>0)oc_enc_eob_log(_enc,_pli,1,eob_run1);
+  /*The AC 1 tokens logged since _prev_ndct_tokens1 are rewritten in place
+     below, so they are counted again once that is done.*/
+  oc_enc_token_counts_sub(_enc,_pli,1,
+   _prev_ndct_tokens1,_enc->ndct_tokens[_pli][1]);
   /*If there was an active EOB run at the start of the 1st AC stack, read it
      in and decode it.*/
   if(_prev_eob_run1>0){
@@ -1300,6 +1348,8 @@ void oc_enc_tokenize_dc_frag_list(oc_enc_ctx *_enc,int _pli,
       }
     }
   }
+  oc_enc_token_counts_add(_enc,_pli,0,_enc->ndct_tokens[_pli][0],ti0);
+  oc_enc_token_counts_add(_enc,_pli,1,_prev_ndct_tokens1,ti1w);
   /*Save the current state.*/
   _enc->ndct_tokens[_pli][0]=ti0;
   _enc->ndct_tokens[_pli][1]=ti1w;
@@ -1364,5 +1414,8 @@ void oc_enc_tokenize_finish(oc_enc_ctx *_enc){
     _enc->dct_tokens[plj][zzj][ti]=(unsigned char)new_tok;
     _enc->extra_bits[plj][zzj][ti]=(ogg_uint16_t)new_eb;
     _enc->dct_token_offs[pli][zzi]++;
+    oc_enc_token_counts(_enc,plj,zzj)[old_tok1]--;
+    oc_enc_token_counts(_enc,plj,zzj)[new_tok]++;
+    oc_enc_token_counts(_enc,pli,zzi)[old_tok2]--;
   }
 }
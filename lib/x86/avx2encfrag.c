@@ -0,0 +1,454 @@
+/********************************************************************
+ *                                                                  *
+ * THIS FILE IS PART OF THE OggTheora SOFTWARE CODEC SOURCE CODE.   *
+ * USE, DISTRIBUTION AND REPRODUCTION OF THIS LIBRARY SOURCE IS     *
+ * GOVERNED BY A BSD-STYLE SOURCE LICENSE INCLUDED WITH THIS SOURCE *
+ * IN 'COPYING'. PLEASE READ THESE TERMS BEFORE DISTRIBUTING.       *
+ *                                                                  *
+ * THE Theora SOURCE CODE IS COPYRIGHT (C) 2002-2009                *
+ * by the Xiph.Org Foundation and contributors http://www.xiph.org/ *
+ *                                                                  *
+ ********************************************************************
+
+  function:
+    last mod: $Id$
+
+ ********************************************************************/
+#include <stdlib.h>
+#include <stddef.h>
+#include "x86enc.h"
+#include "avx2trans.h"
+
+#if defined(OC_X86_64_ASM)
+
+/*All of the functions in this file operate on two fragments at once.
+  Row i of the first fragment is kept in the low 128-bit lane of a register,
+   and row i of the second fragment in the high lane.
+  None of the arithmetic crosses lanes, so each lane computes exactly what the
+   corresponding SSE2 function would have.*/
+
+/*Load one row of 8 pixels from each of %[src0] and %[src1] (at the address
+   offset _soffs) and from %[ref0] and %[ref1] (at the address offset _roffs)
+   and compute their 16-bit differences in %%ymm_reg.
+  %%ymm8 is clobbered.*/
+#define OC_LOAD_SUB_ROW_x2(_reg,_soffs,_roffs) \
+ "vmovq (%[src0]"_soffs"),%%xmm"_reg"\n\t" \
+ "vmovq (%[ref0]"_roffs"),%%xmm8\n\t" \
+ "vmovhps (%[src1]"_soffs"),%%xmm"_reg",%%xmm"_reg"\n\t" \
+ "vmovhps (%[ref1]"_roffs"),%%xmm8,%%xmm8\n\t" \
+ "vpmovzxbw %%xmm"_reg",%%ymm"_reg"\n\t" \
+ "vpmovzxbw %%xmm8,%%ymm8\n\t" \
+ "vpsubw %%ymm8,%%ymm"_reg",%%ymm"_reg"\n\t" \
+
+/*Load two 8x8 arrays of pixel values from %[src0], %[src1] and %[ref0],
+   %[ref1] and compute their 16-bit differences in %%ymm0...%%ymm7.
+  All four pointers are advanced by four rows.*/
+#define OC_LOAD_SUB_8x8x2 \
+ "#OC_LOAD_SUB_8x8x2\n\t" \
+ OC_LOAD_SUB_ROW_x2("0","","") \
+ OC_LOAD_SUB_ROW_x2("1",",%[src_ystride]",",%[ref_ystride]") \
+ OC_LOAD_SUB_ROW_x2("2",",%[src_ystride],2",",%[ref_ystride],2") \
+ OC_LOAD_SUB_ROW_x2("3",",%[src_ystride3]",",%[ref_ystride3]") \
+ "lea (%[src0],%[src_ystride],4),%[src0]\n\t" \
+ "lea (%[src1],%[src_ystride],4),%[src1]\n\t" \
+ "lea (%[ref0],%[ref_ystride],4),%[ref0]\n\t" \
+ "lea (%[ref1],%[ref_ystride],4),%[ref1]\n\t" \
+ OC_LOAD_SUB_ROW_x2("4","","") \
+ OC_LOAD_SUB_ROW_x2("5",",%[src_ystride]",",%[ref_ystride]") \
+ OC_LOAD_SUB_ROW_x2("6",",%[src_ystride],2",",%[ref_ystride],2") \
+ OC_LOAD_SUB_ROW_x2("7",",%[src_ystride3]",",%[ref_ystride3]") \
+
+/*Load one row of 8 pixels from each of %[src0] and %[src1] (at the address
+   offset _soffs) and zero-extend them into %%ymm_reg.*/
+#define OC_LOAD_ROW_x2(_reg,_soffs) \
+ "vmovq (%[src0]"_soffs"),%%xmm"_reg"\n\t" \
+ "vmovhps (%[src1]"_soffs"),%%xmm"_reg",%%xmm"_reg"\n\t" \
+ "vpmovzxbw %%xmm"_reg",%%ymm"_reg"\n\t" \
+
+/*Load two 8x8 arrays of pixel values from %[src0] and %[src1] into
+   %%ymm0...%%ymm7.
+  Both pointers are advanced by four rows.*/
+#define OC_LOAD_8x8x2 \
+ "#OC_LOAD_8x8x2\n\t" \
+ OC_LOAD_ROW_x2("0","") \
+ OC_LOAD_ROW_x2("1",",%[ystride]") \
+ OC_LOAD_ROW_x2("2",",%[ystride],2") \
+ OC_LOAD_ROW_x2("3",",%[ystride3]") \
+ "lea (%[src0],%[ystride],4),%[src0]\n\t" \
+ "lea (%[src1],%[ystride],4),%[src1]\n\t" \
+ OC_LOAD_ROW_x2("4","") \
+ OC_LOAD_ROW_x2("5",",%[ystride]") \
+ OC_LOAD_ROW_x2("6",",%[ystride],2") \
+ OC_LOAD_ROW_x2("7",",%[ystride3]") \
+
+/*Sum the four dwords in each lane of %%ymm_reg, leaving the result for the
+   first fragment in %[ret0] and for the second in %[ret1].
+  %%ymm8 is clobbered.*/
+#define OC_HSUM_x2(_reg) \
+ "#OC_HSUM_x2\n\t" \
+ "vpshufd $0x4E,%%ymm"_reg",%%ymm8\n\t" \
+ "vpaddd %%ymm8,%%ymm"_reg",%%ymm"_reg"\n\t" \
+ "vpshufd $0xB1,%%ymm"_reg",%%ymm8\n\t" \
+ "vpaddd %%ymm8,%%ymm"_reg",%%ymm"_reg"\n\t" \
+ "vextracti128 $1,%%ymm"_reg",%%xmm8\n\t" \
+ "vmovd %%xmm"_reg",%[ret0]\n\t" \
+ "vmovd %%xmm8,%[ret1]\n\t" \
+
+void oc_enc_frag_ssd_x2_avx2(unsigned _ssd[2],
+ const unsigned char *const _src[2],const unsigned char *const _ref[2],
+ int _ystride){
+  const unsigned char *src0;
+  const unsigned char *src1;
+  const unsigned char *ref0;
+  const unsigned char *ref1;
+  unsigned             ret0;
+  unsigned             ret1;
+  src0=_src[0];
+  src1=_src[1];
+  ref0=_ref[0];
+  ref1=_ref[1];
+  __asm__ __volatile__(
+    OC_LOAD_SUB_8x8x2
+    "vpmaddwd %%ymm0,%%ymm0,%%ymm0\n\t"
+    "vpmaddwd %%ymm1,%%ymm1,%%ymm1\n\t"
+    "vpmaddwd %%ymm2,%%ymm2,%%ymm2\n\t"
+    "vpmaddwd %%ymm3,%%ymm3,%%ymm3\n\t"
+    "vpmaddwd %%ymm4,%%ymm4,%%ymm4\n\t"
+    "vpmaddwd %%ymm5,%%ymm5,%%ymm5\n\t"
+    "vpmaddwd %%ymm6,%%ymm6,%%ymm6\n\t"
+    "vpmaddwd %%ymm7,%%ymm7,%%ymm7\n\t"
+    "vpaddd %%ymm1,%%ymm0,%%ymm0\n\t"
+    "vpaddd %%ymm3,%%ymm2,%%ymm2\n\t"
+    "vpaddd %%ymm5,%%ymm4,%%ymm4\n\t"
+    "vpaddd %%ymm7,%%ymm6,%%ymm6\n\t"
+    "vpaddd %%ymm2,%%ymm0,%%ymm0\n\t"
+    "vpaddd %%ymm6,%%ymm4,%%ymm4\n\t"
+    "vpaddd %%ymm4,%%ymm0,%%ymm0\n\t"
+    OC_HSUM_x2("0")
+    "vzeroupper\n\t"
+    :[src0]"+r"(src0),[src1]"+r"(src1),[ref0]"+r"(ref0),[ref1]"+r"(ref1),
+     [ret0]"=m"(ret0),[ret1]"=m"(ret1)
+    :[src_ystride]"r"((ptrdiff_t)_ystride),
+     [src_ystride3]"r"((ptrdiff_t)_ystride*3),
+     [ref_ystride]"r"((ptrdiff_t)_ystride),
+     [ref_ystride3]"r"((ptrdiff_t)_ystride*3)
+  );
+  _ssd[0]=ret0;
+  _ssd[1]=ret1;
+}
+
+/*The bit in each byte lane of a row that selects its pixel, once for each
+   fragment.*/
+static const unsigned char __attribute__((aligned(16)))
+ OC_MASK_CONSTS_x2[16]={
+  0x01,0x02,0x04,0x08,0x10,0x20,0x40,0x80,
+  0x01,0x02,0x04,0x08,0x10,0x20,0x40,0x80
+};
+
+/*A pshufb control that copies byte 0 of each 64-bit mask to all eight bytes
+   of its half of the register.*/
+static const unsigned char __attribute__((aligned(16)))
+ OC_MASK_SHUF_x2[16]={
+  0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,
+  0x08,0x08,0x08,0x08,0x08,0x08,0x08,0x08
+};
+
+/*Load one row of 8 pixels from each of %[src0], %[src1], %[ref0] and
+   %[ref1] (at the address offset _offs), zero out the pixels whose bits are
+   not set in the low byte of each half of %%xmm4, and accumulate the squares
+   of their differences into %%ymm7.
+  %%xmm4 is then shifted to expose the mask bits of the next row.
+  %%xmm5 must contain OC_MASK_SHUF_x2 and %%xmm6 OC_MASK_CONSTS_x2.*/
+#define OC_SSD_MASK_ROW_x2(_offs) \
+ "#OC_SSD_MASK_ROW_x2\n\t" \
+ "vmovq (%[src0]"_offs"),%%xmm0\n\t" \
+ "vmovq (%[ref0]"_offs"),%%xmm1\n\t" \
+ "vpshufb %%xmm5,%%xmm4,%%xmm2\n\t" \
+ "vmovhps (%[src1]"_offs"),%%xmm0,%%xmm0\n\t" \
+ "vmovhps (%[ref1]"_offs"),%%xmm1,%%xmm1\n\t" \
+ "vpand %%xmm6,%%xmm2,%%xmm2\n\t" \
+ "vpsrlq $8,%%xmm4,%%xmm4\n\t" \
+ "vpcmpeqb %%xmm6,%%xmm2,%%xmm2\n\t" \
+ "vpand %%xmm2,%%xmm0,%%xmm0\n\t" \
+ "vpand %%xmm2,%%xmm1,%%xmm1\n\t" \
+ "vpmovzxbw %%xmm0,%%ymm0\n\t" \
+ "vpmovzxbw %%xmm1,%%ymm1\n\t" \
+ "vpsubw %%ymm1,%%ymm0,%%ymm0\n\t" \
+ "vpmaddwd %%ymm0,%%ymm0,%%ymm0\n\t" \
+ "vpaddd %%ymm0,%%ymm7,%%ymm7\n\t" \
+
+void oc_enc_frag_border_ssd_x2_avx2(unsigned _ssd[2],
+ const unsigned char *const _src[2],const unsigned char *const _ref[2],
+ int _ystride,const ogg_int64_t _mask[2]){
+  const unsigned char *src0;
+  const unsigned char *src1;
+  const unsigned char *ref0;
+  const unsigned char *ref1;
+  unsigned             ret0;
+  unsigned             ret1;
+  src0=_src[0];
+  src1=_src[1];
+  ref0=_ref[0];
+  ref1=_ref[1];
+  __asm__ __volatile__(
+    "vmovdqu %[mask],%%xmm4\n\t"
+    "vmovdqa %[shuf],%%xmm5\n\t"
+    "vmovdqa %[c],%%xmm6\n\t"
+    "vpxor %%ymm7,%%ymm7,%%ymm7\n\t"
+    OC_SSD_MASK_ROW_x2("")
+    OC_SSD_MASK_ROW_x2(",%[ystride]")
+    OC_SSD_MASK_ROW_x2(",%[ystride],2")
+    OC_SSD_MASK_ROW_x2(",%[ystride3]")
+    "lea (%[src0],%[ystride],4),%[src0]\n\t"
+    "lea (%[src1],%[ystride],4),%[src1]\n\t"
+    "lea (%[ref0],%[ystride],4),%[ref0]\n\t"
+    "lea (%[ref1],%[ystride],4),%[ref1]\n\t"
+    OC_SSD_MASK_ROW_x2("")
+    OC_SSD_MASK_ROW_x2(",%[ystride]")
+    OC_SSD_MASK_ROW_x2(",%[ystride],2")
+    OC_SSD_MASK_ROW_x2(",%[ystride3]")
+    OC_HSUM_x2("7")
+    "vzeroupper\n\t"
+    :[src0]"+r"(src0),[src1]"+r"(src1),[ref0]"+r"(ref0),[ref1]"+r"(ref1),
+     [ret0]"=m"(ret0),[ret1]"=m"(ret1)
+    :[ystride]"r"((ptrdiff_t)_ystride),[ystride3]"r"((ptrdiff_t)_ystride*3),
+     [mask]"m"(OC_CONST_ARRAY_OPERAND(ogg_int64_t,_mask,2)),
+     [shuf]"m"(OC_CONST_ARRAY_OPERAND(unsigned char,OC_MASK_SHUF_x2,16)),
+     [c]"m"(OC_CONST_ARRAY_OPERAND(unsigned char,OC_MASK_CONSTS_x2,16))
+  );
+  _ssd[0]=ret0;
+  _ssd[1]=ret1;
+}
+
+/*Performs the first two stages of an 8-point 1-D Hadamard transform in place.
+  Outputs 1, 3, 4, and 5 from the second stage are negated (which allows us to
+   perform this stage in place with no temporary registers).*/
+#define OC_HADAMARD_AB_8x8x2 \
+ "#OC_HADAMARD_AB_8x8x2\n\t" \
+ /*Stage A:*/ \
+ "vpaddw %%ymm5,%%ymm1,%%ymm1\n\t" \
+ "vpaddw %%ymm6,%%ymm2,%%ymm2\n\t" \
+ "vpaddw %%ymm5,%%ymm5,%%ymm5\n\t" \
+ "vpaddw %%ymm6,%%ymm6,%%ymm6\n\t" \
+ "vpsubw %%ymm1,%%ymm5,%%ymm5\n\t" \
+ "vpsubw %%ymm2,%%ymm6,%%ymm6\n\t" \
+ "vpaddw %%ymm7,%%ymm3,%%ymm3\n\t" \
+ "vpaddw %%ymm4,%%ymm0,%%ymm0\n\t" \
+ "vpaddw %%ymm7,%%ymm7,%%ymm7\n\t" \
+ "vpaddw %%ymm4,%%ymm4,%%ymm4\n\t" \
+ "vpsubw %%ymm3,%%ymm7,%%ymm7\n\t" \
+ "vpsubw %%ymm0,%%ymm4,%%ymm4\n\t" \
+ /*Stage B:*/ \
+ "vpaddw %%ymm2,%%ymm0,%%ymm0\n\t" \
+ "vpaddw %%ymm3,%%ymm1,%%ymm1\n\t" \
+ "vpaddw %%ymm6,%%ymm4,%%ymm4\n\t" \
+ "vpaddw %%ymm7,%%ymm5,%%ymm5\n\t" \
+ "vpaddw %%ymm2,%%ymm2,%%ymm2\n\t" \
+ "vpaddw %%ymm3,%%ymm3,%%ymm3\n\t" \
+ "vpaddw %%ymm6,%%ymm6,%%ymm6\n\t" \
+ "vpaddw %%ymm7,%%ymm7,%%ymm7\n\t" \
+ "vpsubw %%ymm0,%%ymm2,%%ymm2\n\t" \
+ "vpsubw %%ymm1,%%ymm3,%%ymm3\n\t" \
+ "vpsubw %%ymm4,%%ymm6,%%ymm6\n\t" \
+ "vpsubw %%ymm5,%%ymm7,%%ymm7\n\t" \
+
+
+
+/*Performs the last stage of an 8-point 1-D Hadamard transform in place.
+  Outputs 1, 3, 5, and 7 are negated (which allows us to perform this stage in
+   place with no temporary registers).*/
+#define OC_HADAMARD_C_8x8x2 \
+ "#OC_HADAMARD_C_8x8x2\n\t" \
+ /*Stage C:*/ \
+ "vpaddw %%ymm1,%%ymm0,%%ymm0\n\t" \
+ "vpaddw %%ymm3,%%ymm2,%%ymm2\n\t" \
+ "vpaddw %%ymm5,%%ymm4,%%ymm4\n\t" \
+ "vpaddw %%ymm7,%%ymm6,%%ymm6\n\t" \
+ "vpaddw %%ymm1,%%ymm1,%%ymm1\n\t" \
+ "vpaddw %%ymm3,%%ymm3,%%ymm3\n\t" \
+ "vpaddw %%ymm5,%%ymm5,%%ymm5\n\t" \
+ "vpaddw %%ymm7,%%ymm7,%%ymm7\n\t" \
+ "vpsubw %%ymm0,%%ymm1,%%ymm1\n\t" \
+ "vpsubw %%ymm2,%%ymm3,%%ymm3\n\t" \
+ "vpsubw %%ymm4,%%ymm5,%%ymm5\n\t" \
+ "vpsubw %%ymm6,%%ymm7,%%ymm7\n\t" \
+
+/*Performs an 8-point 1-D Hadamard transform in place.
+  Outputs 1, 2, 4, and 7 are negated (which allows us to perform the transform
+   in place with no temporary registers).*/
+#define OC_HADAMARD_8x8x2 \
+ OC_HADAMARD_AB_8x8x2 \
+ OC_HADAMARD_C_8x8x2 \
+
+/*Performs the first part of the final stage of the Hadamard transform and
+   summing of absolute values.
+  At the end of this part, %%ymm1 will contain the DC coefficient of the
+   transform.*/
+#define OC_HADAMARD_C_ABS_ACCUM_A_8x8x2 \
+ /*We use the fact that \
+     (abs(a+b)+abs(a-b))/2=max(abs(a),abs(b)) \
+    to merge the final butterfly with the abs and the first stage of \
+    accumulation. \
+   Thus we can avoid using pabsw, which is not available until SSSE3. \
+   Emulating pabsw takes 3 instructions, so the straightforward SSE2 \
+    implementation would be (3+3)*8+7=55 instructions (+4 for spilling \
+    registers). \
+   Even with pabsw, it would be (3+1)*8+7=39 instructions (with no spills). \
+   This implementation is only 26 (+4 for spilling registers, which here are \
+    just copies to %%ymm8 and %%ymm9).*/ \
+ "#OC_HADAMARD_C_ABS_ACCUM_A_8x8x2\n\t" \
+ "vmovdqa %%ymm7,%%ymm9\n\t" \
+ "vmovdqa %%ymm6,%%ymm8\n\t" \
+ /*ymm7={0x7FFF}x4 \
+   ymm4=max(abs(ymm4),abs(ymm5))-0x7FFF*/ \
+ "vpcmpeqb %%ymm7,%%ymm7,%%ymm7\n\t" \
+ "vmovdqa %%ymm4,%%ymm6\n\t" \
+ "vpsrlw $1,%%ymm7,%%ymm7\n\t" \
+ "vpaddw %%ymm5,%%ymm6,%%ymm6\n\t" \
+ "vpmaxsw %%ymm5,%%ymm4,%%ymm4\n\t" \
+ "vpaddsw %%ymm7,%%ymm6,%%ymm6\n\t" \
+ "vpsubw %%ymm6,%%ymm4,%%ymm4\n\t" \
+ /*ymm2=max(abs(ymm2),abs(ymm3))-0x7FFF \
+   ymm0=max(abs(ymm0),abs(ymm1))-0x7FFF*/ \
+ "vmovdqa %%ymm2,%%ymm6\n\t" \
+ "vmovdqa %%ymm0,%%ymm5\n\t" \
+ "vpmaxsw %%ymm3,%%ymm2,%%ymm2\n\t" \
+ "vpmaxsw %%ymm1,%%ymm0,%%ymm0\n\t" \
+ "vpaddw %%ymm3,%%ymm6,%%ymm6\n\t" \
+ "vmovdqa %%ymm9,%%ymm3\n\t" \
+ "vpaddw %%ymm5,%%ymm1,%%ymm1\n\t" \
+ "vmovdqa %%ymm8,%%ymm5\n\t" \
+
+/*Performs the second part of the final stage of the Hadamard transform and
+   summing of absolute values.*/
+#define OC_HADAMARD_C_ABS_ACCUM_B_8x8x2 \
+ "#OC_HADAMARD_C_ABS_ACCUM_B_8x8x2\n\t" \
+ "vpaddsw %%ymm7,%%ymm6,%%ymm6\n\t" \
+ "vpaddsw %%ymm7,%%ymm1,%%ymm1\n\t" \
+ "vpsubw %%ymm6,%%ymm2,%%ymm2\n\t" \
+ "vpsubw %%ymm1,%%ymm0,%%ymm0\n\t" \
+ /*ymm7={1}x4 (needed for the horizontal add that follows) \
+   ymm0+=ymm2+ymm4+max(abs(ymm3),abs(ymm5))-0x7FFF*/ \
+ "vmovdqa %%ymm3,%%ymm6\n\t" \
+ "vpmaxsw %%ymm5,%%ymm3,%%ymm3\n\t" \
+ "vpaddw %%ymm2,%%ymm0,%%ymm0\n\t" \
+ "vpaddw %%ymm5,%%ymm6,%%ymm6\n\t" \
+ "vpaddw %%ymm4,%%ymm0,%%ymm0\n\t" \
+ "vpaddsw %%ymm7,%%ymm6,%%ymm6\n\t" \
+ "vpaddw %%ymm3,%%ymm0,%%ymm0\n\t" \
+ "vpsrlw $14,%%ymm7,%%ymm7\n\t" \
+ "vpsubw %%ymm6,%%ymm0,%%ymm0\n\t" \
+
+/*Performs the last stage of an 8-point 1-D Hadamard transform, takes the
+   absolute value of each component, and accumulates everything into ymm0.*/
+#define OC_HADAMARD_C_ABS_ACCUM_8x8x2 \
+ OC_HADAMARD_C_ABS_ACCUM_A_8x8x2 \
+ OC_HADAMARD_C_ABS_ACCUM_B_8x8x2 \
+
+/*Performs an 8-point 1-D Hadamard transform, takes the absolute value of each
+   component, and accumulates everything into ymm0.
+  Note that ymm0 will have an extra 4 added to each column, and that after
+   removing this value, the remainder will be half the conventional value.*/
+#define OC_HADAMARD_ABS_ACCUM_8x8x2 \
+ OC_HADAMARD_AB_8x8x2 \
+ OC_HADAMARD_C_ABS_ACCUM_8x8x2
+
+
+/*Computes the SATD of two pairs of fragments, the first fragment of each pair
+   in the low lane and the second in the high lane.
+  The raw sums and DC coefficients are returned without the final correction,
+   which the callers apply, since it differs between the INTER and INTRA
+   cases.*/
+#define OC_SATD_8x8x2 \
+ OC_HADAMARD_8x8x2 \
+ OC_TRANSPOSE_8x8x2 \
+ /*We split out the stages here so we can save the DC coefficient in the \
+    middle.*/ \
+ OC_HADAMARD_AB_8x8x2 \
+ OC_HADAMARD_C_ABS_ACCUM_A_8x8x2 \
+ "vextracti128 $1,%%ymm1,%%xmm8\n\t" \
+ "vmovd %%xmm1,%[dc0]\n\t" \
+ "vmovd %%xmm8,%[dc1]\n\t" \
+ OC_HADAMARD_C_ABS_ACCUM_B_8x8x2 \
+ /*Up to this point, everything fit in 16 bits (8 input + 1 for the \
+    difference + 2*3 for the two 8-point 1-D Hadamards - 1 for the abs - 1 \
+    for the factor of two we dropped + 3 for the vertical accumulation). \
+   Now we finally have to promote things to dwords.*/ \
+ "vpmaddwd %%ymm7,%%ymm0,%%ymm0\n\t" \
+ OC_HSUM_x2("0") \
+
+static void oc_int_frag_satd_x2_avx2(unsigned _satd[2],int _dc[2],
+ const unsigned char *_src0,const unsigned char *_src1,int _src_ystride,
+ const unsigned char *_ref0,const unsigned char *_ref1,int _ref_ystride){
+  unsigned ret0;
+  unsigned ret1;
+  int      dc0;
+  int      dc1;
+  __asm__ __volatile__(
+    OC_LOAD_SUB_8x8x2
+    OC_SATD_8x8x2
+    "vzeroupper\n\t"
+    :[src0]"+r"(_src0),[src1]"+r"(_src1),[ref0]"+r"(_ref0),[ref1]"+r"(_ref1),
+     [ret0]"=m"(ret0),[ret1]"=m"(ret1),[dc0]"=m"(dc0),[dc1]"=m"(dc1)
+    :[src_ystride]"r"((ptrdiff_t)_src_ystride),
+     [src_ystride3]"r"((ptrdiff_t)_src_ystride*3),
+     [ref_ystride]"r"((ptrdiff_t)_ref_ystride),
+     [ref_ystride3]"r"((ptrdiff_t)_ref_ystride*3)
+  );
+  /*The sums produced by OC_HADAMARD_ABS_ACCUM_8x8x2 each have an extra 4
+     added to them, a factor of two removed, and the DC value included;
+     correct the final sums here.*/
+  dc0=(ogg_int16_t)dc0;
+  dc1=(ogg_int16_t)dc1;
+  _dc[0]=dc0;
+  _dc[1]=dc1;
+  _satd[0]=(ret0<<1)-64-abs(dc0);
+  _satd[1]=(ret1<<1)-64-abs(dc1);
+}
+
+void oc_enc_frag_satd_x2_avx2(unsigned _satd[2],int _dc[2],
+ const unsigned char *const _src[2],const unsigned char *const _ref[2],
+ int _ystride){
+  oc_int_frag_satd_x2_avx2(_satd,_dc,_src[0],_src[1],_ystride,
+   _ref[0],_ref[1],_ystride);
+}
+
+void oc_enc_frag_satd2_x2_avx2(unsigned _satd[2],int _dc[2],
+ const unsigned char *const _src[2],const unsigned char *const _ref1[2],
+ const unsigned char *const _ref2[2],int _ystride){
+  OC_ALIGN8(unsigned char ref[128]);
+  oc_int_frag_copy2_mmxext(ref,8,_ref1[0],_ref2[0],_ystride);
+  oc_int_frag_copy2_mmxext(ref+64,8,_ref1[1],_ref2[1],_ystride);
+  oc_int_frag_satd_x2_avx2(_satd,_dc,_src[0],_src[1],_ystride,
+   ref,ref+64,8);
+}
+
+void oc_enc_frag_intra_satd_x2_avx2(unsigned _satd[2],int _dc[2],
+ const unsigned char *const _src[2],int _ystride){
+  const unsigned char *src0;
+  const unsigned char *src1;
+  unsigned             ret0;
+  unsigned             ret1;
+  int                  dc0;
+  int                  dc1;
+  src0=_src[0];
+  src1=_src[1];
+  __asm__ __volatile__(
+    OC_LOAD_8x8x2
+    OC_SATD_8x8x2
+    "vzeroupper\n\t"
+    :[src0]"+r"(src0),[src1]"+r"(src1),
+     [ret0]"=m"(ret0),[ret1]"=m"(ret1),[dc0]"=m"(dc0),[dc1]"=m"(dc1)
+    :[ystride]"r"((ptrdiff_t)_ystride),[ystride3]"r"((ptrdiff_t)_ystride*3)
+  );
+  /*We assume that the DC coefficient is always positive (which is true,
+     because the input to the INTRA transform was not a difference).*/
+  dc0=(ogg_uint16_t)dc0;
+  dc1=(ogg_uint16_t)dc1;
+  _dc[0]=dc0;
+  _dc[1]=dc1;
+  _satd[0]=(ret0<<1)-64-dc0;
+  _satd[1]=(ret1<<1)-64-dc1;
+}
+
+#endif
@@ -0,0 +1,486 @@
+/********************************************************************
+ *                                                                  *
+ * THIS FILE IS PART OF THE OggTheora SOFTWARE CODEC SOURCE CODE.   *
+ * USE, DISTRIBUTION AND REPRODUCTION OF THIS LIBRARY SOURCE IS     *
+ * GOVERNED BY A BSD-STYLE SOURCE LICENSE INCLUDED WITH THIS SOURCE *
+ * IN 'COPYING'. PLEASE READ THESE TERMS BEFORE DISTRIBUTING.       *
+ *                                                                  *
+ * THE Theora SOURCE CODE IS COPYRIGHT (C) 2002-2009                *
+ * by the Xiph.Org Foundation and contributors http://www.xiph.org/ *
+ *                                                                  *
+ ********************************************************************
+
+  function:
+    last mod: $Id$
+
+ ********************************************************************/
+#include <stddef.h>
+#include "x86enc.h"
+#include "x86zigzag.h"
+#include "avx2trans.h"
+
+#if defined(OC_X86_64_ASM)
+
+/*This is the same fDCT as OC_FDCT_8x8 in sse2fdct.c, with one block in each
+   128-bit lane.
+  Since none of the instructions cross lanes, the two blocks are transformed
+   exactly as if they had been done one at a time.*/
+# define OC_FDCT_8x8x2 \
+ /*Note: ymm15={0}x16 and ymm14={-1}x16.*/ \
+ "#OC_FDCT_8x8x2\n\t" \
+ /*Stage 1:*/ \
+ "vmovdqa %%ymm0,%%ymm11\n\t" \
+ "vmovdqa %%ymm1,%%ymm10\n\t" \
+ "vmovdqa %%ymm2,%%ymm9\n\t" \
+ "vmovdqa %%ymm3,%%ymm8\n\t" \
+ /*ymm11=t7'=t0-t7*/ \
+ "vpsubw %%ymm7,%%ymm11,%%ymm11\n\t" \
+ /*ymm10=t6'=t1-t6*/ \
+ "vpsubw %%ymm6,%%ymm10,%%ymm10\n\t" \
+ /*ymm9=t5'=t2-t5*/ \
+ "vpsubw %%ymm5,%%ymm9,%%ymm9\n\t" \
+ /*ymm8=t4'=t3-t4*/ \
+ "vpsubw %%ymm4,%%ymm8,%%ymm8\n\t" \
+ /*ymm0=t0'=t0+t7*/ \
+ "vpaddw %%ymm7,%%ymm0,%%ymm0\n\t" \
+ /*ymm1=t1'=t1+t6*/ \
+ "vpaddw %%ymm6,%%ymm1,%%ymm1\n\t" \
+ /*ymm5=t2'=t2+t5*/ \
+ "vpaddw %%ymm2,%%ymm5,%%ymm5\n\t" \
+ /*ymm4=t3'=t3+t4*/ \
+ "vpaddw %%ymm3,%%ymm4,%%ymm4\n\t" \
+ /*ymm2,3,6,7 are now free.*/ \
+ /*Stage 2:*/ \
+ "vmovdqa %%ymm0,%%ymm3\n\t" \
+ "mov $0x5A806A0A,%[a]\n\t" \
+ "vmovdqa %%ymm1,%%ymm2\n\t" \
+ "vmovd %[a],%%xmm13\n\t" \
+ "vmovdqa %%ymm10,%%ymm6\n\t" \
+ "vpbroadcastd %%xmm13,%%ymm13\n\t" \
+ /*ymm2=t2''=t1'-t2'*/ \
+ "vpsubw %%ymm5,%%ymm2,%%ymm2\n\t" \
+ "vpxor %%ymm12,%%ymm12,%%ymm12\n\t" \
+ /*ymm3=t3''=t0'-t3'*/ \
+ "vpsubw %%ymm4,%%ymm3,%%ymm3\n\t" \
+ "vpsubw %%ymm14,%%ymm12,%%ymm12\n\t" \
+ /*ymm10=t5''=t6'-t5'*/ \
+ "vpsubw %%ymm9,%%ymm10,%%ymm10\n\t" \
+ "vpaddw %%ymm12,%%ymm12,%%ymm12\n\t" \
+ /*ymm4=t0''=t0'+t3'*/ \
+ "vpaddw %%ymm0,%%ymm4,%%ymm4\n\t" \
+ /*ymm1=t1''=t1'+t2'*/ \
+ "vpaddw %%ymm5,%%ymm1,%%ymm1\n\t" \
+ /*ymm6=t6''=t6'+t5'*/ \
+ "vpaddw %%ymm9,%%ymm6,%%ymm6\n\t" \
+ /*ymm0,ymm5,ymm9 are now free.*/ \
+ /*Stage 3:*/ \
+ /*ymm10:ymm5=t5''*27146+0xB500 \
+   ymm0=t5''*/ \
+ "vmovdqa %%ymm10,%%ymm5\n\t" \
+ "vmovdqa %%ymm10,%%ymm0\n\t" \
+ "vpunpckhwd %%ymm12,%%ymm10,%%ymm10\n\t" \
+ "vpmaddwd %%ymm13,%%ymm10,%%ymm10\n\t" \
+ "vpunpcklwd %%ymm12,%%ymm5,%%ymm5\n\t" \
+ "vpmaddwd %%ymm13,%%ymm5,%%ymm5\n\t" \
+ /*ymm5=(t5''*27146+0xB500>>16)+t5''*/ \
+ "vpsrad $16,%%ymm10,%%ymm10\n\t" \
+ "vpsrad $16,%%ymm5,%%ymm5\n\t" \
+ "vpackssdw %%ymm10,%%ymm5,%%ymm5\n\t" \
+ "vpaddw %%ymm0,%%ymm5,%%ymm5\n\t" \
+ /*ymm0=s=(t5''*27146+0xB500>>16)+t5''+(t5''!=0)>>1*/ \
+ "vpcmpeqw %%ymm15,%%ymm0,%%ymm0\n\t" \
+ "vpsubw %%ymm14,%%ymm0,%%ymm0\n\t" \
+ "vpaddw %%ymm5,%%ymm0,%%ymm0\n\t" \
+ "vmovdqa %%ymm8,%%ymm5\n\t" \
+ "vpsraw $1,%%ymm0,%%ymm0\n\t" \
+ /*ymm5=t5'''=t4'-s*/ \
+ "vpsubw %%ymm0,%%ymm5,%%ymm5\n\t" \
+ /*ymm8=t4''=t4'+s*/ \
+ "vpaddw %%ymm0,%%ymm8,%%ymm8\n\t" \
+ /*ymm0,ymm7,ymm9,ymm10 are free.*/ \
+ /*ymm7:ymm9=t6''*27146+0xB500*/ \
+ "vmovdqa %%ymm6,%%ymm7\n\t" \
+ "vmovdqa %%ymm6,%%ymm9\n\t" \
+ "vpunpckhwd %%ymm12,%%ymm7,%%ymm7\n\t" \
+ "vpmaddwd %%ymm13,%%ymm7,%%ymm7\n\t" \
+ "vpunpcklwd %%ymm12,%%ymm9,%%ymm9\n\t" \
+ "vpmaddwd %%ymm13,%%ymm9,%%ymm9\n\t" \
+ /*ymm9=(t6''*27146+0xB500>>16)+t6''*/ \
+ "vpsrad $16,%%ymm7,%%ymm7\n\t" \
+ "vpsrad $16,%%ymm9,%%ymm9\n\t" \
+ "vpackssdw %%ymm7,%%ymm9,%%ymm9\n\t" \
+ "vpaddw %%ymm6,%%ymm9,%%ymm9\n\t" \
+ /*ymm9=s=(t6''*27146+0xB500>>16)+t6''+(t6''!=0)>>1*/ \
+ "vpcmpeqw %%ymm15,%%ymm6,%%ymm6\n\t" \
+ "vpsubw %%ymm14,%%ymm6,%%ymm6\n\t" \
+ "vpaddw %%ymm6,%%ymm9,%%ymm9\n\t" \
+ "vmovdqa %%ymm11,%%ymm7\n\t" \
+ "vpsraw $1,%%ymm9,%%ymm9\n\t" \
+ /*ymm7=t6'''=t7'-s*/ \
+ "vpsubw %%ymm9,%%ymm7,%%ymm7\n\t" \
+ /*ymm9=t7''=t7'+s*/ \
+ "vpaddw %%ymm11,%%ymm9,%%ymm9\n\t" \
+ /*ymm0,ymm6,ymm10,ymm11 are free.*/ \
+ /*Stage 4:*/ \
+ /*ymm10:ymm0=t1''*27146+0xB500*/ \
+ "vmovdqa %%ymm1,%%ymm0\n\t" \
+ "vmovdqa %%ymm1,%%ymm10\n\t" \
+ "vpunpcklwd %%ymm12,%%ymm0,%%ymm0\n\t" \
+ "vpmaddwd %%ymm13,%%ymm0,%%ymm0\n\t" \
+ "vpunpckhwd %%ymm12,%%ymm10,%%ymm10\n\t" \
+ "vpmaddwd %%ymm13,%%ymm10,%%ymm10\n\t" \
+ /*ymm0=(t1''*27146+0xB500>>16)+t1''*/ \
+ "vpsrad $16,%%ymm0,%%ymm0\n\t" \
+ "vpsrad $16,%%ymm10,%%ymm10\n\t" \
+ "mov $0x20006A0A,%[a]\n\t" \
+ "vpackssdw %%ymm10,%%ymm0,%%ymm0\n\t" \
+ "vmovd %[a],%%xmm13\n\t" \
+ "vpaddw %%ymm1,%%ymm0,%%ymm0\n\t" \
+ /*ymm0=s=(t1''*27146+0xB500>>16)+t1''+(t1''!=0)*/ \
+ "vpcmpeqw %%ymm15,%%ymm1,%%ymm1\n\t" \
+ "vpbroadcastd %%xmm13,%%ymm13\n\t" \
+ "vpsubw %%ymm14,%%ymm1,%%ymm1\n\t" \
+ "vpaddw %%ymm1,%%ymm0,%%ymm0\n\t" \
+ /*ymm10:ymm4=t0''*27146+0x4000*/ \
+ "vmovdqa %%ymm4,%%ymm1\n\t" \
+ "vmovdqa %%ymm4,%%ymm10\n\t" \
+ "vpunpcklwd %%ymm12,%%ymm4,%%ymm4\n\t" \
+ "vpmaddwd %%ymm13,%%ymm4,%%ymm4\n\t" \
+ "vpunpckhwd %%ymm12,%%ymm10,%%ymm10\n\t" \
+ "vpmaddwd %%ymm13,%%ymm10,%%ymm10\n\t" \
+ /*ymm4=(t0''*27146+0x4000>>16)+t0''*/ \
+ "vpsrad $16,%%ymm4,%%ymm4\n\t" \
+ "vpsrad $16,%%ymm10,%%ymm10\n\t" \
+ "mov $0x6CB7,%[a]\n\t" \
+ "vpackssdw %%ymm10,%%ymm4,%%ymm4\n\t" \
+ "vmovd %[a],%%xmm12\n\t" \
+ "vpaddw %%ymm1,%%ymm4,%%ymm4\n\t" \
+ /*ymm4=r=(t0''*27146+0x4000>>16)+t0''+(t0''!=0)*/ \
+ "vpcmpeqw %%ymm15,%%ymm1,%%ymm1\n\t" \
+ "vpbroadcastd %%xmm12,%%ymm12\n\t" \
+ "vpsubw %%ymm14,%%ymm1,%%ymm1\n\t" \
+ "mov $0x7FFF6C84,%[a]\n\t" \
+ "vpaddw %%ymm1,%%ymm4,%%ymm4\n\t" \
+ /*ymm0=_y[0]=u=r+s>>1 \
+   The naive implementation could cause overflow, so we use \
+    u=(r&s)+((r^s)>>1).*/ \
+ "vmovdqa %%ymm0,%%ymm6\n\t" \
+ "vpxor %%ymm4,%%ymm0,%%ymm0\n\t" \
+ "vpand %%ymm4,%%ymm6,%%ymm6\n\t" \
+ "vpsraw $1,%%ymm0,%%ymm0\n\t" \
+ "vmovd %[a],%%xmm13\n\t" \
+ "vpaddw %%ymm6,%%ymm0,%%ymm0\n\t" \
+ /*ymm4=_y[4]=v=r-u*/ \
+ "vpbroadcastd %%xmm13,%%ymm13\n\t" \
+ "vpsubw %%ymm0,%%ymm4,%%ymm4\n\t" \
+ /*ymm1,ymm6,ymm10,ymm11 are free.*/ \
+ /*ymm6:ymm10=60547*t3''+0x6CB7*/ \
+ "vmovdqa %%ymm3,%%ymm10\n\t" \
+ "vmovdqa %%ymm3,%%ymm6\n\t" \
+ "vpunpcklwd %%ymm3,%%ymm10,%%ymm10\n\t" \
+ "vpmaddwd %%ymm13,%%ymm10,%%ymm10\n\t" \
+ "mov $0x61F861F8,%[a]\n\t" \
+ "vpunpckhwd %%ymm3,%%ymm6,%%ymm6\n\t" \
+ "vpmaddwd %%ymm13,%%ymm6,%%ymm6\n\t" \
+ "vmovd %[a],%%xmm13\n\t" \
+ "vpaddd %%ymm12,%%ymm10,%%ymm10\n\t" \
+ "vpbroadcastd %%xmm13,%%ymm13\n\t" \
+ "vpaddd %%ymm12,%%ymm6,%%ymm6\n\t" \
+ /*ymm1:ymm2=25080*t2'' \
+   ymm12=t2''*/ \
+ "vmovdqa %%ymm2,%%ymm11\n\t" \
+ "vmovdqa %%ymm2,%%ymm12\n\t" \
+ "vpmullw %%ymm13,%%ymm2,%%ymm2\n\t" \
+ "vpmulhw %%ymm13,%%ymm11,%%ymm11\n\t" \
+ "vmovdqa %%ymm2,%%ymm1\n\t" \
+ "vpunpcklwd %%ymm11,%%ymm2,%%ymm2\n\t" \
+ "vpunpckhwd %%ymm11,%%ymm1,%%ymm1\n\t" \
+ /*ymm10=u=(25080*t2''+60547*t3''+0x6CB7>>16)+(t3''!=0)*/ \
+ "vpaddd %%ymm2,%%ymm10,%%ymm10\n\t" \
+ "vpaddd %%ymm1,%%ymm6,%%ymm6\n\t" \
+ "vpsrad $16,%%ymm10,%%ymm10\n\t" \
+ "vpcmpeqw %%ymm15,%%ymm3,%%ymm3\n\t" \
+ "vpsrad $16,%%ymm6,%%ymm6\n\t" \
+ "vpsubw %%ymm14,%%ymm3,%%ymm3\n\t" \
+ "vpackssdw %%ymm6,%%ymm10,%%ymm10\n\t" \
+ "vpaddw %%ymm3,%%ymm10,%%ymm10\n\t" \
+ /*ymm2=_y[2]=u \
+   ymm10=s=(25080*u>>16)-t2''*/ \
+ "vmovdqa %%ymm10,%%ymm2\n\t" \
+ "vpmulhw %%ymm13,%%ymm10,%%ymm10\n\t" \
+ "vpsubw %%ymm12,%%ymm10,%%ymm10\n\t" \
+ /*ymm1:ymm6=s*21600+0x2800*/ \
+ "vpxor %%ymm12,%%ymm12,%%ymm12\n\t" \
+ "vpsubw %%ymm14,%%ymm12,%%ymm12\n\t" \
+ "mov $0x28005460,%[a]\n\t" \
+ "vmovd %[a],%%xmm13\n\t" \
+ "vpbroadcastd %%xmm13,%%ymm13\n\t" \
+ "vmovdqa %%ymm10,%%ymm6\n\t" \
+ "vmovdqa %%ymm10,%%ymm1\n\t" \
+ "vpunpcklwd %%ymm12,%%ymm6,%%ymm6\n\t" \
+ "vpmaddwd %%ymm13,%%ymm6,%%ymm6\n\t" \
+ "mov $0x0E3D,%[a]\n\t" \
+ "vpunpckhwd %%ymm12,%%ymm1,%%ymm1\n\t" \
+ "vpmaddwd %%ymm13,%%ymm1,%%ymm1\n\t" \
+ /*ymm6=(s*21600+0x2800>>18)+s*/ \
+ "vpsrad $18,%%ymm6,%%ymm6\n\t" \
+ "vpsrad $18,%%ymm1,%%ymm1\n\t" \
+ "vmovd %[a],%%xmm12\n\t" \
+ "vpackssdw %%ymm1,%%ymm6,%%ymm6\n\t" \
+ "vpbroadcastd %%xmm12,%%ymm12\n\t" \
+ "vpaddw %%ymm10,%%ymm6,%%ymm6\n\t" \
+ /*ymm6=_y[6]=v=(s*21600+0x2800>>18)+s+(s!=0)*/ \
+ "mov $0x7FFF54DC,%[a]\n\t" \
+ "vpcmpeqw %%ymm15,%%ymm10,%%ymm10\n\t" \
+ "vmovd %[a],%%xmm13\n\t" \
+ "vpsubw %%ymm14,%%ymm10,%%ymm10\n\t" \
+ "vpbroadcastd %%xmm13,%%ymm13\n\t" \
+ "vpaddw %%ymm10,%%ymm6,%%ymm6\n\t" \
+ /*ymm1,ymm3,ymm10,ymm11 are free.*/ \
+ /*ymm11:ymm10=54491*t5'''+0x0E3D*/ \
+ "vmovdqa %%ymm5,%%ymm10\n\t" \
+ "vmovdqa %%ymm5,%%ymm11\n\t" \
+ "vpunpcklwd %%ymm5,%%ymm10,%%ymm10\n\t" \
+ "vpmaddwd %%ymm13,%%ymm10,%%ymm10\n\t" \
+ "mov $0x8E3A8E3A,%[a]\n\t" \
+ "vpunpckhwd %%ymm5,%%ymm11,%%ymm11\n\t" \
+ "vpmaddwd %%ymm13,%%ymm11,%%ymm11\n\t" \
+ "vmovd %[a],%%xmm13\n\t" \
+ "vpaddd %%ymm12,%%ymm10,%%ymm10\n\t" \
+ "vpbroadcastd %%xmm13,%%ymm13\n\t" \
+ "vpaddd %%ymm12,%%ymm11,%%ymm11\n\t" \
+ /*ymm7:ymm12=36410*t6''' \
+   ymm1=t6'''*/ \
+ "vmovdqa %%ymm7,%%ymm3\n\t" \
+ "vmovdqa %%ymm7,%%ymm1\n\t" \
+ "vpmulhw %%ymm13,%%ymm3,%%ymm3\n\t" \
+ "vpmullw %%ymm13,%%ymm7,%%ymm7\n\t" \
+ "vpaddw %%ymm1,%%ymm3,%%ymm3\n\t" \
+ "vmovdqa %%ymm7,%%ymm12\n\t" \
+ "vpunpckhwd %%ymm3,%%ymm7,%%ymm7\n\t" \
+ "vpunpcklwd %%ymm3,%%ymm12,%%ymm12\n\t" \
+ /*ymm10=u=(54491*t5'''+36410*t6'''+0x0E3D>>16)+(t5'''!=0)*/ \
+ "vpaddd %%ymm12,%%ymm10,%%ymm10\n\t" \
+ "vpaddd %%ymm7,%%ymm11,%%ymm11\n\t" \
+ "vpsrad $16,%%ymm10,%%ymm10\n\t" \
+ "vpcmpeqw %%ymm15,%%ymm5,%%ymm5\n\t" \
+ "vpsrad $16,%%ymm11,%%ymm11\n\t" \
+ "vpsubw %%ymm14,%%ymm5,%%ymm5\n\t" \
+ "vpackssdw %%ymm11,%%ymm10,%%ymm10\n\t" \
+ "vpxor %%ymm12,%%ymm12,%%ymm12\n\t" \
+ "vpaddw %%ymm5,%%ymm10,%%ymm10\n\t" \
+ /*ymm5=_y[5]=u \
+   ymm1=s=t6'''-(36410*u>>16)*/ \
+ "vpsubw %%ymm14,%%ymm12,%%ymm12\n\t" \
+ "vmovdqa %%ymm10,%%ymm5\n\t" \
+ "mov $0x340067C8,%[a]\n\t" \
+ "vpmulhw %%ymm13,%%ymm10,%%ymm10\n\t" \
+ "vmovd %[a],%%xmm13\n\t" \
+ "vpaddw %%ymm5,%%ymm10,%%ymm10\n\t" \
+ "vpbroadcastd %%xmm13,%%ymm13\n\t" \
+ "vpsubw %%ymm10,%%ymm1,%%ymm1\n\t" \
+ /*ymm11:ymm3=s*26568+0x3400*/ \
+ "vmovdqa %%ymm1,%%ymm3\n\t" \
+ "vmovdqa %%ymm1,%%ymm11\n\t" \
+ "vpunpcklwd %%ymm12,%%ymm3,%%ymm3\n\t" \
+ "vpmaddwd %%ymm13,%%ymm3,%%ymm3\n\t" \
+ "mov $0x7B1B,%[a]\n\t" \
+ "vpunpckhwd %%ymm12,%%ymm11,%%ymm11\n\t" \
+ "vpmaddwd %%ymm13,%%ymm11,%%ymm11\n\t" \
+ /*ymm3=(s*26568+0x3400>>17)+s*/ \
+ "vpsrad $17,%%ymm3,%%ymm3\n\t" \
+ "vpsrad $17,%%ymm11,%%ymm11\n\t" \
+ "vmovd %[a],%%xmm12\n\t" \
+ "vpackssdw %%ymm11,%%ymm3,%%ymm3\n\t" \
+ "vpbroadcastd %%xmm12,%%ymm12\n\t" \
+ "vpaddw %%ymm1,%%ymm3,%%ymm3\n\t" \
+ /*ymm3=_y[3]=v=(s*26568+0x3400>>17)+s+(s!=0)*/ \
+ "mov $0x7FFF7B16,%[a]\n\t" \
+ "vpcmpeqw %%ymm15,%%ymm1,%%ymm1\n\t" \
+ "vmovd %[a],%%xmm13\n\t" \
+ "vpsubw %%ymm14,%%ymm1,%%ymm1\n\t" \
+ "vpbroadcastd %%xmm13,%%ymm13\n\t" \
+ "vpaddw %%ymm1,%%ymm3,%%ymm3\n\t" \
+ /*ymm1,ymm7,ymm10,ymm11 are free.*/ \
+ /*ymm11:ymm10=64277*t7''+0x7B1B*/ \
+ "vmovdqa %%ymm9,%%ymm10\n\t" \
+ "vmovdqa %%ymm9,%%ymm11\n\t" \
+ "vpunpcklwd %%ymm9,%%ymm10,%%ymm10\n\t" \
+ "vpmaddwd %%ymm13,%%ymm10,%%ymm10\n\t" \
+ "mov $0x31F131F1,%[a]\n\t" \
+ "vpunpckhwd %%ymm9,%%ymm11,%%ymm11\n\t" \
+ "vpmaddwd %%ymm13,%%ymm11,%%ymm11\n\t" \
+ "vmovd %[a],%%xmm13\n\t" \
+ "vpaddd %%ymm12,%%ymm10,%%ymm10\n\t" \
+ "vpbroadcastd %%xmm13,%%ymm13\n\t" \
+ "vpaddd %%ymm12,%%ymm11,%%ymm11\n\t" \
+ /*ymm12:ymm7=12785*t4''*/ \
+ "vmovdqa %%ymm8,%%ymm7\n\t" \
+ "vmovdqa %%ymm8,%%ymm1\n\t" \
+ "vpmullw %%ymm13,%%ymm7,%%ymm7\n\t" \
+ "vpmulhw %%ymm13,%%ymm1,%%ymm1\n\t" \
+ "vmovdqa %%ymm7,%%ymm12\n\t" \
+ "vpunpcklwd %%ymm1,%%ymm7,%%ymm7\n\t" \
+ "vpunpckhwd %%ymm1,%%ymm12,%%ymm12\n\t" \
+ /*ymm10=u=(12785*t4''+64277*t7''+0x7B1B>>16)+(t7''!=0)*/ \
+ "vpaddd %%ymm7,%%ymm10,%%ymm10\n\t" \
+ "vpaddd %%ymm12,%%ymm11,%%ymm11\n\t" \
+ "vpsrad $16,%%ymm10,%%ymm10\n\t" \
+ "vpcmpeqw %%ymm15,%%ymm9,%%ymm9\n\t" \
+ "vpsrad $16,%%ymm11,%%ymm11\n\t" \
+ "vpsubw %%ymm14,%%ymm9,%%ymm9\n\t" \
+ "vpackssdw %%ymm11,%%ymm10,%%ymm10\n\t" \
+ "vpxor %%ymm12,%%ymm12,%%ymm12\n\t" \
+ "vpaddw %%ymm9,%%ymm10,%%ymm10\n\t" \
+ /*ymm1=_y[1]=u \
+   ymm10=s=(12785*u>>16)-t4''*/ \
+ "vpsubw %%ymm14,%%ymm12,%%ymm12\n\t" \
+ "vmovdqa %%ymm10,%%ymm1\n\t" \
+ "mov $0x3000503B,%[a]\n\t" \
+ "vpmulhw %%ymm13,%%ymm10,%%ymm10\n\t" \
+ "vmovd %[a],%%xmm13\n\t" \
+ "vpsubw %%ymm8,%%ymm10,%%ymm10\n\t" \
+ "vpbroadcastd %%xmm13,%%ymm13\n\t" \
+ /*ymm8:ymm7=s*20539+0x3000*/ \
+ "vmovdqa %%ymm10,%%ymm7\n\t" \
+ "vmovdqa %%ymm10,%%ymm8\n\t" \
+ "vpunpcklwd %%ymm12,%%ymm7,%%ymm7\n\t" \
+ "vpmaddwd %%ymm13,%%ymm7,%%ymm7\n\t" \
+ "vpunpckhwd %%ymm12,%%ymm8,%%ymm8\n\t" \
+ "vpmaddwd %%ymm13,%%ymm8,%%ymm8\n\t" \
+ /*ymm7=(s*20539+0x3000>>20)+s*/ \
+ "vpsrad $20,%%ymm7,%%ymm7\n\t" \
+ "vpsrad $20,%%ymm8,%%ymm8\n\t" \
+ "vpackssdw %%ymm8,%%ymm7,%%ymm7\n\t" \
+ "vpaddw %%ymm10,%%ymm7,%%ymm7\n\t" \
+ /*ymm7=_y[7]=v=(s*20539+0x3000>>20)+s+(s!=0)*/ \
+ "vpcmpeqw %%ymm15,%%ymm10,%%ymm10\n\t" \
+ "vpsubw %%ymm14,%%ymm10,%%ymm10\n\t" \
+ "vpaddw %%ymm10,%%ymm7,%%ymm7\n\t" \
+
+/*AVX2 implementation of the fDCT of two blocks, stored one after the other in
+   _x and _y, for x86-64 only.
+  The output is bit-exact with oc_enc_fdct8x8_x86_64sse2().*/
+void oc_enc_fdct8x8_x2_avx2(ogg_int16_t _y[128],const ogg_int16_t _x[128]){
+  ptrdiff_t a;
+  __asm__ __volatile__(
+    /*Load the input, with row i of the first block in the lower lane of ymmi
+       and row i of the second block in the upper lane.*/
+    "vmovdqa 0x00(%[x]),%%xmm0\n\t"
+    "vmovdqa 0x10(%[x]),%%xmm1\n\t"
+    "vmovdqa 0x20(%[x]),%%xmm2\n\t"
+    "vmovdqa 0x30(%[x]),%%xmm3\n\t"
+    "vinserti128 $1,0x80(%[x]),%%ymm0,%%ymm0\n\t"
+    "vinserti128 $1,0x90(%[x]),%%ymm1,%%ymm1\n\t"
+    "vinserti128 $1,0xA0(%[x]),%%ymm2,%%ymm2\n\t"
+    "vinserti128 $1,0xB0(%[x]),%%ymm3,%%ymm3\n\t"
+    "vmovdqa 0x40(%[x]),%%xmm4\n\t"
+    "vmovdqa 0x50(%[x]),%%xmm5\n\t"
+    "vmovdqa 0x60(%[x]),%%xmm6\n\t"
+    "vmovdqa 0x70(%[x]),%%xmm7\n\t"
+    "vinserti128 $1,0xC0(%[x]),%%ymm4,%%ymm4\n\t"
+    "vinserti128 $1,0xD0(%[x]),%%ymm5,%%ymm5\n\t"
+    "vinserti128 $1,0xE0(%[x]),%%ymm6,%%ymm6\n\t"
+    "vinserti128 $1,0xF0(%[x]),%%ymm7,%%ymm7\n\t"
+    /*Add two extra bits of working precision and the same biases as the SSE2
+       version (see the comments there).*/
+    /*ymm15={0}x16*/
+    "vpxor %%ymm15,%%ymm15,%%ymm15\n\t"
+    /*ymm14={-1}x16*/
+    "vpcmpeqb %%ymm14,%%ymm14,%%ymm14\n\t"
+    "vpsllw $2,%%ymm0,%%ymm0\n\t"
+    /*ymm8={_x[7...0]!=0} in each lane*/
+    "vpcmpeqw %%ymm15,%%ymm0,%%ymm8\n\t"
+    "vpsllw $2,%%ymm1,%%ymm1\n\t"
+    "vpsubw %%ymm14,%%ymm8,%%ymm8\n\t"
+    "vpsllw $2,%%ymm2,%%ymm2\n\t"
+    "vpsllw $2,%%ymm3,%%ymm3\n\t"
+    /*%[a]=1*/
+    "mov $1,%[a]\n\t"
+    /*ymm8={0,0,_x[2]!=0,0,_x[0]!=0,0} in each lane*/
+    "vpslld $16,%%ymm8,%%ymm8\n\t"
+    "vpsllw $2,%%ymm4,%%ymm4\n\t"
+    /*ymm9={0,0,0,0,0,0,0,1} in each lane*/
+    "vmovd %[a],%%xmm9\n\t"
+    "vpshufhw $0x00,%%ymm8,%%ymm8\n\t"
+    "vpsllw $2,%%ymm5,%%ymm5\n\t"
+    "vinserti128 $1,%%xmm9,%%ymm9,%%ymm9\n\t"
+    /*%[a]={1}x2*/
+    "mov $0x10001,%[a]\n\t"
+    /*ymm8={0,0,0,0,0,0,0,_x[0]!=0} in each lane*/
+    "vpshuflw $0x01,%%ymm8,%%ymm8\n\t"
+    "vpsllw $2,%%ymm6,%%ymm6\n\t"
+    /*ymm10={0,0,0,0,0,0,1,1} in each lane*/
+    "vmovd %[a],%%xmm10\n\t"
+    "vinserti128 $1,%%xmm10,%%ymm10,%%ymm10\n\t"
+    /*ymm0=_x[7...0]+{0,0,0,0,0,0,0,_x[0]!=0}*/
+    "vpaddw %%ymm8,%%ymm0,%%ymm0\n\t"
+    "vpsllw $2,%%ymm7,%%ymm7\n\t"
+    /*ymm0=_x[7...0]+{0,0,0,0,0,0,1,(_x[0]!=0)+1}*/
+    "vpaddw %%ymm10,%%ymm0,%%ymm0\n\t"
+    /*ymm1=_x[15...8]-{0,0,0,0,0,0,0,1}*/
+    "vpsubw %%ymm9,%%ymm1,%%ymm1\n\t"
+    /*Transform columns.*/
+    OC_FDCT_8x8x2
+    /*Transform rows.*/
+    OC_TRANSPOSE_8x8x2
+    OC_FDCT_8x8x2
+    /*ymm14={-2}x16*/
+    "vpaddw %%ymm14,%%ymm14,%%ymm14\n\t"
+    "vpsubw %%ymm14,%%ymm0,%%ymm0\n\t"
+    "vpsubw %%ymm14,%%ymm1,%%ymm1\n\t"
+    "vpsraw $2,%%ymm0,%%ymm0\n\t"
+    "vpsubw %%ymm14,%%ymm2,%%ymm2\n\t"
+    "vpsraw $2,%%ymm1,%%ymm1\n\t"
+    "vpsubw %%ymm14,%%ymm3,%%ymm3\n\t"
+    "vpsraw $2,%%ymm2,%%ymm2\n\t"
+    "vpsubw %%ymm14,%%ymm4,%%ymm4\n\t"
+    "vpsraw $2,%%ymm3,%%ymm3\n\t"
+    "vpsubw %%ymm14,%%ymm5,%%ymm5\n\t"
+    "vpsraw $2,%%ymm4,%%ymm4\n\t"
+    "vpsubw %%ymm14,%%ymm6,%%ymm6\n\t"
+    "vpsraw $2,%%ymm5,%%ymm5\n\t"
+    "vpsubw %%ymm14,%%ymm7,%%ymm7\n\t"
+    "vpsraw $2,%%ymm6,%%ymm6\n\t"
+    "vpsraw $2,%%ymm7,%%ymm7\n\t"
+    /*Move the second block into xmm8...xmm15 and leave the first in
+       xmm0...xmm7.*/
+    "vextracti128 $1,%%ymm0,%%xmm8\n\t"
+    "vextracti128 $1,%%ymm1,%%xmm9\n\t"
+    "vextracti128 $1,%%ymm2,%%xmm10\n\t"
+    "vextracti128 $1,%%ymm3,%%xmm11\n\t"
+    "vextracti128 $1,%%ymm4,%%xmm12\n\t"
+    "vextracti128 $1,%%ymm5,%%xmm13\n\t"
+    "vextracti128 $1,%%ymm6,%%xmm14\n\t"
+    "vextracti128 $1,%%ymm7,%%xmm15\n\t"
+    /*Avoid the AVX->SSE transition penalty in the legacy code below.*/
+    "vzeroupper\n\t"
+    /*Transpose, zig-zag, and store each block with the same code as the SSE2
+       version.*/
+#define OC_ZZ_LOAD_ROW_LO(_row,_reg) \
+    "movdq2q %%xmm"#_row","_reg"\n\t" \
+
+#define OC_ZZ_LOAD_ROW_HI(_row,_reg) \
+    "punpckhqdq %%xmm"#_row",%%xmm"#_row"\n\t" \
+    "movdq2q %%xmm"#_row","_reg"\n\t" \
+
+    OC_TRANSPOSE_ZIG_ZAG_MMXEXT
+    "movdqa %%xmm8,%%xmm0\n\t"
+    "movdqa %%xmm9,%%xmm1\n\t"
+    "movdqa %%xmm10,%%xmm2\n\t"
+    "movdqa %%xmm11,%%xmm3\n\t"
+    "movdqa %%xmm12,%%xmm4\n\t"
+    "movdqa %%xmm13,%%xmm5\n\t"
+    "movdqa %%xmm14,%%xmm6\n\t"
+    "movdqa %%xmm15,%%xmm7\n\t"
+    "add $0x80,%[y]\n\t"
+    OC_TRANSPOSE_ZIG_ZAG_MMXEXT
+#undef OC_ZZ_LOAD_ROW_LO
+#undef OC_ZZ_LOAD_ROW_HI
+    :[a]"=&r"(a),[y]"+r"(_y)
+    :[x]"r"(_x)
+    :"cc","memory"
+  );
+}
+
+#endif
@@ -0,0 +1,104 @@
+/********************************************************************
+ *                                                                  *
+ * THIS FILE IS PART OF THE OggTheora SOFTWARE CODEC SOURCE CODE.   *
+ * USE, DISTRIBUTION AND REPRODUCTION OF THIS LIBRARY SOURCE IS     *
+ * GOVERNED BY A BSD-STYLE SOURCE LICENSE INCLUDED WITH THIS SOURCE *
+ * IN 'COPYING'. PLEASE READ THESE TERMS BEFORE DISTRIBUTING.       *
+ *                                                                  *
+ * THE Theora SOURCE CODE IS COPYRIGHT (C) 2002-2009                *
+ * by the Xiph.Org Foundation and contributors http://www.xiph.org/ *
+ *                                                                  *
+ ********************************************************************
+
+  function:
+    last mod: $Id$
+
+ ********************************************************************/
+
+#if !defined(_x86_avx2trans_H)
+# define _x86_avx2trans_H (1)
+# include "x86int.h"
+
+# if defined(OC_X86_64_ASM)
+/*Transposes two 8x8 blocks at once, one in each 128-bit lane of %%ymm0...7.
+  The AVX2 unpack instructions never cross lanes, so this is exactly the x86-64
+   OC_TRANSPOSE_8x8 from sse2trans.h applied to both halves of each register,
+   and the comments below describe either lane.*/
+#  define OC_TRANSPOSE_8x8x2 \
+ "#OC_TRANSPOSE_8x8x2\n\t" \
+ "vmovdqa %%ymm4,%%ymm8\n\t" \
+ /*ymm4 = f3 e3 f2 e2 f1 e1 f0 e0*/ \
+ "vpunpcklwd %%ymm5,%%ymm4,%%ymm4\n\t" \
+ /*ymm8 = f7 e7 f6 e6 f5 e5 f4 e4*/ \
+ "vpunpckhwd %%ymm5,%%ymm8,%%ymm8\n\t" \
+ /*ymm5 is free.*/ \
+ "vmovdqa %%ymm0,%%ymm5\n\t" \
+ /*ymm0 = b3 a3 b2 a2 b1 a1 b0 a0*/ \
+ "vpunpcklwd %%ymm1,%%ymm0,%%ymm0\n\t" \
+ /*ymm5 = b7 a7 b6 a6 b5 a5 b4 a4*/ \
+ "vpunpckhwd %%ymm1,%%ymm5,%%ymm5\n\t" \
+ /*ymm1 is free.*/ \
+ "vmovdqa %%ymm6,%%ymm1\n\t" \
+ /*ymm6 = h3 g3 h2 g2 h1 g1 h0 g0*/ \
+ "vpunpcklwd %%ymm7,%%ymm6,%%ymm6\n\t" \
+ /*ymm1 = h7 g7 h6 g6 h5 g5 h4 g4*/ \
+ "vpunpckhwd %%ymm7,%%ymm1,%%ymm1\n\t" \
+ /*ymm7 is free.*/ \
+ "vmovdqa %%ymm2,%%ymm7\n\t" \
+ /*ymm2 = d7 c7 d6 c6 d5 c5 d4 c4*/ \
+ "vpunpckhwd %%ymm3,%%ymm2,%%ymm2\n\t" \
+ /*ymm7 = d3 c3 d2 c2 d1 c1 d0 c0*/ \
+ "vpunpcklwd %%ymm3,%%ymm7,%%ymm7\n\t" \
+ /*ymm3 is free.*/ \
+ "vmovdqa %%ymm0,%%ymm3\n\t" \
+ /*ymm0 = d1 c1 b1 a1 d0 c0 b0 a0*/ \
+ "vpunpckldq %%ymm7,%%ymm0,%%ymm0\n\t" \
+ /*ymm3 = d3 c3 b3 a3 d2 c2 b2 a2*/ \
+ "vpunpckhdq %%ymm7,%%ymm3,%%ymm3\n\t" \
+ /*ymm7 is free.*/ \
+ "vmovdqa %%ymm5,%%ymm7\n\t" \
+ /*ymm5 = d5 c5 b5 a5 d4 c4 b4 a4*/ \
+ "vpunpckldq %%ymm2,%%ymm5,%%ymm5\n\t" \
+ /*ymm7 = d7 c7 b7 a7 d6 c6 b6 a6*/ \
+ "vpunpckhdq %%ymm2,%%ymm7,%%ymm7\n\t" \
+ /*ymm2 is free.*/ \
+ "vmovdqa %%ymm4,%%ymm2\n\t" \
+ /*ymm4 = h3 g3 f3 e3 h2 g2 f2 e2*/ \
+ "vpunpckhdq %%ymm6,%%ymm4,%%ymm4\n\t" \
+ /*ymm2 = h1 g1 f1 e1 h0 g0 f0 e0*/ \
+ "vpunpckldq %%ymm6,%%ymm2,%%ymm2\n\t" \
+ /*ymm6 is free.*/ \
+ "vmovdqa %%ymm8,%%ymm6\n\t" \
+ /*ymm6 = h5 g5 f5 e5 h4 g4 f4 e4*/ \
+ "vpunpckldq %%ymm1,%%ymm6,%%ymm6\n\t" \
+ /*ymm8 = h7 g7 f7 e7 h6 g6 f6 e6*/ \
+ "vpunpckhdq %%ymm1,%%ymm8,%%ymm8\n\t" \
+ /*ymm1 is free.*/ \
+ "vmovdqa %%ymm0,%%ymm1\n\t" \
+ /*ymm0 = h0 g0 f0 e0 d0 c0 b0 a0*/ \
+ "vpunpcklqdq %%ymm2,%%ymm0,%%ymm0\n\t" \
+ /*ymm1 = h1 g1 f1 e1 d1 c1 b1 a1*/ \
+ "vpunpckhqdq %%ymm2,%%ymm1,%%ymm1\n\t" \
+ /*ymm2 is free.*/ \
+ "vmovdqa %%ymm3,%%ymm2\n\t" \
+ /*ymm3 = h3 g3 f3 e3 d3 c3 b3 a3*/ \
+ "vpunpckhqdq %%ymm4,%%ymm3,%%ymm3\n\t" \
+ /*ymm2 = h2 g2 f2 e2 d2 c2 b2 a2*/ \
+ "vpunpcklqdq %%ymm4,%%ymm2,%%ymm2\n\t" \
+ /*ymm4 is free.*/ \
+ "vmovdqa %%ymm5,%%ymm4\n\t" \
+ /*ymm5 = h5 g5 f5 e5 d5 c5 b5 a5*/ \
+ "vpunpckhqdq %%ymm6,%%ymm5,%%ymm5\n\t" \
+ /*ymm4 = h4 g4 f4 e4 d4 c4 b4 a4*/ \
+ "vpunpcklqdq %%ymm6,%%ymm4,%%ymm4\n\t" \
+ /*ymm6 is free.*/ \
+ "vmovdqa %%ymm7,%%ymm6\n\t" \
+ /*ymm7 = h7 g7 f7 e7 d7 c7 b7 a7*/ \
+ "vpunpckhqdq %%ymm8,%%ymm7,%%ymm7\n\t" \
+ /*ymm6 = h6 g6 f6 e6 d6 c6 b6 a6*/ \
+ "vpunpcklqdq %%ymm8,%%ymm6,%%ymm6\n\t" \
+ /*ymm8 is free.*/ \
+
+# endif
+
+#endif
@@ -0,0 +1,206 @@
+/********************************************************************
+ *                                                                  *
+ * THIS FILE IS PART OF THE OggTheora SOFTWARE CODEC SOURCE CODE.   *
+ * USE, DISTRIBUTION AND REPRODUCTION OF THIS LIBRARY SOURCE IS     *
+ * GOVERNED BY A BSD-STYLE SOURCE LICENSE INCLUDED WITH THIS SOURCE *
+ * IN 'COPYING'. PLEASE READ THESE TERMS BEFORE DISTRIBUTING.       *
+ *                                                                  *
+ * THE Theora SOURCE CODE IS COPYRIGHT (C) 2002-2009                *
+ * by the Xiph.Org Foundation and contributors http://www.xiph.org/ *
+ *                                                                  *
+ ********************************************************************
+
+  function:
+  last mod: $Id$
+
+ ********************************************************************/
+#include <stddef.h>
+#include "x86enc.h"
+
+#if defined(OC_X86_ASM)
+
+/*The rounding biases used by the R'G'B' conversions.
+  These must match the C versions in encinput.c.*/
+static const int __attribute__((aligned(16))) OC_INPUT_BIAS_SSE2[8]={
+  /*Luma: offset 16 with 8 fractional bits.*/
+  (16<<8)+(1<<7),(16<<8)+(1<<7),(16<<8)+(1<<7),(16<<8)+(1<<7),
+  /*Chroma from a sum of 4 pixels: offset 128 with 10 fractional bits.*/
+  (128<<10)+(1<<9),(128<<10)+(1<<9),(128<<10)+(1<<9),(128<<10)+(1<<9)
+};
+
+void oc_enc_input_deinterleave_sse2(unsigned char *_dst0,
+ unsigned char *_dst1,const unsigned char *_src,int _n){
+  int i;
+  for(i=0;i+16<=_n;i+=16){
+    __asm__ __volatile__(
+      /*xmm4={0x00FF}x8*/
+      "pcmpeqb %%xmm4,%%xmm4\n\t"
+      "psrlw $8,%%xmm4\n\t"
+      "movdqu %[src],%%xmm0\n\t"
+      "movdqu "OC_MEM_OFFS(0x10,src)",%%xmm1\n\t"
+      "movdqa %%xmm0,%%xmm2\n\t"
+      "movdqa %%xmm1,%%xmm3\n\t"
+      "pand %%xmm4,%%xmm0\n\t"
+      "pand %%xmm4,%%xmm1\n\t"
+      "psrlw $8,%%xmm2\n\t"
+      "psrlw $8,%%xmm3\n\t"
+      "packuswb %%xmm1,%%xmm0\n\t"
+      "packuswb %%xmm3,%%xmm2\n\t"
+      "movdqu %%xmm0,%[dst0]\n\t"
+      "movdqu %%xmm2,%[dst1]\n\t"
+      :[dst0]"=m"(OC_ARRAY_OPERAND(unsigned char,_dst0+i,16)),
+       [dst1]"=m"(OC_ARRAY_OPERAND(unsigned char,_dst1+i,16))
+      :[src]"m"(OC_CONST_ARRAY_OPERAND(unsigned char,_src+2*i,32))
+    );
+  }
+  for(;i<_n;i++){
+    _dst0[i]=_src[2*i+0];
+    _dst1[i]=_src[2*i+1];
+  }
+}
+
+void oc_enc_input_avg_sse2(unsigned char *_dst,const unsigned char *_src0,
+ const unsigned char *_src1,int _n){
+  int i;
+  for(i=0;i+16<=_n;i+=16){
+    __asm__ __volatile__(
+      "movdqu %[src0],%%xmm0\n\t"
+      "movdqu %[src1],%%xmm1\n\t"
+      "pavgb %%xmm1,%%xmm0\n\t"
+      "movdqu %%xmm0,%[dst]\n\t"
+      :[dst]"=m"(OC_ARRAY_OPERAND(unsigned char,_dst+i,16))
+      :[src0]"m"(OC_CONST_ARRAY_OPERAND(unsigned char,_src0+i,16)),
+       [src1]"m"(OC_CONST_ARRAY_OPERAND(unsigned char,_src1+i,16))
+    );
+  }
+  for(;i<_n;i++)_dst[i]=(unsigned char)(_src0[i]+_src1[i]+1>>1);
+}
+
+/*Computes the dot product of each pixel in 16 bytes of packed 8-bit pixels
+   with the coefficients in %%xmm6, leaving the 4 32-bit results in _r0.
+  _r1, xmm4, and xmm5 are clobbered, and xmm7 must be zero.*/
+#define OC_RGBX_DOT4(_src,_r0,_r1) \
+ "#OC_RGBX_DOT4\n\t" \
+ "movdqu "_src",%%xmm"_r0"\n\t" \
+ "movdqa %%xmm"_r0",%%xmm"_r1"\n\t" \
+ "punpcklbw %%xmm7,%%xmm"_r0"\n\t" \
+ "punpckhbw %%xmm7,%%xmm"_r1"\n\t" \
+ "pmaddwd %%xmm6,%%xmm"_r0"\n\t" \
+ "pmaddwd %%xmm6,%%xmm"_r1"\n\t" \
+ /*Add the two partial sums for each pixel.*/ \
+ "movdqa %%xmm"_r0",%%xmm4\n\t" \
+ "shufps $0x88,%%xmm"_r1",%%xmm"_r0"\n\t" \
+ "shufps $0xDD,%%xmm"_r1",%%xmm4\n\t" \
+ "paddd %%xmm4,%%xmm"_r0"\n\t" \
+
+void oc_enc_input_rgbx_to_y_sse2(unsigned char *_dst,
+ const unsigned char *_src,int _n,const ogg_int16_t _coefs[8]){
+  int i;
+  for(i=0;i+8<=_n;i+=8){
+    __asm__ __volatile__(
+      "movdqu %[coefs],%%xmm6\n\t"
+      "pxor %%xmm7,%%xmm7\n\t"
+      OC_RGBX_DOT4("%[src]","0","1")
+      OC_RGBX_DOT4(OC_MEM_OFFS(0x10,src),"2","3")
+      "paddd %[bias],%%xmm0\n\t"
+      "paddd %[bias],%%xmm2\n\t"
+      "psrad $8,%%xmm0\n\t"
+      "psrad $8,%%xmm2\n\t"
+      "packssdw %%xmm2,%%xmm0\n\t"
+      "packuswb %%xmm0,%%xmm0\n\t"
+      "movq %%xmm0,%[dst]\n\t"
+      :[dst]"=m"(OC_ARRAY_OPERAND(unsigned char,_dst+i,8))
+      :[src]"m"(OC_CONST_ARRAY_OPERAND(unsigned char,_src+4*i,32)),
+       [coefs]"m"(OC_CONST_ARRAY_OPERAND(ogg_int16_t,_coefs,8)),
+       [bias]"m"(OC_CONST_ARRAY_OPERAND(int,OC_INPUT_BIAS_SSE2,4))
+    );
+  }
+  for(;i<_n;i++){
+    _dst[i]=(unsigned char)(_coefs[0]*_src[4*i+0]+_coefs[1]*_src[4*i+1]
+     +_coefs[2]*_src[4*i+2]+OC_INPUT_BIAS_SSE2[0]>>8);
+  }
+}
+
+/*Sums each 2x2 block of pixels from 16 bytes of each of two rows of packed
+   8-bit pixels, leaving the two 16-bit sums in _r0.
+  _r1, _r2, and _r3 are clobbered, and xmm7 must be zero.*/
+#define OC_RGBX_SUM2x2(_src0,_src1,_r0,_r1,_r2,_r3) \
+ "#OC_RGBX_SUM2x2\n\t" \
+ "movdqu "_src0",%%xmm"_r0"\n\t" \
+ "movdqu "_src1",%%xmm"_r1"\n\t" \
+ "movdqa %%xmm"_r0",%%xmm"_r2"\n\t" \
+ "movdqa %%xmm"_r1",%%xmm"_r3"\n\t" \
+ "punpcklbw %%xmm7,%%xmm"_r0"\n\t" \
+ "punpcklbw %%xmm7,%%xmm"_r1"\n\t" \
+ "punpckhbw %%xmm7,%%xmm"_r2"\n\t" \
+ "punpckhbw %%xmm7,%%xmm"_r3"\n\t" \
+ /*Vertical sums.*/ \
+ "paddw %%xmm"_r1",%%xmm"_r0"\n\t" \
+ "paddw %%xmm"_r3",%%xmm"_r2"\n\t" \
+ /*Horizontal sums.*/ \
+ "pshufd $0x4E,%%xmm"_r0",%%xmm"_r1"\n\t" \
+ "pshufd $0x4E,%%xmm"_r2",%%xmm"_r3"\n\t" \
+ "paddw %%xmm"_r1",%%xmm"_r0"\n\t" \
+ "paddw %%xmm"_r3",%%xmm"_r2"\n\t" \
+ "punpcklqdq %%xmm"_r2",%%xmm"_r0"\n\t" \
+
+void oc_enc_input_rgbx_to_cbcr420_sse2(unsigned char *_cb,unsigned char *_cr,
+ const unsigned char *_src0,const unsigned char *_src1,int _n,
+ const ogg_int16_t _coefs[16]){
+  int i;
+  for(i=0;i+4<=_n;i+=4){
+    __asm__ __volatile__(
+      "pxor %%xmm7,%%xmm7\n\t"
+      OC_RGBX_SUM2x2("%[src0]","%[src1]","0","2","3","4")
+      OC_RGBX_SUM2x2(OC_MEM_OFFS(0x10,src0),OC_MEM_OFFS(0x10,src1),
+       "1","3","4","5")
+      "movdqu %[coefs],%%xmm4\n\t"
+      "movdqu "OC_MEM_OFFS(0x10,coefs)",%%xmm5\n\t"
+      "movdqa %%xmm0,%%xmm2\n\t"
+      "movdqa %%xmm1,%%xmm3\n\t"
+      "pmaddwd %%xmm4,%%xmm0\n\t"
+      "pmaddwd %%xmm4,%%xmm1\n\t"
+      "pmaddwd %%xmm5,%%xmm2\n\t"
+      "pmaddwd %%xmm5,%%xmm3\n\t"
+      /*Add the two partial sums for each chroma sample.*/
+      "movdqa %%xmm0,%%xmm4\n\t"
+      "movdqa %%xmm2,%%xmm5\n\t"
+      "shufps $0x88,%%xmm1,%%xmm0\n\t"
+      "shufps $0xDD,%%xmm1,%%xmm4\n\t"
+      "shufps $0x88,%%xmm3,%%xmm2\n\t"
+      "shufps $0xDD,%%xmm3,%%xmm5\n\t"
+      "paddd %%xmm4,%%xmm0\n\t"
+      "paddd %%xmm5,%%xmm2\n\t"
+      "movdqa "OC_MEM_OFFS(0x10,bias)",%%xmm6\n\t"
+      "paddd %%xmm6,%%xmm0\n\t"
+      "paddd %%xmm6,%%xmm2\n\t"
+      "psrad $10,%%xmm0\n\t"
+      "psrad $10,%%xmm2\n\t"
+      "packssdw %%xmm2,%%xmm0\n\t"
+      "packuswb %%xmm0,%%xmm0\n\t"
+      "movd %%xmm0,%[cb]\n\t"
+      "psrlq $32,%%xmm0\n\t"
+      "movd %%xmm0,%[cr]\n\t"
+      :[cb]"=m"(OC_ARRAY_OPERAND(unsigned char,_cb+i,4)),
+       [cr]"=m"(OC_ARRAY_OPERAND(unsigned char,_cr+i,4))
+      :[src0]"m"(OC_CONST_ARRAY_OPERAND(unsigned char,_src0+8*i,32)),
+       [src1]"m"(OC_CONST_ARRAY_OPERAND(unsigned char,_src1+8*i,32)),
+       [coefs]"m"(OC_CONST_ARRAY_OPERAND(ogg_int16_t,_coefs,16)),
+       [bias]"m"(OC_CONST_ARRAY_OPERAND(int,OC_INPUT_BIAS_SSE2,8))
+    );
+  }
+  for(;i<_n;i++){
+    int s0;
+    int s1;
+    int s2;
+    s0=_src0[8*i+0]+_src0[8*i+4]+_src1[8*i+0]+_src1[8*i+4];
+    s1=_src0[8*i+1]+_src0[8*i+5]+_src1[8*i+1]+_src1[8*i+5];
+    s2=_src0[8*i+2]+_src0[8*i+6]+_src1[8*i+2]+_src1[8*i+6];
+    _cb[i]=(unsigned char)(_coefs[0]*s0+_coefs[1]*s1+_coefs[2]*s2
+     +OC_INPUT_BIAS_SSE2[4]>>10);
+    _cr[i]=(unsigned char)(_coefs[8]*s0+_coefs[9]*s1+_coefs[10]*s2
+     +OC_INPUT_BIAS_SSE2[4]>>10);
+  }
+}
+
+#endif
@@ -32,7 +32,7 @@ ogg_uint32_t oc_cpu_flags_get(void){
   __asm__ __volatile__( \
    "cpuid\n\t" \
    :[eax]"=a"(_eax),[ebx]"=b"(_ebx),[ecx]"=c"(_ecx),[edx]"=d"(_edx) \
-   :"a"(_op) \
+   :"a"(_op),"c"(0) \
    :"cc" \
   )
 # else
@@ -43,7 +43,7 @@ ogg_uint32_t oc_cpu_flags_get(void){
    "cpuid\n\t" \
    "xchgl %%ebx,%[ebx]\n\t" \
    :[eax]"=a"(_eax),[ebx]"=r"(_ebx),[ecx]"=c"(_ecx),[edx]"=d"(_edx) \
-   :"a"(_op) \
+   :"a"(_op),"c"(0) \
    :"cc" \
   )
 # endif
@@ -62,6 +62,26 @@ static ogg_uint32_t oc_parse_intel_flags(ogg_uint32_t _edx,ogg_uint32_t _ecx){
   return flags;
 }
 
+/*AVX2 needs both the instructions themselves (cpuid leaf 7) and an OS that
+   saves the full ymm registers on a context switch (checked with xgetbv).*/
+static ogg_uint32_t oc_detect_avx2(ogg_uint32_t _max_leaf,ogg_uint32_t _ecx){
+  ogg_uint32_t eax;
+  ogg_uint32_t ebx;
+  ogg_uint32_t ecx;
+  ogg_uint32_t edx;
+  /*We need both OSXSAVE and AVX.*/
+  if((_ecx&0x18000000)!=0x18000000||_max_leaf<7)return 0;
+  __asm__ __volatile__(
+   "xgetbv\n\t"
+   :[eax]"=a"(eax),[edx]"=d"(edx)
+   :"c"(0)
+  );
+  /*The OS must have enabled both the xmm and ymm state.*/
+  if((eax&6)!=6)return 0;
+  cpuid(7,eax,ebx,ecx,edx);
+  return ebx&0x00000020?OC_CPU_X86_AVX2:0;
+}
+
 static ogg_uint32_t oc_parse_amd_flags(ogg_uint32_t _edx,ogg_uint32_t _ecx){
   ogg_uint32_t flags;
   /*If there isn't even MMX, give up.*/
@@ -77,6 +97,7 @@ static ogg_uint32_t oc_parse_amd_flags(ogg_uint32_t _edx,ogg_uint32_t _ecx){
 
 ogg_uint32_t oc_cpu_flags_get(void){
   ogg_uint32_t flags;
+  ogg_uint32_t max_leaf;
   ogg_uint32_t eax;
   ogg_uint32_t ebx;
   ogg_uint32_t ecx;
@@ -102,6 +123,7 @@ ogg_uint32_t oc_cpu_flags_get(void){
   if(eax==ebx)return 0;
 # endif
   cpuid(0,eax,ebx,ecx,edx);
+  max_leaf=eax;
   /*         l e t n          I e n i          u n e G*/
   if(ecx==0x6C65746E&&edx==0x49656E69&&ebx==0x756E6547||
    /*      6 8 x M          T e n i          u n e G*/
@@ -111,6 +133,7 @@ ogg_uint32_t oc_cpu_flags_get(void){
     /*Intel, Transmeta (tested with Crusoe TM5800):*/
     cpuid(1,eax,ebx,ecx,edx);
     flags=oc_parse_intel_flags(edx,ecx);
+    flags|=oc_detect_avx2(max_leaf,ecx);
     family=(eax>>8)&0xF;
     model=(eax>>4)&0xF;
     /*The SSE unit on the Pentium M and Core Duo is much slower than the MMX
@@ -133,6 +156,7 @@ ogg_uint32_t oc_cpu_flags_get(void){
     /*Also check for SSE.*/
     cpuid(1,eax,ebx,ecx,edx);
     flags|=oc_parse_intel_flags(edx,ecx);
+    flags|=oc_detect_avx2(max_leaf,ecx);
   }
   /*Technically some VIA chips can be configured in the BIOS to return any
      string here the user wants.
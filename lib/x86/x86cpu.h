@@ -30,6 +30,7 @@
 #define OC_CPU_X86_SSE4_2   (1<<9)
 #define OC_CPU_X86_SSE4A    (1<<10)
 #define OC_CPU_X86_SSE5     (1<<11)
+#define OC_CPU_X86_AVX2     (1<<12)
 
 ogg_uint32_t oc_cpu_flags_get(void);
 
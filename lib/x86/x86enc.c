@@ -18,11 +18,84 @@
 
 #if defined(OC_X86_ASM)
 
+# if defined(OC_X86_64_ASM)
+/*Paired versions of the SSE2 routines, for CPUs without AVX2.*/
+static void oc_enc_frag_satd_x2_sse2(unsigned _satd[2],int _dc[2],
+ const unsigned char *const _src[2],const unsigned char *const _ref[2],
+ int _ystride){
+  _satd[0]=oc_enc_frag_satd_sse2(_dc+0,_src[0],_ref[0],_ystride);
+  _satd[1]=oc_enc_frag_satd_sse2(_dc+1,_src[1],_ref[1],_ystride);
+}
+
+static void oc_enc_frag_satd2_x2_sse2(unsigned _satd[2],int _dc[2],
+ const unsigned char *const _src[2],const unsigned char *const _ref1[2],
+ const unsigned char *const _ref2[2],int _ystride){
+  _satd[0]=oc_enc_frag_satd2_sse2(_dc+0,_src[0],_ref1[0],_ref2[0],_ystride);
+  _satd[1]=oc_enc_frag_satd2_sse2(_dc+1,_src[1],_ref1[1],_ref2[1],_ystride);
+}
+
+static void oc_enc_frag_intra_satd_x2_sse2(unsigned _satd[2],int _dc[2],
+ const unsigned char *const _src[2],int _ystride){
+  _satd[0]=oc_enc_frag_intra_satd_sse2(_dc+0,_src[0],_ystride);
+  _satd[1]=oc_enc_frag_intra_satd_sse2(_dc+1,_src[1],_ystride);
+}
+
+static void oc_enc_frag_ssd_x2_sse2(unsigned _ssd[2],
+ const unsigned char *const _src[2],const unsigned char *const _ref[2],
+ int _ystride){
+  _ssd[0]=oc_enc_frag_ssd_sse2(_src[0],_ref[0],_ystride);
+  _ssd[1]=oc_enc_frag_ssd_sse2(_src[1],_ref[1],_ystride);
+}
+
+static void oc_enc_frag_border_ssd_x2_sse2(unsigned _ssd[2],
+ const unsigned char *const _src[2],const unsigned char *const _ref[2],
+ int _ystride,const ogg_int64_t _mask[2]){
+  _ssd[0]=oc_enc_frag_border_ssd_sse2(_src[0],_ref[0],_ystride,_mask[0]);
+  _ssd[1]=oc_enc_frag_border_ssd_sse2(_src[1],_ref[1],_ystride,_mask[1]);
+}
+
+static void oc_enc_quantize_x2_sse2(int _nonzero[2],ogg_int16_t _qdct[128],
+ const ogg_int16_t _dct[128],const ogg_uint16_t *const _dequant[2],
+ const void *const _enquant[2]){
+  _nonzero[0]=oc_enc_quantize_sse2(_qdct,_dct,_dequant[0],_enquant[0]);
+  _nonzero[1]=oc_enc_quantize_sse2(_qdct+64,_dct+64,_dequant[1],_enquant[1]);
+}
+
+static void oc_enc_fdct8x8_x2_x86_64sse2(ogg_int16_t _y[128],
+ const ogg_int16_t _x[128]){
+  oc_enc_fdct8x8_x86_64sse2(_y,_x);
+  oc_enc_fdct8x8_x86_64sse2(_y+64,_x+64);
+}
+
+void oc_enc_accel_init_x86(oc_enc_ctx *_enc){
+  ogg_uint32_t cpu_flags;
+  cpu_flags=_enc->state.cpu_flags;
+  oc_enc_accel_init_c(_enc);
+  /*x86-64 always has SSE2, so these are installed unconditionally.*/
+  _enc->opt_vtable.frag_satd_x2=oc_enc_frag_satd_x2_sse2;
+  _enc->opt_vtable.frag_satd2_x2=oc_enc_frag_satd2_x2_sse2;
+  _enc->opt_vtable.frag_intra_satd_x2=oc_enc_frag_intra_satd_x2_sse2;
+  _enc->opt_vtable.frag_ssd_x2=oc_enc_frag_ssd_x2_sse2;
+  _enc->opt_vtable.frag_border_ssd_x2=oc_enc_frag_border_ssd_x2_sse2;
+  _enc->opt_vtable.quantize_x2=oc_enc_quantize_x2_sse2;
+  _enc->opt_vtable.fdct8x8_x2=oc_enc_fdct8x8_x2_x86_64sse2;
+  if(cpu_flags&OC_CPU_X86_AVX2){
+    _enc->opt_vtable.frag_satd_x2=oc_enc_frag_satd_x2_avx2;
+    _enc->opt_vtable.frag_satd2_x2=oc_enc_frag_satd2_x2_avx2;
+    _enc->opt_vtable.frag_intra_satd_x2=oc_enc_frag_intra_satd_x2_avx2;
+    _enc->opt_vtable.frag_ssd_x2=oc_enc_frag_ssd_x2_avx2;
+    _enc->opt_vtable.frag_border_ssd_x2=oc_enc_frag_border_ssd_x2_avx2;
+    _enc->opt_vtable.quantize_x2=oc_enc_quantize_x2_avx2;
+    _enc->opt_vtable.fdct8x8_x2=oc_enc_fdct8x8_x2_avx2;
+  }
+  _enc->opt_data.enquant_table_size=128*sizeof(ogg_uint16_t);
+  _enc->opt_data.enquant_table_alignment=16;
+}
+# else
 void oc_enc_accel_init_x86(oc_enc_ctx *_enc){
   ogg_uint32_t cpu_flags;
   cpu_flags=_enc->state.cpu_flags;
   oc_enc_accel_init_c(_enc);
-# if defined(OC_ENC_USE_VTABLE)
   if(cpu_flags&OC_CPU_X86_MMX){
     _enc->opt_vtable.frag_sub=oc_enc_frag_sub_mmx;
     _enc->opt_vtable.frag_sub_128=oc_enc_frag_sub_128_mmx;
@@ -40,9 +113,6 @@ void oc_enc_accel_init_x86(oc_enc_ctx *_enc){
     _enc->opt_vtable.fdct8x8=oc_enc_fdct8x8_mmxext;
   }
   if(cpu_flags&OC_CPU_X86_SSE2){
-#  if defined(OC_X86_64_ASM)
-    _enc->opt_vtable.fdct8x8=oc_enc_fdct8x8_x86_64sse2;
-#  endif
     _enc->opt_vtable.frag_ssd=oc_enc_frag_ssd_sse2;
     _enc->opt_vtable.frag_border_ssd=oc_enc_frag_border_ssd_sse2;
     _enc->opt_vtable.frag_satd=oc_enc_frag_satd_sse2;
@@ -51,13 +121,13 @@ void oc_enc_accel_init_x86(oc_enc_ctx *_enc){
     _enc->opt_vtable.enquant_table_init=oc_enc_enquant_table_init_x86;
     _enc->opt_vtable.enquant_table_fixup=oc_enc_enquant_table_fixup_x86;
     _enc->opt_vtable.quantize=oc_enc_quantize_sse2;
-# else
-    (void) cpu_flags;
-# endif
+    _enc->opt_vtable.input_deinterleave=oc_enc_input_deinterleave_sse2;
+    _enc->opt_vtable.input_avg=oc_enc_input_avg_sse2;
+    _enc->opt_vtable.input_rgbx_to_y=oc_enc_input_rgbx_to_y_sse2;
+    _enc->opt_vtable.input_rgbx_to_cbcr420=oc_enc_input_rgbx_to_cbcr420_sse2;
     _enc->opt_data.enquant_table_size=128*sizeof(ogg_uint16_t);
     _enc->opt_data.enquant_table_alignment=16;
-# if defined(OC_ENC_USE_VTABLE)
   }
-# endif
 }
+# endif
 #endif
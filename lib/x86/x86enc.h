@@ -60,9 +60,19 @@
   oc_frag_recon_inter_mmx(_dst,_src,_ystride,_residue)
 #   define oc_enc_fdct8x8(_enc,_y,_x) \
   oc_enc_fdct8x8_x86_64sse2(_y,_x)
-#  else
-#   define OC_ENC_USE_VTABLE (1)
+#   define oc_enc_input_deinterleave(_enc,_dst0,_dst1,_src,_n) \
+  oc_enc_input_deinterleave_sse2(_dst0,_dst1,_src,_n)
+#   define oc_enc_input_avg(_enc,_dst,_src0,_src1,_n) \
+  oc_enc_input_avg_sse2(_dst,_src0,_src1,_n)
+#   define oc_enc_input_rgbx_to_y(_enc,_dst,_src,_n,_coefs) \
+  oc_enc_input_rgbx_to_y_sse2(_dst,_src,_n,_coefs)
+#   define oc_enc_input_rgbx_to_cbcr420(_enc,_cb,_cr,_src0,_src1,_n,_coefs) \
+  oc_enc_input_rgbx_to_cbcr420_sse2(_cb,_cr,_src0,_src1,_n,_coefs)
+/*The paired routines, on the other hand, have AVX2 variants that need
+   runtime detection, so they still go through the vtable.*/
+#   define OC_ENC_USE_VTABLE_X2 (1)
 #  endif
+#  define OC_ENC_USE_VTABLE (1)
 # endif
 
 # include "../encint.h"
@@ -106,9 +116,36 @@ void oc_enc_enquant_table_fixup_x86(void *_enquant[3][3][2],int _nqis);
 int oc_enc_quantize_sse2(ogg_int16_t _qdct[64],const ogg_int16_t _dct[64],
  const ogg_uint16_t _dequant[64],const void *_enquant);
 void oc_enc_fdct8x8_mmxext(ogg_int16_t _y[64],const ogg_int16_t _x[64]);
+void oc_enc_input_deinterleave_sse2(unsigned char *_dst0,
+ unsigned char *_dst1,const unsigned char *_src,int _n);
+void oc_enc_input_avg_sse2(unsigned char *_dst,const unsigned char *_src0,
+ const unsigned char *_src1,int _n);
+void oc_enc_input_rgbx_to_y_sse2(unsigned char *_dst,
+ const unsigned char *_src,int _n,const ogg_int16_t _coefs[8]);
+void oc_enc_input_rgbx_to_cbcr420_sse2(unsigned char *_cb,unsigned char *_cr,
+ const unsigned char *_src0,const unsigned char *_src1,int _n,
+ const ogg_int16_t _coefs[16]);
 
 # if defined(OC_X86_64_ASM)
 void oc_enc_fdct8x8_x86_64sse2(ogg_int16_t _y[64],const ogg_int16_t _x[64]);
+void oc_enc_frag_satd_x2_avx2(unsigned _satd[2],int _dc[2],
+ const unsigned char *const _src[2],const unsigned char *const _ref[2],
+ int _ystride);
+void oc_enc_frag_satd2_x2_avx2(unsigned _satd[2],int _dc[2],
+ const unsigned char *const _src[2],const unsigned char *const _ref1[2],
+ const unsigned char *const _ref2[2],int _ystride);
+void oc_enc_frag_intra_satd_x2_avx2(unsigned _satd[2],int _dc[2],
+ const unsigned char *const _src[2],int _ystride);
+void oc_enc_frag_ssd_x2_avx2(unsigned _ssd[2],
+ const unsigned char *const _src[2],const unsigned char *const _ref[2],
+ int _ystride);
+void oc_enc_frag_border_ssd_x2_avx2(unsigned _ssd[2],
+ const unsigned char *const _src[2],const unsigned char *const _ref[2],
+ int _ystride,const ogg_int64_t _mask[2]);
+void oc_enc_quantize_x2_avx2(int _nonzero[2],ogg_int16_t _qdct[128],
+ const ogg_int16_t _dct[128],const ogg_uint16_t *const _dequant[2],
+ const void *const _enquant[2]);
+void oc_enc_fdct8x8_x2_avx2(ogg_int16_t _y[128],const ogg_int16_t _x[128]);
 # endif
 
 #endif
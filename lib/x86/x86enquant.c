@@ -146,4 +146,109 @@ int oc_enc_quantize_sse2(ogg_int16_t _qdct[64],const ogg_int16_t _dct[64],
   return (int)r;
 }
 
+# if defined(OC_X86_64_ASM)
+/*Quantizes two blocks at once.
+  The arithmetic is element-wise, so this is oc_enc_quantize_sse2() with the
+   first block in %%ymm0 and the second in %%ymm1, instead of two rows of the
+   same block.*/
+void oc_enc_quantize_x2_avx2(int _nonzero[2],ogg_int16_t _qdct[128],
+ const ogg_int16_t _dct[128],const ogg_uint16_t *const _dequant[2],
+ const void *const _enquant[2]){
+  const ogg_uint16_t *dq0;
+  const ogg_uint16_t *dq1;
+  const void         *q0;
+  const void         *q1;
+  ptrdiff_t           r;
+  ptrdiff_t           m;
+  dq0=_dequant[0];
+  dq1=_dequant[1];
+  q0=_enquant[0];
+  q1=_enquant[1];
+  __asm__ __volatile__(
+    "xor %[r],%[r]\n\t"
+    /*Loop through 16 coefficients of each block at a time.*/
+    ".p2align 4\n\t"
+    "0:\n\t"
+    /*Load the data and the quant matrices.*/
+    "vmovdqu 0x00(%[dct],%[r]),%%ymm0\n\t"
+    "vmovdqu 0x80(%[dct],%[r]),%%ymm1\n\t"
+    "vmovdqu (%[dq0],%[r]),%%ymm2\n\t"
+    "vmovdqu (%[dq1],%[r]),%%ymm3\n\t"
+    "vmovdqu (%[q0],%[r]),%%ymm4\n\t"
+    "vmovdqu (%[q1],%[r]),%%ymm5\n\t"
+    /*Double the input and propagate its sign to the rounding factor.*/
+    "vpaddw %%ymm0,%%ymm0,%%ymm6\n\t"
+    "vpsraw $15,%%ymm0,%%ymm0\n\t"
+    "vpaddw %%ymm1,%%ymm1,%%ymm7\n\t"
+    "vpsraw $15,%%ymm1,%%ymm1\n\t"
+    "vpaddw %%ymm0,%%ymm2,%%ymm2\n\t"
+    "vpaddw %%ymm1,%%ymm3,%%ymm3\n\t"
+    "vpxor %%ymm0,%%ymm2,%%ymm2\n\t"
+    "vpxor %%ymm1,%%ymm3,%%ymm3\n\t"
+    /*Add the rounding factor and perform the first multiply.*/
+    "vpaddw %%ymm2,%%ymm6,%%ymm6\n\t"
+    "vpaddw %%ymm3,%%ymm7,%%ymm7\n\t"
+    "vpmulhw %%ymm6,%%ymm4,%%ymm4\n\t"
+    "vpmulhw %%ymm7,%%ymm5,%%ymm5\n\t"
+    "vmovdqu 0x80(%[q0],%[r]),%%ymm2\n\t"
+    "vmovdqu 0x80(%[q1],%[r]),%%ymm3\n\t"
+    "vpaddw %%ymm4,%%ymm6,%%ymm6\n\t"
+    "vpaddw %%ymm5,%%ymm7,%%ymm7\n\t"
+    /*Emulate an element-wise right-shift via a second multiply.*/
+    "vpmulhw %%ymm2,%%ymm6,%%ymm6\n\t"
+    "vpmulhw %%ymm3,%%ymm7,%%ymm7\n\t"
+    "add $32,%[r]\n\t"
+    "cmp $96,%[r]\n\t"
+    /*Correct for the sign.*/
+    "vpsubw %%ymm0,%%ymm6,%%ymm6\n\t"
+    "vpsubw %%ymm1,%%ymm7,%%ymm7\n\t"
+    /*Save the result.*/
+    "vmovdqu %%ymm6,-0x20(%[qdct],%[r])\n\t"
+    "vmovdqu %%ymm7,0x60(%[qdct],%[r])\n\t"
+    "jle 0b\n\t"
+    /*Now find the location of the last non-zero value in each block.
+      packsswb interleaves the two 128-bit lanes, so vpermq puts the bytes
+       back in zig-zag order before we take the mask.*/
+    "vpxor %%ymm0,%%ymm0,%%ymm0\n\t"
+    "vmovdqu 0x00(%[qdct]),%%ymm4\n\t"
+    "vmovdqu 0x40(%[qdct]),%%ymm5\n\t"
+    "vmovdqu 0x80(%[qdct]),%%ymm6\n\t"
+    "vmovdqu 0xC0(%[qdct]),%%ymm7\n\t"
+    "vpacksswb 0x20(%[qdct]),%%ymm4,%%ymm4\n\t"
+    "vpacksswb 0x60(%[qdct]),%%ymm5,%%ymm5\n\t"
+    "vpacksswb 0xA0(%[qdct]),%%ymm6,%%ymm6\n\t"
+    "vpacksswb 0xE0(%[qdct]),%%ymm7,%%ymm7\n\t"
+    "vpermq $0xD8,%%ymm4,%%ymm4\n\t"
+    "vpermq $0xD8,%%ymm5,%%ymm5\n\t"
+    "vpermq $0xD8,%%ymm6,%%ymm6\n\t"
+    "vpermq $0xD8,%%ymm7,%%ymm7\n\t"
+    "vpcmpeqb %%ymm0,%%ymm4,%%ymm4\n\t"
+    "vpcmpeqb %%ymm0,%%ymm5,%%ymm5\n\t"
+    "vpcmpeqb %%ymm0,%%ymm6,%%ymm6\n\t"
+    "vpcmpeqb %%ymm0,%%ymm7,%%ymm7\n\t"
+    "vpmovmskb %%ymm4,%k[r]\n\t"
+    "vpmovmskb %%ymm5,%k[m]\n\t"
+    "shl $32,%[m]\n\t"
+    "or %[m],%[r]\n\t"
+    "vpmovmskb %%ymm6,%k[m]\n\t"
+    "not %[r]\n\t"
+    "or $1,%[r]\n\t"
+    "bsr %[r],%[r]\n\t"
+    "mov %k[r],%[nz0]\n\t"
+    "vpmovmskb %%ymm7,%k[r]\n\t"
+    "shl $32,%[r]\n\t"
+    "or %[m],%[r]\n\t"
+    "not %[r]\n\t"
+    "or $1,%[r]\n\t"
+    "bsr %[r],%[r]\n\t"
+    "mov %k[r],%[nz1]\n\t"
+    "vzeroupper\n\t"
+    :[r]"=&r"(r),[m]"=&r"(m),[nz0]"=m"(_nonzero[0]),[nz1]"=m"(_nonzero[1])
+    :[dct]"r"(_dct),[qdct]"r"(_qdct),[dq0]"r"(dq0),[dq1]"r"(dq1),
+     [q0]"r"(q0),[q1]"r"(q1)
+    :"cc","memory"
+  );
+}
+# endif
+
 #endif
@@ -0,0 +1,295 @@
+/********************************************************************
+ *                                                                  *
+ * THIS FILE IS PART OF THE OggTheora SOFTWARE CODEC SOURCE CODE.   *
+ * USE, DISTRIBUTION AND REPRODUCTION OF THIS LIBRARY SOURCE IS     *
+ * GOVERNED BY A BSD-STYLE SOURCE LICENSE INCLUDED WITH THIS SOURCE *
+ * IN 'COPYING'. PLEASE READ THESE TERMS BEFORE DISTRIBUTING.       *
+ *                                                                  *
+ * THE Theora SOURCE CODE IS COPYRIGHT (C) 2002-2009                *
+ * by the Xiph.Org Foundation http://www.xiph.org/                  *
+ *                                                                  *
+ ********************************************************************
+
+  function: routines for validating custom Huffman code handling
+  last mod: $Id$
+
+ ********************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+#include <theora/theoraenc.h>
+#include <theora/theoradec.h>
+
+#include "tests.h"
+
+#define WIDTH 64
+#define HEIGHT 64
+#define NFRAMES 6
+
+static unsigned char framedata[WIDTH*HEIGHT*3/2];
+
+static void
+fill_frame (int frame, th_ycbcr_buffer yuv)
+{
+  int x, y;
+  for (y = 0; y < HEIGHT; y++)
+    for (x = 0; x < WIDTH; x++)
+      framedata[y*WIDTH+x] = (unsigned char)((x*7 + frame) ^ (y*3 - frame));
+  for (y = 0; y < HEIGHT/2; y++)
+    for (x = 0; x < WIDTH; x++)
+      framedata[WIDTH*HEIGHT + y*WIDTH + x] = (unsigned char)(x*4 + y + frame);
+  yuv[0].width = WIDTH;
+  yuv[0].height = HEIGHT;
+  yuv[0].stride = WIDTH;
+  yuv[0].data = framedata;
+  yuv[1].width = WIDTH / 2;
+  yuv[1].height = HEIGHT / 2;
+  yuv[1].stride = WIDTH / 2;
+  yuv[1].data = framedata + WIDTH*HEIGHT;
+  yuv[2].width = WIDTH / 2;
+  yuv[2].height = HEIGHT / 2;
+  yuv[2].stride = WIDTH / 2;
+  yuv[2].data = framedata + WIDTH*HEIGHT*5/4;
+}
+
+/* Encodes a short clip with the given Huffman codes, storing all of the
+   packets, headers included, one after the other in buf.
+   If optimal is not NULL, the codes fitted to the clip are returned in it. */
+static int
+encode_with_codes (th_huff_code codes[TH_NHUFFMAN_TABLES][TH_NDCT_TOKENS],
+                   unsigned char *buf, long *sizes, int *npackets,
+                   th_huff_code optimal[TH_NHUFFMAN_TABLES][TH_NDCT_TOKENS])
+{
+  th_info ti;
+  th_comment tc;
+  th_enc_ctx *te;
+  th_ycbcr_buffer yuv;
+  ogg_packet op;
+  long nbytes;
+  int frame;
+  int ret;
+
+  th_info_init (&ti);
+  ti.frame_width = WIDTH;
+  ti.frame_height = HEIGHT;
+  ti.pic_width = WIDTH;
+  ti.pic_height = HEIGHT;
+  ti.fps_numerator = 16;
+  ti.fps_denominator = 1;
+  ti.aspect_numerator = 1;
+  ti.aspect_denominator = 1;
+  ti.colorspace = TH_CS_UNSPECIFIED;
+  ti.pixel_fmt = TH_PF_420;
+  ti.quality = 48;
+  ti.keyframe_granule_shift = 6;
+  te = th_encode_alloc (&ti);
+  th_info_clear (&ti);
+  if (te == NULL)
+    FAIL ("negative return code initializing encoder");
+  ret = th_encode_ctl (te, TH_ENCCTL_SET_HUFFMAN_CODES, codes,
+      sizeof (th_huff_code)*TH_NHUFFMAN_TABLES*TH_NDCT_TOKENS);
+  if (ret < 0) {
+    th_encode_free (te);
+    return ret;
+  }
+
+  nbytes = 0;
+  *npackets = 0;
+  th_comment_init (&tc);
+  while (th_encode_flushheader (te, &tc, &op) > 0) {
+    memcpy (buf + nbytes, op.packet, op.bytes);
+    nbytes += op.bytes;
+    sizes[(*npackets)++] = op.bytes;
+  }
+  th_comment_clear (&tc);
+  for (frame = 0; frame < NFRAMES; frame++) {
+    fill_frame (frame, yuv);
+    if (th_encode_ycbcr_in (te, yuv) < 0)
+      FAIL ("negative error code submitting frame for compression");
+    if (th_encode_packetout (te, frame == NFRAMES - 1, &op) <= 0)
+      FAIL ("failed to retrieve compressed frame");
+    memcpy (buf + nbytes, op.packet, op.bytes);
+    nbytes += op.bytes;
+    sizes[(*npackets)++] = op.bytes;
+  }
+  if (optimal != NULL && th_encode_ctl (te,
+      TH_ENCCTL_GET_OPTIMAL_HUFFMAN_CODES, optimal,
+      sizeof (th_huff_code)*TH_NHUFFMAN_TABLES*TH_NDCT_TOKENS) < 0)
+    FAIL ("could not retrieve the fitted Huffman codes");
+  th_encode_free (te);
+  return 0;
+}
+
+/* Returns the total size of the frame packets stored by encode_with_codes(). */
+static long
+frame_bytes (long *sizes, int npackets)
+{
+  long nbytes;
+  int pi;
+  nbytes = 0;
+  for (pi = 3; pi < npackets; pi++)
+    nbytes += sizes[pi];
+  return nbytes;
+}
+
+/* Decodes the packets stored by encode_with_codes(). */
+static void
+decode_packets (unsigned char *buf, long *sizes, int npackets)
+{
+  th_info ti;
+  th_comment tc;
+  th_setup_info *ts;
+  th_dec_ctx *td;
+  ogg_packet op;
+  long offset;
+  int pi;
+
+  th_info_init (&ti);
+  th_comment_init (&tc);
+  ts = NULL;
+  td = NULL;
+  offset = 0;
+  memset (&op, 0, sizeof (op));
+  for (pi = 0; pi < npackets; pi++) {
+    op.packet = buf + offset;
+    op.bytes = sizes[pi];
+    op.b_o_s = pi == 0;
+    op.packetno = pi;
+    offset += sizes[pi];
+    if (td == NULL) {
+      int ret;
+      ret = th_decode_headerin (&ti, &tc, &ts, &op);
+      if (ret < 0)
+        FAIL ("could not decode the headers");
+      if (ret > 0)
+        continue;
+      td = th_decode_alloc (&ti, ts);
+      if (td == NULL)
+        FAIL ("could not allocate a decoder");
+    }
+    if (th_decode_packetin (td, &op, NULL) < 0)
+      FAIL ("could not decode a frame");
+  }
+  if (td == NULL)
+    FAIL ("no frames decoded");
+  th_decode_free (td);
+  th_setup_free (ts);
+  th_comment_clear (&tc);
+  th_info_clear (&ti);
+}
+
+static int
+huffcodes_test_high_bits (void)
+{
+  static th_huff_code codes[TH_NHUFFMAN_TABLES][TH_NDCT_TOKENS];
+  static unsigned char clean[1<<18];
+  static unsigned char dirty[1<<18];
+  long clean_sizes[NFRAMES + 3];
+  long dirty_sizes[NFRAMES + 3];
+  int nclean;
+  int ndirty;
+  int i;
+  int j;
+
+  /* Every token gets a 5-bit code, which makes a full, prefix-free code. */
+  for (i = 0; i < TH_NHUFFMAN_TABLES; i++)
+    for (j = 0; j < TH_NDCT_TOKENS; j++) {
+      codes[i][j].pattern = j;
+      codes[i][j].nbits = 5;
+    }
+  INFO ("+ Encoding with clean Huffman code patterns");
+  if (encode_with_codes (codes, clean, clean_sizes, &nclean, NULL) < 0)
+    FAIL ("a valid set of Huffman codes was rejected");
+  decode_packets (clean, clean_sizes, nclean);
+
+  INFO ("+ Encoding with garbage above the Huffman code lengths");
+  for (i = 0; i < TH_NHUFFMAN_TABLES; i++)
+    for (j = 0; j < TH_NDCT_TOKENS; j++)
+      codes[i][j].pattern |= 0xFFFFFFE0U ^ (ogg_uint32_t)i << 8;
+  if (encode_with_codes (codes, dirty, dirty_sizes, &ndirty, NULL) < 0)
+    FAIL ("high bits in the Huffman code patterns were not ignored");
+  if (ndirty != nclean)
+    FAIL ("garbage high bits changed the number of packets");
+  for (i = 0; i < nclean; i++)
+    if (dirty_sizes[i] != clean_sizes[i])
+      FAIL ("garbage high bits changed the size of a packet");
+  for (i = 0, j = 0; i < nclean; i++)
+    j += clean_sizes[i];
+  if (memcmp (dirty, clean, j) != 0)
+    FAIL ("garbage high bits changed the contents of a packet");
+  decode_packets (dirty, dirty_sizes, ndirty);
+
+  return 0;
+}
+
+static int
+huffcodes_test_optimal (void)
+{
+  static th_huff_code codes[3][TH_NHUFFMAN_TABLES][TH_NDCT_TOKENS];
+  static unsigned char buf[1<<18];
+  long sizes[NFRAMES + 3];
+  long nbytes[3];
+  int npackets;
+  int pass;
+  int i;
+  int j;
+
+  for (i = 0; i < TH_NHUFFMAN_TABLES; i++)
+    for (j = 0; j < TH_NDCT_TOKENS; j++) {
+      codes[0][i][j].pattern = j;
+      codes[0][i][j].nbits = 5;
+    }
+  INFO ("+ Refitting Huffman codes to a clip");
+  for (pass = 0; pass < 3; pass++) {
+    if (encode_with_codes (codes[pass], buf, sizes, &npackets,
+        pass < 2 ? codes[pass + 1] : NULL) < 0)
+      FAIL ("the fitted Huffman codes were rejected");
+    decode_packets (buf, sizes, npackets);
+    nbytes[pass] = frame_bytes (sizes, npackets);
+#if DEBUG
+    printf ("++ pass %d: %ld bytes\n", pass, nbytes[pass]);
+#endif
+  }
+  if (nbytes[1] >= nbytes[0])
+    FAIL ("codes fitted to a clip did not make it smaller");
+  if (nbytes[2] > nbytes[1])
+    FAIL ("refitting the codes made the clip larger");
+
+  INFO ("+ Checking that tables never chosen keep their codes");
+  {
+    th_info ti;
+    th_enc_ctx *te;
+    th_info_init (&ti);
+    ti.frame_width = WIDTH;
+    ti.frame_height = HEIGHT;
+    ti.pic_width = WIDTH;
+    ti.pic_height = HEIGHT;
+    ti.fps_numerator = 16;
+    ti.fps_denominator = 1;
+    ti.pixel_fmt = TH_PF_420;
+    te = th_encode_alloc (&ti);
+    th_info_clear (&ti);
+    if (te == NULL)
+      FAIL ("negative return code initializing encoder");
+    if (th_encode_ctl (te, TH_ENCCTL_SET_HUFFMAN_CODES, codes[2],
+        sizeof (codes[2])) < 0)
+      FAIL ("the fitted Huffman codes were rejected");
+    if (th_encode_ctl (te, TH_ENCCTL_GET_OPTIMAL_HUFFMAN_CODES, codes[0],
+        sizeof (codes[0])) < 0)
+      FAIL ("could not retrieve the fitted Huffman codes");
+    if (memcmp (codes[0], codes[2], sizeof (codes[0])) != 0)
+      FAIL ("Huffman codes changed without any tokens coded");
+    th_encode_free (te);
+  }
+
+  return 0;
+}
+
+int main(int argc, char *argv[])
+{
+  huffcodes_test_high_bits ();
+
+  huffcodes_test_optimal ();
+
+  exit (0);
+}
@@ -0,0 +1,611 @@
+/********************************************************************
+ *                                                                  *
+ * THIS FILE IS PART OF THE OggTheora SOFTWARE CODEC SOURCE CODE.   *
+ * USE, DISTRIBUTION AND REPRODUCTION OF THIS LIBRARY SOURCE IS     *
+ * GOVERNED BY A BSD-STYLE SOURCE LICENSE INCLUDED WITH THIS SOURCE *
+ * IN 'COPYING'. PLEASE READ THESE TERMS BEFORE DISTRIBUTING.       *
+ *                                                                  *
+ * THE Theora SOURCE CODE IS COPYRIGHT (C) 2002-2009                *
+ * by the Xiph.Org Foundation http://www.xiph.org/                  *
+ *                                                                  *
+ ********************************************************************
+
+  function: routines for validating asynchronous encoding, stream resets
+            and image input against the plain encode and decode calls
+  last mod: $Id$
+
+ ********************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+#include <theora/theoraenc.h>
+#include <theora/theoradec.h>
+
+#include "tests.h"
+
+#define WIDTH 64
+#define HEIGHT 64
+#define NFRAMES 8
+#define MAX_PACKETS (NFRAMES + 3)
+
+/* The packets of one encoded stream, headers included, stored one after the
+   other. */
+typedef struct {
+  unsigned char data[1<<18];
+  long sizes[MAX_PACKETS];
+  ogg_int64_t granulepos[MAX_PACKETS];
+  int eos[MAX_PACKETS];
+  int npackets;
+  long nbytes;
+} stream;
+
+static stream streams[3];
+
+static unsigned char framedata[WIDTH*HEIGHT*3/2];
+
+/* A packed image, big enough for the 4-byte-per-pixel formats. */
+static unsigned char packed[WIDTH*HEIGHT*4];
+static unsigned char packed_uv[WIDTH*HEIGHT/2];
+
+static void
+fill_frame (int frame, th_ycbcr_buffer yuv)
+{
+  int x, y;
+  for (y = 0; y < HEIGHT; y++)
+    for (x = 0; x < WIDTH; x++)
+      framedata[y*WIDTH+x] = (unsigned char)((x*5 + 2*frame) ^ (y*3 + frame));
+  for (y = 0; y < HEIGHT/2; y++)
+    for (x = 0; x < WIDTH/2; x++) {
+      framedata[WIDTH*HEIGHT + y*WIDTH/2 + x] =
+          (unsigned char)(96 + x*2 + y + frame);
+      framedata[WIDTH*HEIGHT*5/4 + y*WIDTH/2 + x] =
+          (unsigned char)(160 - x - y*2 + frame);
+    }
+  yuv[0].width = WIDTH;
+  yuv[0].height = HEIGHT;
+  yuv[0].stride = WIDTH;
+  yuv[0].data = framedata;
+  yuv[1].width = WIDTH / 2;
+  yuv[1].height = HEIGHT / 2;
+  yuv[1].stride = WIDTH / 2;
+  yuv[1].data = framedata + WIDTH*HEIGHT;
+  yuv[2].width = WIDTH / 2;
+  yuv[2].height = HEIGHT / 2;
+  yuv[2].stride = WIDTH / 2;
+  yuv[2].data = framedata + WIDTH*HEIGHT*5/4;
+}
+
+/* Fills packed with frame in R'G'B' with the given byte order and stores the
+   Y'CbCr the encoder is expected to convert it to in framedata. */
+static void
+fill_rgb_frame (int frame, int bgr, th_ycbcr_buffer yuv)
+{
+  int x, y;
+  fill_frame (frame, yuv);
+  for (y = 0; y < HEIGHT; y++)
+    for (x = 0; x < WIDTH; x++) {
+      unsigned char *p;
+      int r, g, b;
+      r = (x*4 + frame) & 0xFF;
+      g = (y*4 + x + 3*frame) & 0xFF;
+      b = (x*y + frame) & 0xFF;
+      p = packed + (y*WIDTH + x)*4;
+      p[0] = (unsigned char)(bgr ? b : r);
+      p[1] = (unsigned char)g;
+      p[2] = (unsigned char)(bgr ? r : b);
+      p[3] = (unsigned char)(x ^ y);
+      framedata[y*WIDTH+x] =
+          (unsigned char)((66*r + 129*g + 25*b + (16<<8) + 128) >> 8);
+    }
+  for (y = 0; y < HEIGHT/2; y++)
+    for (x = 0; x < WIDTH/2; x++) {
+      int sr, sg, sb;
+      int i;
+      sr = sg = sb = 0;
+      for (i = 0; i < 4; i++) {
+        unsigned char *p;
+        p = packed + ((2*y + (i>>1))*WIDTH + 2*x + (i&1))*4;
+        sr += p[bgr ? 2 : 0];
+        sg += p[1];
+        sb += p[bgr ? 0 : 2];
+      }
+      framedata[WIDTH*HEIGHT + y*WIDTH/2 + x] = (unsigned char)
+          ((-38*sr - 74*sg + 112*sb + (128<<10) + 512) >> 10);
+      framedata[WIDTH*HEIGHT*5/4 + y*WIDTH/2 + x] = (unsigned char)
+          ((112*sr - 94*sg - 18*sb + (128<<10) + 512) >> 10);
+    }
+}
+
+/* Repacks the 4:2:0 frame in framedata into packed with the given input
+   format.
+   Each chroma row is repeated for both of the luma rows it covers, so that
+   converting the image back to 4:2:0 gives exactly the same frame. */
+static void
+pack_frame (th_input_fmt fmt, th_input_image *img)
+{
+  const unsigned char *cb;
+  const unsigned char *cr;
+  int x, y;
+  cb = framedata + WIDTH*HEIGHT;
+  cr = framedata + WIDTH*HEIGHT*5/4;
+  memset (img, 0, sizeof (*img));
+  img->fmt = fmt;
+  switch (fmt) {
+  case TH_INFMT_I420:
+    /* Store the image bottom-up to exercise negative strides. */
+    for (y = 0; y < HEIGHT; y++)
+      memcpy (packed + (HEIGHT - 1 - y)*WIDTH, framedata + y*WIDTH, WIDTH);
+    for (y = 0; y < HEIGHT/2; y++) {
+      memcpy (packed_uv + (HEIGHT/2 - 1 - y)*WIDTH/2, cb + y*WIDTH/2,
+          WIDTH/2);
+      memcpy (packed_uv + WIDTH*HEIGHT/4 + (HEIGHT/2 - 1 - y)*WIDTH/2,
+          cr + y*WIDTH/2, WIDTH/2);
+    }
+    img->data[0] = packed + (HEIGHT - 1)*WIDTH;
+    img->data[1] = packed_uv + (HEIGHT/2 - 1)*WIDTH/2;
+    img->data[2] = packed_uv + WIDTH*HEIGHT/4 + (HEIGHT/2 - 1)*WIDTH/2;
+    img->stride[0] = -WIDTH;
+    img->stride[1] = -WIDTH/2;
+    img->stride[2] = -WIDTH/2;
+    break;
+  case TH_INFMT_NV12:
+    for (y = 0; y < HEIGHT/2; y++)
+      for (x = 0; x < WIDTH/2; x++) {
+        packed_uv[y*WIDTH + 2*x] = cb[y*WIDTH/2 + x];
+        packed_uv[y*WIDTH + 2*x + 1] = cr[y*WIDTH/2 + x];
+      }
+    img->data[0] = framedata;
+    img->data[1] = packed_uv;
+    img->stride[0] = WIDTH;
+    img->stride[1] = WIDTH;
+    break;
+  case TH_INFMT_YUYV:
+  case TH_INFMT_UYVY: {
+    int yoff;
+    yoff = fmt == TH_INFMT_UYVY;
+    for (y = 0; y < HEIGHT; y++)
+      for (x = 0; x < WIDTH/2; x++) {
+        unsigned char *p;
+        p = packed + y*WIDTH*2 + 4*x;
+        p[yoff] = framedata[y*WIDTH + 2*x];
+        p[yoff + 2] = framedata[y*WIDTH + 2*x + 1];
+        p[1 - yoff] = cb[(y>>1)*WIDTH/2 + x];
+        p[3 - yoff] = cr[(y>>1)*WIDTH/2 + x];
+      }
+    img->data[0] = packed;
+    img->stride[0] = WIDTH*2;
+    break;
+  }
+  default:
+    img->data[0] = packed;
+    img->stride[0] = WIDTH*4;
+    break;
+  }
+}
+
+static void
+init_info (th_info *ti, int quality)
+{
+  th_info_init (ti);
+  ti->frame_width = WIDTH;
+  ti->frame_height = HEIGHT;
+  ti->pic_width = WIDTH;
+  ti->pic_height = HEIGHT;
+  ti->fps_numerator = 16;
+  ti->fps_denominator = 1;
+  ti->aspect_numerator = 1;
+  ti->aspect_denominator = 1;
+  ti->colorspace = TH_CS_UNSPECIFIED;
+  ti->pixel_fmt = TH_PF_420;
+  ti->quality = quality;
+  ti->keyframe_granule_shift = 6;
+}
+
+static th_enc_ctx *
+new_encoder (int quality)
+{
+  th_info ti;
+  th_enc_ctx *te;
+
+  init_info (&ti, quality);
+  te = th_encode_alloc (&ti);
+  th_info_clear (&ti);
+  if (te == NULL)
+    FAIL ("negative return code initializing encoder");
+  return te;
+}
+
+static void
+store_packet (stream *s, ogg_packet *op)
+{
+  if (s->npackets >= MAX_PACKETS
+      || s->nbytes + op->bytes > (long)sizeof (s->data))
+    FAIL ("too many packets produced");
+  memcpy (s->data + s->nbytes, op->packet, op->bytes);
+  s->nbytes += op->bytes;
+  s->sizes[s->npackets] = op->bytes;
+  s->granulepos[s->npackets] = op->granulepos;
+  s->eos[s->npackets] = op->e_o_s;
+  s->npackets++;
+}
+
+static void
+store_headers (th_enc_ctx *te, stream *s)
+{
+  th_comment tc;
+  ogg_packet op;
+  s->npackets = 0;
+  s->nbytes = 0;
+  th_comment_init (&tc);
+  while (th_encode_flushheader (te, &tc, &op) > 0)
+    store_packet (s, &op);
+  th_comment_clear (&tc);
+}
+
+/* Encodes the test clip with th_encode_ycbcr_in().
+   If rgb is non-zero, the frames are the ones fill_rgb_frame() produces. */
+static void
+encode_sync (th_enc_ctx *te, stream *s, int rgb)
+{
+  th_ycbcr_buffer yuv;
+  ogg_packet op;
+  int frame;
+
+  store_headers (te, s);
+  for (frame = 0; frame < NFRAMES; frame++) {
+    if (rgb)
+      fill_rgb_frame (frame, 0, yuv);
+    else
+      fill_frame (frame, yuv);
+    if (th_encode_ycbcr_in (te, yuv) < 0)
+      FAIL ("negative error code submitting frame for compression");
+    while (th_encode_packetout (te, frame == NFRAMES - 1, &op) > 0)
+      store_packet (s, &op);
+  }
+}
+
+static void
+compare_streams (stream *a, stream *b, const char *msg)
+{
+  int pi;
+  if (a->npackets != b->npackets || a->nbytes != b->nbytes
+      || memcmp (a->data, b->data, a->nbytes) != 0)
+    FAIL (msg);
+  for (pi = 0; pi < a->npackets; pi++)
+    if (a->sizes[pi] != b->sizes[pi] || a->eos[pi] != b->eos[pi]
+        || a->granulepos[pi] != b->granulepos[pi])
+      FAIL (msg);
+}
+
+/* Parses the headers of a stored stream. */
+static void
+decode_headers (stream *s, th_info *ti, th_setup_info **ts)
+{
+  th_comment tc;
+  ogg_packet op;
+  long offset;
+  int pi;
+
+  th_info_init (ti);
+  th_comment_init (&tc);
+  *ts = NULL;
+  offset = 0;
+  memset (&op, 0, sizeof (op));
+  for (pi = 0; pi < 3; pi++) {
+    op.packet = s->data + offset;
+    op.bytes = s->sizes[pi];
+    op.b_o_s = pi == 0;
+    op.packetno = pi;
+    offset += s->sizes[pi];
+    if (th_decode_headerin (ti, &tc, ts, &op) <= 0)
+      FAIL ("could not decode the headers");
+  }
+  th_comment_clear (&tc);
+}
+
+/* Decodes the frames of a stored stream, recording a hash of each picture. */
+static void
+decode_frames (th_dec_ctx *td, stream *s, unsigned long hashes[NFRAMES])
+{
+  ogg_packet op;
+  long offset;
+  int pi;
+
+  memset (&op, 0, sizeof (op));
+  offset = s->sizes[0] + s->sizes[1] + s->sizes[2];
+  if (s->npackets != NFRAMES + 3)
+    FAIL ("wrong number of frames encoded");
+  for (pi = 3; pi < s->npackets; pi++) {
+    th_ycbcr_buffer out;
+    unsigned long hash;
+    int pli, x, y;
+    op.packet = s->data + offset;
+    op.bytes = s->sizes[pi];
+    op.granulepos = s->granulepos[pi];
+    op.e_o_s = s->eos[pi];
+    op.packetno = pi;
+    offset += s->sizes[pi];
+    if (th_decode_packetin (td, &op, NULL) < 0)
+      FAIL ("could not decode a frame");
+    if (th_decode_ycbcr_out (td, out) < 0)
+      FAIL ("could not retrieve a decoded frame");
+    hash = 2166136261UL;
+    for (pli = 0; pli < 3; pli++)
+      for (y = 0; y < out[pli].height; y++)
+        for (x = 0; x < out[pli].width; x++) {
+          hash ^= out[pli].data[y*out[pli].stride + x];
+          hash = (hash*16777619UL) & 0xFFFFFFFFUL;
+        }
+    hashes[pi - 3] = hash;
+  }
+}
+
+static void
+decode_stream (stream *s, unsigned long hashes[NFRAMES])
+{
+  th_info ti;
+  th_setup_info *ts;
+  th_dec_ctx *td;
+  decode_headers (s, &ti, &ts);
+  td = th_decode_alloc (&ti, ts);
+  if (td == NULL)
+    FAIL ("could not allocate a decoder");
+  decode_frames (td, s, hashes);
+  th_decode_free (td);
+  th_setup_free (ts);
+  th_info_clear (&ti);
+}
+
+/* Encodes the test clip with th_encode_submit() and th_encode_receive(). */
+static void
+encode_async (th_enc_ctx *te, stream *s)
+{
+  th_ycbcr_buffer yuv;
+  ogg_packet op;
+  int frame;
+  int ret;
+
+  store_headers (te, s);
+  for (frame = 0; frame < NFRAMES; frame++) {
+    int flags;
+    fill_frame (frame, yuv);
+    flags = TH_ENCASYNC_WAIT;
+    if (frame == NFRAMES - 1)
+      flags |= TH_ENCASYNC_LAST;
+    for (;;) {
+      ret = th_encode_submit (te, yuv, flags);
+      if (ret < 0)
+        FAIL ("negative error code submitting frame for compression");
+      if (ret > 0)
+        break;
+      /* Too many packets are waiting: collect some and try again. */
+      while ((ret = th_encode_receive (te, &op, 0)) > 0)
+        store_packet (s, &op);
+      if (ret < 0)
+        FAIL ("negative error code receiving a packet");
+    }
+    while ((ret = th_encode_receive (te, &op, 0)) > 0)
+      store_packet (s, &op);
+    if (ret < 0)
+      FAIL ("negative error code receiving a packet");
+  }
+  while ((ret = th_encode_receive (te, &op, TH_ENCASYNC_WAIT)) > 0)
+    store_packet (s, &op);
+  if (ret < 0)
+    FAIL ("negative error code receiving a packet");
+  if (th_encode_submit (te, yuv, TH_ENCASYNC_WAIT) != TH_EINVAL)
+    FAIL ("a frame was accepted after the last one");
+}
+
+static int
+roundtrip_test_async (void)
+{
+  static const int depths[3] = { 1, 2, 5 };
+  unsigned long sync_hashes[NFRAMES];
+  unsigned long async_hashes[NFRAMES];
+  th_executor *exec;
+  th_enc_ctx *te;
+  int i;
+
+  te = new_encoder (40);
+  encode_sync (te, streams + 0, 0);
+  th_encode_free (te);
+  decode_stream (streams + 0, sync_hashes);
+
+  INFO ("+ Comparing asynchronous encoding with the synchronous calls");
+  for (i = 0; i < 3; i++) {
+    te = new_encoder (40);
+    if (th_encode_ctl (te, TH_ENCCTL_SET_ASYNC_DEPTH, (void *)(depths + i),
+        sizeof (depths[i])) < 0)
+      FAIL ("could not set the queue depth");
+    encode_async (te, streams + 1);
+    th_encode_free (te);
+    compare_streams (streams + 0, streams + 1,
+        "asynchronous encoding changed the packets");
+  }
+  decode_stream (streams + 1, async_hashes);
+  if (memcmp (sync_hashes, async_hashes, sizeof (sync_hashes)) != 0)
+    FAIL ("asynchronous encoding changed the decoded frames");
+
+  exec = th_executor_pthread_create (2);
+  if (exec != NULL) {
+    INFO ("+ Comparing asynchronous encoding on an executor");
+    te = new_encoder (40);
+    if (th_encode_ctl (te, TH_ENCCTL_SET_EXECUTOR, exec, sizeof (*exec)) < 0)
+      FAIL ("could not attach the executor");
+    encode_async (te, streams + 1);
+    th_encode_free (te);
+    th_executor_pthread_free (exec);
+    compare_streams (streams + 0, streams + 1,
+        "encoding on an executor changed the packets");
+  }
+
+  return 0;
+}
+
+static int
+roundtrip_test_reset (void)
+{
+  unsigned long hashes[3][NFRAMES];
+  unsigned long seed;
+  th_info ti;
+  th_setup_info *ts;
+  th_executor *exec;
+  th_dec_ctx *td;
+  th_enc_ctx *te;
+  int frame;
+
+  INFO ("+ Comparing a reset encoder with a new one");
+  seed = 1;
+  te = new_encoder (20);
+  encode_sync (te, streams + 1, 0);
+  th_encode_free (te);
+  te = new_encoder (50);
+  encode_sync (te, streams + 0, 0);
+  init_info (&ti, 20);
+  if (th_encode_reset (te, &ti) < 0)
+    FAIL ("could not reset the encoder");
+  encode_sync (te, streams + 2, 0);
+  compare_streams (streams + 1, streams + 2,
+      "a reset encoder produced different packets from a new one");
+  ti.frame_width = WIDTH + 16;
+  if (th_encode_reset (te, &ti) != TH_EINVAL)
+    FAIL ("an encoder was reset to a different frame size");
+  ti.frame_width = WIDTH;
+
+  exec = th_executor_pthread_create (2);
+  if (exec != NULL) {
+    INFO ("+ Resetting an encoder that used an executor");
+    if (th_encode_reset (te, &ti) < 0)
+      FAIL ("could not reset the encoder");
+    if (th_encode_ctl (te, TH_ENCCTL_SET_EXECUTOR, exec, sizeof (*exec)) < 0)
+      FAIL ("could not attach the executor");
+    encode_async (te, streams + 2);
+    if (th_encode_reset (te, &ti) < 0)
+      FAIL ("could not reset the encoder");
+    /* The reset must detach the executor, so it can be freed here. */
+    th_executor_pthread_free (exec);
+    encode_async (te, streams + 2);
+    compare_streams (streams + 1, streams + 2,
+        "an executor changed the packets after a reset");
+  }
+
+  INFO ("+ Resetting an encoder after a dropped frame");
+  ti.quality = 0;
+  ti.target_bitrate = 4000;
+  if (th_encode_reset (te, &ti) < 0)
+    FAIL ("could not reset the encoder");
+  store_headers (te, streams + 2);
+  for (frame = 0;; frame++) {
+    th_ycbcr_buffer yuv;
+    ogg_packet op;
+    int x;
+    if (frame >= 64)
+      FAIL ("no frames were dropped");
+    fill_frame (frame, yuv);
+    for (x = 0; x < WIDTH*HEIGHT; x++) {
+      seed = seed*1103515245 + 12345;
+      framedata[x] = (unsigned char)(seed >> 16);
+    }
+    if (th_encode_ycbcr_in (te, yuv) < 0)
+      FAIL ("negative error code submitting frame for compression");
+    if (th_encode_packetout (te, 0, &op) <= 0)
+      FAIL ("failed to retrieve compressed frame");
+    if (op.bytes == 0)
+      break;
+  }
+  ti.quality = 20;
+  ti.target_bitrate = 0;
+  if (th_encode_reset (te, &ti) < 0)
+    FAIL ("could not reset the encoder");
+  encode_sync (te, streams + 2, 0);
+  compare_streams (streams + 1, streams + 2,
+      "a dropped frame changed the packets after a reset");
+  th_info_clear (&ti);
+  th_encode_free (te);
+
+  INFO ("+ Decoding a stream again after resetting the decoder");
+  decode_headers (streams + 0, &ti, &ts);
+  td = th_decode_alloc (&ti, ts);
+  if (td == NULL)
+    FAIL ("could not allocate a decoder");
+  decode_frames (td, streams + 0, hashes[0]);
+  if (th_decode_reset (td, &ti, NULL) < 0)
+    FAIL ("could not reset the decoder");
+  decode_frames (td, streams + 0, hashes[1]);
+  if (memcmp (hashes[0], hashes[1], sizeof (hashes[0])) != 0)
+    FAIL ("a reset decoder decoded the same stream differently");
+  th_setup_free (ts);
+  th_info_clear (&ti);
+
+  INFO ("+ Decoding a new stream after resetting the decoder");
+  decode_headers (streams + 1, &ti, &ts);
+  if (th_decode_reset (td, &ti, ts) < 0)
+    FAIL ("could not reset the decoder to a new stream");
+  decode_frames (td, streams + 1, hashes[1]);
+  th_decode_free (td);
+  th_setup_free (ts);
+  th_info_clear (&ti);
+  decode_stream (streams + 1, hashes[2]);
+  if (memcmp (hashes[1], hashes[2], sizeof (hashes[1])) != 0)
+    FAIL ("a reset decoder decoded a new stream differently");
+
+  return 0;
+}
+
+static int
+roundtrip_test_image_in (void)
+{
+  th_enc_ctx *te;
+  int fmt;
+
+  INFO ("+ Comparing th_encode_image_in() with th_encode_ycbcr_in()");
+  te = new_encoder (48);
+  encode_sync (te, streams + 0, 0);
+  th_encode_free (te);
+  te = new_encoder (48);
+  encode_sync (te, streams + 2, 1);
+  th_encode_free (te);
+
+  for (fmt = 0; fmt < TH_INFMT_NFORMATS; fmt++) {
+    th_ycbcr_buffer yuv;
+    th_input_image img;
+    ogg_packet op;
+    int rgb;
+    int frame;
+
+    rgb = fmt == TH_INFMT_BGRA || fmt == TH_INFMT_RGBA;
+#if DEBUG
+    printf ("++ input format %d\n", fmt);
+#endif
+    te = new_encoder (48);
+    store_headers (te, streams + 1);
+    for (frame = 0; frame < NFRAMES; frame++) {
+      if (rgb)
+        fill_rgb_frame (frame, fmt == TH_INFMT_BGRA, yuv);
+      else
+        fill_frame (frame, yuv);
+      pack_frame ((th_input_fmt)fmt, &img);
+      if (th_encode_image_in (te, &img) < 0)
+        FAIL ("negative error code submitting an image for compression");
+      while (th_encode_packetout (te, frame == NFRAMES - 1, &op) > 0)
+        store_packet (streams + 1, &op);
+    }
+    th_encode_free (te);
+    compare_streams (streams + (rgb ? 2 : 0), streams + 1,
+        "th_encode_image_in() did not convert the image exactly");
+  }
+
+  return 0;
+}
+
+int main(int argc, char *argv[])
+{
+  roundtrip_test_async ();
+
+  roundtrip_test_reset ();
+
+  roundtrip_test_image_in ();
+
+  exit (0);
+}
@@ -0,0 +1,180 @@
+/********************************************************************
+ *                                                                  *
+ * THIS FILE IS PART OF THE OggTheora SOFTWARE CODEC SOURCE CODE.   *
+ * USE, DISTRIBUTION AND REPRODUCTION OF THIS LIBRARY SOURCE IS     *
+ * GOVERNED BY A BSD-STYLE SOURCE LICENSE INCLUDED WITH THIS SOURCE *
+ * IN 'COPYING'. PLEASE READ THESE TERMS BEFORE DISTRIBUTING.       *
+ *                                                                  *
+ * THE Theora SOURCE CODE IS COPYRIGHT (C) 2002-2009                *
+ * by the Xiph.Org Foundation http://www.xiph.org/                  *
+ *                                                                  *
+ ********************************************************************
+
+  function: routines for validating rate control on mostly static input
+  last mod: $Id$
+
+ ********************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <theora/theoraenc.h>
+#include <theora/theoradec.h>
+
+#include "tests.h"
+
+#define WIDTH 320
+#define HEIGHT 240
+#define NFRAMES 60
+#define BITRATE 200000
+
+static unsigned char framedata[WIDTH*HEIGHT*3/2];
+
+/* A static background, half of which changes every third of the clip, with
+   a small block moving across the other half. */
+static void
+fill_frame (int frame, th_ycbcr_buffer yuv)
+{
+  int x, y;
+  for (y = 0; y < HEIGHT; y++)
+    for (x = 0; x < WIDTH; x++)
+      framedata[y*WIDTH+x] = (unsigned char)(128
+          + 50*sin(x*0.13)*cos(y*0.11) + ((x/8 + y/8) & 1)*20);
+  if (frame >= NFRAMES/3)
+    for (y = 0; y < HEIGHT/2; y++)
+      for (x = 0; x < WIDTH; x++)
+        framedata[y*WIDTH+x] =
+            (unsigned char)((x*7 ^ y*5) + frame/(NFRAMES/3)*40);
+  for (y = 0; y < 32; y++)
+    for (x = 0; x < 32; x++)
+      framedata[(HEIGHT*2/3 + y)*WIDTH + 40 + frame*2 + x] =
+          (unsigned char)(30 + (x*y & 63));
+  memset (framedata + WIDTH*HEIGHT, 120, WIDTH*HEIGHT/4);
+  memset (framedata + WIDTH*HEIGHT*5/4, 136, WIDTH*HEIGHT/4);
+  yuv[0].width = WIDTH;
+  yuv[0].height = HEIGHT;
+  yuv[0].stride = WIDTH;
+  yuv[0].data = framedata;
+  yuv[1].width = WIDTH / 2;
+  yuv[1].height = HEIGHT / 2;
+  yuv[1].stride = WIDTH / 2;
+  yuv[1].data = framedata + WIDTH*HEIGHT;
+  yuv[2].width = WIDTH / 2;
+  yuv[2].height = HEIGHT / 2;
+  yuv[2].stride = WIDTH / 2;
+  yuv[2].data = framedata + WIDTH*HEIGHT*5/4;
+}
+
+/* Encodes the clip at the given speed level and decodes it again.
+   Returns the luma PSNR in dB, and the number of dropped frames in drops. */
+static double
+encode_clip (int splevel, int *drops)
+{
+  th_info ti;
+  th_comment tc;
+  th_setup_info *ts;
+  th_enc_ctx *te;
+  th_dec_ctx *td;
+  ogg_packet op;
+  double sse;
+  int frame;
+
+  th_info_init (&ti);
+  ti.frame_width = WIDTH;
+  ti.frame_height = HEIGHT;
+  ti.pic_width = WIDTH;
+  ti.pic_height = HEIGHT;
+  ti.fps_numerator = 30;
+  ti.fps_denominator = 1;
+  ti.aspect_numerator = 1;
+  ti.aspect_denominator = 1;
+  ti.colorspace = TH_CS_UNSPECIFIED;
+  ti.pixel_fmt = TH_PF_420;
+  ti.target_bitrate = BITRATE;
+  ti.keyframe_granule_shift = 6;
+  te = th_encode_alloc (&ti);
+  th_info_clear (&ti);
+  if (te == NULL)
+    FAIL ("negative return code initializing encoder");
+  if (th_encode_ctl (te, TH_ENCCTL_SET_SPLEVEL, &splevel,
+      sizeof (splevel)) < 0)
+    FAIL ("could not set the speed level");
+
+  th_info_init (&ti);
+  th_comment_init (&tc);
+  ts = NULL;
+  while (th_encode_flushheader (te, &tc, &op) > 0)
+    if (th_decode_headerin (&ti, &tc, &ts, &op) < 0)
+      FAIL ("could not decode the headers");
+  td = th_decode_alloc (&ti, ts);
+  if (td == NULL)
+    FAIL ("could not allocate a decoder");
+
+  sse = 0;
+  *drops = 0;
+  for (frame = 0; frame < NFRAMES; frame++) {
+    th_ycbcr_buffer yuv;
+    fill_frame (frame, yuv);
+    if (th_encode_ycbcr_in (te, yuv) < 0)
+      FAIL ("negative error code submitting frame for compression");
+    while (th_encode_packetout (te, frame == NFRAMES - 1, &op) > 0) {
+      th_ycbcr_buffer out;
+      int x, y;
+      if (op.bytes == 0)
+        (*drops)++;
+      if (th_decode_packetin (td, &op, NULL) < 0)
+        FAIL ("could not decode a frame");
+      if (th_decode_ycbcr_out (td, out) < 0)
+        FAIL ("could not retrieve a decoded frame");
+      for (y = 0; y < HEIGHT; y++)
+        for (x = 0; x < WIDTH; x++) {
+          double d;
+          d = out[0].data[y*out[0].stride + x] - (double)framedata[y*WIDTH+x];
+          sse += d*d;
+        }
+    }
+  }
+
+  th_decode_free (td);
+  th_setup_free (ts);
+  th_comment_clear (&tc);
+  th_info_clear (&ti);
+  th_encode_free (te);
+  return 10*log10 (255.0*255*WIDTH*HEIGHT*NFRAMES/(sse + 1e-9));
+}
+
+static int
+staticskip_test_rate (void)
+{
+  double psnr_slow;
+  double psnr;
+  int drops_slow;
+  int drops;
+  int splevel;
+
+  INFO ("+ Encoding a mostly static clip at the slowest speed level");
+  psnr_slow = encode_clip (0, &drops_slow);
+#if DEBUG
+  printf ("++ speed level 0: %.2f dB, %d dropped\n", psnr_slow, drops_slow);
+#endif
+  for (splevel = 1; splevel <= 2; splevel++) {
+    INFO ("+ Encoding the same clip at a faster speed level");
+    psnr = encode_clip (splevel, &drops);
+#if DEBUG
+    printf ("++ speed level %d: %.2f dB, %d dropped\n", splevel, psnr, drops);
+#endif
+    if (drops > drops_slow)
+      FAIL ("a faster speed level dropped more frames");
+    if (psnr < psnr_slow - 2)
+      FAIL ("a faster speed level lost too much quality");
+  }
+
+  return 0;
+}
+
+int main(int argc, char *argv[])
+{
+  staticskip_test_rate ();
+
+  exit (0);
+}
@@ -0,0 +1,220 @@
+/********************************************************************
+ *                                                                  *
+ * THIS FILE IS PART OF THE OggTheora SOFTWARE CODEC SOURCE CODE.   *
+ * USE, DISTRIBUTION AND REPRODUCTION OF THIS LIBRARY SOURCE IS     *
+ * GOVERNED BY A BSD-STYLE SOURCE LICENSE INCLUDED WITH THIS SOURCE *
+ * IN 'COPYING'. PLEASE READ THESE TERMS BEFORE DISTRIBUTING.       *
+ *                                                                  *
+ * THE Theora SOURCE CODE IS COPYRIGHT (C) 2002-2009                *
+ * by the Xiph.Org Foundation http://www.xiph.org/                  *
+ *                                                                  *
+ ********************************************************************
+
+  function: routines for validating split first-pass two-pass encoding
+  last mod: $Id$
+
+ ********************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+#include <theora/theoraenc.h>
+
+#include "tests.h"
+
+#define WIDTH 64
+#define HEIGHT 64
+#define KEYFRAME_FREQUENCY 8
+#define NFRAMES (KEYFRAME_FREQUENCY*2)
+
+static unsigned char framedata[WIDTH*HEIGHT*3/2];
+
+static void
+fill_frame (int frame, th_ycbcr_buffer yuv)
+{
+  int x, y;
+  for (y = 0; y < HEIGHT; y++)
+    for (x = 0; x < WIDTH; x++)
+      framedata[y*WIDTH+x] = (unsigned char)((x + 3*frame) ^ (y*5 + frame));
+  memset (framedata + WIDTH*HEIGHT, 128, WIDTH*HEIGHT/2);
+  yuv[0].width = WIDTH;
+  yuv[0].height = HEIGHT;
+  yuv[0].stride = WIDTH;
+  yuv[0].data = framedata;
+  yuv[1].width = WIDTH / 2;
+  yuv[1].height = HEIGHT / 2;
+  yuv[1].stride = WIDTH / 2;
+  yuv[1].data = framedata + WIDTH*HEIGHT;
+  yuv[2].width = WIDTH / 2;
+  yuv[2].height = HEIGHT / 2;
+  yuv[2].stride = WIDTH / 2;
+  yuv[2].data = framedata + WIDTH*HEIGHT*5/4;
+}
+
+static th_enc_ctx *
+twopass_encoder (void)
+{
+  th_info ti;
+  th_enc_ctx *te;
+  ogg_uint32_t keyframe_frequency;
+
+  th_info_init (&ti);
+  ti.frame_width = WIDTH;
+  ti.frame_height = HEIGHT;
+  ti.pic_width = WIDTH;
+  ti.pic_height = HEIGHT;
+  ti.fps_numerator = 16;
+  ti.fps_denominator = 1;
+  ti.aspect_numerator = 1;
+  ti.aspect_denominator = 1;
+  ti.colorspace = TH_CS_UNSPECIFIED;
+  ti.pixel_fmt = TH_PF_420;
+  ti.target_bitrate = 64000;
+  ti.keyframe_granule_shift = 3;
+  te = th_encode_alloc (&ti);
+  th_info_clear (&ti);
+  if (te == NULL)
+    FAIL ("negative return code initializing encoder");
+  keyframe_frequency = KEYFRAME_FREQUENCY;
+  if (th_encode_ctl (te, TH_ENCCTL_SET_KEYFRAME_FREQUENCY_FORCE,
+      &keyframe_frequency, sizeof (keyframe_frequency)) < 0
+      || keyframe_frequency != KEYFRAME_FREQUENCY)
+    FAIL ("could not set the keyframe interval");
+  return te;
+}
+
+/* Runs the first pass over frames [start, start+nframes).
+   The per-frame data is appended to data, and the summary is returned in
+   summary. */
+static void
+first_pass (int start, int nframes, unsigned char *data, int *ndata,
+            unsigned char *summary, int *summary_sz)
+{
+  th_enc_ctx *te;
+  th_ycbcr_buffer yuv;
+  ogg_packet op;
+  unsigned char *buffer;
+  int bytes;
+  int frame;
+
+  te = twopass_encoder ();
+  /* The first call returns placeholder data for the summary. */
+  bytes = th_encode_ctl (te, TH_ENCCTL_2PASS_OUT, &buffer, sizeof (buffer));
+  if (bytes <= 0)
+    FAIL ("could not start the first pass");
+  if (th_encode_2pass_merge (summary, bytes, buffer, bytes,
+      KEYFRAME_FREQUENCY) != TH_EBADHEADER)
+    FAIL ("th_encode_2pass_merge() accepted placeholder summary data");
+  for (frame = start; frame < start + nframes; frame++) {
+    fill_frame (frame, yuv);
+    if (th_encode_ycbcr_in (te, yuv) < 0)
+      FAIL ("negative error code submitting frame for compression");
+    bytes = th_encode_ctl (te, TH_ENCCTL_2PASS_OUT, &buffer, sizeof (buffer));
+    if (bytes < 0)
+      FAIL ("could not read first-pass frame data");
+    memcpy (data + *ndata, buffer, bytes);
+    *ndata += bytes;
+    if (th_encode_packetout (te, frame == start + nframes - 1, &op) <= 0)
+      FAIL ("failed to retrieve compressed frame");
+  }
+  bytes = th_encode_ctl (te, TH_ENCCTL_2PASS_OUT, &buffer, sizeof (buffer));
+  if (bytes <= 0)
+    FAIL ("could not read the first-pass summary");
+  memcpy (summary, buffer, bytes);
+  *summary_sz = bytes;
+  th_encode_free (te);
+}
+
+static int
+twopass_test_merge (void)
+{
+  static unsigned char data[4096];
+  unsigned char merged[64];
+  unsigned char seg[2][64];
+  int seg_sz[2];
+  int ndata;
+  int ret;
+
+  INFO ("+ Checking that misaligned segments are rejected");
+  ndata = 0;
+  memset (seg, 0, sizeof (seg));
+  first_pass (0, KEYFRAME_FREQUENCY - 3, data, &ndata, seg[0], seg_sz + 0);
+  first_pass (KEYFRAME_FREQUENCY - 3, NFRAMES - KEYFRAME_FREQUENCY + 3,
+      data, &ndata, seg[1], seg_sz + 1);
+  memset (merged, 0, sizeof (merged));
+  ret = th_encode_2pass_merge (merged, seg_sz[0], seg[0], seg_sz[0],
+      KEYFRAME_FREQUENCY);
+  if (ret != seg_sz[0])
+    FAIL ("could not merge the first segment");
+  ret = th_encode_2pass_merge (merged, seg_sz[0], seg[1], seg_sz[1],
+      KEYFRAME_FREQUENCY);
+  if (ret != TH_EINVAL)
+    FAIL ("th_encode_2pass_merge() accepted a misaligned segment");
+
+  INFO ("+ Checking that aligned segments are merged");
+  ndata = 0;
+  first_pass (0, KEYFRAME_FREQUENCY, data, &ndata, seg[0], seg_sz + 0);
+  first_pass (KEYFRAME_FREQUENCY, NFRAMES - KEYFRAME_FREQUENCY,
+      data, &ndata, seg[1], seg_sz + 1);
+  memset (merged, 0, sizeof (merged));
+  if (th_encode_2pass_merge (merged, seg_sz[0], seg[0], seg_sz[0], 0)
+      != TH_EINVAL)
+    FAIL ("th_encode_2pass_merge() accepted a zero keyframe interval");
+  if (th_encode_2pass_merge (merged, seg_sz[0], seg[0], seg_sz[0],
+      KEYFRAME_FREQUENCY) != seg_sz[0])
+    FAIL ("could not merge the first segment");
+  ret = th_encode_2pass_merge (merged, seg_sz[0], seg[1], seg_sz[1],
+      KEYFRAME_FREQUENCY);
+  if (ret != seg_sz[0])
+    FAIL ("could not merge a segment starting on a keyframe");
+
+  INFO ("+ Checking the second pass with the merged data");
+  {
+    th_enc_ctx *te;
+    th_ycbcr_buffer yuv;
+    ogg_packet op;
+    int consumed;
+    int frame;
+
+    te = twopass_encoder ();
+    /* The second pass takes the summary followed by the frame data. */
+    memmove (data + ret, data, ndata);
+    memcpy (data, merged, ret);
+    ndata += ret;
+    consumed = 0;
+    for (frame = 0; frame < NFRAMES; frame++) {
+      for (;;) {
+        int bytes;
+        bytes = th_encode_ctl (te, TH_ENCCTL_2PASS_IN, NULL, 0);
+        if (bytes < 0)
+          FAIL ("error asking for second-pass data");
+        if (bytes == 0)
+          break;
+        if (bytes > ndata - consumed)
+          FAIL ("second pass asked for more data than the first produced");
+        bytes = th_encode_ctl (te, TH_ENCCTL_2PASS_IN, data + consumed, bytes);
+        if (bytes < 0)
+          FAIL ("error submitting second-pass data");
+        consumed += bytes;
+      }
+      fill_frame (frame, yuv);
+      if (th_encode_ycbcr_in (te, yuv) < 0)
+        FAIL ("negative error code submitting frame for compression");
+      if (th_encode_packetout (te, frame == NFRAMES - 1, &op) <= 0)
+        FAIL ("failed to retrieve compressed frame");
+      if (th_packet_iskeyframe (&op) != (frame % KEYFRAME_FREQUENCY == 0))
+        FAIL ("second pass did not place keyframes on the segment starts");
+    }
+    if (consumed != ndata)
+      FAIL ("second pass did not consume all of the first-pass data");
+    th_encode_free (te);
+  }
+
+  return 0;
+}
+
+int main(int argc, char *argv[])
+{
+  twopass_test_merge ();
+
+  exit (0);
+}